@@ -42,6 +42,8 @@
 #include <limits>
 #include <stdexcept>
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <math.h>
 
 /* constexpr if support only for c++17 or newer */
@@ -131,6 +133,7 @@ namespace orbtree {
 				public:
 					/* typedefs */
 					typedef std::bidirectional_iterator_tag iterator_category;
+					typedef std::ptrdiff_t difference_type;
 					/* note: value type is always const, value cannot be changed
 					 * by dereferincing the iterator since rank function might depend on it
 					 * need to call set_value() explicitely */
@@ -286,6 +289,28 @@ namespace orbtree {
 				return std::pair<iterator,bool>(iterator(*this,x.first),x.second);
 			}
 			
+			/// \brief convert the result of an insert in orbtree_base to insert_type
+			template<bool multi_ = multi>
+			typename std::enable_if<multi_,insert_type>::type insert_result(const std::pair<NodeHandle,bool>& x) {
+				return iterator(*this,x.first);
+			}
+			template<bool multi_ = multi>
+			typename std::enable_if<!multi_,insert_type>::type insert_result(const std::pair<NodeHandle,bool>& x) {
+				return std::pair<iterator,bool>(iterator(*this,x.first),x.second);
+			}
+			
+			/// \brief helper for \ref update_values(): get the node to modify from an iterator
+			NodeHandle update_values_node(const iterator& it) const {
+				if(it.n == this->nil()) throw std::out_of_range("orbtree::update_values(): invalid iterator!\n");
+				return it.n;
+			}
+			/// \brief helper for \ref update_values(): find the node to modify by key
+			template<class K> NodeHandle update_values_node(const K& k) const {
+				NodeHandle n = orbtree_base<NodeAllocator, Compare, NVFunc, multi>::find(k);
+				if(n == this->nil()) throw std::out_of_range("orbtree::update_values(): key not present in map!\n");
+				return n;
+			}
+			
 			
 		public:
 			
@@ -336,6 +361,26 @@ namespace orbtree {
 				for(;first!=last;++first) orbtree::insert(*first);
 			}
 			
+			/** \brief Append new element after all existing elements
+			 * 
+			 * The key of v must not be before the last key (an exception is thrown
+			 * otherwise). The tree is not searched, which makes this faster than
+			 * insert() when building a tree from keys in increasing order. The return
+			 * value is the same as for insert(); for non-multi map/set, the insert
+			 * fails if the key is equal to the last key. See also
+			 * \ref orbtree_base::append_sorted() for appending a sorted range. */
+			insert_type push_back(const value_type& v) {
+				return insert_result(orbtree_base<NodeAllocator, Compare, NVFunc, multi>::push_back(v));
+			}
+			/// \copydoc push_back(const value_type& v)
+			insert_type push_back(value_type&& v) {
+				return insert_result(orbtree_base<NodeAllocator, Compare, NVFunc, multi>::push_back(std::move(v)));
+			}
+			/// construct new element and append it after all existing elements (see push_back())
+			template<class... Args> insert_type emplace_back(Args&&... args) {
+				return push_back(value_type(std::forward<Args>(args)...));
+			}
+			
 			/// construct new element in-place
 			template<class... Args> insert_type emplace(Args&&... args) { return emplace_helper(std::forward<Args...>(args...)); }
 			/// construct new element in-place, using the given hint in a same way as insert() with a hint
@@ -348,12 +393,43 @@ namespace orbtree {
 			//~ iterator erase(iterator pos) { return iterator(*this,orbtree_base<NodeAllocator, Compare, NVFunc, multi>::erase(pos.n)); }
 			/// erase element pointed to by the given iterator; returns the element after it (in order)
 			iterator erase(const_iterator pos) { return iterator(*this,orbtree_base<NodeAllocator, Compare, NVFunc, multi>::erase(pos.n)); }
-			/// erase elements in the range [first,last); returns last
+			/** \brief erase elements in the range [first,last); returns last
+			 * 
+			 * Except for short ranges, the tree is split at first and last and
+			 * joined again after freeing the elements in between, so this takes
+			 * O(k + log N) time for erasing k elements. */
 			iterator erase(const_iterator first, const_iterator last) {
 				if(first == last) return iterator(*this,first.n);
-				iterator x = erase(first);
-				while(x != last) x = erase(x);
-				return x;
+				/* automatic compaction would invalidate last, do it only at the end */
+				size_t ac = this->auto_compact;
+				this->auto_compact = 0;
+				NodeHandle x = orbtree_base<NodeAllocator, Compare, NVFunc, multi>::erase_range(first.n,last.n);
+				this->auto_compact = ac;
+				if(ac) this->compact_step(ac,x);
+				return iterator(*this,x);
+			}
+			/** \brief erase all elements for which p returns true; returns the number of elements erased
+			 * 
+			 * p is called once for each element, in order, with the same argument as
+			 * the result of dereferencing an iterator. If most elements are erased,
+			 * the tree is rebuilt from the remaining ones in one linear pass, instead
+			 * of erasing elements one by one. Invalidates all iterators.
+			 */
+			template<class Pred> size_t erase_if(Pred p) {
+				size_t ac = this->auto_compact;
+				this->auto_compact = 0;
+				size_t r;
+				try {
+					r = orbtree_base<NodeAllocator, Compare, NVFunc, multi>::erase_if_node(
+						[this,&p] (NodeHandle n) { return p(this->get_node(n).get_key_value().keyvalue()); });
+				}
+				catch(...) {
+					this->auto_compact = ac;
+					throw;
+				}
+				this->auto_compact = ac;
+				if(ac) this->compact_step(ac);
+				return r;
 			}
 			
 			/// erase all elements with the given key; returns the number of elements erased
@@ -492,7 +568,93 @@ namespace orbtree {
 			template<bool simple_ = simple> const_iterator lower_bound_rank(const NVType& r) const {
 				return lower_bound_w([&r] (const NVType* x) { return *x >= r; });
 			}
+
+			/** \brief Find the element whose weight covers value in the given component
+			 *
+			 * Returns the first element where the sum of the given component of weights
+			 * of all elements up to and including it is larger than value, or end() if
+			 * there is no such element. Drawing value uniformly from [0,norm) gives
+			 * elements with probability proportional to their weight. If res is not
+			 * null, it is filled with the partial sum of all weight components before
+			 * the result (the same as get_sum_node()), so no separate query is needed.
+			 *
+			 * This is faster than using lower_bound_w() for the same purpose, since
+			 * only one component is compared during the search. */
+			iterator find_by_weight(unsigned int component, const NVType& value, NVType* res = 0) {
+				return iterator(*this, this->find_by_weight_fv(component,value,res));
+			}
+			/// \copydoc find_by_weight()
+			const_iterator find_by_weight(unsigned int component, const NVType& value, NVType* res = 0) const {
+				return const_iterator(*this, this->find_by_weight_fv(component,value,res));
+			}
+			/** \brief Find the elements for multiple values at once, see \ref find_by_weight()
+			 *
+			 * Values in the range [first,last) must be sorted (an exception is thrown
+			 * otherwise). The result iterators are written to out in the same order.
+			 * If res is not null, it should point to an array of size
+			 * n_values * NVFunc::get_nr(); the row for each value is filled with the
+			 * partial sum before the result. The tree is traversed only once. */
+			template<class ValIt, class OutIt>
+			OutIt find_by_weights(unsigned int component, ValIt first, ValIt last, OutIt out, NVType* res = 0) {
+				this->find_by_weights_fv(component,first,last,[this,&out] (NodeHandle n) { *out = iterator(*this,n); ++out; },res);
+				return out;
+			}
+			/// \copydoc find_by_weights()
+			template<class ValIt, class OutIt>
+			OutIt find_by_weights(unsigned int component, ValIt first, ValIt last, OutIt out, NVType* res = 0) const {
+				this->find_by_weights_fv(component,first,last,[this,&out] (NodeHandle n) { *out = const_iterator(*this,n); ++out; },res);
+				return out;
+			}
+
+			/** \brief Weighted sampling for simple containers: find the element whose weight
+			 * covers u (see \ref find_by_weight()) and return it along with the partial sum
+			 * of the weights before it. */
+			template<bool simple_ = simple>
+			std::pair<iterator,NVType> sample(typename std::enable_if<simple_,const NVType&>::type u) {
+				NVType res;
+				NodeHandle n = this->find_by_weight_fv(0,u,&res);
+				return std::pair<iterator,NVType>(iterator(*this,n),res);
+			}
+			/// \copydoc sample()
+			template<bool simple_ = simple>
+			std::pair<const_iterator,NVType> sample(typename std::enable_if<simple_,const NVType&>::type u) const {
+				NVType res;
+				NodeHandle n = this->find_by_weight_fv(0,u,&res);
+				return std::pair<const_iterator,NVType>(const_iterator(*this,n),res);
+			}
 			
+			/** \brief Change the values of multiple elements (only for maps and multimaps).
+			 * 
+			 * Elements in [first,last) should be pairs, where first is either an
+			 * iterator to or the key of the element to modify, and second is its new
+			 * value. All values are changed first, only marking the partial sums that
+			 * need to be updated (as in lazy mode, see set_lazy_sums()), then these are
+			 * recalculated in one pass, visiting each affected node once (instead of
+			 * once for each modified element below it). If nthreads > 1, this pass is
+			 * done with multiple threads (see flush_sums()). If the tree is in lazy
+			 * mode, partial sums are not recalculated here.
+			 * 
+			 * Throws an exception if a key is not found or an iterator is invalid;
+			 * in this case, values before it are changed, and partial sums are
+			 * updated for them.
+			 */
+			template<class InputIt>
+			void update_values(InputIt first, InputIt last, unsigned int nthreads = 1) {
+				bool lazy = this->get_lazy_sums();
+				if(!lazy) this->set_lazy_sums(true);
+				try {
+					for(;first != last;++first) this->update_value(update_values_node(first->first),first->second);
+				}
+				catch(...) {
+					if(!lazy) this->set_lazy_sums(false);
+					throw;
+				}
+				if(!lazy) {
+					this->flush_sums(nthreads);
+					this->set_lazy_sums(false);
+				}
+			}
+
 		public:
 			/** \brief Calculate partial sum of the weights of nodes
 			 * that come before the one pointed to by it.
@@ -525,12 +687,14 @@ namespace orbtree {
 			 * 
 			 * Result is returned in res, which must point to an array
 			 * large enough (with elements corresponding to the number
-			 * of components returned by NVFunc).
+			 * of components returned by NVFunc). Works for any type K
+			 * that is comparable to the keys.
+			 * 
+			 * This requires only one traversal of the tree from the root.
 			 */
-			template<bool simple_ = simple>
-			void get_sum(const key_type& k, typename std::enable_if<!simple_,NVType*>::type res) const {
-				auto it = lower_bound(k);
-				get_sum_node(it,res);
+			template<class K, bool simple_ = simple>
+			void get_sum(const K& k, typename std::enable_if<!simple_,NVType*>::type res) const {
+				this->get_sum_fv(k,res);
 			}
 			/** \brief Calculate partial sum of weights for keys that come before k.
 			 * 
@@ -538,33 +702,63 @@ namespace orbtree {
 			 * weight function returns only one component) that returns
 			 * the result directly instead of using a pointer.
 			 */
-			template<bool simple_ = simple>
-			NVType get_sum(typename std::enable_if<simple_,const key_type&>::type k) const {
-				auto it = lower_bound(k);
-				return get_sum_node(it);
+			template<class K, bool simple_ = simple>
+			typename std::enable_if<simple_,NVType>::type get_sum(const K& k) const {
+				NVType res;
+				this->get_sum_fv(k,&res);
+				return res;
 			}
 			
-			/** \brief Calculate partial sum of weights for keys that come before k.
+			/** \brief Calculate partial sum of weights for multiple keys.
 			 * 
-			 * Result is returned in res, which must point to an array
-			 * large enough (with elements corresponding to the number
-			 * of components returned by NVFunc).
+			 * Keys in the range [first,last) must be sorted (an exception
+			 * is thrown otherwise). Results are stored in res, which must
+			 * point to an array of size n_keys * NVFunc::get_nr(), with
+			 * the row for each key containing the same result as get_sum().
+			 * 
+			 * The tree is traversed only once for all keys, which is faster
+			 * than calling get_sum() separately for each of them.
+			 */
+			template<class KeyIt> void get_sums(KeyIt first, KeyIt last, NVType* res) const {
+				this->get_sums_fv(first,last,res);
+			}
+			
+			/** \brief Find the first element with key not less than k and
+			 * calculate the partial sum of weights for all elements before it
+			 * in one traversal of the tree.
+			 * 
+			 * Returns the same iterator as lower_bound(k); the sum (which
+			 * is the same as the result of get_sum(k)) is returned in res.
 			 */
 			template<class K, bool simple_ = simple>
-			void get_sum(const K& k, typename std::enable_if<!simple_,NVType*>::type res) const {
-				auto it = lower_bound(k);
-				get_sum_node(it,res);
+			iterator lower_bound_sum(const K& k, typename std::enable_if<!simple_,NVType*>::type res) {
+				return iterator(*this,orbtree_base<NodeAllocator, Compare, NVFunc, multi>::lower_bound_sum(k,res));
 			}
-			/** \brief Calculate partial sum of weights for keys that come before k.
+			/// \copydoc lower_bound_sum(const K&, NVType*)
+			template<class K, bool simple_ = simple>
+			const_iterator lower_bound_sum(const K& k, typename std::enable_if<!simple_,NVType*>::type res) const {
+				return const_iterator(*this,orbtree_base<NodeAllocator, Compare, NVFunc, multi>::lower_bound_sum(k,res));
+			}
+			/** \brief Find the first element with key not less than k and
+			 * calculate the partial sum of weights for all elements before it
+			 * in one traversal of the tree.
 			 * 
-			 * Specialized version for simple containers (i.e. where the
-			 * weight function returns only one component) that returns
-			 * the result directly instead of using a pointer.
+			 * Specialized version for simple containers that returns a pair
+			 * of the iterator (same as lower_bound(k)) and the sum (same as
+			 * get_sum(k)).
 			 */
 			template<class K, bool simple_ = simple>
-			NVType get_sum(typename std::enable_if<simple_,const K&>::type k) const {
-				auto it = lower_bound(k);
-				return get_sum_node(it);
+			typename std::enable_if<simple_, std::pair<iterator,NVType> >::type lower_bound_sum(const K& k) {
+				NVType res;
+				NodeHandle n = orbtree_base<NodeAllocator, Compare, NVFunc, multi>::lower_bound_sum(k,&res);
+				return std::pair<iterator,NVType>(iterator(*this,n),res);
+			}
+			/// \copydoc lower_bound_sum(const K&)
+			template<class K, bool simple_ = simple>
+			typename std::enable_if<simple_, std::pair<const_iterator,NVType> >::type lower_bound_sum(const K& k) const {
+				NVType res;
+				NodeHandle n = orbtree_base<NodeAllocator, Compare, NVFunc, multi>::lower_bound_sum(k,&res);
+				return std::pair<const_iterator,NVType>(const_iterator(*this,n),res);
 			}
 			
 			/// Calculate normalization, i.e. sum of all weights. Equivalent to get_sum(cend(),res).
@@ -577,9 +771,68 @@ namespace orbtree {
 				return res;
 			}
 			
+			/** \brief Calculate the sum of weights for keys in the range [lo,hi).
+			 * 
+			 * The result is the same as get_sum(hi) - get_sum(lo), but only one
+			 * traversal of the tree is needed, and only the weights inside the
+			 * range are added (so there is no loss of precision for floating
+			 * point weights). The result is zero if hi is not after lo.
+			 */
+			template<class K1, class K2, bool simple_ = simple>
+			void get_range_sum(const K1& lo, const K2& hi, typename std::enable_if<!simple_,NVType*>::type res) const {
+				this->get_range_sum_fv(lo,hi,res);
+			}
+			/** \brief Calculate the sum of weights for keys in the range [lo,hi).
+			 * 
+			 * Specialized version for simple containers that returns the result directly.
+			 */
+			template<class K1, class K2, bool simple_ = simple>
+			typename std::enable_if<simple_,NVType>::type get_range_sum(const K1& lo, const K2& hi) const {
+				NVType res;
+				this->get_range_sum_fv(lo,hi,&res);
+				return res;
+			}
+			/** \brief Calculate the sum of weights for elements in the range [it1,it2).
+			 * 
+			 * it2 should not come before it1. Same as get_sum_node(it2) - get_sum_node(it1),
+			 * but only the paths from the two elements up to their common ancestor
+			 * are visited.
+			 */
+			void get_range_sum_node(const_iterator it1, const_iterator it2, NVType* res) const {
+				this->get_range_sum_fv_node(it1.n,it2.n,res);
+			}
+			/** \brief Calculate the sum of weights for elements in the range [it1,it2).
+			 * 
+			 * Specialized version for simple containers that returns the result directly.
+			 */
+			template<bool simple_ = simple>
+			NVType get_range_sum_node(typename std::enable_if<simple_,const_iterator>::type it1, const_iterator it2) const {
+				NVType res;
+				this->get_range_sum_fv_node(it1.n,it2.n,&res);
+				return res;
+			}
+			/** \brief Calculate the sum of weights for elements in a range of the
+			 * given component of the weights (e.g. a range of ranks).
+			 * 
+			 * The range includes elements from find_by_weight(component,lo)
+			 * (inclusive) to find_by_weight(component,hi) (exclusive). If the
+			 * component is the rank of elements (i.e. each element has weight one
+			 * in it), this is the elements with rank in [lo,hi). Only one traversal
+			 * of the tree is needed.
+			 */
+			void get_range_sum_by_weight(unsigned int component, const NVType& lo, const NVType& hi, NVType* res) const {
+				this->get_range_sum_w_fv(component,lo,hi,res);
+			}
+			
 			
 	};
 	
+	/// Exchange the contents of two trees in constant time, see \ref orbtree_base::swap()
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi, bool simple>
+	void swap(orbtree<NodeAllocator, Compare, NVFunc, multi, simple>& t1, orbtree<NodeAllocator, Compare, NVFunc, multi, simple>& t2) {
+		t1.swap(t2);
+	}
+	
 	
 	/** \brief Adapter for functions that return only one result.
 	 * This class also describes the interface expected for the
@@ -597,7 +850,11 @@ namespace orbtree {
 		 * it can be used as a vector function and results for multiple
 		 * parameter combinations can be calculated at the same time.
 		 */
-		constexpr unsigned int get_nr() const { return 1; }
+		static constexpr unsigned int get_nr() { return 1; }
+		/// Dimension of result if it is known at compile time (optional).
+		/** If given, the tree can store partial sums in fixed size arrays
+		 * and use loops with constant length when calculating with them. */
+		static constexpr unsigned int fixed_nr = 1;
 		/// Calculate the function value associated with one node.
 		/**
 		 * @param node_value Node's value, i.e. the key in case of a set or multiset,
@@ -623,6 +880,59 @@ namespace orbtree {
 	};
 	
 	
+	/** \brief Adapter for weight functions of run-length encoded multisets
+	 * (see \ref orbtree::orbtreemultiset_rle "orbtreemultiset_rle").
+	 * 
+	 * Elements are stored as pairs of key and the number of times the key
+	 * is present. The weights calculated by NVFunc for the key are multiplied
+	 * by the count, so partial sums are the same as if each copy was stored
+	 * separately. For integral weights, an exception is thrown on overflow.
+	 * 
+	 * @tparam NVFunc Weight function taking only the key, with the same
+	 * interface as required by \ref orbtree::orbtree "orbtree" (e.g.
+	 * NVFunc_Adapter_Simple or NVFunc_Adapter_Vec).
+	 * @tparam CountType Integral type used to store the count of keys.
+	 */
+	template<class NVFunc, class CountType>
+	struct NVFunc_Adapter_Count {
+		static_assert(std::is_integral<CountType>::value && std::is_unsigned<CountType>::value,
+			"NVFunc_Adapter_Count: CountType must be an unsigned integer type!\n");
+		/// Type of the result of this function.
+		typedef typename NVFunc::result_type result_type;
+		/// Dimension of result if it is known at compile time (zero otherwise).
+		static constexpr unsigned int fixed_nr = NVFunc_fixed_nr<NVFunc>::value;
+		/// Dimension of result, same as the adapted function.
+		unsigned int get_nr() const { return f.get_nr(); }
+		/// Calculate the weight of a key and its count: the weight of the key multiplied by the count.
+		template<class KeyType>
+		void operator ()(const trivial_pair<KeyType, CountType>& node_value, result_type* res) const {
+			f(node_value.first, res);
+			const CountType c = node_value.second;
+			for(unsigned int i = 0;i < get_nr();i++) {
+				if(std::is_integral<result_type>::value && res[i] && c > 1) {
+					/* check overflow before multiplying */
+					if((uintmax_t)c > (uintmax_t)std::numeric_limits<result_type>::max() ||
+							(res[i] > 0 && res[i] > std::numeric_limits<result_type>::max() / (result_type)c) ||
+							(res[i] < 0 && res[i] < std::numeric_limits<result_type>::lowest() / (result_type)c))
+						throw std::runtime_error("NVFunc_Adapter_Count: overflow!\n");
+				}
+				res[i] *= (result_type)c;
+			}
+		}
+		NVFunc f;
+		NVFunc_Adapter_Count() { }
+		/// Create a new instance storing the given function
+		explicit NVFunc_Adapter_Count(const NVFunc& f_):f(f_) { }
+		explicit NVFunc_Adapter_Count(NVFunc&& f_):f(std::move(f_)) { }
+		template<class T>
+		explicit NVFunc_Adapter_Count(const T& t):f(t) { }
+		
+		static auto rank_compare(result_type r) {
+			return NVFunc::rank_compare(r);
+		}
+	};
+	
+	
 	/* basic classes */
 	
 	/* general set and multiset -- needs to be given a node value type and function */
@@ -823,8 +1133,8 @@ namespace orbtree {
 	template<class NVFunc> 
 	struct NVFunc_Adapter_Vec {
 		NVFunc f;
-		/// copy of the parameters
-		const std::vector<typename NVFunc::ParType> pars;
+		/// copy of the parameters (not const, so that trees using this adapter can be swapped)
+		std::vector<typename NVFunc::ParType> pars;
 		/// definition of result for the tree class to use
 		typedef typename NVFunc::result_type result_type;
 		/// number of component values returned is the same as the number of parameters
@@ -845,6 +1155,47 @@ namespace orbtree {
 	};
 	
 	
+	/// adapter for functions that take one parameter from a fixed size array of parameters
+	/** The number of parameters, and thus the number of components
+	 * returned is known at compile time. This allows storing partial
+	 * sums in the nodes directly (instead of separately allocated arrays)
+	 * and using fixed size loops when calculating with them.
+	 * 
+	 * @tparam NVFunc Function object to adapt. Should be a function that takes
+	 * one extra parameter of type NVFunc::ParType beside the key / value stored in the tree
+	 * @tparam N Number of parameters */
+	template<class NVFunc, unsigned int N>
+	struct NVFunc_Adapter_Fixed {
+		static_assert(N > 0, "NVFunc_Adapter_Fixed: number of parameters must be positive!\n");
+		NVFunc f;
+		/// copy of the parameters (not const, so that trees using this adapter can be swapped)
+		std::array<typename NVFunc::ParType, N> pars;
+		/// definition of result for the tree class to use
+		typedef typename NVFunc::result_type result_type;
+		/// number of component values returned is the same as the number of parameters
+		static constexpr unsigned int fixed_nr = N;
+		/// number of component values returned is the same as the number of parameters
+		static constexpr unsigned int get_nr() { return N; }
+		/// calculate the result of the given function for the given value with each of the parameters
+		void operator ()(const typename NVFunc::argument_type& node_value, result_type* res) const {
+			for(unsigned int i=0;i<N;i++) res[i] = f(node_value,pars[i]);
+		}
+		NVFunc_Adapter_Fixed() = delete; /* need parameters */
+		/// this adapter can only be constructed with the parameters
+		explicit NVFunc_Adapter_Fixed(const std::array<typename NVFunc::ParType, N>& pars_, const NVFunc& f_ = NVFunc()):f(f_),pars(pars_) { }
+		/// this adapter can only be constructed with the parameters; the size of pars_ must be N
+		explicit NVFunc_Adapter_Fixed(const std::vector<typename NVFunc::ParType>& pars_, const NVFunc& f_ = NVFunc()):f(f_),pars(to_array(pars_)) { }
+		
+		private:
+			static std::array<typename NVFunc::ParType, N> to_array(const std::vector<typename NVFunc::ParType>& v) {
+				if(v.size() != N) throw std::runtime_error("NVFunc_Adapter_Fixed: wrong number of parameters!\n");
+				std::array<typename NVFunc::ParType, N> a;
+				std::copy(v.begin(),v.end(),a.begin());
+				return a;
+			}
+	};
+	
+	
 	/// example function: key^\alpha, i.e. raise the key for a given power
 	template<class KeyType> struct NVPower {
 		/// main interface takes the exponent as parameter
@@ -987,7 +1338,7 @@ namespace orbtree {
 			const mapped_type& at(const key_type& k) const {
 				NodeHandle n = orbtree_base<NodeAllocator, Compare, NVFunc, false>::find(k);
 				if(n == this->nil()) throw std::out_of_range("orbtreemap::at(): key not present in map!\n");
-				return get_node(n).get_key_value().value();
+				return this->get_node(n).get_key_value().value();
 			}
 			/// Access mapped value for a key that compares equal to k, throws an exception if not such key is found
 			/** Cannot be used to modify value since that can require
@@ -997,7 +1348,7 @@ namespace orbtree {
 			template<class K> const mapped_type& at(const K& k) const {
 				NodeHandle n = orbtree_base<NodeAllocator, Compare, NVFunc, false>::find(k);
 				if(n == this->nil()) throw std::out_of_range("orbtreemap::at(): key not present in map!\n");
-				return get_node(n).get_key_value().value();
+				return this->get_node(n).get_key_value().value();
 			}
 			
 			/// Access mapped value for a given key, inserts a new element with the default value if not found.
@@ -1007,8 +1358,8 @@ namespace orbtree {
 			 */
 			const mapped_type& operator[](const key_type& k) {
 				NodeHandle n = orbtree_base<NodeAllocator, Compare, NVFunc, false>::find(k);
-				if(n == this->nil()) n = orbtree_base<NodeAllocator, Compare, NVFunc, false>::insert(value_type(k,mapped_type()));
-				return get_node(n).get_key_value().value();
+				if(n == this->nil()) n = orbtree_base<NodeAllocator, Compare, NVFunc, false>::insert(value_type(k,mapped_type())).first;
+				return this->get_node(n).get_key_value().value();
 			}
 			
 			/** \brief set value associated with the given key or insert new element
@@ -1070,6 +1421,216 @@ namespace orbtree {
 			}
 	};
 	
+	
+	/** \brief Run-length encoded multiset: keys are stored once with their count.
+	 * 
+	 * Multiset where each distinct key is stored in one node of the tree, along
+	 * with the number of times it is present. Weights are multiplied by the count
+	 * (the weight function should be wrapped in NVFunc_Adapter_Count), so partial
+	 * sums and rank queries give the same results as for a multiset storing each
+	 * copy separately, while memory use and the depth of the tree depend on
+	 * the number of distinct keys only. Elements are pairs of key and count;
+	 * iterators refer to distinct keys and cannot be used to modify counts.
+	 * 
+	 * It is recommended to use the templates \ref orbmultisetR, \ref rankmultisetR,
+	 * \ref orbmultisetCR and \ref rankmultisetCR instead of directly using this
+	 * class template.
+	 * 
+	 * @tparam NodeAllocator node allocator class, storing KeyValue<Key, CountType>
+	 * @tparam Compare comparison functor
+	 * @tparam NVFunc weight function, NVFunc_Adapter_Count wrapping a function of the key
+	 * @tparam simple determines if the weight function returns one value
+	 */
+	template<class NodeAllocator, class Compare, class NVFunc, bool simple = false>
+	class orbtreemultiset_rle : protected orbtree<NodeAllocator, Compare, NVFunc, false, simple> {
+		protected:
+			typedef orbtree<NodeAllocator, Compare, NVFunc, false, simple> base;
+			typedef typename base::KeyValue KeyValue;
+			size_t total; ///< \brief number of elements, counting all copies of keys
+		
+		public:
+			/* typedefs */
+			/// pair of key and count of copies
+			typedef typename base::value_type value_type;
+			typedef typename base::key_type key_type;
+			/// type used to store the number of copies of keys
+			typedef typename KeyValue::MappedType count_type;
+			typedef typename base::size_type size_type;
+			typedef typename base::difference_type difference_type;
+			typedef typename base::NVType NVType;
+			typedef typename base::NVFunc_t NVFunc_t;
+			/// iterators refer to distinct keys and do not allow modification
+			typedef typename base::const_iterator const_iterator;
+			/// iterators refer to distinct keys and do not allow modification
+			typedef const_iterator iterator;
+			
+			explicit orbtreemultiset_rle(const NVFunc& f_ = NVFunc(), const Compare& c_ = Compare()) : base(f_,c_), total(0) { }
+			explicit orbtreemultiset_rle(NVFunc&& f_, const Compare& c_ = Compare()) : base(std::move(f_),c_), total(0) { }
+			template <class T>
+			explicit orbtreemultiset_rle(const T& t, const Compare& c_ = Compare()) : base(t,c_), total(0) { }
+			
+			/// Exchange the contents of this multiset with t in constant time
+			void swap(orbtreemultiset_rle& t) {
+				base::swap(t);
+				std::swap(total, t.total);
+			}
+			
+			const_iterator begin() const { return base::cbegin(); } /// get an iterator to the beginning (lowest key)
+			const_iterator cbegin() const { return base::cbegin(); } /// get an iterator to the beginning (lowest key)
+			const_iterator end() const { return base::cend(); } /// get the past-the-end iterator
+			const_iterator cend() const { return base::cend(); } /// get the past-the-end iterator
+			
+			/// number of elements, counting each copy of keys
+			size_t size() const { return total; }
+			/// number of distinct keys (i.e. nodes in the tree)
+			size_t distinct_size() const { return base::size(); }
+			using base::empty;
+			/// remove all elements
+			void clear() {
+				base::clear();
+				total = 0;
+			}
+			
+			/** \brief Insert n copies of key k, returns an iterator to its node.
+			 * 
+			 * Throws an exception if the count or the weights would overflow;
+			 * in this case, the multiset is not changed. */
+			const_iterator insert(const key_type& k, count_type n = 1) {
+				if(n == 0) return find(k);
+				if(total > std::numeric_limits<size_t>::max() - n)
+					throw std::runtime_error("orbtreemultiset_rle::insert(): too many elements!\n");
+				{
+					/* check that the sum of weights will not overflow before changing the tree
+					 * (weights are proportional to the count, so this is the weight of n copies) */
+					NVType w[base::fixed_nr ? base::fixed_nr : this->get_nr()];
+					NVType norm[base::fixed_nr ? base::fixed_nr : this->get_nr()];
+					this->f(value_type(k,n), w);
+					this->get_norm_fv(norm);
+					this->NVAdd(norm, w);
+				}
+				std::pair<typename base::iterator, bool> r = base::insert(value_type(k,n));
+				if(!r.second) {
+					count_type c = r.first->second;
+					if(c > std::numeric_limits<count_type>::max() - n)
+						throw std::runtime_error("orbtreemultiset_rle::insert(): count overflow!\n");
+					r.first.set_value(c + n);
+				}
+				total += n;
+				return r.first;
+			}
+			/// insert all keys in the range [first,last), with one copy for each occurrence
+			template<class InputIt, class = typename std::iterator_traits<InputIt>::iterator_category>
+			void insert(InputIt first, InputIt last) {
+				for(;first != last;++first) insert(*first);
+			}
+			/** \brief Replace the contents with the keys in the sorted range [first,last)
+			 * (repeated keys are counted, see \ref orbtree_base::assign_sorted()). */
+			template<class InputIt> void assign_sorted(InputIt first, InputIt last) {
+				std::vector<value_type> runs;
+				size_t n = 0;
+				for(;first != last;++first,++n) {
+					if(runs.size() && !this->c(runs.back().first,*first)) {
+						if(this->c(*first,runs.back().first))
+							throw std::runtime_error("orbtreemultiset_rle::assign_sorted(): input is not sorted!\n");
+						if(runs.back().second == std::numeric_limits<count_type>::max())
+							throw std::runtime_error("orbtreemultiset_rle::assign_sorted(): count overflow!\n");
+						runs.back().second++;
+					}
+					else runs.push_back(value_type(*first,1));
+				}
+				total = 0;
+				base::assign_sorted(runs.begin(),runs.end());
+				total = n;
+			}
+			
+			/// erase all copies of the key pointed to by the iterator, returns an iterator to the next key
+			const_iterator erase(const_iterator it) {
+				count_type c = it->second;
+				const_iterator ret = base::erase(it);
+				total -= c;
+				return ret;
+			}
+			/// erase all copies of the given key, returns the number of elements erased
+			size_t erase(const key_type& k) {
+				const_iterator it = find(k);
+				if(it == end()) return 0;
+				size_t c = it->second;
+				erase(it);
+				return c;
+			}
+			/// erase at most n copies of the given key, returns the number of elements erased
+			count_type erase(const key_type& k, count_type n) {
+				typename base::iterator it = base::find(k);
+				if(it == base::end() || n == 0) return 0;
+				count_type c = it->second;
+				if(n >= c) {
+					base::erase(it);
+					n = c;
+				}
+				else it.set_value(c - n);
+				total -= n;
+				return n;
+			}
+			
+			/// returns the number of copies of the given key
+			size_t count(const key_type& k) const {
+				const_iterator it = find(k);
+				return (it == end()) ? 0 : it->second;
+			}
+			/// check if the given key is present
+			bool contains(const key_type& k) const { return base::contains(k); }
+			const_iterator find(const key_type& k) const { return base::find(k); } /// find the node of the given key
+			const_iterator lower_bound(const key_type& k) const { return base::lower_bound(k); } /// first key not less than k
+			const_iterator upper_bound(const key_type& k) const { return base::upper_bound(k); } /// first key greater than k
+			/** \brief Range of keys equal to k: this contains at most one node,
+			 * the number of copies is given by its count. */
+			std::pair<const_iterator,const_iterator> equal_range(const key_type& k) const { return base::equal_range(k); }
+			/// find the first node for which the sum of weights before it satisfies p, see \ref orbtree::orbtree::lower_bound_w() "orbtree::lower_bound_w()"
+			template<class pred> const_iterator lower_bound_w(const pred& p) const { return base::lower_bound_w(p); }
+			/** \brief Find the node containing the element with the given weight in one component,
+			 * see \ref orbtree::orbtree::find_by_weight() "orbtree::find_by_weight()". For a
+			 * rank multiset, this is the key that is at position value in sorted order. */
+			const_iterator find_by_weight(unsigned int component, const NVType& value, NVType* res = 0) const {
+				return base::find_by_weight(component,value,res);
+			}
+			/// weighted sampling, see \ref orbtree::orbtree::sample() "orbtree::sample()"
+			template<bool simple_ = simple>
+			std::pair<const_iterator,NVType> sample(typename std::enable_if<simple_,const NVType&>::type u) const {
+				return base::sample(u);
+			}
+			
+			/* partial sums: these work the same as in orbtree, but count all copies of keys */
+			using base::get_sum_node;
+			using base::get_sum;
+			using base::get_sums;
+			using base::get_norm;
+			using base::get_range_sum;
+			using base::get_range_sum_node;
+			using base::get_range_sum_by_weight;
+			using base::recompute_weights;
+			using base::set_nvfunc;
+			using base::get_nvfunc;
+			using base::get_stats;
+			using base::reset_stats;
+			
+			/// check that the tree is valid and the counts are consistent, see \ref orbtree_base::check_tree()
+			void check_tree(double epsilon = -1.0) const {
+				base::check_tree(epsilon);
+				size_t n = 0;
+				for(const_iterator it = begin();it != end();++it) {
+					if(it->second == 0) throw std::runtime_error("orbtreemultiset_rle::check_tree(): key with zero count!\n");
+					n += it->second;
+				}
+				if(n != total) throw std::runtime_error("orbtreemultiset_rle::check_tree(): inconsistent number of elements!\n");
+			}
+	};
+	
+	/// Exchange the contents of two multisets in constant time
+	template<class NodeAllocator, class Compare, class NVFunc, bool simple>
+	void swap(orbtreemultiset_rle<NodeAllocator, Compare, NVFunc, simple>& t1, orbtreemultiset_rle<NodeAllocator, Compare, NVFunc, simple>& t2) {
+		t1.swap(t2);
+	}
+	
 	/** \class orbtree::orbmap
 	 * \brief General map implementation. See \ref orbtree::orbtree "orbtree"
 	 * and \ref orbtreemap for description of members.
@@ -1229,6 +1790,154 @@ namespace orbtree {
 		Compare, NVFunc_Adapter_Simple<NVFunc>, true, true >;
 	
 	
+	/* versions for weight functions with a number of components known at
+	 * compile time (NVFunc::fixed_nr, e.g. by using NVFunc_Adapter_Fixed):
+	 * partial sums are stored in fixed size arrays inside the nodes */
+	/** \class orbtree::orbsetF
+	 * \brief General set with weight functions of fixed dimension. Partial sums are
+	 * stored as part of nodes, no separate allocation is needed for them.
+	 * See \ref orbtree::orbtree "orbtree" for description of members.
+	 * 
+	 * @tparam Key type of elements ("keys") stored in this set.
+	 * @tparam NVFunc function calculating the weights associated with stored
+	 * elements. Should have a static constexpr fixed_nr member giving the
+	 * number of components, e.g. NVFunc_Adapter_Fixed.
+	 * @tparam Compare comparison functor for keys.
+	 */
+	template<class Key, class NVFunc, class Compare = std::less<Key> >
+	using orbsetF = orbtree< NodeAllocatorPtr< KeyOnly<Key>, typename NVFunc::result_type, false, NVFunc::fixed_nr >,
+		Compare, NVFunc, false >;
+	
+	/** \class orbtree::orbmultisetF
+	 * \brief General multiset with weight functions of fixed dimension.
+	 * See \ref orbtree::orbsetF "orbsetF" and \ref orbtree::orbtree "orbtree" for description of members.
+	 */
+	template<class Key, class NVFunc, class Compare = std::less<Key> >
+	using orbmultisetF = orbtree< NodeAllocatorPtr< KeyOnly<Key>, typename NVFunc::result_type, false, NVFunc::fixed_nr >,
+		Compare, NVFunc, true >;
+	
+	/** \class orbtree::orbmapF
+	 * \brief General map with weight functions of fixed dimension.
+	 * See \ref orbtree::orbsetF "orbsetF", \ref orbtree::orbtree "orbtree"
+	 * and \ref orbtreemap for description of members.
+	 */
+	template<class Key, class Value, class NVFunc, class Compare = std::less<Key> >
+	using orbmapF = orbtreemap< NodeAllocatorPtr< KeyValue<Key,Value>, typename NVFunc::result_type, false, NVFunc::fixed_nr >,
+		Compare, NVFunc >;
+	
+	/** \class orbtree::orbmultimapF
+	 * \brief General multimap with weight functions of fixed dimension.
+	 * See \ref orbtree::orbsetF "orbsetF" and \ref orbtree::orbtree "orbtree" for description of members.
+	 */
+	template<class Key, class Value, class NVFunc, class Compare = std::less<Key> >
+	using orbmultimapF = orbtree< NodeAllocatorPtr< KeyValue<Key,Value>, typename NVFunc::result_type, false, NVFunc::fixed_nr >,
+		Compare, NVFunc, true >;
+	
+	/** \class orbtree::orbsetCF
+	 * \brief Set with compact storage and weight functions of fixed dimension.
+	 * See \ref orbtree::orbsetC "orbsetC" and \ref orbtree::orbsetF "orbsetF" for details.
+	 */
+	template<class Key, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbsetCF = orbtree< NodeAllocatorCompact< KeyOnly<Key>, typename NVFunc::result_type, IndexType, NVFunc::fixed_nr >,
+		Compare, NVFunc, false >;
+	
+	/** \class orbtree::orbmultisetCF
+	 * \brief Multiset with compact storage and weight functions of fixed dimension.
+	 * See \ref orbtree::orbmultisetC "orbmultisetC" and \ref orbtree::orbsetF "orbsetF" for details.
+	 */
+	template<class Key, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbmultisetCF = orbtree< NodeAllocatorCompact< KeyOnly<Key>, typename NVFunc::result_type, IndexType, NVFunc::fixed_nr >,
+		Compare, NVFunc, true >;
+	
+	/** \class orbtree::orbmapCF
+	 * \brief Map with compact storage and weight functions of fixed dimension.
+	 * See \ref orbtree::orbmapC "orbmapC" and \ref orbtree::orbsetF "orbsetF" for details.
+	 */
+	template<class Key, class Value, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbmapCF = orbtreemap< NodeAllocatorCompact< KeyValue<Key,Value>, typename NVFunc::result_type, IndexType, NVFunc::fixed_nr >,
+		Compare, NVFunc >;
+	
+	/** \class orbtree::orbmultimapCF
+	 * \brief Multimap with compact storage and weight functions of fixed dimension.
+	 * See \ref orbtree::orbmultimapC "orbmultimapC" and \ref orbtree::orbsetF "orbsetF" for details.
+	 */
+	template<class Key, class Value, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbmultimapCF = orbtree< NodeAllocatorCompact< KeyValue<Key,Value>, typename NVFunc::result_type, IndexType, NVFunc::fixed_nr >,
+		Compare, NVFunc, true >;
+	
+	
+	/* versions that store the weight of each element in its node, next to the
+	 * partial sums: the weight function is only called when inserting an element
+	 * or changing its value, not during searches, rotations and queries */
+	/** \class orbtree::orbsetW
+	 * \brief General set that stores the weight of each element. Useful if the weight
+	 * function is expensive to calculate (e.g. \ref NVPower); the price is storing
+	 * one more copy of the weights in each node. Works with weight functions with both
+	 * a variable and a fixed number of components (\ref NVFunc_Adapter_Vec or \ref NVFunc_Adapter_Fixed).
+	 * See \ref orbtree::orbtree "orbtree" for description of members.
+	 */
+	template<class Key, class NVFunc, class Compare = std::less<Key> >
+	using orbsetW = orbtree< NodeAllocatorPtr< KeyOnly<Key>, typename NVFunc::result_type, false, NVFunc_fixed_nr<NVFunc>::value, false, true >,
+		Compare, NVFunc, false >;
+	
+	/** \class orbtree::orbmultisetW
+	 * \brief General multiset that stores the weight of each element.
+	 * See \ref orbtree::orbsetW "orbsetW" and \ref orbtree::orbtree "orbtree" for description of members.
+	 */
+	template<class Key, class NVFunc, class Compare = std::less<Key> >
+	using orbmultisetW = orbtree< NodeAllocatorPtr< KeyOnly<Key>, typename NVFunc::result_type, false, NVFunc_fixed_nr<NVFunc>::value, false, true >,
+		Compare, NVFunc, true >;
+	
+	/** \class orbtree::orbmapW
+	 * \brief General map that stores the weight of each element.
+	 * See \ref orbtree::orbsetW "orbsetW", \ref orbtree::orbtree "orbtree"
+	 * and \ref orbtreemap for description of members.
+	 */
+	template<class Key, class Value, class NVFunc, class Compare = std::less<Key> >
+	using orbmapW = orbtreemap< NodeAllocatorPtr< KeyValue<Key,Value>, typename NVFunc::result_type, false, NVFunc_fixed_nr<NVFunc>::value, false, true >,
+		Compare, NVFunc >;
+	
+	/** \class orbtree::orbmultimapW
+	 * \brief General multimap that stores the weight of each element.
+	 * See \ref orbtree::orbsetW "orbsetW" and \ref orbtree::orbtree "orbtree" for description of members.
+	 */
+	template<class Key, class Value, class NVFunc, class Compare = std::less<Key> >
+	using orbmultimapW = orbtree< NodeAllocatorPtr< KeyValue<Key,Value>, typename NVFunc::result_type, false, NVFunc_fixed_nr<NVFunc>::value, false, true >,
+		Compare, NVFunc, true >;
+	
+	/** \class orbtree::orbsetCW
+	 * \brief Set with compact storage that stores the weight of each element.
+	 * See \ref orbtree::orbsetC "orbsetC" and \ref orbtree::orbsetW "orbsetW" for details.
+	 */
+	template<class Key, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbsetCW = orbtree< NodeAllocatorCompact< KeyOnly<Key>, typename NVFunc::result_type, IndexType, NVFunc_fixed_nr<NVFunc>::value,
+		realloc_vector::malloc_alloc, true >, Compare, NVFunc, false >;
+	
+	/** \class orbtree::orbmultisetCW
+	 * \brief Multiset with compact storage that stores the weight of each element.
+	 * See \ref orbtree::orbmultisetC "orbmultisetC" and \ref orbtree::orbsetW "orbsetW" for details.
+	 */
+	template<class Key, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbmultisetCW = orbtree< NodeAllocatorCompact< KeyOnly<Key>, typename NVFunc::result_type, IndexType, NVFunc_fixed_nr<NVFunc>::value,
+		realloc_vector::malloc_alloc, true >, Compare, NVFunc, true >;
+	
+	/** \class orbtree::orbmapCW
+	 * \brief Map with compact storage that stores the weight of each element.
+	 * See \ref orbtree::orbmapC "orbmapC" and \ref orbtree::orbsetW "orbsetW" for details.
+	 */
+	template<class Key, class Value, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbmapCW = orbtreemap< NodeAllocatorCompact< KeyValue<Key,Value>, typename NVFunc::result_type, IndexType, NVFunc_fixed_nr<NVFunc>::value,
+		realloc_vector::malloc_alloc, true >, Compare, NVFunc >;
+	
+	/** \class orbtree::orbmultimapCW
+	 * \brief Multimap with compact storage that stores the weight of each element.
+	 * See \ref orbtree::orbmultimapC "orbmultimapC" and \ref orbtree::orbsetW "orbsetW" for details.
+	 */
+	template<class Key, class Value, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbmultimapCW = orbtree< NodeAllocatorCompact< KeyValue<Key,Value>, typename NVFunc::result_type, IndexType, NVFunc_fixed_nr<NVFunc>::value,
+		realloc_vector::malloc_alloc, true >, Compare, NVFunc, true >;
+	
+	
 	/** \class orbtree::rankmap
 	 * \brief  Order statistic map, calculates the rank of elements.
 	 * See \ref orbtree::orbtree "orbtree" and \ref orbtreemap for description of members.
@@ -1300,6 +2009,102 @@ namespace orbtree {
 			NVFunc_Adapter_Simple< RankFunc<trivial_pair<Key,Value>, NVType > >, true, true >;
 	
 	
+	/* versions using pool allocation (NodeAllocatorPool): nodes are allocated
+	 * from large slabs, which makes allocation and clearing / destroying large
+	 * trees faster; memory of deleted nodes is reused, but only given back
+	 * when the whole tree is cleared */
+	/** \class orbtree::simple_setP
+	 * \brief Same as \ref orbtree::simple_set "simple_set", but nodes are allocated with NodeAllocatorPool.
+	 */
+	template<class Key, class NVFunc, class Compare = std::less<Key> >
+	using simple_setP = orbtree< NodeAllocatorPool< KeyOnly<Key>, typename NVFunc::result_type, true >,
+		Compare, NVFunc_Adapter_Simple<NVFunc>, false, true >;
+	
+	/** \class orbtree::simple_multisetP
+	 * \brief Same as \ref orbtree::simple_multiset "simple_multiset", but nodes are allocated with NodeAllocatorPool.
+	 */
+	template<class Key, class NVFunc, class Compare = std::less<Key> >
+	using simple_multisetP = orbtree< NodeAllocatorPool< KeyOnly<Key>, typename NVFunc::result_type, true >,
+		Compare, NVFunc_Adapter_Simple<NVFunc>, true, true >;
+	
+	/** \class orbtree::simple_mapP
+	 * \brief Same as \ref orbtree::simple_map "simple_map", but nodes are allocated with NodeAllocatorPool.
+	 */
+	template<class Key, class Value, class NVFunc, class Compare = std::less<Key> >
+	using simple_mapP = orbtreemap< NodeAllocatorPool< KeyValue<Key,Value>, typename NVFunc::result_type, true >,
+		Compare, NVFunc_Adapter_Simple<NVFunc>, true >;
+	
+	/** \class orbtree::simple_multimapP
+	 * \brief Same as \ref orbtree::simple_multimap "simple_multimap", but nodes are allocated with NodeAllocatorPool.
+	 */
+	template<class Key, class Value, class NVFunc, class Compare = std::less<Key> >
+	using simple_multimapP = orbtree< NodeAllocatorPool< KeyValue<Key,Value>, typename NVFunc::result_type, true >,
+		Compare, NVFunc_Adapter_Simple<NVFunc>, true, true>;
+	
+	/** \class orbtree::ranksetP
+	 * \brief Same as \ref orbtree::rankset "rankset", but nodes are allocated with NodeAllocatorPool.
+	 */
+	template<class Key, class NVType = uint32_t, class Compare = std::less<Key> >
+	using ranksetP = orbtree< NodeAllocatorPool< KeyOnly<Key>, NVType, true >, Compare,
+			NVFunc_Adapter_Simple<RankFunc<Key, NVType> >, false, true >;
+	
+	/** \class orbtree::rankmultisetP
+	 * \brief Same as \ref orbtree::rankmultiset "rankmultiset", but nodes are allocated with NodeAllocatorPool.
+	 */
+	template<class Key, class NVType = uint32_t, class Compare = std::less<Key> >
+	using rankmultisetP = orbtree< NodeAllocatorPool< KeyOnly<Key>, NVType, true >, Compare,
+			NVFunc_Adapter_Simple<RankFunc<Key, NVType> >, true, true >;
+	
+	/** \class orbtree::rankmapP
+	 * \brief Same as \ref orbtree::rankmap "rankmap", but nodes are allocated with NodeAllocatorPool.
+	 */
+	template<class Key, class Value, class NVType = uint32_t, class Compare = std::less<Key> >
+	using rankmapP = orbtreemap< NodeAllocatorPool< KeyValue<Key,Value>, NVType, true >, Compare,
+			NVFunc_Adapter_Simple< RankFunc<trivial_pair<Key,Value>, NVType > >, true >;
+	
+	/** \class orbtree::rankmultimapP
+	 * \brief Same as \ref orbtree::rankmultimap "rankmultimap", but nodes are allocated with NodeAllocatorPool.
+	 */
+	template<class Key, class Value, class NVType = uint32_t, class Compare = std::less<Key> >
+	using rankmultimapP = orbtree< NodeAllocatorPool< KeyValue<Key,Value>, NVType, true >, Compare,
+			NVFunc_Adapter_Simple< RankFunc<trivial_pair<Key,Value>, NVType > >, true, true >;
+	
+	/** \class orbtree::orbmultisetR
+	 * \brief Run-length encoded multiset, storing each distinct key with its count,
+	 * see \ref orbtree::orbtreemultiset_rle "orbtreemultiset_rle".
+	 * 
+	 * @tparam Key Type of keys.
+	 * @tparam NVFunc Function object calculating the weight of one copy of a key
+	 * (same as for \ref orbtree::orbmultiset "orbmultiset").
+	 * @tparam CountType Unsigned integer type storing the number of copies.
+	 * @tparam Compare comparison functor for keys.
+	 */
+	template<class Key, class NVFunc, class CountType = uint32_t, class Compare = std::less<Key> >
+	using orbmultisetR = orbtreemultiset_rle< NodeAllocatorPtr< KeyValue<Key,CountType>, typename NVFunc::result_type >, Compare,
+			NVFunc_Adapter_Count<NVFunc, CountType> >;
+	
+	/** \class orbtree::rankmultisetR
+	 * \brief Run-length encoded multiset with ranks, storing each distinct key with its count.
+	 */
+	template<class Key, class NVType = uint32_t, class CountType = uint32_t, class Compare = std::less<Key> >
+	using rankmultisetR = orbtreemultiset_rle< NodeAllocatorPtr< KeyValue<Key,CountType>, NVType, true >, Compare,
+			NVFunc_Adapter_Count<NVFunc_Adapter_Simple<RankFunc<Key, NVType> >, CountType>, true >;
+	
+	/** \class orbtree::orbmultisetCR
+	 * \brief Same as \ref orbtree::orbmultisetR "orbmultisetR", but nodes are stored in flat arrays (see \ref orbmultisetC).
+	 */
+	template<class Key, class NVFunc, class CountType = uint32_t, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbmultisetCR = orbtreemultiset_rle< NodeAllocatorCompact< KeyValue<Key,CountType>, typename NVFunc::result_type, IndexType >, Compare,
+			NVFunc_Adapter_Count<NVFunc, CountType> >;
+	
+	/** \class orbtree::rankmultisetCR
+	 * \brief Same as \ref orbtree::rankmultisetR "rankmultisetR", but nodes are stored in flat arrays (see \ref orbmultisetC).
+	 */
+	template<class Key, class NVType = uint32_t, class CountType = uint32_t, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using rankmultisetCR = orbtreemultiset_rle< NodeAllocatorCompact< KeyValue<Key,CountType>, NVType, IndexType >, Compare,
+			NVFunc_Adapter_Count<NVFunc_Adapter_Simple<RankFunc<Key, NVType> >, CountType>, true >;
+	
+	
 	
 	/** Find the first element in the given container with rank not less than the given value; works for containers with scalar weight functions. */
 	template<class cont>
@@ -36,6 +36,23 @@
 #ifndef ORBTREE_BASE_H
 #define ORBTREE_BASE_H
 #include "orbtree_node.h"
+#include <iterator>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <math.h>
+
+/* size of temporary arrays storing weights: this is a compile-time constant
+ * if the weight function has a fixed number of components, so no VLA is used */
+#define ORBTREE_NV_SIZE (fixed_nr ? fixed_nr : f.get_nr())
+
+/* counting of operations for tree_stats, only enabled if ORBTREE_STATS is defined */
+#ifdef ORBTREE_STATS
+#define ORBTREE_STAT_ADD(name, x) this->stat_counters.add(this->stat_counters.name, (x))
+#else
+#define ORBTREE_STAT_ADD(name, x)
+#endif
 
 namespace orbtree {
 	
@@ -48,6 +65,155 @@ namespace orbtree {
 			explicit NVFunc_wrapper(const T& t):f(t) { }
 	};
 	
+	/** \brief Number of components returned by a weight function, if it is
+	 * known at compile time (i.e. NVFunc has a static constexpr fixed_nr member),
+	 * zero otherwise. */
+	template<class NVFunc, class = void>
+	struct NVFunc_fixed_nr : std::integral_constant<unsigned int, 0> { };
+	template<class NVFunc>
+	struct NVFunc_fixed_nr<NVFunc, typename std::enable_if<(NVFunc::fixed_nr > 0)>::type> :
+		std::integral_constant<unsigned int, NVFunc::fixed_nr> { };
+	
+	/** \brief Helper for adding and subtracting arrays of weights.
+	 * 
+	 * Loops are written without branches and aliasing, so that they can
+	 * be vectorized by the compiler. General version (e.g. floating point
+	 * types), no checks are performed.
+	 */
+	template<class NVType, bool checked = std::is_integral<NVType>::value && !std::is_same<NVType,bool>::value>
+	struct NVOps {
+		/// \brief x = x + y
+		static void add(NVType* __restrict x, const NVType* __restrict y, unsigned int nr) {
+			/* TODO: overflow / rounding check for floats? */
+			for(unsigned int i=0;i<nr;i++) x[i] += y[i];
+		}
+		/// \brief x = x - y
+		static void subtract(NVType* __restrict x, const NVType* __restrict y, unsigned int nr) {
+			for(unsigned int i=0;i<nr;i++) x[i] -= y[i];
+		}
+	};
+	
+	/** \brief Helper for adding and subtracting arrays of weights, version
+	 * for integral types that throws an exception on overflow.
+	 * 
+	 * Overflow flags are accumulated without branches for the whole array
+	 * and checked once; x is only modified if there was no overflow.
+	 */
+	template<class NVType>
+	struct NVOps<NVType,true> {
+		/* calculations are done with unsigned types where overflow is well-defined */
+		typedef typename std::make_unsigned<NVType>::type U;
+		static constexpr U signbit = ((U)1) << (std::numeric_limits<U>::digits - 1);
+		
+		/// \brief check if x + y overflows (returns nonzero if it does)
+		static U add_overflow(U x, U y) {
+			U r = x + y;
+			if(std::is_signed<NVType>::value) return ((x ^ r) & (y ^ r)) & signbit;
+			else return r < x;
+		}
+		/// \brief check if x - y overflows (returns nonzero if it does)
+		static U subtract_overflow(U x, U y) {
+			U r = x - y;
+			if(std::is_signed<NVType>::value) return ((x ^ y) & (x ^ r)) & signbit;
+			else return x < y;
+		}
+		
+		/// \brief x = x + y
+		static void add(NVType* __restrict x, const NVType* __restrict y, unsigned int nr) {
+			U ovf = 0;
+			for(unsigned int i=0;i<nr;i++) ovf |= add_overflow((U)x[i],(U)y[i]);
+			if(ovf) {
+				/* find the first problematic element for the error message */
+				for(unsigned int i=0;i<nr;i++) if(add_overflow((U)x[i],(U)y[i])) {
+					if(y[i] > 0) throw std::runtime_error("orbtree_base::NVAdd(): overflow!\n");
+					else throw std::runtime_error("orbtree_base::NVAdd(): underflow!\n");
+				}
+			}
+			for(unsigned int i=0;i<nr;i++) x[i] = (NVType)((U)x[i] + (U)y[i]);
+		}
+		/// \brief x = x - y
+		static void subtract(NVType* __restrict x, const NVType* __restrict y, unsigned int nr) {
+			U ovf = 0;
+			for(unsigned int i=0;i<nr;i++) ovf |= subtract_overflow((U)x[i],(U)y[i]);
+			if(ovf) {
+				for(unsigned int i=0;i<nr;i++) if(subtract_overflow((U)x[i],(U)y[i])) {
+					if(y[i] > 0) throw std::runtime_error("orbtree_base::NVSubtract(): underflow!\n");
+					else throw std::runtime_error("orbtree_base::NVSubtract(): overflow!\n");
+				}
+			}
+			for(unsigned int i=0;i<nr;i++) x[i] = (NVType)((U)x[i] - (U)y[i]);
+		}
+	};
+	
+	/** \brief Snapshot of statistics about a tree, returned by orbtree_base::get_stats().
+	 * 
+	 * Structure and memory use are calculated when calling get_stats().
+	 * Operation counters are only updated if ORBTREE_STATS is defined when
+	 * compiling (otherwise they are always zero and there is no overhead);
+	 * they count since the tree was created or reset_stats() was last called.
+	 * Counters are not synchronized: if the tree is used from multiple threads
+	 * at the same time (e.g. queries or parallel updates of partial sums),
+	 * some events may not be counted.
+	 */
+	struct tree_stats {
+		size_t size = 0; ///< \brief number of elements
+		size_t height = 0; ///< \brief number of nodes on the longest path from the root to a leaf
+		size_t black_height = 0; ///< \brief number of black nodes on paths from the root to the leaves (not counting nil; the root itself can be red)
+		double avg_depth = 0.0; ///< \brief average depth of nodes (the root has depth 1), i.e. number of nodes visited when searching
+		
+		size_t deleted_nodes = 0; ///< \brief number of deleted nodes still taking up space (only with NodeAllocatorCompact)
+		size_t node_capacity = 0; ///< \brief number of elements that fit in the currently allocated storage (see orbtree_base::capacity())
+		size_t node_bytes = 0; ///< \brief memory allocated for node storage, in bytes (only with NodeAllocatorCompact, zero otherwise)
+		size_t nv_bytes = 0; ///< \brief memory allocated for storing partial sums separately, in bytes (only with NodeAllocatorCompact, zero otherwise)
+		
+		bool counters_enabled = false; ///< \brief whether the following counters are updated (i.e. ORBTREE_STATS was defined)
+		uint64_t rotations = 0; ///< \brief number of rotations done while rebalancing
+		uint64_t nvfunc_calls = 0; ///< \brief number of times the weight function was evaluated
+		uint64_t get_sum_calls = 0; ///< \brief number of searches by key calculating partial sums (get_sum(), lower_bound_sum())
+		uint64_t get_sum_nodes = 0; ///< \brief number of nodes visited by these
+		uint64_t lower_bound_w_calls = 0; ///< \brief number of searches by partial sums (lower_bound_w())
+		uint64_t lower_bound_w_nodes = 0; ///< \brief number of nodes visited by these
+		uint64_t insert_search_calls = 0; ///< \brief number of searches for the place of a new element when inserting
+		uint64_t insert_search_nodes = 0; ///< \brief number of nodes visited by these
+	};
+	
+#ifdef ORBTREE_STATS
+	/** \brief Counters of operations for tree_stats (only used if ORBTREE_STATS is defined).
+	 * 
+	 * Atomic types are used to avoid data races, but updates are not
+	 * atomic read-modify-write operations to keep them cheap. */
+	struct tree_stat_counters {
+		std::atomic<uint64_t> rotations{0};
+		std::atomic<uint64_t> nvfunc_calls{0};
+		std::atomic<uint64_t> get_sum_calls{0};
+		std::atomic<uint64_t> get_sum_nodes{0};
+		std::atomic<uint64_t> lower_bound_w_calls{0};
+		std::atomic<uint64_t> lower_bound_w_nodes{0};
+		std::atomic<uint64_t> insert_search_calls{0};
+		std::atomic<uint64_t> insert_search_nodes{0};
+		
+		static void add(std::atomic<uint64_t>& c, uint64_t x) {
+			c.store(c.load(std::memory_order_relaxed) + x, std::memory_order_relaxed);
+		}
+		void reset() {
+			for(std::atomic<uint64_t>* c : {&rotations, &nvfunc_calls, &get_sum_calls, &get_sum_nodes,
+					&lower_bound_w_calls, &lower_bound_w_nodes, &insert_search_calls, &insert_search_nodes})
+				c->store(0, std::memory_order_relaxed);
+		}
+		void get(tree_stats& s) const {
+			s.counters_enabled = true;
+			s.rotations = rotations.load(std::memory_order_relaxed);
+			s.nvfunc_calls = nvfunc_calls.load(std::memory_order_relaxed);
+			s.get_sum_calls = get_sum_calls.load(std::memory_order_relaxed);
+			s.get_sum_nodes = get_sum_nodes.load(std::memory_order_relaxed);
+			s.lower_bound_w_calls = lower_bound_w_calls.load(std::memory_order_relaxed);
+			s.lower_bound_w_nodes = lower_bound_w_nodes.load(std::memory_order_relaxed);
+			s.insert_search_calls = insert_search_calls.load(std::memory_order_relaxed);
+			s.insert_search_nodes = insert_search_nodes.load(std::memory_order_relaxed);
+		}
+	};
+#endif
+	
 	/** \brief base class for both map and set -- should not be used directly
 	 * 
 	 * @tparam NodeAllocator Class taking care of allocating and freeing
@@ -84,8 +250,21 @@ namespace orbtree {
 		
 			/** \brief keep track of the number of inserted elements */
 			size_t size1;
+			/** \brief number of compaction steps to do after erasing an element (zero: no automatic compaction) */
+			size_t auto_compact;
+			/** \brief if true, partial sums are not updated on modifications, only marked as outdated */
+			bool lazy_sums;
 			NVFunc& f;
 			Compare c;
+#ifdef ORBTREE_STATS
+			/** \brief counters of operations, see tree_stats; these are not copied or swapped with the tree */
+			mutable tree_stat_counters stat_counters;
+#endif
+			
+			/// \brief number of components returned by NVFunc if known at compile time (zero otherwise)
+			static constexpr unsigned int fixed_nr = NVFunc_fixed_nr<NVFunc>::value;
+			/// \brief number of components returned by NVFunc (compile-time constant if fixed_nr is nonzero)
+			unsigned int get_nr() const { return fixed_nr ? fixed_nr : f.get_nr(); }
 			
 			void create_sentinels() {
 				Node& rootn = get_node(root());
@@ -112,16 +291,67 @@ namespace orbtree {
 			
 			
 		//~ public:
-			orbtree_base() { create_sentinels(); }
+			orbtree_base() : auto_compact(0), lazy_sums(false), f(NVFunc_wrapper<NVFunc>::f) { create_sentinels(); }
 			explicit orbtree_base(const NVFunc& f_, const Compare& c_) : NVFunc_wrapper<NVFunc>(f_),
-				NodeAllocator(NVFunc_wrapper<NVFunc>::f.get_nr()), f(NVFunc_wrapper<NVFunc>::f), c(c_) { create_sentinels(); }
+				NodeAllocator(NVFunc_wrapper<NVFunc>::f.get_nr()), auto_compact(0), lazy_sums(false), f(NVFunc_wrapper<NVFunc>::f), c(c_) { create_sentinels(); }
 			explicit orbtree_base(NVFunc&& f_, const Compare& c_) : NVFunc_wrapper<NVFunc>(std::move(f_)),
-				NodeAllocator(NVFunc_wrapper<NVFunc>::f.get_nr()), f(NVFunc_wrapper<NVFunc>::f), c(c_) { create_sentinels(); }
+				NodeAllocator(NVFunc_wrapper<NVFunc>::f.get_nr()), auto_compact(0), lazy_sums(false), f(NVFunc_wrapper<NVFunc>::f), c(c_) { create_sentinels(); }
 			template<class T>
 			explicit orbtree_base(const T& t, const Compare& c_) : NVFunc_wrapper<NVFunc>(t),
-				NodeAllocator(NVFunc_wrapper<NVFunc>::f.get_nr()), f(NVFunc_wrapper<NVFunc>::f), c(c_) { create_sentinels(); }
+				NodeAllocator(NVFunc_wrapper<NVFunc>::f.get_nr()), auto_compact(0), lazy_sums(false), f(NVFunc_wrapper<NVFunc>::f), c(c_) { create_sentinels(); }
+			
+			/** \brief Copy constructor: copies the structure of the tree directly
+			 * (keys / values, links, colors and partial sums), without any
+			 * comparisons or evaluation of the weight function. */
+			orbtree_base(const orbtree_base& t) : NVFunc_wrapper<NVFunc>(t.f), NodeAllocator(t), size1(t.size1),
+				auto_compact(t.auto_compact), lazy_sums(t.lazy_sums), f(NVFunc_wrapper<NVFunc>::f), c(t.c) { }
+			/** \brief Move constructor: takes over the nodes (including the sentinels),
+			 * the weight function and the comparison object of t in constant time,
+			 * without allocating memory, so that e.g. std::vector can move trees
+			 * when reallocating. t is left without sentinels, so it can only be
+			 * destroyed, assigned to or swapped with another tree. */
+			orbtree_base(orbtree_base&& t) noexcept(std::is_nothrow_move_constructible<NVFunc>::value &&
+					std::is_nothrow_move_constructible<Compare>::value) :
+					NVFunc_wrapper<NVFunc>(std::move(t.f)), NodeAllocator(std::move(static_cast<NodeAllocator&>(t))), size1(t.size1),
+					auto_compact(t.auto_compact), lazy_sums(t.lazy_sums), f(NVFunc_wrapper<NVFunc>::f), c(std::move(t.c)) {
+				t.size1 = 0;
+			}
+			/// \brief Copy assignment, see the copy constructor.
+			orbtree_base& operator = (const orbtree_base& t) {
+				if(this != &t) {
+					orbtree_base tmp(t);
+					swap(tmp);
+				}
+				return *this;
+			}
+			/** \brief Move assignment: takes over the nodes of t in constant time,
+			 * t is left in the same state as after the move constructor. */
+			orbtree_base& operator = (orbtree_base&& t) noexcept(std::is_nothrow_move_constructible<NVFunc>::value &&
+					std::is_nothrow_move_constructible<Compare>::value) {
+				if(this != &t) {
+					orbtree_base tmp(std::move(t));
+					swap(tmp);
+				}
+				return *this;
+			}
 			
-			/* copy / move constructor -- not implemented yet */
+		public:
+			/** \brief Exchange the contents of this tree with t in constant time.
+			 * 
+			 * Weight functions and comparison objects are exchanged as well, so
+			 * both need to be swappable. Iterators are invalidated (since they
+			 * store a reference to the tree object as well). */
+			void swap(orbtree_base& t) {
+				using std::swap;
+				NodeAllocator::swap(t);
+				swap(NVFunc_wrapper<NVFunc>::f, t.NVFunc_wrapper<NVFunc>::f);
+				swap(c, t.c);
+				swap(size1, t.size1);
+				swap(auto_compact, t.auto_compact);
+				swap(lazy_sums, t.lazy_sums);
+			}
+		
+		protected:
 			
 			
 			/* interface for finding elements / inserting
@@ -190,6 +420,19 @@ namespace orbtree {
 			 * Try to insert as close to hint as possible. Note: if hint is bad, it is ignored.
 			 */
 			bool insert_search_hint(NodeHandle hint, const KeyType& k, NodeHandle& n, bool& insert_left) const;
+			/** \brief check if a node with key k can be appended after all nodes (for push_back())
+			 * 
+			 * n is set to the last node (or root, if the tree is empty); the new node
+			 * should be its right child. Throws an exception if k comes before the last
+			 * key. Returns false if k is equal to the last key in a non-multi tree. */
+			bool append_search(const KeyType& k, NodeHandle& n) const {
+				n = last();
+				if(n == nil()) { n = root(); return true; }
+				const KeyType& k1 = get_node_key(n);
+				if(c(k,k1)) throw std::runtime_error("orbtree_base::push_back(): key is before the last element!\n");
+				if(!multi) if(!c(k1,k)) return false;
+				return true;
+			}
 			/** \brief helper function to do the real work for insert 
 			 * 
 			 * insert n1 as the left / right child of n
@@ -198,7 +441,17 @@ namespace orbtree {
 			 * 
 			 * note: this function does not check for the correct relationship between the keys of n and n1,
 			 * that is the caller's responsibility */
-			void insert_helper(NodeHandle n, NodeHandle n1, bool insert_left);
+			void insert_helper(NodeHandle n, NodeHandle n1, bool insert_left) { insert_helper(n,n1,insert_left,root()); }
+			/** \brief insert n1 as the left / right child of n in the subtree below top
+			 * 
+			 * top is a sentinel node whose right child is the root of the subtree
+			 * (normally the root sentinel, root()); partial sums are updated and
+			 * the tree is rebalanced only below top. Only nodes in this subtree are
+			 * modified, so this can be used on separate subtrees in parallel (if not
+			 * in lazy mode). */
+			void insert_helper(NodeHandle n, NodeHandle n1, bool insert_left, NodeHandle top);
+			/// \brief restore red-black properties after n1 (red) was made the child of n (below top)
+			void insert_fixup(NodeHandle n, NodeHandle n1, NodeHandle top);
 			
 			/** \brief find any node with the given key
 			 * 
@@ -220,6 +473,39 @@ namespace orbtree {
 			 * 
 			 * Returns nil if not found. */
 			template<class pred> auto lower_bound_w(const pred& p) const -> NodeHandle;
+			/** \brief find the first node not less than the given key and calculate
+			 * the sum of NVFunc for all nodes before it in the same traversal
+			 * 
+			 * Returns nil if not found (in this case, res contains the sum of all weights). */
+			template<class K> auto lower_bound_sum(const K& key, NVType* res) const -> NodeHandle;
+			/** \brief weighted search using one component of the weight function
+			 * 
+			 * Find the first (in-order) node where the sum of the given component of
+			 * the weights of all nodes up to and including it is larger than value,
+			 * i.e. the node whose weight covers value. With value drawn uniformly from
+			 * [0,norm), nodes are found with probability proportional to their weight
+			 * (nodes with zero weight are never returned). Only the given component
+			 * is compared during the search. If res is not null, the sum of all weight
+			 * components for the nodes before the result is stored in it (i.e. the
+			 * same as get_sum_fv_node()).
+			 * 
+			 * Returns nil if value is not less than the sum of all weights (in this
+			 * case, res contains the sum of all weights). */
+			auto find_by_weight_fv(unsigned int component, const NVType& value, NVType* res) const -> NodeHandle;
+			/** \brief weighted search for multiple values at once
+			 * 
+			 * Values in the range [first,last) must be sorted (an exception is thrown
+			 * otherwise). For each value, out is called with the same node that
+			 * find_by_weight_fv() returns (in the same order as the values); if res is
+			 * not null, it should point to an array of size n_values * f.get_nr() that
+			 * is filled with the sums before each node. The tree is traversed only
+			 * once, visiting each node at most once. */
+			template<class ValIt, class Out>
+			void find_by_weights_fv(unsigned int component, ValIt first, ValIt last, Out out, NVType* res) const;
+			/// \brief recursive helper for \ref find_by_weights_fv() (acc is the sum of weights before the subtree of n)
+			template<class ValIt, class Out>
+			void find_by_weights_fv_r(NodeHandle n, unsigned int component, ValIt first, ValIt last,
+				Out& out, NVType* res, const NVType* acc) const;
 			
 			/// \brief convenience function to get the key of a node
 			const KeyType& get_node_key(NodeHandle n) const { return get_node(n).get_key_value().key(); }
@@ -234,8 +520,42 @@ namespace orbtree {
 			 * should not be called with nil, root or Invalid
 			 * 
 			 * note that rank function can depend on a node's value as well;
-			 * care need to be taken to update rank if a node's value changes! */
-			void get_node_grvalue(NodeHandle n, NVType* res) const { f(get_node(n).get_key_value().keyvalue(), res); }
+			 * care need to be taken to update rank if a node's value changes!
+			 * 
+			 * if the allocator stores the weight of each node, the stored value is returned */
+			void get_node_grvalue(NodeHandle n, NVType* res) const {
+				if CONSTEXPR (NodeAllocator::stores_weight) NodeAllocator::get_node_weight(n, res);
+				else {
+					ORBTREE_STAT_ADD(nvfunc_calls, 1);
+					f(get_node(n).get_key_value().keyvalue(), res);
+				}
+			}
+			/** \brief calculate the value of NVFunc for the given node and store it in the node
+			 * if the allocator stores weights; this has to be called when a node is
+			 * inserted or its value changes */
+			void update_node_grvalue(NodeHandle n, NVType* res) {
+				ORBTREE_STAT_ADD(nvfunc_calls, 1);
+				f(get_node(n).get_key_value().keyvalue(), res);
+				NodeAllocator::set_node_weight(n, res);
+			}
+			/// \brief helper for get_stats(): collect the height and depths in the subtree of n (depth is the depth of n)
+			void get_stats_r(NodeHandle n, size_t depth, size_t& height, size_t& nodes, size_t& sum_depth) const {
+				/* recursion depth is limited by the tree height */
+				nodes++;
+				sum_depth += depth;
+				if(depth > height) height = depth;
+				NodeHandle l = get_node(n).get_left();
+				NodeHandle r = get_node(n).get_right();
+				if(l != nil()) get_stats_r(l, depth + 1, height, nodes, sum_depth);
+				if(r != nil()) get_stats_r(r, depth + 1, height, nodes, sum_depth);
+			}
+			/// \brief store the weight of n if the allocator stores weights (no-op otherwise)
+			void update_node_weight(NodeHandle n) {
+				if CONSTEXPR (NodeAllocator::stores_weight) {
+					NVType tmp[ORBTREE_NV_SIZE];
+					update_node_grvalue(n, tmp);
+				}
+			}
 			
 			/// \brief get first node (or nil)
 			NodeHandle first() const;
@@ -248,6 +568,21 @@ namespace orbtree {
 			
 			/// \brief remove the given node -- return the next node (i.e. next(n) before deleting n)
 			NodeHandle erase(NodeHandle n);
+			/** \brief remove all nodes from a (inclusive) to b (exclusive) -- returns b
+			 * 
+			 * b has to be either nil or come after a in order (this is not checked).
+			 * Short ranges are erased node by node; otherwise, the tree is split at
+			 * a and b (see split_at()), the nodes between them are freed without
+			 * rebalancing and the rest is joined again, which takes O(k + log N)
+			 * time for erasing k nodes. Does not do automatic compaction. */
+			NodeHandle erase_range(NodeHandle a, NodeHandle b);
+			/** \brief remove all nodes where p(n) returns true -- returns the number of nodes removed
+			 * 
+			 * p is called for all nodes in order first. If many nodes are removed, the
+			 * tree is rebuilt from the remaining nodes in linear time (as in
+			 * assign_sorted()), otherwise nodes are erased one by one. Does not do
+			 * automatic compaction. */
+			template<class Pred> size_t erase_if_node(Pred p);
 			
 			/// \brief convenience helper to get node object that is the left child of the given node handle
 			Node& get_left(NodeHandle n) { return get_node(get_node(n).get_left()); }
@@ -276,13 +611,37 @@ namespace orbtree {
 			/// \brief update the sum only inside n
 			void update_sum(NodeHandle n);
 			/// \brief update the sum recursively up the tree
-			void update_sum_r(NodeHandle n) { for(;n != root();n = get_node(n).get_parent()) update_sum(n); }
+			void update_sum_r(NodeHandle n) {
+				if(lazy_sums) { mark_dirty(n); return; }
+				for(;n != root();n = get_node(n).get_parent()) update_sum(n);
+			}
+			/** \brief mark the partial sum of n and its ancestors outdated (in lazy mode);
+			 * stops at the first node that is already marked, since the ones above it
+			 * have to be marked already */
+			void mark_dirty(NodeHandle n) {
+				for(;n != root() && !get_node(n).is_dirty();n = get_node(n).get_parent()) get_node(n).set_dirty();
+			}
+			/// \brief recalculate outdated partial sums in the subtree of n (n has to be marked as outdated)
+			void flush_sums_r(NodeHandle n);
+			/** \brief recalculate outdated partial sums in the subtree of n using multiple threads
+			 * 
+			 * The top levels of outdated nodes are expanded until there are enough
+			 * separate subtrees, these are processed in parallel by flush_sums_r(),
+			 * and then the top levels are updated in the calling thread. If all is
+			 * true, all nodes are processed (using recompute_sums_r()), not only
+			 * the ones marked as outdated. */
+			void flush_sums_parallel(NodeHandle n, unsigned int nthreads, bool all = false);
+			/// \brief recalculate the weight of all nodes and all partial sums in the subtree of n
+			void recompute_sums_r(NodeHandle n);
+			/// \brief make sure that partial sums are up-to-date before using them in a query
+			void flush_sums_lazy() const { if(lazy_sums) const_cast<orbtree_base*>(this)->flush_sums(); }
 			
 			/** \brief update value in a node -- only if this is a map;
 			 * update sum recursively based on it as well */
 			template<class KeyValue_ = KeyValue>
 			void update_value(NodeHandle n, typename KeyValue_::MappedType const& v) {
 				get_node(n).get_key_value().value() = v;
+				update_node_weight(n);
 				update_sum_r(n);
 			}
 			/** \brief update value in a node -- only if this is a map;
@@ -290,6 +649,7 @@ namespace orbtree {
 			template<class KeyValue_ = KeyValue>
 			void update_value(NodeHandle n, typename KeyValue_::MappedType&& v) {
 				get_node(n).get_key_value().value() = std::move(v);
+				update_node_weight(n);
 				update_sum_r(n);
 			}
 			
@@ -309,18 +669,296 @@ namespace orbtree {
 			void rotate_parent(NodeHandle x);
 			
 		public:
+			/** \brief Incrementally give back storage used by deleted nodes.
+			 * 
+			 * Only has an effect if nodes are stored in flat arrays (i.e. with
+			 * NodeAllocatorCompact), where memory of deleted nodes is not freed
+			 * immediately. Up to budget nodes are removed from the end of storage
+			 * (moving them in the place of deleted nodes if needed), so the amount
+			 * of work done is bounded. Note that this invalidates all iterators.
+			 * 
+			 * Returns the number of deleted nodes that still take up space. */
+			size_t compact_step(size_t budget) { return NodeAllocator::compact_step(budget); }
+			/** \brief Set up automatic compaction: perform compact_step(budget)
+			 * after each erase (zero turns off automatic compaction, this is the default).
+			 * 
+			 * If automatic compaction is used, erasing an element invalidates all
+			 * iterators, except the one returned by erase(). */
+			void set_auto_compact(size_t budget) { auto_compact = budget; }
+			/** \brief Get the number of compaction steps performed after each erase. */
+			size_t get_auto_compact() const { return auto_compact; }
+			/** \brief Get the number of deleted nodes whose storage has not been given back yet. */
+			size_t deleted_nodes() const { return NodeAllocator::deleted_nodes(); }
+			/** \brief Turn lazy update of partial sums on or off.
+			 * 
+			 * In lazy mode, inserting or erasing elements and changing values does
+			 * not update the partial sums stored in the tree, only marks them as
+			 * outdated. They are recalculated (visiting each outdated node once) by
+			 * the next query that needs them or by calling flush_sums(). This can
+			 * make a series of modifications without queries in between
+			 * significantly faster. Note that in lazy mode, queries can modify the
+			 * tree, so it is not safe to perform them from multiple threads in
+			 * parallel, unless flush_sums() is called first. Turning off lazy mode
+			 * recalculates all outdated sums. */
+			void set_lazy_sums(bool lazy) {
+				if(lazy_sums && !lazy) flush_sums();
+				lazy_sums = lazy;
+			}
+			/** \brief Check if lazy update of partial sums is used. */
+			bool get_lazy_sums() const { return lazy_sums; }
+			/** \brief Recalculate all outdated partial sums (only has an effect in lazy mode).
+			 * 
+			 * If nthreads > 1, separate subtrees are processed by up to nthreads
+			 * threads in parallel (NVFunc is called from all of them, so it should
+			 * be thread-safe); this is useful after a large number of modifications. */
+			void flush_sums(unsigned int nthreads = 1) {
+				if(root() == Invalid) return;
+				NodeHandle n = get_node(root()).get_right();
+				if(n == Invalid || n == nil() || !get_node(n).is_dirty()) return;
+				if(nthreads > 1) flush_sums_parallel(n,nthreads);
+				else flush_sums_r(n);
+			}
+			
+			/** \brief Recalculate the weight of all nodes and all partial sums.
+			 * 
+			 * This is needed if the weights of elements changed without the tree
+			 * knowing about it (e.g. the parameters of NVFunc changed, see
+			 * set_nvfunc()). All nodes are visited once in post-order, without
+			 * comparing keys or changing the structure of the tree, so it takes
+			 * O(N) time. If nthreads > 1, separate subtrees are processed in
+			 * parallel, in the same way as in flush_sums(). If an exception is
+			 * thrown (e.g. because of overflow), partial sums are inconsistent
+			 * until this function completes successfully. */
+			void recompute_weights(unsigned int nthreads = 1) {
+				if(root() == Invalid) return;
+				NodeHandle n = get_node(root()).get_right();
+				if(n == Invalid || n == nil()) return;
+				if(nthreads > 1) flush_sums_parallel(n,nthreads,true);
+				else recompute_sums_r(n);
+			}
+			/** \brief Replace the weight function and recalculate all partial sums.
+			 * 
+			 * This can be used to change the parameters of the weight function
+			 * (e.g. the exponents used with NVFunc_Adapter_Vec<NVPower>) without
+			 * building a new tree. The new function has to return the same number
+			 * of components as the current one; otherwise an exception is thrown
+			 * and the tree is not changed. Calls recompute_weights(nthreads). */
+			void set_nvfunc(const NVFunc& f_, unsigned int nthreads = 1) { set_nvfunc(NVFunc(f_),nthreads); }
+			/// \copydoc set_nvfunc(const NVFunc& f_, unsigned int nthreads)
+			void set_nvfunc(NVFunc&& f_, unsigned int nthreads = 1) {
+				if(f_.get_nr() != get_nr()) throw std::runtime_error("orbtree_base::set_nvfunc(): number of components differ!\n");
+				NVFunc_wrapper<NVFunc>::f = std::move(f_);
+				recompute_weights(nthreads);
+			}
+			/** \brief Replace the weight function with one constructed from t (e.g. the
+			 * vector of parameters for NVFunc_Adapter_Vec) and recalculate all partial sums. */
+			template<class T> void set_nvfunc(const T& t, unsigned int nthreads = 1) { set_nvfunc(NVFunc(t),nthreads); }
+			/// \brief Access the weight function used by the tree.
+			const NVFunc& get_nvfunc() const { return f; }
+			/// \brief Get a copy of the comparison functor used by the tree.
+			Compare key_comp() const { return c; }
+			
+			/** \brief Reorganize node storage so that searches access memory more efficiently.
+			 * 
+			 * Only has an effect if nodes are stored in flat arrays (i.e. with
+			 * NodeAllocatorCompact): nodes and partial sums are renumbered in the
+			 * van Emde Boas order of the tree, so that nodes close to each other
+			 * in the tree are also stored close to each other. This is useful for
+			 * trees that are built once and then queried many times. It takes
+			 * O(N log log N) time and invalidates all iterators. */
+			void relayout() { NodeAllocator::relayout(); }
+			/** \brief Get the fraction of node storage taken up by deleted nodes. */
+			double fragmentation() const {
+				size_t d = deleted_nodes();
+				return d ? ((double)d) / ((double)(d + size1)) : 0.0;
+			}
+			/** \brief Get statistics about the structure and memory use of the tree,
+			 * and the number of operations performed (if ORBTREE_STATS is defined).
+			 * 
+			 * Calculating the height and average depth visits each node once, so
+			 * this takes O(N) time. Should not be called while the tree is modified
+			 * by other threads. See \ref tree_stats for the description of the results. */
+			tree_stats get_stats() const {
+				tree_stats s;
+				s.size = size1;
+				s.deleted_nodes = deleted_nodes();
+				s.node_capacity = capacity();
+				NodeAllocator::get_storage_bytes(s.node_bytes, s.nv_bytes);
+				NodeHandle n = nil();
+				if(root() != Invalid) {
+					n = get_node(root()).get_right();
+					if(n == Invalid) n = nil();
+				}
+				if(n != nil()) {
+					size_t nodes = 0;
+					size_t sum_depth = 0;
+					get_stats_r(n, 1, s.height, nodes, sum_depth);
+					s.avg_depth = ((double)sum_depth) / ((double)nodes);
+					for(;n != nil();n = get_node(n).get_left()) if(get_node(n).is_black()) s.black_height++;
+				}
+#ifdef ORBTREE_STATS
+				stat_counters.get(s);
+#endif
+				return s;
+			}
+			/** \brief Reset the counters of operations returned by get_stats() to zero
+			 * (no-op if ORBTREE_STATS is not defined). */
+			void reset_stats() {
+#ifdef ORBTREE_STATS
+				stat_counters.reset();
+#endif
+			}
+			/** \brief Reserve storage for at least n elements in total.
+			 * 
+			 * Useful if the number of elements to insert is known in advance, to avoid
+			 * repeatedly growing storage. With flat arrays (NodeAllocatorCompact), this
+			 * grows the node and partial sum arrays in one step; with pool allocation,
+			 * a slab that is large enough is allocated; otherwise it has no effect. */
+			void reserve(size_t n) { if(n > size1) NodeAllocator::reserve(n - size1); }
+			/** \brief Get the number of elements that can be stored without allocating
+			 * more memory for nodes (with pointer-based storage without pool allocation,
+			 * this is always the current size). */
+			size_t capacity() const { return size1 + NodeAllocator::free_capacity(); }
+			/** \brief Give back unused memory.
+			 * 
+			 * With flat arrays (NodeAllocatorCompact), all storage used by deleted nodes
+			 * is removed (which invalidates all iterators) and the arrays are shrunk to
+			 * the current size. With pointer-based storage, memory of deleted nodes is
+			 * already freed (or kept for reuse with pool allocation), so this has no effect. */
+			void shrink_to_fit() { NodeAllocator::shrink_to_fit(); }
+			
 			/// \brief erase all nodes
 			void clear() {
 				NodeAllocator::clear_tree(); /* free up all nodes (except root and nil sentinels) */
 				create_sentinels(); /* reset sentinels */
 			}
-			
+
+			/** \brief Save the tree to a file that can be opened later with \ref open_mapped().
+			 *
+			 * Only supported if nodes are stored in flat arrays (i.e. with
+			 * NodeAllocatorCompact) and keys and values are trivially copyable.
+			 * The arrays are written as they are stored in memory (along with a
+			 * small header), so the file can only be opened on the same platform
+			 * with the same type of tree. */
+			void save(const char* fn) const {
+				flush_sums_lazy();
+				NodeAllocator::save_image(fn, size1);
+			}
+			/** \brief Replace the contents of the tree with one saved by \ref save(),
+			 * by mapping the file into memory.
+			 *
+			 * The tree is not read or built, so queries can be run right away, with
+			 * pages of the file loaded on demand. The tree can be modified after this,
+			 * but changes are not written back to the file (pages are copied on write,
+			 * and the whole storage is copied to memory if it needs to be grown).
+			 * The weight function should be the same as the one used for the saved
+			 * tree (only the number of components is checked). Throws an exception if
+			 * the file cannot be opened or stores a different type of tree; in this
+			 * case, the tree is not changed. Invalidates all iterators. */
+			void open_mapped(const char* fn) { size1 = NodeAllocator::open_image(fn); }
+
+			/** \brief Replace the contents of the tree with the elements
+			 * in the range [first,last), which must be sorted according to
+			 * the comparison functor.
+			 *
+			 * Nodes are linked into a balanced tree directly and partial
+			 * sums are calculated in one bottom-up pass, so this takes
+			 * O(N) time (with N evaluations of NVFunc) instead of the
+			 * O(N log N) needed when inserting elements one by one.
+			 *
+			 * For a non-multi tree, only the first of any elements with
+			 * equal keys is kept. Throws an exception if the input is not
+			 * sorted; in this case, the tree is left empty. */
+			template<class InputIt> void assign_sorted(InputIt first, InputIt last);
+			/** \brief Insert all elements in the range [first,last), which must
+			 * be sorted according to the comparison functor, in parallel.
+			 *
+			 * The tree is split into pieces by keys chosen evenly from the
+			 * input, each piece receives the corresponding part of the input
+			 * (inserted by a separate thread), and the pieces are joined again
+			 * in the end. Splitting and joining takes O(nthreads log N) time,
+			 * so this is useful for large batches (small batches, or nthreads <= 1
+			 * result in inserting elements one by one in the calling thread).
+			 * nthreads == 0 means to use std::thread::hardware_concurrency().
+			 *
+			 * The comparison functor and NVFunc are called from multiple threads,
+			 * so these should be thread-safe (NVFunc is only called through const
+			 * member functions). Lazy update of partial sums is not used while
+			 * inserting, but stays enabled after. For a non-multi tree, elements
+			 * whose key is already present (or is repeated in the input) are not
+			 * inserted. Returns the number of elements inserted.
+			 *
+			 * Throws an exception if the input is not sorted; in this case, the
+			 * tree is not modified. Invalidates all iterators. */
+			template<class InputIt> size_t insert_batch(InputIt first, InputIt last, unsigned int nthreads = 0);
+			/** \brief Append a new element after all existing elements.
+			 * 
+			 * The key of kv must not come before the key of the last element (an
+			 * exception is thrown otherwise and the tree is not modified). The tree
+			 * is not searched, the new node is attached at the end of the right
+			 * spine, and is compared only with the last node. For a non-multi tree,
+			 * nothing is inserted if the key is equal to the last key; in this case,
+			 * the last node and false is returned. */
+			std::pair<NodeHandle,bool> push_back(const ValueType& kv);
+			/// \copydoc push_back(const ValueType& kv)
+			std::pair<NodeHandle,bool> push_back(ValueType&& kv);
+			/** \brief Append all elements in the range [first,last) after all
+			 * existing elements.
+			 * 
+			 * The range must be sorted according to the comparison functor and
+			 * its first key must not come before the last key in the tree. The
+			 * new nodes are linked into a balanced subtree in one pass (as in
+			 * assign_sorted()), which is then joined with the existing tree, so
+			 * this takes O(k + log N) time for k new elements, i.e. amortized
+			 * O(1) per element for large batches. For a non-multi tree, elements
+			 * with keys already present (or repeated in the input) are not
+			 * inserted. Returns the number of elements inserted.
+			 * 
+			 * Throws an exception if the input is not sorted or comes before the
+			 * last element; in this case, the tree is not modified. */
+			template<class InputIt> size_t append_sorted(InputIt first, InputIt last);
+
 			/** \brief get the generalized rank for a key, i.e. the sum of NVFunc for all nodes with node.key < k */
 			template<class K> void get_sum_fv(const K& k, NVType* res) const;
+			/** \brief get the generalized rank for multiple keys at once
+			 * 
+			 * Keys in the range [first,last) must be sorted according to
+			 * the comparison functor (an exception is thrown otherwise).
+			 * For each key, the result (same as get_sum_fv()) is stored
+			 * in the corresponding row of res, which should be an array
+			 * of size n_keys * f.get_nr().
+			 * 
+			 * The tree is traversed only once, visiting each node at most
+			 * once, so the top levels of the descent are shared among
+			 * all keys. */
+			template<class KeyIt> void get_sums_fv(KeyIt first, KeyIt last, NVType* res) const;
 			/** \brief get the generalized rank for a given node, i.e. the sum of NVFunv for all nodes before it in order */
 			void get_sum_fv_node(NodeHandle x, NVType* res) const;
 			/** \brief get the normalization factor, i.e. the sum of all keys */
 			void get_norm_fv(NVType* res) const;
+			/** \brief get the sum of NVFunc for all nodes with lo <= node.key < hi
+			 * 
+			 * Gives the same result as subtracting get_sum_fv(lo) from get_sum_fv(hi),
+			 * but the tree is descended only once, to the highest node in the range,
+			 * and from there only weights inside the range are added (so there is no
+			 * loss of precision due to subtracting large sums). The result is zero if
+			 * hi is not after lo. */
+			template<class K1, class K2> void get_range_sum_fv(const K1& lo, const K2& hi, NVType* res) const;
+			/** \brief get the sum of NVFunc for nodes from a (inclusive) to b (exclusive)
+			 * 
+			 * b has to be either nil (end of the tree) or come after a in order
+			 * (this is not checked). Only the nodes on the paths from a and b up
+			 * to their lowest common ancestor are visited. */
+			void get_range_sum_fv_node(NodeHandle a, NodeHandle b, NVType* res) const;
+			/** \brief get the sum of NVFunc for nodes in a range of weights
+			 * 
+			 * Includes nodes from find_by_weight_fv(component,lo) (inclusive) to
+			 * find_by_weight_fv(component,hi) (exclusive), i.e. nodes where the sum of
+			 * the given component up to and including the node is in (lo,hi]. If that
+			 * component is the rank (i.e. all nodes have weight one), this is the nodes
+			 * with rank in [lo,hi). The tree is descended only once, similarly to
+			 * get_range_sum_fv(). */
+			void get_range_sum_w_fv(unsigned int component, const NVType& lo, const NVType& hi, NVType* res) const;
 			
 			/** \brief check that the tree is valid
 			 * 
@@ -330,8 +968,98 @@ namespace orbtree {
 			 * (epsilon is the tolerance for rounding errors if NVType is not integral) */
 			void check_tree(double epsilon = -1.0) const;
 		protected:
+			/** \brief compaction keeping track of one node
+			 * (the handle in track is updated if that node is moved) */
+			size_t compact_step(size_t budget, NodeHandle& track) { return NodeAllocator::compact_step(budget,&track); }
+			/// \brief add the weight of n and the sum of the subtree of s to res (either can be nil)
+			void add_node_subtree(NodeHandle n, NodeHandle s, NVType* res) const {
+				NVType tmp[ORBTREE_NV_SIZE];
+				if(n != nil()) {
+					get_node_grvalue(n,tmp);
+					NVAdd(res,tmp);
+				}
+				if(s != nil()) {
+					this->get_node_sum(s,tmp);
+					NVAdd(res,tmp);
+				}
+			}
 			/// \brief recursive helper for \ref check_tree(double)
 			void check_tree_r(double epsilon, NodeHandle x, size_t black_count, size_t& previous_black_count) const;
+			/// \brief helper for check_tree(): throw an exception with the given message if x and y differ
+			void check_nv_equal(double epsilon, const NVType* x, const NVType* y, const char* msg) const {
+				/* if NVType is integral, we want exact match -- otherwise, we use epsilon for comparison */
+				if(std::is_integral<NVType>::value) { for(unsigned int i=0;i<get_nr();i++) if(x[i] != y[i]) throw std::runtime_error(msg); }
+				else for(unsigned int i=0;i<get_nr();i++) if(fabs(x[i]-y[i]) > epsilon) throw std::runtime_error(msg);
+			}
+			/** \brief recursive helper for \ref get_sums_fv()
+			 * 
+			 * Calculate sums for keys in [first,last) that are all in the
+			 * subtree of n; acc is the sum of weights before this subtree. */
+			template<class KeyIt> void get_sums_fv_r(NodeHandle n, KeyIt first, KeyIt last,
+				NVType* res, const NVType* acc) const;
+			/** \brief recursive helper for \ref assign_sorted()
+			 *
+			 * Build a balanced subtree from the next n nodes of a list linked
+			 * by the right pointers (starting at head, which is advanced).
+			 * Nodes at depth red_depth are colored red, all others black.
+			 * Returns the root of the new subtree. */
+			NodeHandle build_sorted_r(NodeHandle& head, size_t n, unsigned int depth, unsigned int red_depth);
+			/** \brief link n nodes from a list connected by the right pointers (starting
+			 * at head, the sorted order) into a balanced tree below the root sentinel
+			 * (which should have no nodes below it yet); sets size1 as well */
+			void build_sorted(NodeHandle head, size_t n);
+			
+			/// \brief number of black nodes on a path from n to nil (including n, not including nil)
+			unsigned int black_height(NodeHandle n) const {
+				unsigned int h = 0;
+				for(;n != nil();n = get_node(n).get_left()) if(get_node(n).is_black()) h++;
+				return h;
+			}
+			/** \brief join two valid red-black subtrees with a pivot node
+			 * 
+			 * l and r are not part of the tree (or part of any other subtree of
+			 * the tree), all keys in l have to be before the key of k and all keys
+			 * in r after it (this is not checked); hl and hr are the black height of
+			 * l and r (see black_height()). Returns the root of the new subtree
+			 * and stores its black height in h. Takes O(|hl - hr| + 1) time.
+			 * 
+			 * The root sentinel is used as temporary storage, so the tree has
+			 * to be taken apart already when calling this. */
+			NodeHandle join(NodeHandle l, unsigned int hl, NodeHandle k, NodeHandle r, unsigned int hr, unsigned int& h);
+			/** \brief split the subtree of t (with black height ht) by key k
+			 * 
+			 * Nodes in t are distributed into two valid red-black subtrees: l
+			 * (with black height hl) has all keys before k and r (with black
+			 * height hr) has all keys after it. In a multi tree, keys equal to k go
+			 * to l; in a non-multi tree, the node with key equal to k (if any) is
+			 * returned in match (which is not modified otherwise). Uses join(),
+			 * takes O(log N) time. */
+			void split(NodeHandle t, unsigned int ht, const KeyType& k, NodeHandle& l,
+				unsigned int& hl, NodeHandle& r, unsigned int& hr, NodeHandle& match);
+			/** \brief split the tree below the root sentinel at node x
+			 * 
+			 * l gets all nodes before x, r all nodes after it (with black heights hl
+			 * and hr); x is not part of either. The ancestors of x are joined to
+			 * either side going up from x, this takes O(log N) time. */
+			void split_at(NodeHandle x, NodeHandle& l, unsigned int& hl, NodeHandle& r, unsigned int& hr);
+			/// \brief free all nodes in the subtree of n -- returns the number of nodes freed
+			size_t free_subtree(NodeHandle n) {
+				/* recursion depth is the height of the subtree */
+				if(n == nil()) return 0;
+				NodeHandle l = get_node(n).get_left();
+				NodeHandle r = get_node(n).get_right();
+				size_t res = free_subtree(l) + free_subtree(r);
+				this->free_node(n);
+				return res + 1;
+			}
+			/** \brief helper for \ref insert_batch(): insert nodes in [first,last)
+			 * into the subtree below the sentinel top
+			 * 
+			 * Nodes that are inserted are replaced by nil in the input; the
+			 * others (duplicates in a non-multi tree) are left there. Returns the
+			 * number of nodes inserted. Only nodes in the subtree and the
+			 * input are modified, so this can run in parallel for separate subtrees. */
+			size_t insert_nodes(NodeHandle top, NodeHandle* first, NodeHandle* last);
 	};
 	
 	
@@ -385,11 +1113,11 @@ namespace orbtree {
 			if(c(key,k1)) {
 				/* key < k1, potential candidate */
 				last = n;
-				n = get_node(n).left;
+				n = get_node(n).get_left();
 			}
 			else {
 				/* key >= k1, has to go right */
-				n = get_node(n).right;
+				n = get_node(n).get_right();
 			}
 			if(n == nil()) return last; /* end of search */
 		}
@@ -397,17 +1125,20 @@ namespace orbtree {
 	
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class pred>
 	auto orbtree_base<NodeAllocator,Compare,NVFunc,multi>::lower_bound_w(const pred& p) const -> NodeHandle {
+		flush_sums_lazy();
 		if(root() == Invalid) return nil();
 		NodeHandle n = get_node(root()).get_right();
 		if(n == Invalid || n == nil()) return nil();
 		NodeHandle last = nil(); /* guess of the result node */
-		NVType parent[f.get_nr()];
-		NVType left[f.get_nr()];
-		NVType current[f.get_nr()];
-		for(unsigned int i=0; i < f.get_nr(); i++) parent[i] = NVType();
+		NVType parent[ORBTREE_NV_SIZE];
+		NVType left[ORBTREE_NV_SIZE];
+		NVType current[ORBTREE_NV_SIZE];
+		for(unsigned int i=0; i < get_nr(); i++) parent[i] = NVType();
+		ORBTREE_STAT_ADD(lower_bound_w_calls, 1);
 		
 		do {
-			for(unsigned int i=0; i < f.get_nr(); i++) current[i] = NVType();
+			ORBTREE_STAT_ADD(lower_bound_w_nodes, 1);
+			for(unsigned int i=0; i < get_nr(); i++) current[i] = NVType();
 			NVAdd(current, parent);
 			NodeHandle l = get_node(n).get_left();
 			if(l != nil()) {
@@ -436,14 +1167,17 @@ namespace orbtree {
 
 
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class K>
-	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::get_sum_fv(const K& k, NVType* res) const {
-		for(unsigned int i=0; i < f.get_nr(); i++) res[i] = NVType();
-		NVType tmp[f.get_nr()];
-		if(root() == Invalid) return;
-		//~ const Node& r = get_node(root());
+	auto orbtree_base<NodeAllocator,Compare,NVFunc,multi>::lower_bound_sum(const K& k, NVType* res) const -> NodeHandle {
+		flush_sums_lazy();
+		for(unsigned int i=0; i < get_nr(); i++) res[i] = NVType();
+		NVType tmp[ORBTREE_NV_SIZE];
+		ORBTREE_STAT_ADD(get_sum_calls, 1);
+		if(root() == Invalid) return nil();
 		NodeHandle n = get_node(root()).get_right();
-		if(n == Invalid || n == nil()) return;
-		while(true) { /* recursive search starting from the root to find all nodes with key < k */
+		if(n == Invalid || n == nil()) return nil();
+		NodeHandle last = nil(); /* guess of the result node */
+		while(true) { /* search starting from the root to find all nodes with key < k */
+			ORBTREE_STAT_ADD(get_sum_nodes, 1);
 			const KeyType& k1 = get_node_key(n);
 			if(c(k1,k)) {
 				/* k1 < key, we have to add the sum from the left subtree + n and continue to the right */ 
@@ -459,17 +1193,165 @@ namespace orbtree {
 				if(n == nil()) break;
 			}
 			else {
-				/* k1 >= key, we have to continue toward the left */
+				/* k1 >= key, potential candidate, we have to continue toward the left */
+				last = n;
 				n = get_node(n).get_left();
 				if(n == nil()) break;
 			}
 		}
+		return last;
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	auto orbtree_base<NodeAllocator,Compare,NVFunc,multi>::find_by_weight_fv(unsigned int component,
+			const NVType& value, NVType* res) const -> NodeHandle {
+		if(component >= get_nr()) throw std::runtime_error("orbtree_base::find_by_weight_fv(): invalid component!\n");
+		flush_sums_lazy();
+		if(res) for(unsigned int i=0; i < get_nr(); i++) res[i] = NVType();
+		if(root() == Invalid) return nil();
+		NodeHandle n = get_node(root()).get_right();
+		if(n == Invalid) return nil();
+		NVType acc = NVType(); /* sum of the searched component for nodes before the subtree of n */
+		NVType tmp[ORBTREE_NV_SIZE];
+		while(n != nil()) {
+			NodeHandle l = get_node(n).get_left();
+			NVType left = NVType();
+			if(l != nil()) left = this->get_node_sum_component(l, component);
+			if(value < acc + left) {
+				/* result is in the left subtree */
+				n = l;
+				continue;
+			}
+			if(res && l != nil()) {
+				this->get_node_sum(l, tmp);
+				NVAdd(res, tmp);
+			}
+			get_node_grvalue(n, tmp);
+			acc += left + tmp[component];
+			if(value < acc) return n;
+			/* continue in the right subtree */
+			if(res) NVAdd(res, tmp);
+			n = get_node(n).get_right();
+		}
+		return nil();
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class ValIt, class Out>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::find_by_weights_fv(unsigned int component,
+			ValIt first, ValIt last, Out out, NVType* res) const {
+		if(component >= get_nr()) throw std::runtime_error("orbtree_base::find_by_weights_fv(): invalid component!\n");
+		if(!std::is_sorted(first,last)) throw std::runtime_error("orbtree_base::find_by_weights_fv(): values are not sorted!\n");
+		flush_sums_lazy();
+		NVType acc[ORBTREE_NV_SIZE];
+		for(unsigned int i=0; i < get_nr(); i++) acc[i] = NVType();
+		NodeHandle n = nil();
+		if(root() != Invalid) {
+			n = get_node(root()).get_right();
+			if(n == Invalid) n = nil();
+		}
+		find_by_weights_fv_r(n,component,first,last,out,res,acc);
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class ValIt, class Out>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::find_by_weights_fv_r(NodeHandle n, unsigned int component,
+			ValIt first, ValIt last, Out& out, NVType* res, const NVType* acc) const {
+		/* recursion depth is limited by the tree height */
+		typedef typename std::iterator_traits<ValIt>::value_type V;
+		unsigned int nr = get_nr();
+		if(n == nil()) {
+			/* all remaining values are after the last node */
+			for(;first != last;++first) {
+				out(n);
+				if(res) { for(unsigned int i=0;i<nr;i++) res[i] = acc[i]; res += nr; }
+			}
+			return;
+		}
+		NodeHandle l = get_node(n).get_left();
+		NVType left = acc[component];
+		if(l != nil()) left += this->get_node_sum_component(l, component);
+		/* values less than the sum before n are found in the left subtree */
+		ValIt mid = std::partition_point(first,last,[&left](const V& v) { return v < left; });
+		if(first != mid) {
+			find_by_weights_fv_r(l,component,first,mid,out,res,acc);
+			if(res) res += std::distance(first,mid)*nr;
+		}
+		if(mid == last) return;
+		NVType acc2[ORBTREE_NV_SIZE];
+		NVType tmp[ORBTREE_NV_SIZE];
+		for(unsigned int i=0;i<nr;i++) acc2[i] = acc[i];
+		if(l != nil()) {
+			this->get_node_sum(l,tmp);
+			NVAdd(acc2,tmp);
+		}
+		get_node_grvalue(n,tmp);
+		/* values less than the sum including n are found here */
+		NVType right = left + tmp[component];
+		for(;mid != last && *mid < right;++mid) {
+			out(n);
+			if(res) { for(unsigned int i=0;i<nr;i++) res[i] = acc2[i]; res += nr; }
+		}
+		if(mid == last) return;
+		NVAdd(acc2,tmp);
+		find_by_weights_fv_r(get_node(n).get_right(),component,mid,last,out,res,acc2);
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class K>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::get_sum_fv(const K& k, NVType* res) const {
+		lower_bound_sum(k,res);
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class KeyIt>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::get_sums_fv(KeyIt first, KeyIt last, NVType* res) const {
+		typedef typename std::iterator_traits<KeyIt>::value_type K;
+		if(!std::is_sorted(first,last,[this](const K& x, const K& y) { return c(x,y); }))
+			throw std::runtime_error("orbtree_base::get_sums_fv(): keys are not sorted!\n");
+		flush_sums_lazy();
+		NVType acc[ORBTREE_NV_SIZE];
+		for(unsigned int i=0; i < get_nr(); i++) acc[i] = NVType();
+		NodeHandle n = nil();
+		if(root() != Invalid) {
+			n = get_node(root()).get_right();
+			if(n == Invalid) n = nil();
+		}
+		get_sums_fv_r(n,first,last,res,acc);
+	}
 	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class KeyIt>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::get_sums_fv_r(NodeHandle n, KeyIt first, KeyIt last,
+			NVType* res, const NVType* acc) const {
+		/* recursion depth is limited by the tree height */
+		unsigned int nr = get_nr();
+		if(n == nil()) {
+			/* all remaining keys are between the same two nodes */
+			for(;first != last;++first, res += nr)
+				for(unsigned int i=0;i<nr;i++) res[i] = acc[i];
+			return;
+		}
+		const KeyType& k1 = get_node_key(n);
+		/* keys with key <= k1 go to the left subtree, others to the right */
+		typedef typename std::iterator_traits<KeyIt>::value_type K;
+		KeyIt mid = std::partition_point(first,last,[this,&k1](const K& k) { return !c(k1,k); });
+		NodeHandle l = get_node(n).get_left();
+		if(first != mid) get_sums_fv_r(l,first,mid,res,acc);
+		if(mid != last) {
+			NVType acc2[ORBTREE_NV_SIZE];
+			NVType tmp[ORBTREE_NV_SIZE];
+			for(unsigned int i=0;i<nr;i++) acc2[i] = acc[i];
+			if(l != nil()) {
+				this->get_node_sum(l,tmp);
+				NVAdd(acc2,tmp);
+			}
+			get_node_grvalue(n,tmp);
+			NVAdd(acc2,tmp);
+			get_sums_fv_r(get_node(n).get_right(),mid,last,res + std::distance(first,mid)*nr,acc2);
+		}
 	}
+	
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
 	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::get_sum_fv_node(NodeHandle x, NVType* res) const {
-		for(unsigned int i=0; i < f.get_nr(); i++) res[i] = NVType();
-		NVType tmp[f.get_nr()];
+		flush_sums_lazy();
+		for(unsigned int i=0; i < get_nr(); i++) res[i] = NVType();
+		NVType tmp[ORBTREE_NV_SIZE];
 		if(x == this->Invalid || x == nil() || x == root()) return;
 		/* 1. add sum from x's left to the sum
 		 * 2. go up one level
@@ -501,6 +1383,7 @@ namespace orbtree {
 	
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
 	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::get_norm_fv(NVType* res) const {
+		flush_sums_lazy();
 		if(root() != Invalid) {
 			NodeHandle n = get_node(root()).get_right();
 			if(n != Invalid && n != nil()) {
@@ -508,7 +1391,147 @@ namespace orbtree {
 				return;
 			}
 		}
-		for(unsigned int i=0; i < f.get_nr(); i++) res[i] = NVType(); /* return all zeroes for an empty tree */
+		for(unsigned int i=0; i < get_nr(); i++) res[i] = NVType(); /* return all zeroes for an empty tree */
+	}
+	
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class K1, class K2>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::get_range_sum_fv(const K1& lo, const K2& hi, NVType* res) const {
+		flush_sums_lazy();
+		for(unsigned int i=0; i < get_nr(); i++) res[i] = NVType();
+		if(root() == Invalid) return;
+		NodeHandle x = get_node(root()).get_right();
+		if(x == Invalid) return;
+		/* 1. find the highest node in the range, all others are in its subtree */
+		while(x != nil()) {
+			const KeyType& k1 = get_node_key(x);
+			if(c(k1,lo)) x = get_node(x).get_right();
+			else if(!c(k1,hi)) x = get_node(x).get_left();
+			else break;
+		}
+		if(x == nil()) return; /* empty range */
+		add_node_subtree(x,nil(),res);
+		/* 2. nodes in the left subtree not before lo: if a node is included,
+		 * its right subtree is included as well */
+		for(NodeHandle y = get_node(x).get_left(); y != nil();) {
+			if(c(get_node_key(y),lo)) y = get_node(y).get_right();
+			else {
+				add_node_subtree(y,get_node(y).get_right(),res);
+				y = get_node(y).get_left();
+			}
+		}
+		/* 3. nodes in the right subtree before hi, similarly */
+		for(NodeHandle y = get_node(x).get_right(); y != nil();) {
+			if(c(get_node_key(y),hi)) {
+				add_node_subtree(y,get_node(y).get_left(),res);
+				y = get_node(y).get_right();
+			}
+			else y = get_node(y).get_left();
+		}
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::get_range_sum_fv_node(NodeHandle a, NodeHandle b, NVType* res) const {
+		flush_sums_lazy();
+		for(unsigned int i=0; i < get_nr(); i++) res[i] = NVType();
+		if(a == Invalid || a == nil() || a == root() || a == b) return;
+		if(b == Invalid || b == root()) b = nil();
+		
+		/* 1. find the lowest common ancestor (the root sentinel if b is the end) */
+		NodeHandle x = root();
+		if(b != nil()) {
+			size_t da = 0, db = 0;
+			for(NodeHandle n = a; n != root(); n = get_node(n).get_parent()) da++;
+			for(NodeHandle n = b; n != root(); n = get_node(n).get_parent()) db++;
+			x = a;
+			NodeHandle y = b;
+			for(;da > db;da--) x = get_node(x).get_parent();
+			for(;db > da;db--) y = get_node(y).get_parent();
+			while(x != y) {
+				x = get_node(x).get_parent();
+				y = get_node(y).get_parent();
+			}
+		}
+		
+		/* 2. a and nodes after it below x: ancestors reached from their left side
+		 * and their right subtrees */
+		if(a != x) {
+			add_node_subtree(a,get_node(a).get_right(),res);
+			for(NodeHandle n = a, p = get_node(a).get_parent(); p != x; n = p, p = get_node(p).get_parent())
+				if(n == get_node(p).get_left()) add_node_subtree(p,get_node(p).get_right(),res);
+		}
+		if(x != root() && x != b) add_node_subtree(x,nil(),res); /* x is either a or between a and b */
+		
+		/* 3. nodes before b below x: ancestors reached from their right side
+		 * and their left subtrees */
+		if(b != nil() && b != x) {
+			add_node_subtree(nil(),get_node(b).get_left(),res);
+			for(NodeHandle n = b, p = get_node(b).get_parent(); p != x; n = p, p = get_node(p).get_parent())
+				if(n == get_node(p).get_right()) add_node_subtree(p,get_node(p).get_left(),res);
+		}
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::get_range_sum_w_fv(unsigned int component,
+			const NVType& lo, const NVType& hi, NVType* res) const {
+		if(component >= get_nr()) throw std::runtime_error("orbtree_base::get_range_sum_w_fv(): invalid component!\n");
+		flush_sums_lazy();
+		for(unsigned int i=0; i < get_nr(); i++) res[i] = NVType();
+		if(root() == Invalid) return;
+		NodeHandle x = get_node(root()).get_right();
+		if(x == Invalid) return;
+		NVType tmp[ORBTREE_NV_SIZE];
+		NVType acc = NVType(); /* sum of the component for nodes before the subtree of x */
+		NVType end_x = NVType(); /* sum of the component up to and including x */
+		/* 1. find the highest node in the range, i.e. with lo < end_x <= hi */
+		while(x != nil()) {
+			NodeHandle l = get_node(x).get_left();
+			NVType left = NVType();
+			if(l != nil()) left = this->get_node_sum_component(l, component);
+			get_node_grvalue(x, tmp);
+			end_x = acc + left + tmp[component];
+			if(!(lo < end_x)) {
+				acc = end_x;
+				x = get_node(x).get_right();
+			}
+			else if(hi < end_x) x = l;
+			else break;
+		}
+		if(x == nil()) return; /* empty range */
+		NVAdd(res,tmp);
+		/* 2. nodes in the left subtree after lo (with their right subtrees) */
+		for(NodeHandle y = get_node(x).get_left(); y != nil();) {
+			NodeHandle l = get_node(y).get_left();
+			NVType left = NVType();
+			if(l != nil()) left = this->get_node_sum_component(l, component);
+			get_node_grvalue(y, tmp);
+			NVType e = acc + left + tmp[component];
+			if(lo < e) {
+				NVAdd(res,tmp);
+				add_node_subtree(nil(),get_node(y).get_right(),res);
+				y = l;
+			}
+			else {
+				acc = e;
+				y = get_node(y).get_right();
+			}
+		}
+		/* 3. nodes in the right subtree not after hi (with their left subtrees) */
+		acc = end_x;
+		for(NodeHandle y = get_node(x).get_right(); y != nil();) {
+			NodeHandle l = get_node(y).get_left();
+			NVType left = NVType();
+			if(l != nil()) left = this->get_node_sum_component(l, component);
+			get_node_grvalue(y, tmp);
+			NVType e = acc + left + tmp[component];
+			if(!(hi < e)) {
+				NVAdd(res,tmp);
+				add_node_subtree(nil(),l,res);
+				acc = e;
+				y = get_node(y).get_right();
+			}
+			else y = l;
+		}
 	}
 	
 	
@@ -575,8 +1598,8 @@ namespace orbtree {
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
 	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::update_sum(NodeHandle n) {
 		/* sum(n) = sum(n.left) + sum(n.right) + f(n.key) */
-		NVType sum[f.get_nr()];
-		NVType tmp[f.get_nr()];
+		NVType sum[ORBTREE_NV_SIZE];
+		NVType tmp[ORBTREE_NV_SIZE];
 		get_node_grvalue(n,sum);
 		if(get_node(n).get_left() != nil()) {
 			this->get_node_sum(get_node(n).get_left(),tmp);
@@ -589,6 +1612,77 @@ namespace orbtree {
 		this->set_node_sum(n,sum);
 	}
 	
+	/* recalculate outdated sums in lazy mode: post-order traversal of outdated nodes
+	 * (if a node is outdated, all of its ancestors are outdated as well) */
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::flush_sums_r(NodeHandle n) {
+		NodeHandle l = get_node(n).get_left();
+		NodeHandle r = get_node(n).get_right();
+		if(l != nil() && get_node(l).is_dirty()) flush_sums_r(l);
+		if(r != nil() && get_node(r).is_dirty()) flush_sums_r(r);
+		update_sum(n);
+		get_node(n).set_clean();
+	}
+	
+	/* recalculate all weights and sums: post-order traversal of all nodes */
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::recompute_sums_r(NodeHandle n) {
+		NodeHandle l = get_node(n).get_left();
+		NodeHandle r = get_node(n).get_right();
+		if(l != nil()) recompute_sums_r(l);
+		if(r != nil()) recompute_sums_r(r);
+		update_node_weight(n);
+		update_sum(n);
+		get_node(n).set_clean();
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::flush_sums_parallel(NodeHandle n, unsigned int nthreads, bool all) {
+		/* 1. expand the top levels: nodes in upper are updated at the end (in
+		 * reverse order, so that children come before their parents) */
+		std::vector<NodeHandle> upper;
+		std::vector<NodeHandle> tasks(1,n);
+		const size_t min_tasks = 4*(size_t)nthreads;
+		for(unsigned int level = 0;level < 16 && tasks.size() && tasks.size() < min_tasks;level++) {
+			std::vector<NodeHandle> next;
+			for(NodeHandle x : tasks) {
+				upper.push_back(x);
+				NodeHandle l = get_node(x).get_left();
+				NodeHandle r = get_node(x).get_right();
+				if(l != nil() && (all || get_node(l).is_dirty())) next.push_back(l);
+				if(r != nil() && (all || get_node(r).is_dirty())) next.push_back(r);
+			}
+			tasks.swap(next);
+		}
+		
+		/* 2. process the subtrees below in parallel, each thread takes the next
+		 * one that is not done yet */
+		std::atomic<size_t> next_task(0);
+		std::vector<std::exception_ptr> errors(nthreads);
+		auto worker = [this,&tasks,&next_task,&errors,all] (unsigned int j) {
+			try { for(size_t i = next_task++;i < tasks.size();i = next_task++) {
+				if(all) recompute_sums_r(tasks[i]);
+				else flush_sums_r(tasks[i]);
+			} }
+			catch(...) { errors[j] = std::current_exception(); }
+		};
+		std::vector<std::thread> threads;
+		if(tasks.size() > 1) for(unsigned int j = 1;j < nthreads && j < tasks.size();j++) {
+			try { threads.emplace_back(worker,j); }
+			catch(...) { break; } /* could not start a new thread, the remaining work is done here */
+		}
+		worker(0);
+		for(std::thread& th : threads) th.join();
+		for(const std::exception_ptr& e : errors) if(e) std::rethrow_exception(e);
+		
+		/* 3. update the top levels */
+		for(auto it = upper.rbegin();it != upper.rend();++it) {
+			if(all) update_node_weight(*it);
+			update_sum(*it);
+			get_node(*it).set_clean();
+		}
+	}
+	
 	
 	/* left rotate:
 	 * right child of x takes its place, x becomes its left child
@@ -596,6 +1690,7 @@ namespace orbtree {
 	 */
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
 	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::rotate_left(NodeHandle x) {
+		ORBTREE_STAT_ADD(rotations, 1);
 		NodeHandle y = get_node(x).get_right(); /* we assume that x != nil and y != nil */
 		get_node(x).set_right( get_node(y).get_left() ); /* x.right = y.left; -- this can be nil */
 		if(get_node(x).get_right() != nil()) get_right(x).set_parent(x); /* here we have to check -- don't want to modify parent of nil */
@@ -606,6 +1701,7 @@ namespace orbtree {
 		get_node(y).set_left(x);
 		get_node(x).set_parent(y);
 		
+		if(lazy_sums) { get_node(x).set_dirty(); mark_dirty(y); return; }
 		update_sum(x); /* only these two need to be updated -- upstream of y the values stay the same */
 		update_sum(y);
 	}
@@ -615,6 +1711,7 @@ namespace orbtree {
 	 * right child of x's original left child becomes x's left child */
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
 	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::rotate_right(NodeHandle x) {
+		ORBTREE_STAT_ADD(rotations, 1);
 		NodeHandle y = get_node(x).get_left(); /* we assume that x != nil and y != nil */
 		get_node(x).set_left( get_node(y).get_right() );
 		if(get_node(x).get_left() != nil()) get_left(x).set_parent(x);
@@ -625,6 +1722,7 @@ namespace orbtree {
 		get_node(y).set_right(x);
 		get_node(x).set_parent(y);
 		
+		if(lazy_sums) { get_node(x).set_dirty(); mark_dirty(y); return; }
 		update_sum(x);
 		update_sum(y);
 	}
@@ -645,6 +1743,7 @@ namespace orbtree {
 	bool orbtree_base<NodeAllocator,Compare,NVFunc,multi>::insert_search(const KeyType& k, NodeHandle& n, bool& insert_left) const {
 		n = root();
 		if(n == Invalid) throw std::runtime_error("orbtree_base::insert_search(): root is Invalid!\n");
+		ORBTREE_STAT_ADD(insert_search_calls, 1);
 		if(get_node(n).get_right() == nil()) {
 			/* empty tree, insert as the dummy root node's right child */
 			insert_left = false;
@@ -652,6 +1751,7 @@ namespace orbtree {
 		}
 		n = get_node(n).get_right(); /* nonempty tree, start with the real root */
 		while(true) {
+			ORBTREE_STAT_ADD(insert_search_nodes, 1);
 			const KeyType& k1 = get_node_key(n);
 			if(c(k,k1)) {
 				/* should go to the left */
@@ -674,26 +1774,31 @@ namespace orbtree {
 	 * note: this function does not check for the correct relationship between the keys of n and n1,
 	 * that is the caller's responsibility */
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
-	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::insert_helper(NodeHandle n, NodeHandle n1, bool insert_left) {
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::insert_helper(NodeHandle n, NodeHandle n1, bool insert_left, NodeHandle top) {
 		if(insert_left) get_node(n).set_left(n1);
 		else get_node(n).set_right(n1);
 		get_node(n1).set_parent(n);
 		get_node(n1).set_left(nil());
 		get_node(n1).set_right(nil());
 		get_node(n1).set_red(); /* all new nodes are red */
-		NVType sum_add[f.get_nr()];
-		get_node_grvalue(n1,sum_add); /* calculate the new value */
+		NVType sum_add[ORBTREE_NV_SIZE];
+		update_node_grvalue(n1,sum_add); /* calculate the new value */
 		this->set_node_sum(n1,sum_add);
 		/* update sum up the tree from n */
-		for(NodeHandle n2 = n; n2 != root(); n2 = get_node(n2).get_parent()) {
-			NVType tmp[f.get_nr()];
+		if(lazy_sums) mark_dirty(n);
+		else for(NodeHandle n2 = n; n2 != top; n2 = get_node(n2).get_parent()) {
+			NVType tmp[ORBTREE_NV_SIZE];
 			this->get_node_sum(n2,tmp);
 			NVAdd(tmp,sum_add);
 			this->set_node_sum(n2,tmp);
 		}
-			
+		insert_fixup(n,n1,top);
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::insert_fixup(NodeHandle n, NodeHandle n1, NodeHandle top) {
 		while(true) {
-			if(n == root()) return; /* nothing to do if we just added one node to an empty tree */
+			if(n == top) return; /* nothing to do if we just added one node to an empty tree */
 			/* here, n1 is always red */
 			/* has to fix red-black tree properties */
 			/* only possible problem is if n is red */
@@ -702,7 +1807,7 @@ namespace orbtree {
 			/* if n is red, it can have a black other child (only after the first step though) */
 			
 			/* if n is the real root, we can fix the tree by coloring it black */
-			if(get_node(n).get_parent() == root()) { get_node(n).set_black(); return; }
+			if(get_node(n).get_parent() == top) { get_node(n).set_black(); return; }
 			
 			/* now, n has a valid, black parent and potentially a sibling */
 			if(get_sibling(n).is_red()) {
@@ -842,6 +1947,26 @@ namespace orbtree {
 	}
 	
 	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	auto orbtree_base<NodeAllocator,Compare,NVFunc,multi>::push_back(const ValueType& kv) -> std::pair<NodeHandle,bool> {
+		NodeHandle n;
+		if(!append_search(KeyValue::key(kv),n)) return std::pair<NodeHandle,bool>(n,false);
+		NodeHandle n1 = this->new_node(kv);
+		insert_helper(n,n1,false);
+		size1++;
+		return std::pair<NodeHandle,bool>(n1,true);
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	auto orbtree_base<NodeAllocator,Compare,NVFunc,multi>::push_back(ValueType&& kv) -> std::pair<NodeHandle,bool> {
+		NodeHandle n;
+		if(!append_search(KeyValue::key(kv),n)) return std::pair<NodeHandle,bool>(n,false);
+		NodeHandle n1 = this->new_node(std::move(kv));
+		insert_helper(n,n1,false);
+		size1++;
+		return std::pair<NodeHandle,bool>(n1,true);
+	}
+	
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class... T>
 	auto orbtree_base<NodeAllocator,Compare,NVFunc,multi>::emplace(T&&... t) -> std::pair<NodeHandle,bool> {
 		/* create a new node first, so constructor is only called once */
@@ -894,10 +2019,11 @@ namespace orbtree {
 		else get_node(p).set_right(c);
 		
 		/* subtract the rank function values up from del */
-		NVType x2[f.get_nr()];
-		get_node_grvalue(del,x2);
-		for(NodeHandle p2 = p; p2 != root(); p2 = get_node(p2).get_parent()) {
-			NVType y[f.get_nr()];
+		NVType x2[ORBTREE_NV_SIZE];
+		if(lazy_sums) mark_dirty(p);
+		else get_node_grvalue(del,x2);
+		if(!lazy_sums) for(NodeHandle p2 = p; p2 != root(); p2 = get_node(p2).get_parent()) {
+			NVType y[ORBTREE_NV_SIZE];
 			this->get_node_sum(p2,y);
 			NVSubtract(y,x2);
 			this->set_node_sum(p2,y);
@@ -994,61 +2120,29 @@ namespace orbtree {
 			if(get_node(x).get_right() != nil()) get_right(x).set_parent(x);
 			
 			/* fix sums */
-			update_sum_r(x);
+			if(lazy_sums) {
+				get_node(x).set_dirty();
+				mark_dirty(get_node(x).get_parent());
+			}
+			else update_sum_r(x);
 		}
 		/* delete node of n -- need to give x as well as its value can potentially change */
 		this->free_node(n);
 		if(!size1) throw std::runtime_error("size1 is zero in orbtree_base::erase!\n");
 		size1--;
+		/* compaction can move x, its handle is updated in this case */
+		if(auto_compact) NodeAllocator::compact_step(auto_compact,&x);
 		return x; /* return the successor -- it can be nil if n was the largest node */
 	}
 	
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
 	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::NVAdd(NVType* x, const NVType* y) const {
-		unsigned int nr = f.get_nr();
-		
-		if(std::is_integral<NVType>::value) {
-			/* for integer types -- check for overflow */
-			NVType max = std::numeric_limits<NVType>::max();
-			NVType min = std::numeric_limits<NVType>::min();
-			for(unsigned int i = 0;i<nr;i++) {
-				if(y[i] > 0) {
-					if(max - y[i] < x[i]) throw std::runtime_error("orbtree_base::NVAdd(): overflow!\n");
-				}
-				else {
-					if(min - y[i] > x[i]) throw std::runtime_error("orbtree_base::NVAdd(): underflow!\n");
-				}
-				x[i] += y[i];
-			}
-		}
-		else {
-			/* TODO: overflow / rounding check for floats? */
-			for(unsigned int i=0;i<nr;i++) x[i] += y[i];
-		}
-	}	
+		NVOps<NVType>::add(x,y,get_nr());
+	}
 	
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
 	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::NVSubtract(NVType* x, const NVType* y) const {
-		unsigned int nr = f.get_nr();
-		
-		if(std::is_integral<NVType>::value) {
-			/* for integer types -- check for overflow */
-			NVType max = std::numeric_limits<NVType>::max();
-			NVType min = std::numeric_limits<NVType>::min();
-			for(unsigned int i = 0;i<nr;i++) {
-				if(y[i] > 0) {
-					if(min + y[i] > x[i]) throw std::runtime_error("orbtree_base::NVSubtract(): underflow!\n");
-				}
-				else {
-					if(max + y[i] < x[i]) throw std::runtime_error("orbtree_base::NVSubtract(): overflow!\n");
-				}
-				x[i] -= y[i];
-			}
-		}
-		else {
-			/* TODO: overflow / rounding check for floats? */
-			for(unsigned int i=0;i<nr;i++) x[i] -= y[i];
-		}
+		NVOps<NVType>::subtract(x,y,get_nr());
 	}
 	
 	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
@@ -1060,6 +2154,7 @@ namespace orbtree {
 		if(x == nil()) return; /* empty tree nothing more to do */
 		if(x == this->Invalid) throw std::runtime_error("orbtree_base::check_tree(): invalid node handle found!\n");
 		if(get_node(x).get_parent() != root()) throw std::runtime_error("orbtree_base::check_tree(): inconsistent root node!\n");
+		if(epsilon >= 0.0) flush_sums_lazy();
 		
 		size_t previous_black_count = (size_t)-1;
 		check_tree_r(epsilon,x,0,previous_black_count);
@@ -1072,6 +2167,7 @@ namespace orbtree {
 	 *  -- for red x, both children have to be black or nil
 	 *  -- if nil is reached, black_count has to be the same as previous_black_count
 	 *  -- if epsilon >= 0.0, then than the rank function value stored in x is equal to the sum of its children + x's value
+	 *  -- if x's partial sum is marked outdated (in lazy mode), its parent has to be marked as well
 	 *  -- recurses into both children, increasing black_count if x is black
 	 * as tree height for N elements is maximum 2*log_2(N), this will not result in stack overflow
 	 * 	(e.g. N <~ 2^40 on a machine with few hundred GB RAM, thus tree height <~ 80, which is reasonable for recursion depth)
@@ -1080,12 +2176,21 @@ namespace orbtree {
 	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::check_tree_r(double epsilon, NodeHandle x, size_t black_count, size_t& previous_black_count) const {
 		NodeHandle l = get_node(x).get_left();
 		NodeHandle r = get_node(x).get_right();
+		if(get_node(x).is_dirty() && !(lazy_sums && (get_node(x).get_parent() == root() || get_parent(x).is_dirty())))
+			throw std::runtime_error("orbtree_base::check_tree(): inconsistent outdated partial sums!\n");
 		
 		{ /* scope for sum and tmp -- no need to keep them over the recursion */
-			NVType sum[f.get_nr()];
-			NVType tmp[f.get_nr()];
+			NVType sum[ORBTREE_NV_SIZE];
+			NVType tmp[ORBTREE_NV_SIZE];
 			
-			if(epsilon >= 0.0) get_node_grvalue(x,sum);
+			if(epsilon >= 0.0) {
+				get_node_grvalue(x,sum);
+				if CONSTEXPR (NodeAllocator::stores_weight) {
+					/* check that the stored weight is up-to-date */
+					f(get_node(x).get_key_value().keyvalue(), tmp);
+					check_nv_equal(epsilon, sum, tmp, "orbtree_base::check_tree(): stored weight is inconsistent!\n");
+				}
+			}
 			
 			if(l != nil()) {
 				/* check if x is l's parent */
@@ -1123,11 +2228,7 @@ namespace orbtree {
 				/* check that the partial sum stored in x is consistent */
 				this->get_node_sum(x,tmp);
 				
-				/* if NVType is integral, we want exact match -- otherwise, we use epsilon for comparison */
-				if(std::is_integral<NVType>::value) { for(unsigned int i=0;i<f.get_nr();i++) if(tmp[i] != sum[i])
-						throw std::runtime_error("orbtree_base::check_tree(): partial sums are inconsistent!\n"); }
-				else for(unsigned int i=0;i<f.get_nr();i++) if(fabs(tmp[i]-sum[i]) > epsilon)
-					throw std::runtime_error("orbtree_base::check_tree(): partial sums are inconsistent!\n");
+				check_nv_equal(epsilon, tmp, sum, "orbtree_base::check_tree(): partial sums are inconsistent!\n");
 			}
 		}
 		
@@ -1141,11 +2242,518 @@ namespace orbtree {
 		
 		/* recurse into both children (if not nil) */
 		if(l != nil()) check_tree_r(epsilon,l,black_count,previous_black_count);
-		if(r != nil()) check_tree_r(epsilon,r,black_count,previous_black_count);		
+		if(r != nil()) check_tree_r(epsilon,r,black_count,previous_black_count);
+	}
+
+
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class InputIt>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::assign_sorted(InputIt first, InputIt last) {
+		clear();
+		if(first == last) return;
+		if CONSTEXPR (std::is_base_of<std::forward_iterator_tag,
+				typename std::iterator_traits<InputIt>::iterator_category>::value)
+			NodeAllocator::reserve(std::distance(first,last));
+
+		/* 1. create all nodes in order, temporarily linking them in a
+		 * list using their right pointers */
+		NodeHandle head = nil();
+		NodeHandle tail = nil();
+		size_t n = 0;
+		try {
+			for(;first != last;++first) {
+				NodeHandle n1 = this->new_node(*first);
+				if(tail != nil()) {
+					if(c(get_node_key(n1),get_node_key(tail))) {
+						this->free_node(n1);
+						throw std::runtime_error("orbtree_base::assign_sorted(): input is not sorted!\n");
+					}
+					if(!multi) if(!c(get_node_key(tail),get_node_key(n1))) {
+						this->free_node(n1); /* duplicate key, keep the first one */
+						continue;
+					}
+					get_node(tail).set_right(n1);
+				}
+				else head = n1;
+				get_node(n1).set_right(nil());
+				tail = n1;
+				update_node_weight(n1);
+				n++;
+			}
+		}
+		catch(...) {
+			/* free the nodes already created, so the tree is left empty */
+			while(head != nil()) {
+				NodeHandle n1 = get_node(head).get_right();
+				this->free_node(head);
+				head = n1;
+			}
+			clear();
+			throw;
+		}
+
+		/* 2. link nodes into a balanced tree */
+		build_sorted(head,n);
 	}
 	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class InputIt>
+	size_t orbtree_base<NodeAllocator,Compare,NVFunc,multi>::append_sorted(InputIt first, InputIt last) {
+		if(first == last) return 0;
+		if CONSTEXPR (std::is_base_of<std::forward_iterator_tag,
+				typename std::iterator_traits<InputIt>::iterator_category>::value)
+			NodeAllocator::reserve(std::distance(first,last));
+		
+		/* 1. create all nodes in order, linked by their right pointers (same as
+		 * in assign_sorted()); the first one is compared to the last node */
+		NodeHandle prev = this->last();
+		NodeHandle head = nil();
+		NodeHandle tail = nil();
+		size_t n = 0;
+		try {
+			for(;first != last;++first) {
+				NodeHandle n1 = this->new_node(*first);
+				NodeHandle p = (tail != nil()) ? tail : prev;
+				if(p != nil()) {
+					if(c(get_node_key(n1),get_node_key(p))) {
+						this->free_node(n1);
+						throw std::runtime_error("orbtree_base::append_sorted(): input is not sorted or is before the last element!\n");
+					}
+					if(!multi) if(!c(get_node_key(p),get_node_key(n1))) {
+						this->free_node(n1);
+						continue;
+					}
+				}
+				if(tail != nil()) get_node(tail).set_right(n1);
+				else head = n1;
+				get_node(n1).set_right(nil());
+				tail = n1;
+				update_node_weight(n1);
+				n++;
+			}
+		}
+		catch(...) {
+			/* the tree itself was not modified yet */
+			while(head != nil()) {
+				NodeHandle n1 = get_node(head).get_right();
+				this->free_node(head);
+				head = n1;
+			}
+			throw;
+		}
+		if(n == 0) return 0;
+		if(size1 == 0) {
+			build_sorted(head,n);
+			return n;
+		}
+		
+		/* 2. link all new nodes except the first into a balanced subtree, and join
+		 * it with the existing tree, using the first new node as the pivot */
+		bool lazy = lazy_sums;
+		if(lazy) { flush_sums(); lazy_sums = false; }
+		NodeHandle piv = head;
+		head = get_node(piv).get_right();
+		unsigned int red_depth = 0;
+		for(size_t n2 = n; n2 > 1; n2 /= 2) red_depth++;
+		NodeHandle r = build_sorted_r(head,n - 1,0,red_depth);
+		NodeHandle l = get_node(root()).get_right();
+		get_node(root()).set_right(nil());
+		unsigned int h;
+		NodeHandle res = join(l,black_height(l),piv,r,black_height(r),h);
+		get_node(root()).set_right(res);
+		get_node(res).set_parent(root());
+		get_node(res).set_black();
+		size1 += n;
+		lazy_sums = lazy;
+		return n;
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::build_sorted(NodeHandle head, size_t n) {
+		/* all levels are complete except possibly the deepest one, nodes there are colored red */
+		unsigned int red_depth = 0;
+		for(size_t n2 = n + 1; n2 > 1; n2 /= 2) red_depth++;
+		NodeHandle r = build_sorted_r(head,n,0,red_depth);
+		get_node(root()).set_right(r);
+		if(r != nil()) get_node(r).set_parent(root());
+		size1 = n;
+	}
+
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	auto orbtree_base<NodeAllocator,Compare,NVFunc,multi>::build_sorted_r(NodeHandle& head,
+			size_t n, unsigned int depth, unsigned int red_depth) -> NodeHandle {
+		/* recursion depth is log2(n), so this is safe */
+		if(n == 0) return nil();
+		size_t nleft = n / 2;
+		NodeHandle l = build_sorted_r(head,nleft,depth + 1,red_depth);
+		NodeHandle x = head;
+		head = get_node(x).get_right();
+		NodeHandle r = build_sorted_r(head,n - nleft - 1,depth + 1,red_depth);
+
+		Node& xn = get_node(x);
+		xn.set_left(l);
+		xn.set_right(r);
+		if(depth == red_depth) xn.set_red();
+		else xn.set_black();
+		if(l != nil()) get_node(l).set_parent(x);
+		if(r != nil()) get_node(r).set_parent(x);
+		update_sum(x);
+		return x;
+	}
+
+
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	auto orbtree_base<NodeAllocator,Compare,NVFunc,multi>::join(NodeHandle l, unsigned int hl,
+			NodeHandle k, NodeHandle r, unsigned int hr, unsigned int& h) -> NodeHandle {
+		/* roots of l and r are made black, which is always valid */
+		if(l != nil() && get_node(l).is_red()) { get_node(l).set_black(); hl++; }
+		if(r != nil() && get_node(r).is_red()) { get_node(r).set_black(); hr++; }
+		Node& kn = get_node(k);
+		if(hl == hr) {
+			/* simple case, k becomes the new (black) root */
+			kn.set_left(l);
+			kn.set_right(r);
+			kn.set_black();
+			if(l != nil()) get_node(l).set_parent(k);
+			if(r != nil()) get_node(r).set_parent(k);
+			update_sum(k);
+			h = hl + 1;
+			return k;
+		}
+		
+		/* the taller subtree is temporarily linked below the root sentinel,
+		 * k is inserted (as red) into its right (or left) spine, at a black
+		 * node with the same black height as the other subtree; after this,
+		 * the same fixup is needed as after inserting a node */
+		bool right_spine = (hl > hr);
+		NodeHandle t = right_spine ? l : r;
+		unsigned int hc = right_spine ? hl : hr;
+		unsigned int ho = right_spine ? hr : hl;
+		get_node(root()).set_right(t);
+		get_node(t).set_parent(root());
+		NodeHandle p = root();
+		NodeHandle x = t;
+		/* note: nil is black, so this stops at the latest at nil (with hc == 0) */
+		while(hc > ho || get_node(x).is_red()) {
+			if(get_node(x).is_black()) hc--;
+			p = x;
+			x = right_spine ? get_node(x).get_right() : get_node(x).get_left();
+		}
+		if(right_spine) {
+			get_node(p).set_right(k);
+			kn.set_left(x);
+			kn.set_right(r);
+		}
+		else {
+			get_node(p).set_left(k);
+			kn.set_left(l);
+			kn.set_right(x);
+		}
+		kn.set_parent(p);
+		kn.set_red();
+		if(kn.get_left() != nil()) get_node(kn.get_left()).set_parent(k);
+		if(kn.get_right() != nil()) get_node(kn.get_right()).set_parent(k);
+		update_sum(k);
+		update_sum_r(p);
+		insert_fixup(p,k,root());
+		
+		/* the fixup does not change the black height below the root sentinel,
+		 * except if the new root ended up red: making it black adds one level */
+		NodeHandle res = get_node(root()).get_right();
+		h = std::max(hl, hr);
+		if(get_node(res).is_red()) {
+			get_node(res).set_black();
+			h++;
+		}
+		get_node(root()).set_right(nil());
+		return res;
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::split(NodeHandle t, unsigned int ht,
+			const KeyType& k, NodeHandle& l, unsigned int& hl, NodeHandle& r, unsigned int& hr, NodeHandle& match) {
+		/* recursion depth is at most the height of the tree */
+		if(t == nil()) { l = nil(); r = nil(); hl = 0; hr = 0; return; }
+		NodeHandle tl = get_node(t).get_left();
+		NodeHandle tr = get_node(t).get_right();
+		unsigned int hc = ht - (get_node(t).is_black() ? 1 : 0); /* black height of children */
+		const KeyType& kt = get_node_key(t);
+		if(multi ? !c(k,kt) : c(kt,k)) {
+			/* t and its left subtree go to the left side */
+			split(tr,hc,k,l,hl,r,hr,match);
+			l = join(tl,hc,t,l,hl,hl);
+		}
+		else if(multi || c(k,kt)) {
+			/* t and its right subtree go to the right side */
+			split(tl,hc,k,l,hl,r,hr,match);
+			r = join(r,hr,t,tr,hc,hr);
+		}
+		else {
+			/* k == kt in a non-multi tree */
+			l = tl; hl = hc;
+			r = tr; hr = hc;
+			if(l != nil() && get_node(l).is_red()) { get_node(l).set_black(); hl++; }
+			if(r != nil() && get_node(r).is_red()) { get_node(r).set_black(); hr++; }
+			match = t;
+		}
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	void orbtree_base<NodeAllocator,Compare,NVFunc,multi>::split_at(NodeHandle x, NodeHandle& l,
+			unsigned int& hl, NodeHandle& r, unsigned int& hr) {
+		unsigned int h = black_height(x); /* black height of the subtree of n, before splitting */
+		l = get_node(x).get_left();
+		r = get_node(x).get_right();
+		hl = h - (get_node(x).is_black() ? 1 : 0);
+		hr = hl;
+		NodeHandle n = x;
+		NodeHandle p = get_node(x).get_parent();
+		while(p != root()) {
+			NodeHandle pp = get_node(p).get_parent(); /* has to be saved, join() changes it */
+			unsigned int hs = h; /* the other child of p has the same black height as n */
+			if(get_node(p).is_black()) h++;
+			if(get_node(p).get_left() == n) r = join(r,hr,p,get_node(p).get_right(),hs,hr);
+			else l = join(get_node(p).get_left(),hs,p,l,hl,hl);
+			n = p;
+			p = pp;
+		}
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	auto orbtree_base<NodeAllocator,Compare,NVFunc,multi>::erase_range(NodeHandle a, NodeHandle b) -> NodeHandle {
+		/* erase nodes one by one if only a few nodes are erased */
+		const size_t min_split = 32;
+		size_t k = 0;
+		NodeHandle x = a;
+		for(;x != b && k < min_split;k++) x = next(x);
+		if(x == b) {
+			while(a != b) a = erase(a);
+			return b;
+		}
+		
+		bool lazy = lazy_sums;
+		if(lazy) { flush_sums(); lazy_sums = false; }
+		/* 1. split at a and b, the part between them is cut out */
+		NodeHandle l, r, r2;
+		unsigned int hl, hr, hr2;
+		split_at(a,l,hl,r,hr);
+		this->free_node(a);
+		size_t n_del = 1;
+		get_node(root()).set_right(r);
+		if(r != nil()) get_node(r).set_parent(root());
+		NodeHandle res = l;
+		if(b != nil()) {
+			split_at(b,r,hr,r2,hr2);
+			n_del += free_subtree(r);
+			/* 2. join the remaining parts with b as the pivot */
+			res = join(l,hl,b,r2,hr2,hl);
+		}
+		else n_del += free_subtree(r);
+		get_node(root()).set_right(res);
+		if(res != nil()) {
+			get_node(res).set_parent(root());
+			get_node(res).set_black();
+		}
+		if(n_del > size1) throw std::runtime_error("orbtree_base::erase_range(): inconsistent tree size!\n");
+		size1 -= n_del;
+		lazy_sums = lazy;
+		return b;
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class Pred>
+	size_t orbtree_base<NodeAllocator,Compare,NVFunc,multi>::erase_if_node(Pred p) {
+		std::vector<NodeHandle> keep;
+		std::vector<NodeHandle> del;
+		for(NodeHandle n = first();n != nil();n = next(n)) {
+			if(p(n)) del.push_back(n);
+			else keep.push_back(n);
+		}
+		if(del.empty()) return 0;
+		
+		/* erasing one node takes O(log N) time, rebuilding the tree takes O(N) */
+		size_t log_n = 1;
+		for(size_t n2 = size1; n2 > 1; n2 /= 2) log_n++;
+		if(del.size() * log_n < size1) {
+			for(NodeHandle n : del) erase(n);
+			return del.size();
+		}
+		
+		NodeHandle head = nil();
+		for(auto it = keep.rbegin();it != keep.rend();++it) {
+			get_node(*it).set_right(head);
+			get_node(*it).set_clean(); /* partial sums are recalculated for all nodes */
+			head = *it;
+		}
+		for(NodeHandle n : del) this->free_node(n);
+		get_node(root()).set_right(nil());
+		build_sorted(head,keep.size());
+		return del.size();
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi>
+	size_t orbtree_base<NodeAllocator,Compare,NVFunc,multi>::insert_nodes(NodeHandle top,
+			NodeHandle* first, NodeHandle* last) {
+		size_t n_ins = 0;
+		for(;first != last;++first) {
+			NodeHandle n1 = *first;
+			const KeyType& k = get_node_key(n1);
+			/* same search as insert_search(), but starting from top */
+			NodeHandle n = top;
+			bool insert_left = false;
+			bool found = false;
+			ORBTREE_STAT_ADD(insert_search_calls, 1);
+			for(NodeHandle x = get_node(top).get_right(); x != nil();) {
+				ORBTREE_STAT_ADD(insert_search_nodes, 1);
+				n = x;
+				const KeyType& k1 = get_node_key(x);
+				if(c(k,k1)) { insert_left = true; x = get_node(x).get_left(); }
+				else {
+					if(!multi) if(!c(k1,k)) { found = true; break; }
+					insert_left = false;
+					x = get_node(x).get_right();
+				}
+			}
+			if(found) continue;
+			insert_helper(n,n1,insert_left,top);
+			*first = nil();
+			n_ins++;
+		}
+		return n_ins;
+	}
+	
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi> template<class InputIt>
+	size_t orbtree_base<NodeAllocator,Compare,NVFunc,multi>::insert_batch(InputIt first, InputIt last, unsigned int nthreads) {
+		/* minimum number of elements inserted by one thread */
+		const size_t min_chunk = 4096;
+		if(nthreads == 0) nthreads = std::thread::hardware_concurrency();
+		if(nthreads == 0) nthreads = 1;
+		if CONSTEXPR (std::is_base_of<std::forward_iterator_tag,
+				typename std::iterator_traits<InputIt>::iterator_category>::value)
+			NodeAllocator::reserve(std::distance(first,last) + nthreads);
+		
+		/* 1. create all nodes (this also checks that the input is sorted and
+		 * removes duplicates in a non-multi tree) */
+		std::vector<NodeHandle> nodes;
+		try {
+			for(;first != last;++first) {
+				NodeHandle n1 = this->new_node(*first);
+				if(nodes.size()) {
+					NodeHandle prev = nodes.back();
+					if(c(get_node_key(n1),get_node_key(prev))) {
+						this->free_node(n1);
+						throw std::runtime_error("orbtree_base::insert_batch(): input is not sorted!\n");
+					}
+					if(!multi) if(!c(get_node_key(prev),get_node_key(n1))) {
+						this->free_node(n1);
+						continue;
+					}
+				}
+				nodes.push_back(n1);
+			}
+		}
+		catch(...) {
+			for(NodeHandle n1 : nodes) this->free_node(n1);
+			throw;
+		}
+		
+		size_t m = nodes.size();
+		size_t nchunks = m / min_chunk;
+		if(nchunks > nthreads) nchunks = nthreads;
+		if(nchunks <= 1) {
+			/* insert in the calling thread */
+			size_t n_ins = insert_nodes(root(),nodes.data(),nodes.data() + m);
+			size1 += n_ins;
+			for(NodeHandle n1 : nodes) if(n1 != nil()) this->free_node(n1);
+			return n_ins;
+		}
+		
+		/* sentinels for the pieces (allocated first, so that node
+		 * storage is not reallocated after this) */
+		std::vector<NodeHandle> tops;
+		try { for(size_t j = 0;j < nchunks;j++) tops.push_back(this->new_node()); }
+		catch(...) {
+			for(NodeHandle n1 : tops) this->free_node(n1);
+			for(NodeHandle n1 : nodes) this->free_node(n1);
+			throw;
+		}
+		
+		bool lazy = lazy_sums;
+		if(lazy) { flush_sums(); lazy_sums = false; }
+		
+		/* 2. split the tree by the first node in each chunk (except the
+		 * first chunk); these are used as the pivots for joining the pieces,
+		 * unless the same key is already in the tree (non-multi tree only) */
+		std::vector<size_t> start(nchunks + 1);
+		std::vector<NodeHandle> pivots(nchunks,nil());
+		size_t n_ins = 0;
+		for(size_t j = 0;j <= nchunks;j++) start[j] = (m * j) / nchunks;
+		NodeHandle rest = get_node(root()).get_right();
+		unsigned int hrest = black_height(rest);
+		get_node(root()).set_right(nil());
+		for(size_t j = 1;j < nchunks;j++) {
+			NodeHandle piv = nodes[start[j]];
+			NodeHandle match = nil();
+			NodeHandle l;
+			unsigned int hl;
+			split(rest,hrest,get_node_key(piv),l,hl,rest,hrest,match);
+			get_node(tops[j-1]).set_right(l);
+			if(match != nil()) pivots[j] = match;
+			else {
+				pivots[j] = piv;
+				update_node_weight(piv);
+				nodes[start[j]] = nil();
+				n_ins++;
+			}
+		}
+		get_node(tops[nchunks-1]).set_right(rest);
+		
+		/* 3. insert into the pieces in parallel */
+		std::vector<size_t> counts(nchunks,0);
+		std::vector<std::exception_ptr> errors(nchunks);
+		auto worker = [this,&tops,&nodes,&start,&counts,&errors] (size_t j) {
+			/* note: the pivot (first node) is not inserted by the worker, except in the first chunk */
+			try { counts[j] = insert_nodes(tops[j],nodes.data() + start[j] + (j ? 1 : 0),nodes.data() + start[j+1]); }
+			catch(...) { errors[j] = std::current_exception(); }
+		};
+		for(size_t j = 0;j < nchunks;j++) {
+			NodeHandle t = tops[j];
+			Node& tn = get_node(t);
+			tn.set_left(nil());
+			tn.set_parent(nil());
+			if(tn.get_right() != nil()) get_node(tn.get_right()).set_parent(t);
+		}
+		std::vector<std::thread> threads;
+		for(size_t j = 1;j < nchunks;j++) {
+			try { threads.emplace_back(worker,j); }
+			catch(...) { worker(j); } /* could not start a new thread, do it here */
+		}
+		worker(0);
+		for(std::thread& th : threads) th.join();
+		
+		/* 4. join the pieces and free the remaining nodes */
+		NodeHandle res = get_node(tops[0]).get_right();
+		unsigned int hres = black_height(res);
+		for(size_t j = 1;j < nchunks;j++) {
+			NodeHandle r = get_node(tops[j]).get_right();
+			res = join(res,hres,pivots[j],r,black_height(r),hres);
+		}
+		get_node(root()).set_right(res);
+		if(res != nil()) {
+			get_node(res).set_parent(root());
+			get_node(res).set_black();
+		}
+		for(size_t j = 0;j < nchunks;j++) n_ins += counts[j];
+		size1 += n_ins;
+		for(NodeHandle n1 : tops) this->free_node(n1);
+		for(NodeHandle n1 : nodes) if(n1 != nil()) this->free_node(n1);
+		lazy_sums = lazy;
+		
+		for(size_t j = 0;j < nchunks;j++) if(errors[j]) std::rethrow_exception(errors[j]);
+		return n_ins;
+	}
+
 
 } // namespace orbtree
 
-#endif
+#undef ORBTREE_NV_SIZE
+#undef ORBTREE_STAT_ADD
 
+#endif
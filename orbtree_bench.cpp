@@ -0,0 +1,308 @@
+/*
+ * orbtree_bench.cpp -- benchmark for comparing tree variants
+ *
+ * Copyright 2023 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * Measures the speed of insert, get_sum, lower_bound_w, update_value
+ * and erase operations and the memory used per element for pointer-based
+ * and compact trees (with 32-bit and 64-bit indexes), and for scalar and
+ * vector weight functions with different number of components.
+ *
+ * The vector implementation used by compact trees is selected at compile
+ * time, so build and run the program separately for each:
+ *
+ * g++ -o ob orbtree_bench.cpp -O3 -march=native -std=gnu++14
+ * g++ -o obs orbtree_bench.cpp -O3 -march=native -std=gnu++14 -DUSE_STACKED_VECTOR
+ * g++ -o obd orbtree_bench.cpp -O3 -march=native -std=gnu++14 -DUSE_STACKED_VECTOR -DUSE_LIBDIVIDE
+ *
+ * Options:
+ * 	-n N	number of elements to use (default: 1000000)
+ * 	-s S	seed for the random number generator
+ * 	-r R	number of repeated runs (default: 1)
+ *
+ * Results are written to stdout as tab-separated values with a header line:
+ * variant, vector implementation, operation, number of elements and
+ * number of weight components, average time per operation and 50th, 90th
+ * and 99th percentile of the time for a sample of individually timed
+ * operations (all in nanoseconds), and number of bytes allocated per element
+ * (measured after the insert step, only available with glibc).
+ */
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "orbtree.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifdef USE_LIBDIVIDE
+static const char* vector_type = "stacked_libdivide";
+#elif defined(USE_STACKED_VECTOR)
+static const char* vector_type = "stacked";
+#else
+static const char* vector_type = "realloc";
+#endif
+
+/* scalar weight function: weight is the stored value */
+struct value_func {
+	typedef std::pair<uint64_t, double> argument_type;
+	typedef double result_type;
+	double operator()(const std::pair<uint64_t, double>& p) const { return p.second; }
+};
+
+/* vector weight function: weight is the stored value multiplied by the parameter */
+struct value_mult {
+	typedef std::pair<uint64_t, double> argument_type;
+	typedef double ParType;
+	typedef double result_type;
+	double operator()(const std::pair<uint64_t, double>& p, double a) const { return a*p.second; }
+};
+
+
+/* currently allocated memory in bytes */
+static size_t mem_used() {
+#ifdef __GLIBC__
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 mi = mallinfo2();
+#else
+	struct mallinfo mi = mallinfo();
+#endif
+	return (size_t)mi.uordblks + (size_t)mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+typedef std::chrono::steady_clock bench_clock;
+
+/* timing results for one operation */
+struct op_timer {
+	std::vector<double> samples; /* individually timed operations */
+	bench_clock::time_point start;
+	bench_clock::time_point op_start;
+
+	void begin() { samples.clear(); start = bench_clock::now(); }
+	void op_begin() { op_start = bench_clock::now(); }
+	void op_end() {
+		samples.push_back(std::chrono::duration<double, std::nano>(bench_clock::now() - op_start).count());
+	}
+
+	void write(const char* variant, const char* op, size_t n, unsigned int nr, double bytes) {
+		double total = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+		double p[3] = {0.0, 0.0, 0.0};
+		const double q[3] = {0.5, 0.9, 0.99};
+		if(samples.size()) {
+			std::sort(samples.begin(), samples.end());
+			for(int i=0;i<3;i++) p[i] = samples[(size_t)(q[i] * (samples.size() - 1))];
+		}
+		printf("%s\t%s\t%s\t%zu\t%u\t%.1f\t%.0f\t%.0f\t%.0f\t%.1f\n", variant, vector_type, op, n, nr,
+			n ? total / n : 0.0, p[0], p[1], p[2], bytes);
+	}
+};
+
+/* only every sample_step-th operation is timed separately, to keep the overhead of timing low */
+static const size_t sample_step = 16;
+
+static volatile double sink;
+
+
+/* run all operations on one tree, with keys given in random order */
+template<class Tree>
+void run_bench(const char* variant, Tree& t, unsigned int nr, const std::vector<uint64_t>& keys,
+		const std::vector<uint64_t>& queries, std::mt19937_64& rng) {
+	size_t n = keys.size();
+	std::vector<double> res(nr);
+	std::vector<double> norm(nr);
+	std::uniform_real_distribution<double> vd(0.5, 1.5);
+	op_timer timer;
+	double tmp = 0.0;
+
+	/* 1. insert */
+	size_t mem0 = mem_used();
+	timer.begin();
+	for(size_t i=0;i<n;i++) {
+		if(i % sample_step == 0) {
+			timer.op_begin();
+			t.insert(std::make_pair(keys[i], (double)(keys[i] & 1023) + 1.0));
+			timer.op_end();
+		}
+		else t.insert(std::make_pair(keys[i], (double)(keys[i] & 1023) + 1.0));
+	}
+	double bytes = n ? ((double)mem_used() - (double)mem0) / n : 0.0;
+	timer.write(variant, "insert", n, nr, bytes);
+	if(t.size() != n) throw std::runtime_error("orbtree_bench: error inserting elements!\n");
+
+	/* 2. get_sum for existing keys */
+	timer.begin();
+	for(size_t i=0;i<n;i++) {
+		if(i % sample_step == 0) {
+			timer.op_begin();
+			t.get_sum_fv(queries[i], res.data());
+			timer.op_end();
+		}
+		else t.get_sum_fv(queries[i], res.data());
+		tmp += res[0];
+	}
+	timer.write(variant, "get_sum", n, nr, bytes);
+
+	/* 3. lower_bound_w for random partial sums of the first component */
+	t.get_norm_fv(norm.data());
+	std::vector<double> targets(n);
+	{
+		std::uniform_real_distribution<double> td(0.0, norm[0]);
+		for(size_t i=0;i<n;i++) targets[i] = td(rng);
+	}
+	timer.begin();
+	for(size_t i=0;i<n;i++) {
+		double r = targets[i];
+		auto pred = [r] (const double* x) { return x[0] > r; };
+		if(i % sample_step == 0) {
+			timer.op_begin();
+			auto it = t.lower_bound_w(pred);
+			timer.op_end();
+			if(it != t.end()) tmp += it->second;
+		}
+		else {
+			auto it = t.lower_bound_w(pred);
+			if(it != t.end()) tmp += it->second;
+		}
+	}
+	timer.write(variant, "lower_bound_w", n, nr, bytes);
+
+	/* 4. update_value for existing keys */
+	for(size_t i=0;i<n;i++) targets[i] = vd(rng);
+	timer.begin();
+	for(size_t i=0;i<n;i++) {
+		if(i % sample_step == 0) {
+			timer.op_begin();
+			t.update_value(queries[i], targets[i]);
+			timer.op_end();
+		}
+		else t.update_value(queries[i], targets[i]);
+	}
+	timer.write(variant, "update_value", n, nr, bytes);
+
+	/* 5. erase all elements (in a different random order) */
+	timer.begin();
+	for(size_t i=0;i<n;i++) {
+		if(i % sample_step == 0) {
+			timer.op_begin();
+			t.erase(queries[i]);
+			timer.op_end();
+		}
+		else t.erase(queries[i]);
+	}
+	timer.write(variant, "erase", n, nr, bytes);
+	if(t.size()) throw std::runtime_error("orbtree_bench: error erasing elements!\n");
+
+	sink = tmp;
+	fflush(stdout);
+}
+
+/* create a tree with a scalar weight function and run the benchmark */
+template<class Tree>
+void run_simple(const char* variant, const std::vector<uint64_t>& keys,
+		const std::vector<uint64_t>& queries, std::mt19937_64& rng) {
+	Tree t;
+	run_bench(variant, t, 1, keys, queries, rng);
+}
+
+/* create a tree with a vector weight function with nr components and run the benchmark */
+template<class Tree>
+void run_vec(const char* variant, unsigned int nr, const std::vector<uint64_t>& keys,
+		const std::vector<uint64_t>& queries, std::mt19937_64& rng) {
+	std::vector<double> pars(nr);
+	for(unsigned int i=0;i<nr;i++) pars[i] = 1.0 + i;
+	Tree t(pars);
+	run_bench(variant, t, nr, keys, queries, rng);
+}
+
+
+int main(int argc, char **argv)
+{
+	size_t n = 1000000;
+	uint64_t seed = 0;
+	unsigned int repeat = 1;
+
+	for(int i=1;i<argc;i++) if(argv[i][0] == '-') switch(argv[i][1]) {
+		case 'n':
+			if(i + 1 < argc) n = strtoul(argv[++i], 0, 10);
+			break;
+		case 's':
+			if(i + 1 < argc) seed = strtoull(argv[++i], 0, 10);
+			break;
+		case 'r':
+			if(i + 1 < argc) repeat = strtoul(argv[++i], 0, 10);
+			break;
+		default:
+			fprintf(stderr,"Unknown parameter: %s!\n",argv[i]);
+	}
+
+	std::mt19937_64 rng(seed);
+	if(seed == 0) rng.seed(std::random_device()());
+
+	/* distinct random keys, inserted in random order */
+	std::vector<uint64_t> keys(n);
+	{
+		std::uniform_int_distribution<uint64_t> kd(0, 1ULL << 62);
+		for(size_t i=0;i<n;i++) keys[i] = kd(rng);
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+		std::shuffle(keys.begin(), keys.end(), rng);
+		n = keys.size();
+	}
+	/* the same keys in a different order for queries */
+	std::vector<uint64_t> queries(keys);
+	std::shuffle(queries.begin(), queries.end(), rng);
+
+	printf("variant\tvector\top\tn\tnr\tns_per_op\tp50_ns\tp90_ns\tp99_ns\tbytes_per_elem\n");
+
+	for(unsigned int r=0;r<repeat;r++) {
+		run_simple<orbtree::simple_map<uint64_t, double, value_func> >("ptr_simple", keys, queries, rng);
+		run_simple<orbtree::simple_mapC<uint64_t, double, value_func, uint32_t> >("compact32_simple", keys, queries, rng);
+		run_simple<orbtree::simple_mapC<uint64_t, double, value_func, uint64_t> >("compact64_simple", keys, queries, rng);
+
+		for(unsigned int nr : {1U, 4U, 16U}) {
+			run_vec<orbtree::orbmap<uint64_t, double, orbtree::NVFunc_Adapter_Vec<value_mult> > >("ptr_vec", nr, keys, queries, rng);
+			run_vec<orbtree::orbmapC<uint64_t, double, orbtree::NVFunc_Adapter_Vec<value_mult>, uint32_t> >("compact32_vec", nr, keys, queries, rng);
+			run_vec<orbtree::orbmapC<uint64_t, double, orbtree::NVFunc_Adapter_Vec<value_mult>, uint64_t> >("compact64_vec", nr, keys, queries, rng);
+		}
+	}
+
+	return 0;
+}
+
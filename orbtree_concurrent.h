@@ -0,0 +1,129 @@
+/*  -*- C++ -*-
+ * orbtree_concurrent.h -- wrapper for using a tree with one writer and
+ * 	many concurrent readers
+ *
+ * Copyright 2020 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+
+#ifndef ORBTREE_CONCURRENT_H
+#define ORBTREE_CONCURRENT_H
+
+#include "orbtree.h"
+#include <memory>
+#include <atomic>
+#include <utility>
+#include <stdint.h>
+
+
+namespace orbtree {
+
+	/** \brief Wrapper for a tree that is modified by one thread and queried
+	 * by any number of other threads in parallel.
+	 *
+	 * The writer thread modifies its own copy of the tree (accessed by
+	 * \ref writer()) and calls \ref publish() to make the current state visible
+	 * to readers. Publishing creates an immutable copy of the tree (using the
+	 * copy constructor, i.e. without comparisons or evaluating the weight function;
+	 * for trees using NodeAllocatorCompact, this is a copy of the underlying arrays)
+	 * and replaces the previous version atomically. Readers obtain the latest
+	 * version with \ref snapshot() and can run any const query on it without
+	 * locking; they never see a partially modified tree and are not blocked
+	 * by the writer. Each version is freed when the last reader releases it.
+	 *
+	 * Publishing takes O(N) time, so the writer should typically apply a batch
+	 * of modifications between calls to publish().
+	 *
+	 * @tparam Tree Type of tree (any of the orbtree containers).
+	 */
+	template<class Tree>
+	class concurrent_tree {
+		public:
+			/// \brief type of tree stored
+			typedef Tree tree_type;
+			/// \brief reference to a published version of the tree, can be shared among threads
+			typedef std::shared_ptr<const Tree> snapshot_type;
+
+			/** \brief Create a new empty tree; arguments are passed to the constructor of Tree.
+			 * The empty tree is published as the first version. */
+			template<class... Args>
+			explicit concurrent_tree(Args&&... args) : w(std::forward<Args>(args)...), ver(0) { publish(); }
+
+			concurrent_tree(const concurrent_tree&) = delete;
+			concurrent_tree& operator = (const concurrent_tree&) = delete;
+
+			/** \brief Get the latest published version of the tree. Can be called from any
+			 * thread; the returned tree can be queried (with any const member function)
+			 * for as long as the caller keeps the reference. */
+			snapshot_type snapshot() const {
+#if __cplusplus >= 202002L
+				return current.load();
+#else
+				return std::atomic_load(&current);
+#endif
+			}
+			/// \brief Get the number of times the tree was published (including the initial empty version).
+			uint64_t version() const { return ver.load(); }
+
+			/** \brief Access the tree for modification. Can only be called by the writer
+			 * thread; changes are not visible to readers until \ref publish() is called. */
+			Tree& writer() { return w; }
+			/// \brief Read-only access to the writer's tree (only from the writer thread).
+			const Tree& writer() const { return w; }
+
+			/** \brief Publish the current state of the writer's tree as a new version.
+			 * Can only be called by the writer thread. Outdated partial sums are
+			 * recalculated first (if the tree uses lazy updates), so that queries on
+			 * the published version do not modify it. */
+			void publish() {
+				w.flush_sums();
+				snapshot_type s = std::make_shared<const Tree>(w);
+#if __cplusplus >= 202002L
+				current.store(std::move(s));
+#else
+				std::atomic_store(&current, std::move(s));
+#endif
+				ver++;
+			}
+
+		protected:
+			Tree w; ///< \brief tree modified by the writer
+#if __cplusplus >= 202002L
+			std::atomic<snapshot_type> current; ///< \brief latest published version
+#else
+			snapshot_type current; ///< \brief latest published version, only accessed with atomic operations
+#endif
+			std::atomic<uint64_t> ver; ///< \brief number of published versions
+	};
+}
+
+#endif
+
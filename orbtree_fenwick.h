@@ -0,0 +1,850 @@
+/*  -*- C++ -*-
+ * orbtree_fenwick.h -- containers with weights for keys from a dense
+ * 	range of integers, stored in a Fenwick tree (binary indexed tree)
+ *
+ * Copyright 2020 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+
+#ifndef ORBTREE_FENWICK_H
+#define ORBTREE_FENWICK_H
+
+#include "orbtree.h"
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <stdint.h>
+
+/* constexpr if support only for c++17 or newer */
+#if __cplusplus >= 201703L
+#define CONSTEXPR constexpr
+#else
+#define CONSTEXPR
+#endif
+
+/* size of temporary arrays storing weights (same as in orbtree_base.h) */
+#define ORBTREE_NV_SIZE (fixed_nr ? fixed_nr : f.get_nr())
+
+
+namespace orbtree {
+
+	/** \brief Container with weights for keys from a fixed range of integers,
+	 * stored in a Fenwick tree.
+	 *
+	 * Alternative to \ref orbtree::orbtree "orbtree" with mostly the same interface,
+	 * for the case when keys are integers from a dense range [0,N), where N (the
+	 * universe size) is given when creating the container (and can be changed
+	 * later by resize()). Each possible key has a fixed position in flat arrays,
+	 * so there are no comparisons, no links between nodes and no rebalancing.
+	 * Partial sums of weights are stored in a Fenwick tree (binary indexed tree),
+	 * i.e. one array with N elements for each component of the weights, so
+	 * inserting, erasing or changing an element and calculating partial sums take
+	 * O(log N) time. Keys that are not present have zero weight. Presence of keys
+	 * is stored in a bitmap, which is used for iteration and key searches.
+	 *
+	 * Iterators stay valid until the element they refer to is erased (or the
+	 * universe is resized so that it is removed). Memory use is proportional to
+	 * N (not the number of elements), so this is only useful if a large part of
+	 * the possible keys are present. Only sets and maps are supported (no
+	 * multisets or multimaps).
+	 *
+	 * It is recommended to use the templates \ref orbsetD, \ref orbmapD, \ref
+	 * simple_setD, \ref simple_mapD, \ref ranksetD and \ref rankmapD instead of
+	 * directly using this class template.
+	 *
+	 * @tparam KeyValueT Type of stored data, should be either KeyOnly or KeyValue,
+	 * 		with an unsigned integral key type
+	 * @tparam NVTypeT Type of weights (i.e. the return value of NVFunc)
+	 * @tparam NVFunc function that calculates the weights associated with
+	 * 		elements based on key and value (see NVFunc_Adapter_Simple)
+	 * @tparam simple determines if the weight function returns one value
+	 * 		(if true) or multiple values (if false), same as for orbtree
+	 */
+	template<class KeyValueT, class NVTypeT, class NVFunc, bool simple = false>
+	class orbtree_fenwick {
+		static_assert(std::is_integral<typename KeyValueT::KeyType>::value && std::is_unsigned<typename KeyValueT::KeyType>::value,
+			"orbtree_fenwick: keys should be unsigned integers!\n");
+		protected:
+			typedef KeyValueT KeyValue;
+			typedef typename KeyValueT::KeyType KeyType;
+		public:
+/* typedefs */
+			/// \brief Values stored in this container. Either the key (for sets)
+			///	or an orbtree::trivial_pair of key and value
+			typedef typename KeyValueT::ValueType value_type;
+			/// Key type of elements.
+			typedef KeyType key_type;
+			/// Type of values associated by elements (calculated by NVFunc)
+			typedef NVTypeT NVType;
+			typedef NVFunc NVFunc_t;
+			typedef size_t size_type;
+			typedef size_t difference_type;
+
+		protected:
+			/// \brief number of components returned by NVFunc if known at compile time (zero otherwise)
+			static constexpr unsigned int fixed_nr = NVFunc_fixed_nr<NVFunc>::value;
+
+			/// \brief storage of elements (one for each possible key), same choice as in NodeAllocatorCompact
+			typedef typename std::conditional< std::is_trivially_copyable<KeyValueT>::value,
+				realloc_vector::vector<KeyValue>, stacked_vector::vector<KeyValue, stacked_vector::std_vector_wrapper, true> >::type kv_vector_type;
+
+			kv_vector_type kv; ///< \brief elements, kv[k] is only valid if k is present
+			/** \brief Fenwick tree: node i (1 <= i <= N) stores the sum of weights of keys in
+			 * [i - lowbit(i), i), with the components of each node stored after each other;
+			 * node i starts at position (i - 1) * nr */
+			realloc_vector::vector<NVType> fw;
+			realloc_vector::vector<uint64_t> bits; ///< \brief bitmap of keys that are present
+			size_t universe; ///< \brief the number of possible keys (N)
+			size_t size1; ///< \brief number of elements stored
+			NVFunc f;
+
+			/// \brief number of components returned by NVFunc (compile-time constant if fixed_nr is nonzero)
+			unsigned int get_nr() const { return fixed_nr ? fixed_nr : f.get_nr(); }
+			/// \brief x = x + y, checks for overflow and throws exception in the case of integral types
+			void NVAdd(NVType* x, const NVType* y) const { NVOps<NVType>::add(x,y,get_nr()); }
+			/// \brief x = x - y, checks for overflow and throws exception in the case of integral types
+			void NVSubtract(NVType* x, const NVType* y) const { NVOps<NVType>::subtract(x,y,get_nr()); }
+			/// \brief set x to zero
+			void NVZero(NVType* x) const { for(unsigned int i = 0;i < get_nr();i++) x[i] = NVType(); }
+
+			/// \brief partial sums stored in node i of the Fenwick tree (1 <= i <= N)
+			NVType* fw_node(size_t i) { return fw.data() + (i - 1) * get_nr(); }
+			/// \copydoc fw_node()
+			const NVType* fw_node(size_t i) const { return fw.data() + (i - 1) * get_nr(); }
+			/// \brief lowest set bit of i, i.e. the number of keys covered by node i
+			static size_t lowbit(size_t i) { return i & (~i + 1); }
+
+			/// \brief check if key k is present
+			bool present(size_t k) const { return (bits[k / 64] >> (k % 64)) & 1U; }
+			/// \brief position of the lowest set bit in a nonzero word
+			static unsigned int lowest_bit(uint64_t x) {
+#if defined(__GNUC__)
+				return __builtin_ctzll(x);
+#else
+				unsigned int i = 0;
+				for(;!(x & 1U);x >>= 1) i++;
+				return i;
+#endif
+			}
+			/// \brief position of the highest set bit in a nonzero word
+			static unsigned int highest_bit(uint64_t x) {
+#if defined(__GNUC__)
+				return 63 - __builtin_clzll(x);
+#else
+				unsigned int i = 0;
+				for(;x >>= 1;) i++;
+				return i;
+#endif
+			}
+			/// \brief first key that is present and not less than k (or N if there is none)
+			size_t next_present(size_t k) const {
+				if(k >= universe) return universe;
+				size_t j = k / 64;
+				uint64_t x = bits[j] & (~(uint64_t)0 << (k % 64));
+				while(!x) {
+					if(++j >= bits.size()) return universe;
+					x = bits[j];
+				}
+				return j * 64 + lowest_bit(x);
+			}
+			/// \brief last key that is present and less than k (or N if there is none)
+			size_t prev_present(size_t k) const {
+				if(k > universe) k = universe;
+				if(k == 0) return universe;
+				size_t j = (k - 1) / 64;
+				unsigned int s = (k - 1) % 64;
+				uint64_t x = bits[j] & (s == 63 ? ~(uint64_t)0 : ((uint64_t)1 << (s + 1)) - 1);
+				while(!x) {
+					if(j == 0) return universe;
+					x = bits[--j];
+				}
+				return j * 64 + highest_bit(x);
+			}
+
+			/// \brief add w to the partial sums of all nodes that cover key k
+			void fw_add(size_t k, const NVType* w) {
+				for(size_t i = k + 1;i <= universe;i += lowbit(i)) NVAdd(fw_node(i), w);
+			}
+			/// \brief subtract w from the partial sums of all nodes that cover key k
+			void fw_subtract(size_t k, const NVType* w) {
+				for(size_t i = k + 1;i <= universe;i += lowbit(i)) NVSubtract(fw_node(i), w);
+			}
+			/// \brief sum of weights of keys less than k (k <= N)
+			void fw_prefix(size_t k, NVType* res) const {
+				NVZero(res);
+				for(size_t i = k;i;i -= lowbit(i)) NVAdd(res, fw_node(i));
+			}
+			/// \brief largest power of two not greater than N (zero if N is zero), used for searches
+			size_t top_step() const {
+				size_t s = 1;
+				if(universe == 0) return 0;
+				while(s <= universe / 2) s *= 2;
+				return s;
+			}
+			/// \brief throws an exception if the sum of all weights would overflow after adding w
+			void check_add(const NVType* w) const {
+				NVType norm[ORBTREE_NV_SIZE];
+				fw_prefix(universe, norm);
+				NVAdd(norm, w);
+			}
+
+			/// \brief change the value of the element with key k, updating the partial sums
+			template<class V> void update_value(size_t k, V&& v) {
+				NVType w1[ORBTREE_NV_SIZE];
+				NVType w2[ORBTREE_NV_SIZE];
+				f(kv[k].keyvalue(), w1);
+				KeyValue tmp(kv[k]);
+				tmp.value() = std::forward<V>(v);
+				f(tmp.keyvalue(), w2);
+				/* add the difference of weights: first check that the new total is not too large */
+				NVType norm[ORBTREE_NV_SIZE];
+				fw_prefix(universe, norm);
+				NVSubtract(norm, w1);
+				NVAdd(norm, w2);
+				fw_subtract(k, w1);
+				fw_add(k, w2);
+				kv[k] = std::move(tmp);
+			}
+
+			/// \brief throws an exception if the key is outside of the range of possible keys
+			size_t check_key(const KeyType& k, const char* msg) const {
+				if((size_t)k >= universe) throw std::out_of_range(msg);
+				return k;
+			}
+
+			/// \brief helper to insert a new element
+			std::pair<size_t,bool> insert_kv(KeyValue&& x) {
+				size_t k = check_key(x.key(), "orbtree_fenwick::insert(): key outside of the range of possible keys!\n");
+				if(present(k)) return std::pair<size_t,bool>(k,false);
+				NVType w[ORBTREE_NV_SIZE];
+				f(x.keyvalue(), w);
+				check_add(w);
+				kv[k] = std::move(x);
+				fw_add(k, w);
+				bits[k / 64] |= (uint64_t)1 << (k % 64);
+				size1++;
+				return std::pair<size_t,bool>(k,true);
+			}
+			/// \brief helper to erase the element with key k (which has to be present)
+			void erase_k(size_t k) {
+				NVType w[ORBTREE_NV_SIZE];
+				f(kv[k].keyvalue(), w);
+				fw_subtract(k, w);
+				bits[k / 64] &= ~((uint64_t)1 << (k % 64));
+				kv[k] = KeyValue();
+				size1--;
+			}
+
+			/// \brief helper for find_by_weight(): first element for which the sum of
+			/// weights in the given component including its own is greater than value
+			size_t find_by_weight_k(unsigned int component, const NVType& value, NVType* res) const {
+				if(component >= get_nr()) throw std::runtime_error("orbtree_fenwick::find_by_weight(): invalid component!\n");
+				size_t pos = 0;
+				NVType acc = NVType();
+				for(size_t s = top_step();s;s /= 2) if(pos + s <= universe) {
+					NVType x = acc + fw_node(pos + s)[component];
+					if(!(value < x)) {
+						pos += s;
+						acc = x;
+					}
+				}
+				/* sum for keys less than pos is not more than value, but including pos it is */
+				size_t k = next_present(pos);
+				if(res) fw_prefix(k, res);
+				return k;
+			}
+			/// \brief helper for lower_bound_w(): first element for which p(sum of weights before it) is true
+			template<class pred>
+			size_t lower_bound_w_k(const pred& p) const {
+				NVType acc[ORBTREE_NV_SIZE];
+				NVType cur[ORBTREE_NV_SIZE];
+				NVZero(acc);
+				if(p(acc)) return next_present(0);
+				size_t pos = 0;
+				for(size_t s = top_step();s;s /= 2) if(pos + s <= universe) {
+					for(unsigned int i = 0;i < get_nr();i++) cur[i] = acc[i];
+					NVAdd(cur, fw_node(pos + s));
+					if(!p(cur)) {
+						pos += s;
+						for(unsigned int i = 0;i < get_nr();i++) acc[i] = cur[i];
+					}
+				}
+				/* p() is false for the sum of keys less than pos, but true for all keys after pos */
+				return next_present(pos + 1);
+			}
+			/// \brief sum of weights of keys in [k1,k2) (zero if k2 is not after k1)
+			void get_range_sum_k(size_t k1, size_t k2, NVType* res) const {
+				if(k2 <= k1) NVZero(res);
+				else {
+					NVType tmp[ORBTREE_NV_SIZE];
+					fw_prefix(k2, res);
+					fw_prefix(k1, tmp);
+					NVSubtract(res, tmp);
+				}
+			}
+			/// \brief clamp a key used for searches to the range of possible keys
+			size_t clamp(const KeyType& k) const { return (size_t)k < universe ? (size_t)k : universe; }
+
+			void check_nv_equal(double epsilon, const NVType* x, const NVType* y, const char* msg) const {
+				/* if NVType is integral, we want exact match -- otherwise, we use epsilon for comparison */
+				if(std::is_integral<NVType>::value) { for(unsigned int i=0;i<get_nr();i++) if(x[i] != y[i]) throw std::runtime_error(msg); }
+				else for(unsigned int i=0;i<get_nr();i++) if(fabs(x[i]-y[i]) > epsilon) throw std::runtime_error(msg);
+			}
+
+		public:
+			/// \brief Create an empty container for keys in the range [0,n).
+			explicit orbtree_fenwick(size_t n = 0, const NVFunc& f_ = NVFunc()) : universe(0), size1(0), f(f_) {
+				if CONSTEXPR (simple) if(f.get_nr() != 1) {
+					throw std::runtime_error("For simple tree, weight function can only return one component!\n");
+				}
+				resize(n);
+			}
+			/// \copydoc orbtree_fenwick(size_t, const NVFunc&)
+			orbtree_fenwick(size_t n, NVFunc&& f_) : universe(0), size1(0), f(std::move(f_)) {
+				if CONSTEXPR (simple) if(f.get_nr() != 1) {
+					throw std::runtime_error("For simple tree, weight function can only return one component!\n");
+				}
+				resize(n);
+			}
+			/// \brief Create an empty container for keys in the range [0,n), passing t to the constructor of NVFunc.
+			template<class T>
+			orbtree_fenwick(size_t n, const T& t) : universe(0), size1(0), f(t) {
+				if CONSTEXPR (simple) if(f.get_nr() != 1) {
+					throw std::runtime_error("For simple tree, weight function can only return one component!\n");
+				}
+				resize(n);
+			}
+			/// \brief Exchange the contents of this container with t in constant time.
+			void swap(orbtree_fenwick& t) {
+				using std::swap;
+				kv.swap(t.kv);
+				fw.swap(t.fw);
+				bits.swap(t.bits);
+				swap(universe, t.universe);
+				swap(size1, t.size1);
+				swap(f, t.f);
+			}
+
+			/// Iterators
+			template<bool is_const>
+			struct iterator_base {
+				protected:
+					typedef typename std::conditional<is_const, const orbtree_fenwick, orbtree_fenwick>::type orbtree_t;
+				public:
+					/* typedefs */
+					typedef std::bidirectional_iterator_tag iterator_category;
+					typedef std::ptrdiff_t difference_type;
+					/** \brief Type of value pointed to by iterator; cannot be changed directly
+					 * (use the set_value() member function for maps) */
+					typedef const typename KeyValueT::ValueType value_type;
+					typedef value_type* pointer;
+					typedef value_type& reference;
+
+					friend struct iterator_base<!is_const>;
+					friend class orbtree_fenwick;
+				protected:
+					orbtree_t* t;
+					size_t k; ///< \brief key of the current element, N for the past-the-end iterator
+					iterator_base() = delete;
+					iterator_base(orbtree_t* t_, size_t k_):t(t_),k(k_) { }
+				public:
+					/* any iterator can be copied from non-const iterator;
+					 * this is not explicit so comparison operators can auto-convert */
+					iterator_base(const iterator_base<false>& it):t(it.t),k(it.k) { }
+					void operator = (const iterator_base<false>& it) { t = it.t; k = it.k; }
+					/* only const iterator can be copied from const iterator */
+					template<bool is_const_ = is_const>
+					iterator_base(const iterator_base<true>& it, typename std::enable_if<is_const_>::type* = 0 ):t(it.t),k(it.k) { }
+					template<bool is_const_ = is_const>
+					void operator = (typename std::enable_if<is_const_, const iterator_base<true> >::type& it) {
+						t = it.t;
+						k = it.k;
+					}
+
+					/// read-only access to values; dereferencing the past-the-end iterator throws an exception
+					reference operator * () const {
+						if(k >= t->universe) throw std::runtime_error("Attempt to dereference invalid orbtree_fenwick::iterator!\n");
+						return t->kv[k].keyvalue();
+					}
+					/// \copydoc operator*()
+					pointer operator -> () const {
+						if(k >= t->universe) throw std::runtime_error("Attempt to dereference invalid orbtree_fenwick::iterator!\n");
+						return &(t->kv[k].keyvalue());
+					}
+					/// change value stored in map
+					template<bool is_const_ = is_const, class KeyValue_ = KeyValue>
+					typename std::enable_if<!is_const_>::type set_value(typename KeyValue_::MappedType&& v) {
+						t->update_value(k,std::move(v));
+					}
+					/// change value stored in map
+					template<bool is_const_ = is_const, class KeyValue_ = KeyValue>
+					typename std::enable_if<!is_const_>::type set_value(typename KeyValue_::MappedType const& v) {
+						t->update_value(k,v);
+					}
+					/// convenience function to return the key (for both set and map)
+					key_type key() const { return (key_type)k; }
+
+					/// compare iterators (comparing iterators from different containers is undefined behavior)
+					template<bool is_const2> bool operator == (const iterator_base<is_const2>& i) const { return k == i.k; }
+					/// compare iterators (comparing iterators from different containers is undefined behavior)
+					template<bool is_const2> bool operator != (const iterator_base<is_const2>& i) const { return k != i.k; }
+
+					/// increment: move to the next element
+					iterator_base& operator ++() { k = t->next_present(k + 1); return *this; }
+					/// increment: move to the next element
+					iterator_base operator ++(int) { iterator_base<is_const> i(*this); ++(*this); return i; }
+					/// decrement: move to the previous element
+					iterator_base& operator --() { k = t->prev_present(k); return *this; }
+					/// decrement: move to the previous element
+					iterator_base operator --(int) { iterator_base<is_const> i(*this); --(*this); return i; }
+			};
+
+			/// iterator that does not allow modification
+			typedef iterator_base<true> const_iterator;
+			/// iteraror that allows the modification of the stored value (for maps)
+			typedef typename std::conditional<KeyValue::keyonly, iterator_base<true>, iterator_base<false> >::type iterator;
+			iterator begin() { return iterator(this,next_present(0)); } /// get an iterator to the beginning (element with the lowest key value)
+			const_iterator begin() const { return const_iterator(this,next_present(0)); } /// get an iterator to the beginning (element with the lowest key value)
+			const_iterator cbegin() const { return const_iterator(this,next_present(0)); } /// get an iterator to the beginning (element with the lowest key value)
+			iterator end() { return iterator(this,universe); } /// get the past-the-end iterator
+			const_iterator end() const { return const_iterator(this,universe); } /// get the past-the-end iterator
+			const_iterator cend() const { return const_iterator(this,universe); } /// get the past-the-end iterator
+
+/* 1. size */
+			bool empty() const { return size1 == 0; } /// check if the container is empty
+			size_t size() const { return size1; } /// return the number of elemets
+			/// number of possible keys, i.e. keys need to be in the range [0,universe_size())
+			size_t universe_size() const { return universe; }
+			/// maximum number of elements (same as the number of possible keys)
+			size_t max_size() const { return universe; }
+			/// number of components returned by the weight function
+			unsigned int get_nr_components() const { return get_nr(); }
+			/// \brief Remove all elements (the number of possible keys does not change).
+			void clear() {
+				for(size_t k = next_present(0);k < universe;k = next_present(k + 1)) kv[k] = KeyValue();
+				std::fill(fw.begin(), fw.end(), NVType());
+				std::fill(bits.begin(), bits.end(), 0);
+				size1 = 0;
+			}
+			/** \brief Change the range of possible keys to [0,n).
+			 *
+			 * Elements with keys not less than n are removed. Partial sums of
+			 * the remaining keys do not need to be recalculated, this takes
+			 * O(|n - N| log N) time. */
+			void resize(size_t n);
+			/// \brief Give back memory not used by the arrays currently.
+			void shrink_to_fit() {
+				kv.shrink_to_fit();
+				fw.shrink_to_fit();
+				bits.shrink_to_fit();
+			}
+
+/* 2. add / remove */
+			/// insert new element, returns an iterator to it (or the existing element with the same key)
+			/// and whether the insert happened
+			std::pair<iterator,bool> insert(const value_type& v) {
+				std::pair<size_t,bool> r = insert_kv(KeyValue(v));
+				return std::pair<iterator,bool>(iterator(this,r.first),r.second);
+			}
+			/// \copydoc insert(const value_type&)
+			std::pair<iterator,bool> insert(value_type&& v) {
+				std::pair<size_t,bool> r = insert_kv(KeyValue(std::move(v)));
+				return std::pair<iterator,bool>(iterator(this,r.first),r.second);
+			}
+			/// insert all elements from the range [first,last)
+			template<class InputIt> void insert(InputIt first, InputIt last) {
+				for(;first != last;++first) insert(*first);
+			}
+			/// insert new element, constructed from args
+			template<class... Args> std::pair<iterator,bool> emplace(Args&&... args) {
+				return insert(value_type(std::forward<Args>(args)...));
+			}
+			/** \brief Replace the contents with the elements in [first,last).
+			 *
+			 * Elements do not need to be sorted, but this is called assign_sorted()
+			 * for consistency with orbtree. For repeated keys, only the first one is
+			 * stored. This takes O(N + n) time, as the partial sums are built in one
+			 * pass after inserting all elements. */
+			template<class InputIt> void assign_sorted(InputIt first, InputIt last);
+
+			/// erase element pointed to by iterator, returns an iterator to the next element
+			iterator erase(const_iterator pos) {
+				size_t k = pos.k;
+				if(k >= universe || !present(k)) throw std::runtime_error("orbtree_fenwick::erase(): invalid iterator!\n");
+				erase_k(k);
+				return iterator(this,next_present(k + 1));
+			}
+			/// erase elements in the range [first,last), returns last
+			iterator erase(const_iterator first, const_iterator last) {
+				for(size_t k = next_present(first.k);k < last.k;k = next_present(k + 1)) erase_k(k);
+				return iterator(this,last.k);
+			}
+			/// erase all elements for which p returns true, returns the number of elements erased
+			template<class Pred> size_t erase_if(Pred p) {
+				size_t n = 0;
+				for(size_t k = next_present(0);k < universe;k = next_present(k + 1))
+					if(p(kv[k].keyvalue())) {
+						erase_k(k);
+						n++;
+					}
+				return n;
+			}
+			/// erase element with the given key, returns the number of elements erased (0 or 1)
+			size_t erase(const key_type& k) {
+				if((size_t)k >= universe || !present(k)) return 0;
+				erase_k(k);
+				return 1;
+			}
+
+/* 3. search */
+			/// returns the number of elements with the given key (0 or 1)
+			size_t count(const key_type& k) const { return ((size_t)k < universe && present(k)) ? 1 : 0; }
+			/// returns true if an element with the given key is present
+			bool contains(const key_type& k) const { return count(k) != 0; }
+			/// find element with the given key, returns end() if not found
+			iterator find(const key_type& k) { return iterator(this,count(k) ? (size_t)k : universe); }
+			/// \copydoc find()
+			const_iterator find(const key_type& k) const { return const_iterator(this,count(k) ? (size_t)k : universe); }
+			/// find the first element with key not less than k
+			iterator lower_bound(const key_type& k) { return iterator(this,next_present(k)); }
+			/// \copydoc lower_bound()
+			const_iterator lower_bound(const key_type& k) const { return const_iterator(this,next_present(k)); }
+			/// find the first element with key greater than k
+			iterator upper_bound(const key_type& k) { return iterator(this,next_present((size_t)k + 1)); }
+			/// \copydoc upper_bound()
+			const_iterator upper_bound(const key_type& k) const { return const_iterator(this,next_present((size_t)k + 1)); }
+			/// return the range of elements with the given key
+			std::pair<iterator,iterator> equal_range(const key_type& k) {
+				return std::pair<iterator,iterator>(lower_bound(k),upper_bound(k));
+			}
+			/// \copydoc equal_range()
+			std::pair<const_iterator,const_iterator> equal_range(const key_type& k) const {
+				return std::pair<const_iterator,const_iterator>(lower_bound(k),upper_bound(k));
+			}
+			/** \brief Find the first element for which the predicate returns true for the
+			 * sum of weights before it, see \ref orbtree::orbtree::lower_bound_w() "orbtree::lower_bound_w()".
+			 * The predicate should be monotonic in the sum of weights. */
+			template<class pred> iterator lower_bound_w(const pred& p) { return iterator(this,lower_bound_w_k(p)); }
+			/// \copydoc lower_bound_w()
+			template<class pred> const_iterator lower_bound_w(const pred& p) const { return const_iterator(this,lower_bound_w_k(p)); }
+			/// returns the first element with generalized rank not less than r (only for cases with scalar weight function)
+			template<bool simple_ = simple> iterator lower_bound_rank(const NVType& r) {
+				return lower_bound_w([&r] (const NVType* x) { return *x >= r; });
+			}
+			/// returns the first element with generalized rank not less than r (only for cases with scalar weight function)
+			template<bool simple_ = simple> const_iterator lower_bound_rank(const NVType& r) const {
+				return lower_bound_w([&r] (const NVType* x) { return *x >= r; });
+			}
+			/** \brief Find the element whose weight covers value in the given component,
+			 * see \ref orbtree::find_by_weight(). Weights should not be negative. */
+			iterator find_by_weight(unsigned int component, const NVType& value, NVType* res = 0) {
+				return iterator(this,find_by_weight_k(component,value,res));
+			}
+			/// \copydoc find_by_weight()
+			const_iterator find_by_weight(unsigned int component, const NVType& value, NVType* res = 0) const {
+				return const_iterator(this,find_by_weight_k(component,value,res));
+			}
+			/** \brief Weighted sampling for simple containers: find the element whose weight
+			 * covers u (see \ref find_by_weight()) and return it along with the partial sum
+			 * of the weights before it. */
+			template<bool simple_ = simple>
+			std::pair<iterator,NVType> sample(typename std::enable_if<simple_,const NVType&>::type u) {
+				NVType res;
+				size_t k = find_by_weight_k(0,u,&res);
+				return std::pair<iterator,NVType>(iterator(this,k),res);
+			}
+			/// \copydoc sample()
+			template<bool simple_ = simple>
+			std::pair<const_iterator,NVType> sample(typename std::enable_if<simple_,const NVType&>::type u) const {
+				NVType res;
+				size_t k = find_by_weight_k(0,u,&res);
+				return std::pair<const_iterator,NVType>(const_iterator(this,k),res);
+			}
+
+/* 4. partial sums of weights */
+			/** \brief Calculate partial sum of the weights of elements
+			 * that come before the one pointed to by it.
+			 *
+			 * Result is returned in res, which must point to an array
+			 * large enough (with as many elements as the components
+			 * calculated by NVFunc) */
+			void get_sum_node(const_iterator it, NVType* res) const { fw_prefix(it.k,res); }
+			/// \brief Calculate partial sum of the weights of elements before it, for simple containers.
+			template<bool simple_ = simple>
+			NVType get_sum_node(typename std::enable_if<simple_,const_iterator>::type it) const {
+				NVType res;
+				fw_prefix(it.k,&res);
+				return res;
+			}
+			/** \brief Calculate partial sum of weights for keys that come before k.
+			 *
+			 * Result is returned in res, which must point to an array large enough. */
+			template<bool simple_ = simple>
+			void get_sum(const key_type& k, typename std::enable_if<!simple_,NVType*>::type res) const { fw_prefix(clamp(k),res); }
+			/// \brief Calculate partial sum of weights for keys that come before k, for simple containers.
+			template<bool simple_ = simple>
+			typename std::enable_if<simple_,NVType>::type get_sum(const key_type& k) const {
+				NVType res;
+				fw_prefix(clamp(k),&res);
+				return res;
+			}
+			/** \brief Calculate partial sum of weights for multiple keys. Results are stored
+			 * in res, which must point to an array of size n_keys * NVFunc::get_nr(). */
+			template<class KeyIt> void get_sums(KeyIt first, KeyIt last, NVType* res) const {
+				for(;first != last;++first, res += get_nr()) fw_prefix(clamp(*first),res);
+			}
+			/// Calculate normalization, i.e. sum of all weights.
+			template<bool simple_ = simple>
+			void get_norm(typename std::enable_if<!simple_,NVType*>::type res) const { fw_prefix(universe,res); }
+			/// Calculate normalization, i.e. sum of all weights.
+			template<bool simple_ = simple> NVType get_norm(typename std::enable_if<simple_,void*>::type k = 0) const {
+				NVType res;
+				fw_prefix(universe,&res);
+				return res;
+			}
+			/** \brief Calculate the sum of weights for keys in the range [lo,hi)
+			 * (zero if hi is not after lo). */
+			template<bool simple_ = simple>
+			void get_range_sum(const key_type& lo, const key_type& hi, typename std::enable_if<!simple_,NVType*>::type res) const {
+				get_range_sum_k(clamp(lo), clamp(hi), res);
+			}
+			/// \brief Calculate the sum of weights for keys in the range [lo,hi), for simple containers.
+			template<bool simple_ = simple>
+			typename std::enable_if<simple_,NVType>::type get_range_sum(const key_type& lo, const key_type& hi) const {
+				NVType res;
+				get_range_sum_k(clamp(lo), clamp(hi), &res);
+				return res;
+			}
+			/// \brief Calculate the sum of weights for elements in the range [it1,it2).
+			void get_range_sum_node(const_iterator it1, const_iterator it2, NVType* res) const {
+				get_range_sum_k(it1.k,it2.k,res);
+			}
+			/// \brief Calculate the sum of weights for elements in the range [it1,it2), for simple containers.
+			template<bool simple_ = simple>
+			NVType get_range_sum_node(typename std::enable_if<simple_,const_iterator>::type it1, const_iterator it2) const {
+				NVType res;
+				get_range_sum_k(it1.k,it2.k,&res);
+				return res;
+			}
+			/** \brief check that the container is valid
+			 *
+			 * Checks that the bitmap and stored keys are consistent, throws exception
+			 * on error. Also checks that partial sums are consistent with the weights
+			 * of the elements if epsilon >= 0 (epsilon is the tolerance for rounding
+			 * errors if NVType is not integral) */
+			void check_tree(double epsilon = -1.0) const;
+	};
+
+	/// \brief swap the contents of two containers
+	template<class KeyValueT, class NVTypeT, class NVFunc, bool simple>
+	void swap(orbtree_fenwick<KeyValueT, NVTypeT, NVFunc, simple>& t1, orbtree_fenwick<KeyValueT, NVTypeT, NVFunc, simple>& t2) {
+		t1.swap(t2);
+	}
+
+	template<class KeyValueT, class NVTypeT, class NVFunc, bool simple>
+	void orbtree_fenwick<KeyValueT,NVTypeT,NVFunc,simple>::resize(size_t n) {
+		if(n && n - 1 > (size_t)std::numeric_limits<KeyType>::max())
+			throw std::runtime_error("orbtree_fenwick::resize(): keys cannot represent the given range!\n");
+		size_t nw = (n + 63) / 64;
+		if(n < universe) {
+			/* remove elements that are outside the new range */
+			for(size_t k = next_present(n);k < universe;k = next_present(k + 1)) {
+				kv[k] = KeyValue();
+				size1--;
+			}
+			kv.resize(n);
+			fw.resize(n * get_nr());
+			bits.resize(nw);
+			if(n % 64) bits[nw - 1] &= ((uint64_t)1 << (n % 64)) - 1;
+			universe = n;
+			return;
+		}
+		if(n == universe) return;
+		kv.resize(n);
+		fw.resize(n * get_nr(), NVType());
+		bits.resize(nw, 0);
+		/* new nodes can cover keys in the old range as well: their sum is the sum of
+		 * the nodes that partition the range covered by them (these come before them) */
+		for(size_t i = universe + 1;i <= n;i++) {
+			size_t lo = i - lowbit(i);
+			for(size_t j = i - 1;j > lo;j -= lowbit(j)) NVAdd(fw_node(i), fw_node(j));
+		}
+		universe = n;
+	}
+
+	template<class KeyValueT, class NVTypeT, class NVFunc, bool simple> template<class InputIt>
+	void orbtree_fenwick<KeyValueT,NVTypeT,NVFunc,simple>::assign_sorted(InputIt first, InputIt last) {
+		clear();
+		try {
+			NVType w[ORBTREE_NV_SIZE];
+			for(;first != last;++first) {
+				KeyValue x(*first);
+				size_t k = check_key(x.key(), "orbtree_fenwick::assign_sorted(): key outside of the range of possible keys!\n");
+				if(present(k)) continue;
+				f(x.keyvalue(), w);
+				NVAdd(fw_node(k + 1), w);
+				kv[k] = std::move(x);
+				bits[k / 64] |= (uint64_t)1 << (k % 64);
+				size1++;
+			}
+			/* build partial sums: add each node to its parent */
+			for(size_t i = 1;i <= universe;i++) {
+				size_t j = i + lowbit(i);
+				if(j <= universe) NVAdd(fw_node(j), fw_node(i));
+			}
+		}
+		catch(...) {
+			clear();
+			throw;
+		}
+	}
+
+	template<class KeyValueT, class NVTypeT, class NVFunc, bool simple>
+	void orbtree_fenwick<KeyValueT,NVTypeT,NVFunc,simple>::check_tree(double epsilon) const {
+		if(kv.size() != universe || fw.size() != universe * get_nr() || bits.size() != (universe + 63) / 64)
+			throw std::runtime_error("orbtree_fenwick::check_tree(): inconsistent array sizes!\n");
+		if(universe % 64 && (bits[universe / 64] >> (universe % 64)))
+			throw std::runtime_error("orbtree_fenwick::check_tree(): key outside of range present!\n");
+		size_t n = 0;
+		for(size_t k = next_present(0);k < universe;k = next_present(k + 1)) {
+			if((size_t)kv[k].key() != k) throw std::runtime_error("orbtree_fenwick::check_tree(): inconsistent key!\n");
+			n++;
+		}
+		if(n != size1) throw std::runtime_error("orbtree_fenwick::check_tree(): inconsistent size!\n");
+		if(epsilon < 0.0) return;
+		/* build all partial sums again and compare */
+		realloc_vector::vector<NVType> fw2(universe * get_nr(), NVType());
+		NVType w[ORBTREE_NV_SIZE];
+		for(size_t k = next_present(0);k < universe;k = next_present(k + 1)) {
+			f(kv[k].keyvalue(), w);
+			NVAdd(fw2.data() + k * get_nr(), w);
+		}
+		for(size_t i = 1;i <= universe;i++) {
+			size_t j = i + lowbit(i);
+			if(j <= universe) NVAdd(fw2.data() + (j - 1) * get_nr(), fw2.data() + (i - 1) * get_nr());
+			check_nv_equal(epsilon, fw2.data() + (i - 1) * get_nr(), fw_node(i), "orbtree_fenwick::check_tree(): partial sums are inconsistent!\n");
+		}
+	}
+
+
+	/** \brief Map based on orbtree_fenwick, adds the functions specific to maps
+	 * (the same as \ref orbtree::orbtreemap "orbtreemap"). */
+	template<class KeyValueT, class NVTypeT, class NVFunc, bool simple = false>
+	class orbtreemap_fenwick : public orbtree_fenwick<KeyValueT, NVTypeT, NVFunc, simple> {
+		protected:
+			typedef orbtree_fenwick<KeyValueT, NVTypeT, NVFunc, simple> base;
+		public:
+			typedef typename base::value_type value_type;
+			typedef typename base::key_type key_type;
+			typedef typename base::iterator iterator;
+			typedef typename base::const_iterator const_iterator;
+			/// type of values stored in this map
+			typedef typename KeyValueT::MappedType mapped_type;
+
+			explicit orbtreemap_fenwick(size_t n = 0, const NVFunc& f_ = NVFunc()) : base(n,f_) { }
+			orbtreemap_fenwick(size_t n, NVFunc&& f_) : base(n,std::move(f_)) { }
+			template <class T>
+			orbtreemap_fenwick(size_t n, const T& t) : base(n,t) { }
+
+			/// Access mapped value for the given key, throws an exception if not such key is found
+			const mapped_type& at(const key_type& k) const {
+				const_iterator it = base::find(k);
+				if(it == base::cend()) throw std::out_of_range("orbtreemap_fenwick::at(): key not present in map!\n");
+				return it->second;
+			}
+			/// Access mapped value for a given key, inserts a new element with the default value if not found.
+			const mapped_type& operator[](const key_type& k) {
+				iterator it = base::find(k);
+				if(it == base::end()) it = base::insert(value_type(k,mapped_type())).first;
+				return it->second;
+			}
+			/** \brief set value associated with the given key or insert new element
+			 * 
+			 * Returns true if a new element was inserted, false if the
+			 * value of an existing element was updated. */
+			bool set_value(const key_type& k, const mapped_type& v) {
+				std::pair<iterator,bool> tmp = base::insert(value_type(k,v));
+				if(tmp.second == false) tmp.first.set_value(v);
+				return tmp.second;
+			}
+	};
+
+
+	/** \class orbtree::orbsetD
+	 * \brief Set of integers from a dense range [0,N) with weights, stored in a Fenwick tree
+	 * (see \ref orbtree::orbtree_fenwick "orbtree_fenwick").
+	 */
+	template<class Key, class NVFunc>
+	using orbsetD = orbtree_fenwick< KeyOnly<Key>, typename NVFunc::result_type, NVFunc, false >;
+
+	/** \class orbtree::orbmapD
+	 * \brief Map with integer keys from a dense range [0,N) and weights, stored in a Fenwick tree.
+	 */
+	template<class Key, class Value, class NVFunc>
+	using orbmapD = orbtreemap_fenwick< KeyValue<Key,Value>, typename NVFunc::result_type, NVFunc, false >;
+
+	/** \class orbtree::simple_setD
+	 * \brief Same as \ref orbtree::simple_set "simple_set", but for integer keys from a dense range,
+	 * stored in a Fenwick tree.
+	 */
+	template<class Key, class NVFunc>
+	using simple_setD = orbtree_fenwick< KeyOnly<Key>, typename NVFunc::result_type, NVFunc_Adapter_Simple<NVFunc>, true >;
+
+	/** \class orbtree::simple_mapD
+	 * \brief Same as \ref orbtree::simple_map "simple_map", but for integer keys from a dense range,
+	 * stored in a Fenwick tree.
+	 */
+	template<class Key, class Value, class NVFunc>
+	using simple_mapD = orbtreemap_fenwick< KeyValue<Key,Value>, typename NVFunc::result_type, NVFunc_Adapter_Simple<NVFunc>, true >;
+
+	/** \class orbtree::ranksetD
+	 * \brief Same as \ref orbtree::rankset "rankset", but for integer keys from a dense range,
+	 * stored in a Fenwick tree.
+	 */
+	template<class Key, class NVType = uint32_t>
+	using ranksetD = orbtree_fenwick< KeyOnly<Key>, NVType, NVFunc_Adapter_Simple<RankFunc<Key, NVType> >, true >;
+
+	/** \class orbtree::rankmapD
+	 * \brief Same as \ref orbtree::rankmap "rankmap", but for integer keys from a dense range,
+	 * stored in a Fenwick tree.
+	 */
+	template<class Key, class Value, class NVType = uint32_t>
+	using rankmapD = orbtreemap_fenwick< KeyValue<Key,Value>, NVType,
+			NVFunc_Adapter_Simple< RankFunc<trivial_pair<Key,Value>, NVType > >, true >;
+}
+
+#undef ORBTREE_NV_SIZE
+#undef CONSTEXPR
+
+#endif
+
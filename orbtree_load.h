@@ -0,0 +1,235 @@
+/*  -*- C++ -*-
+ * orbtree_load.h -- fill trees with data read from text files in parallel
+ *
+ * Copyright 2020 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+
+#ifndef ORBTREE_LOAD_H
+#define ORBTREE_LOAD_H
+
+#include "orbtree.h"
+#include "read_table.h"
+#include <vector>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <string.h>
+
+
+namespace orbtree {
+
+	/// \brief helper for \ref load_file(): the key of an element read for a set
+	template<class K> const K& load_key(const K& k) { return k; }
+	/// \brief helper for \ref load_file(): the key of an element read for a map
+	template<class K, class V> const K& load_key(const trivial_pair<K,V>& p) { return p.first; }
+	/// \brief helper for \ref load_file(): read one key (the first field of a line)
+	template<class K> bool load_parse_default(read_table2& r, K& k) { return r.read(k); }
+	/// \brief helper for \ref load_file(): read one key and value (the first two fields of a line)
+	template<class K, class V> bool load_parse_default(read_table2& r, trivial_pair<K,V>& p) {
+		return r.read(p.first, p.second);
+	}
+	/// \brief helper for \ref load_file(): throw an exception with the position of the last error in r
+	inline void load_error(read_table2& r) {
+		if(r.get_last_error() == T_OK) r.last_error = T_FORMAT; /* custom parse function failed */
+		throw std::runtime_error(r.exception_string("orbtree::load_file(): "));
+	}
+	
+	/** \brief Replace the contents of a tree with elements read from a text
+	 * file, using multiple threads.
+	 * 
+	 * Each (non-empty) line of the input contains one element; parse is called
+	 * once for each line with a read_table2 instance positioned at the start of
+	 * the line and a reference to the element to fill in, and should return
+	 * false on error (parse can use any of the read functions of read_table2).
+	 * 
+	 * The file is mapped into memory (see read_table2::use_mmap()) and split
+	 * into nthreads chunks at line boundaries. Each chunk is parsed and sorted
+	 * by a separate thread, the sorted pieces are merged in parallel, and the
+	 * tree is built from the result with assign_sorted(), in linear time. The
+	 * order of elements with equal keys is the same as in the file, i.e. the
+	 * result is the same as inserting elements one by one into an empty tree
+	 * (for a non-multi tree, the first element with each key is kept). If the
+	 * file cannot be mapped (e.g. it is a pipe) or nthreads <= 1, the input is
+	 * parsed in the calling thread. nthreads == 0 means to use
+	 * std::thread::hardware_concurrency(). parse and the comparison functor
+	 * are called from multiple threads.
+	 * 
+	 * delim and comment are the field delimiter and comment character (see
+	 * read_table2::set_delim() and read_table2::set_comment()). Throws an
+	 * exception if the file cannot be opened or read, or an error occurs
+	 * while parsing (the message includes the line in the file); in this case,
+	 * the tree is not changed. Returns the number of elements in the tree.
+	 * 
+	 * min_chunk is the minimum size of the input (in bytes) processed by one
+	 * thread, i.e. files smaller than 2 * min_chunk are parsed by one thread. */
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi, bool simple, class Parse>
+	size_t load_file_parse(orbtree<NodeAllocator, Compare, NVFunc, multi, simple>& t, const char* fn,
+			Parse parse, unsigned int nthreads = 0, char delim = 0, char comment = 0, size_t min_chunk = 1048576) {
+		typedef typename std::remove_const<typename orbtree<NodeAllocator, Compare, NVFunc, multi, simple>::value_type>::type E;
+		if(min_chunk == 0) min_chunk = 1;
+		if(nthreads == 0) nthreads = std::thread::hardware_concurrency();
+		if(nthreads == 0) nthreads = 1;
+		
+		read_table2 r(fn);
+		if(r.get_last_error() != T_OK) throw std::runtime_error(r.exception_string("orbtree::load_file(): "));
+		r.set_delim(delim);
+		r.set_comment(comment);
+		
+		Compare c = t.key_comp();
+		auto cmp = [&c] (const E& x, const E& y) { return c(load_key(x),load_key(y)); };
+		/* parse lines from rt into res and sort them -- returns false on error */
+		auto parse_sort = [&parse,&cmp] (read_table2& rt, std::vector<E>& res) {
+			while(rt.read_line()) {
+				res.emplace_back();
+				if(!parse(rt,res.back())) return false;
+			}
+			if(rt.get_last_error() != T_EOF) return false;
+			std::stable_sort(res.begin(),res.end(),cmp);
+			return true;
+		};
+		
+		std::vector<std::vector<E> > parts;
+		size_t start = 0;
+		size_t size = 0;
+		if(nthreads > 1 && r.use_mmap()) {
+			start = r.map_pos;
+			size = r.map_size;
+		}
+		size_t nchunks = (size - start) / min_chunk;
+		if(nchunks > nthreads) nchunks = nthreads;
+		if(nchunks <= 1) {
+			/* parse in the calling thread */
+			parts.resize(1);
+			if(!parse_sort(r,parts[0])) load_error(r);
+		}
+		else {
+			/* 1. split the input at the first newline after evenly spaced positions */
+			std::vector<size_t> bounds(1,start);
+			for(size_t j = 1;j < nchunks;j++) {
+				size_t p = start + ((size - start) * j) / nchunks;
+				if(p < bounds.back()) p = bounds.back();
+				const char* nl = (const char*)memchr(r.map + p, '\n', size - p);
+				p = nl ? (nl - r.map) + 1 : size;
+				if(p > bounds.back() && p < size) bounds.push_back(p);
+			}
+			bounds.push_back(size);
+			nchunks = bounds.size() - 1;
+			
+			/* 2. parse and sort chunks in parallel */
+			parts.resize(nchunks);
+			std::vector<std::exception_ptr> errors(nchunks);
+			auto worker = [&] (size_t j) {
+				try {
+					read_table2 rt((FILE*)0);
+					rt.set_delim(delim);
+					rt.set_comment(comment);
+					rt.set_fn(fn);
+					rt.use_buffer(r.map + bounds[j], bounds[j+1] - bounds[j]);
+					if(!parse_sort(rt,parts[j])) {
+						/* count lines before this chunk, so that the error message gives the line in the file */
+						const char* p = r.map + start;
+						const char* end = r.map + bounds[j];
+						for(;p < end && (p = (const char*)memchr(p, '\n', end - p));p++) rt.line++;
+						load_error(rt);
+					}
+				}
+				catch(...) { errors[j] = std::current_exception(); }
+			};
+			std::vector<std::thread> threads;
+			for(size_t j = 1;j < nchunks;j++) {
+				try { threads.emplace_back(worker,j); }
+				catch(...) { worker(j); } /* could not start a new thread, do it here */
+			}
+			worker(0);
+			for(std::thread& th : threads) th.join();
+			for(const std::exception_ptr& e : errors) if(e) std::rethrow_exception(e);
+			
+			/* 3. merge pairs of neighboring pieces in parallel, so that elements
+			 * with equal keys stay in the order of the input */
+			while(parts.size() > 1) {
+				std::vector<std::vector<E> > merged((parts.size() + 1) / 2);
+				auto merge_worker = [&parts,&merged,&cmp] (size_t j) {
+					if(2*j + 1 == parts.size()) merged[j].swap(parts[2*j]);
+					else {
+						std::vector<E>& a = parts[2*j];
+						std::vector<E>& b = parts[2*j + 1];
+						merged[j].reserve(a.size() + b.size());
+						std::merge(std::make_move_iterator(a.begin()), std::make_move_iterator(a.end()),
+							std::make_move_iterator(b.begin()), std::make_move_iterator(b.end()),
+							std::back_inserter(merged[j]), cmp);
+						std::vector<E>().swap(a);
+						std::vector<E>().swap(b);
+					}
+				};
+				threads.clear();
+				for(size_t j = 1;j < merged.size();j++) {
+					try { threads.emplace_back(merge_worker,j); }
+					catch(...) { merge_worker(j); }
+				}
+				merge_worker(0);
+				for(std::thread& th : threads) th.join();
+				parts.swap(merged);
+			}
+		}
+		
+		/* 4. build the tree in one pass */
+		t.assign_sorted(parts[0].begin(),parts[0].end());
+		return t.size();
+	}
+	
+	/** \brief Replace the contents of a tree with elements read from a text
+	 * file, using multiple threads.
+	 * 
+	 * Same as \ref load_file_parse(), reading the key from the first field of
+	 * each line for a set, and the key and the value from the first two fields
+	 * for a map (other fields are ignored). Keys and values can be any type
+	 * that read_table2 can parse (integers, double or strings).
+	 * 
+	 * Example: read a weighted edge list, where the value (weight) of each
+	 * edge is given after its ID:
+	 * 
+	 *     orbtree::rankmapC<uint64_t, double> edges;
+	 *     orbtree::load_file(edges, "edges.tsv", 8, '\t');
+	 */
+	template<class NodeAllocator, class Compare, class NVFunc, bool multi, bool simple>
+	size_t load_file(orbtree<NodeAllocator, Compare, NVFunc, multi, simple>& t, const char* fn,
+			unsigned int nthreads = 0, char delim = 0, char comment = 0, size_t min_chunk = 1048576) {
+		typedef typename std::remove_const<typename orbtree<NodeAllocator, Compare, NVFunc, multi, simple>::value_type>::type E;
+		return load_file_parse(t, fn, [] (read_table2& r, E& e) { return load_parse_default(r,e); },
+			nthreads, delim, comment, min_chunk);
+	}
+}
+
+#endif
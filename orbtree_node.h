@@ -37,11 +37,16 @@
 #define ORBTREE_NODE_H
 
 #include <functional>
+#include <cstddef>
 #include <stdexcept>
 #include <type_traits>
 #include <limits>
 #include <utility>
 #include <algorithm>
+#include <array>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 
 
 //~ #ifdef USE_STACKED_VECTOR
@@ -52,6 +57,12 @@
 //~ template <class T> using compact_vector = realloc_vector::vector<T>;
 //~ #endif
 
+#ifdef REALLOC_VECTOR_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
 /* constexpr if support only for c++17 or newer */
 #if __cplusplus >= 201703L
 #define CONSTEXPR constexpr
@@ -157,14 +168,35 @@ namespace orbtree {
 	 * 
 	 * @tparam KeyValueT Type of stored data, should be either KeyOnly or KeyValue
 	 * @tparam NVTypeT Type of extra data stored along in nodes (i.e. the return value of the function whose sum can be calculated).
+	 * @tparam simple Whether the weight function returns only one value, in this case it is stored directly in the node.
+	 * @tparam fixed_nr If nonzero, the weight function returns this many values (known at compile time);
+	 * 	in this case, they are stored in an array in the node instead of a separately allocated array.
+	 * @tparam pool If true, nodes (and their partial sum arrays) are allocated from large slabs
+	 * 	instead of individually. Deleted nodes are kept in a free list for reuse; memory is only
+	 * 	given back when the tree is cleared or destroyed. Clearing the tree does not need to visit
+	 * 	individual nodes if KeyValueT is trivially destructible. Nodes are never moved, so pointers
+	 * 	and iterators stay valid the same way as with the default allocation.
+	 * @tparam cache_weight If true, the weight of each node (the value of the weight function for
+	 * 	its key and value) is stored along with its partial sum, so that the weight function only
+	 * 	needs to be called when a node is inserted or its value changes (instead of during every
+	 * 	search and rotation). This doubles the memory used for storing partial sums.
 	 */
-	template<class KeyValueT, class NVTypeT, bool simple = false>
+	template<class KeyValueT, class NVTypeT, bool simple = false, unsigned int fixed_nr = 0, bool pool = false, bool cache_weight = false>
 	class NodeAllocatorPtr {
 		protected: /* everything is protected, red-black tree class inherits from this */
 			
 			typedef KeyValueT KeyValue;
 			typedef NVTypeT NVType;
 			
+			/// \brief true if the weight of each node is stored (see \ref get_node_weight())
+			static constexpr bool stores_weight = cache_weight;
+			/// \brief number of values stored for each weight component: partial sum, and optionally the node's own weight after it
+			static constexpr unsigned int sum_mult = cache_weight ? 2 : 1;
+			
+			/// \brief type used to store partial sums in nodes: one value, a fixed size array or a pointer to a separately allocated array
+			typedef typename std::conditional<simple && !cache_weight, NVType, typename std::conditional<simple || fixed_nr != 0,
+				std::array<NVType, (simple ? 1 : fixed_nr)*sum_mult>, NVType*>::type >::type PartialSumType;
+			
 			/** \brief node class
 			 * 
 			 * All properties are protected and should be accessed via getters / setters.
@@ -173,24 +205,31 @@ namespace orbtree {
 				protected:
 					KeyValue kv; /**< \brief key and (optionally) value stored */
 					/// \brief partial sum (sum of this node's children's weight + this node's weight)
-					typename std::conditional<simple, NVType, NVType*>::type partialsum;
+					PartialSumType partialsum;
 					Node* parent;
 					Node* left;
 					Node* right;
 					bool red;
+					bool dirty; /**< \brief set if the partial sum needs to be recalculated (only used if the tree is in lazy mode) */
+					
+					/* helpers to access partial sums the same way for all storage types */
+					static NVType* sum_ptr(NVType& x) { return &x; }
+					static NVType* sum_ptr(NVType* x) { return x; }
+					template<size_t N> static NVType* sum_ptr(std::array<NVType,N>& x) { return x.data(); }
+					static const NVType* sum_ptr(const NVType& x) { return &x; }
+					template<size_t N> static const NVType* sum_ptr(const std::array<NVType,N>& x) { return x.data(); }
+					static void sum_free(NVType* x) { if(x) delete[]x; }
+					template<class T> static void sum_free(const T&) { }
 				
 				public:
 					/* node functionality */
-					Node(const KeyValue& kv_) : kv(kv_), partialsum(0) { }
-					Node(KeyValue&& kv_) : kv(std::move(kv_)), partialsum(0) { }
-					Node():kv(), partialsum(0) { }
-					template<class... T> Node(T&&... args) : kv(std::forward<T...>(args...)), partialsum(0) { }
-					/* note: destructor only deletes the partial sum, does not recursively delete the children */
-					template<bool simple_ = simple> void do_delete(typename std::enable_if<simple_,void*>::type = 0) { }
-					template<bool simple_ = simple> void do_delete(typename std::enable_if<!simple_,void*>::type = 0) {
-						if(partialsum) delete[]partialsum;
-					}
-					~Node() { do_delete(); }
+					Node(const KeyValue& kv_) : kv(kv_), partialsum() { }
+					Node(KeyValue&& kv_) : kv(std::move(kv_)), partialsum() { }
+					Node():kv(), partialsum() { }
+					template<class... T> Node(T&&... args) : kv(std::forward<T...>(args...)), partialsum() { }
+					/* note: destructor only deletes the partial sum, does not recursively delete the children;
+					 * with pool allocation, the partial sum is part of the same memory slot as the node */
+					~Node() { if CONSTEXPR (!pool) sum_free(partialsum); }
 					
 					KeyValue& get_key_value() { return kv; }
 					const KeyValue& get_key_value() const { return kv; }
@@ -200,6 +239,10 @@ namespace orbtree {
 					void set_red() { red = true; } ///< \brief set this node red
 					void set_black() { red = false; } ///< \brief set this node black
 					
+					bool is_dirty() const { return dirty; } ///< \brief test if the partial sum in this node is outdated
+					void set_dirty() { dirty = true; } ///< \brief mark the partial sum in this node outdated
+					void set_clean() { dirty = false; } ///< \brief mark the partial sum in this node up-to-date
+					
 					/* get / set for parent, left and right -- node is considered opaque
 					 * by the tree to allow different optimizations here */
 					const Node* get_parent() const { return parent; } ///< \brief get handle for parent
@@ -209,7 +252,7 @@ namespace orbtree {
 					void set_left(const Node* x) { left = const_cast<Node*>(x); } ///< \brief set handle for left child
 					void set_right(const Node* x) { right = const_cast<Node*>(x); } ///< \brief set handle for right child
 				
-					friend class NodeAllocatorPtr<KeyValueT,NVTypeT,simple>;
+					friend class NodeAllocatorPtr<KeyValueT,NVTypeT,simple,fixed_nr,pool,cache_weight>;
 			};
 			
 			/** \brief Node handle type to be used by tree implementation.
@@ -224,22 +267,64 @@ namespace orbtree {
 			Node* nil; ///< \brief Sentinel for nil.
 			
 			/** \brief each node has nv_per_node values calculated and stored in it */
-			const unsigned int nv_per_node;
-			unsigned int get_nv_per_node() const { return nv_per_node; }
+			unsigned int nv_per_node;
+			/** \brief each node has nv_per_node values calculated and stored in it
+			 * (this is a compile-time constant for simple and fixed size cases) */
+			unsigned int get_nv_per_node() const { return simple ? 1 : (fixed_nr ? fixed_nr : nv_per_node); }
 			
-			NodeAllocatorPtr():root(0),nil(0),nv_per_node(1) {
+			NodeAllocatorPtr():root(0),nil(0),nv_per_node(fixed_nr ? fixed_nr : 1) {
+				pool_init();
 				root = new_node();
 				nil = new_node();
 			}
 			explicit NodeAllocatorPtr(unsigned int nv_per_node_):root(0),nil(0),nv_per_node(nv_per_node_) {
 				if CONSTEXPR (simple) if(nv_per_node != 1)
 					throw std::runtime_error("For simple tree, weight function can only return one component!\n");
+				if CONSTEXPR (fixed_nr != 0) if(nv_per_node != fixed_nr)
+					throw std::runtime_error("NodeAllocatorPtr: weight function returns different number of components than expected!\n");
+				pool_init();
 				root = new_node();
 				nil = new_node();
 			}
-			~NodeAllocatorPtr() { 
-				if(root) free_tree_nodes_r(root);
-				if(nil) delete nil;
+			/** \brief copy the structure of another tree: all nodes are cloned along with
+			 * their partial sums, colors and links, no comparisons or weight function
+			 * calls are performed */
+			NodeAllocatorPtr(const NodeAllocatorPtr& a):root(0),nil(0),nv_per_node(a.nv_per_node) {
+				pool_init();
+				try {
+					nil = copy_node(a.nil);
+					root = copy_node(a.root);
+					root->parent = copy_link(a.root->parent, a);
+					copy_tree_r(root->left, a.root->left, root, a);
+					copy_tree_r(root->right, a.root->right, root, a);
+				}
+				catch(...) {
+					free_all();
+					throw;
+				}
+			}
+			/** \brief take over all nodes (and the sentinels) of a without allocating;
+			 * a is left without sentinels, so it can only be destroyed or swapped with */
+			NodeAllocatorPtr(NodeAllocatorPtr&& a) noexcept : root(0),nil(0),nv_per_node(a.nv_per_node) { swap(a); }
+			/* assignment is done by the tree class (by copying and swapping) */
+			NodeAllocatorPtr& operator = (const NodeAllocatorPtr&) = delete;
+			~NodeAllocatorPtr() { free_all(); }
+			
+			/** \brief swap contents with another allocator: only the sentinels (and the
+			 * slabs with pool allocation) are exchanged, nodes are not touched */
+			void swap(NodeAllocatorPtr& a) {
+				using std::swap;
+				swap(root, a.root);
+				swap(nil, a.nil);
+				swap(nv_per_node, a.nv_per_node);
+				swap(pool_first, a.pool_first);
+				swap(pool_slabs, a.pool_slabs);
+				swap(pool_next, a.pool_next);
+				swap(pool_end, a.pool_end);
+				swap(pool_free_head, a.pool_free_head);
+				swap(pool_slot_size, a.pool_slot_size);
+				swap(pool_next_slab, a.pool_next_slab);
+				swap(pool_nfree, a.pool_nfree);
 			}
 			
 			/** \brief get reference to a modifiable node */
@@ -256,26 +341,71 @@ namespace orbtree {
 			 * It is the callers responsibility to store
 			 * the handle in the tree or otherwise remember and free it later.
 			 * Will throw an exception if allocation failed. */
-			Node* new_node() { Node* n = new Node(); init_node(n); return n; }
+			Node* new_node() { Node* n = alloc_node(); init_node(n); return n; }
 			/// \copydoc new_node()
-			Node* new_node(const KeyValue& kv) { Node* n = new Node(kv); init_node(n); return n; }
+			Node* new_node(const KeyValue& kv) { Node* n = alloc_node(kv); init_node(n); return n; }
 			/// \copydoc new_node()
-			Node* new_node(KeyValue&& kv) { Node* n = new Node(std::move(kv)); init_node(n); return n; }
+			Node* new_node(KeyValue&& kv) { Node* n = alloc_node(std::move(kv)); init_node(n); return n; }
 			/// \copydoc new_node()
 			template<class... T>
-			Node* new_node(T&&... kv) { Node* n = new Node(std::forward<T>(kv)...); init_node(n); return n; }
+			Node* new_node(T&&... kv) { Node* n = alloc_node(std::forward<T>(kv)...); init_node(n); return n; }
 			
 			/** \brief delete node -- tree is not traversed, the caller must arrange to "cut" out
 			 * the node in question (otherwise the referenced nodes will be lost) */
-			void free_node(NodeHandle n) { delete (Node*)n; }
+			void free_node(NodeHandle n) {
+				if CONSTEXPR (pool) {
+					Node* n2 = const_cast<Node*>(n);
+					n2->~Node();
+					pool_put(n2);
+				}
+				else delete (Node*)n;
+			}
+			/** \brief reserve space for this many new nodes -- with pool allocation, a new
+			 * slab is allocated if needed (unused slots of the current slab are put in the
+			 * free list first); no-op otherwise */
+			void reserve(size_t size) {
+				if CONSTEXPR (pool) {
+					size_t avail = free_capacity();
+					if(size > avail) {
+						for(;pool_next != pool_end;pool_next += pool_slot_size) pool_put(pool_next);
+						PoolSlab* slab = pool_new_slab(size - avail);
+						slab->next = pool_slabs;
+						pool_slabs = slab;
+					}
+				}
+			}
+			/** \brief number of nodes that can be created without allocating memory (only
+			 * nonzero with pool allocation: unused slots in the current slab and the free list) */
+			size_t free_capacity() const {
+				if CONSTEXPR (pool) return (pool_end - pool_next) / pool_slot_size + pool_nfree;
+				else return 0;
+			}
+			/** \brief give back unused memory -- no-op, memory of deleted nodes is freed (or reused
+			 * with pool allocation) immediately */
+			void shrink_to_fit() { }
+			/** \brief compaction of storage -- no-op, memory of deleted nodes is freed (or reused
+			 * with pool allocation) immediately and nodes are never moved */
+			size_t compact_step(size_t, NodeHandle* = 0) { return 0; }
+			/** \brief number of deleted nodes taking up space -- always zero */
+			size_t deleted_nodes() const { return 0; }
+			/** \brief memory allocated for nodes and separately stored partial sums -- not tracked,
+			 * as each node is allocated separately (both are set to zero) */
+			void get_storage_bytes(size_t& node_bytes, size_t& nv_bytes) const { node_bytes = 0; nv_bytes = 0; }
+			/** \brief change memory layout of nodes -- no-op, nodes are never moved */
+			void relayout() { }
 			/** \brief clear tree, i.e. free all nodes, but keep root (sentinel) and nil, so that tree can be used again */
 			void clear_tree() { 
 				if(root) {
 					Node* n = root;
-					if(n->left && n->left != nil) free_tree_nodes_r((Node*)(n->left));
-					if(n->right && n->right != nil) free_tree_nodes_r((Node*)(n->right));
+					if(!pool || !std::is_trivially_destructible<KeyValue>::value) {
+						if(n->left && n->left != nil) free_tree_nodes_r((Node*)(n->left));
+						if(n->right && n->right != nil) free_tree_nodes_r((Node*)(n->right));
+					}
 					n->left = 0;
 					n->right = 0;
+					/* with pool allocation, all slabs can be given back, except the
+					 * first one that stores the sentinels */
+					pool_free_slabs(false);
 				}
 			}
 			
@@ -283,56 +413,207 @@ namespace orbtree {
 			void free_tree_nodes_r(Node* n) {
 				if(n->left && n->left != nil) free_tree_nodes_r((Node*)(n->left));
 				if(n->right && n->right != nil) free_tree_nodes_r((Node*)(n->right));
-				delete n;
+				free_node(n);
+			}
+			/** \brief free all nodes including the sentinels and all memory used */
+			void free_all() {
+				if(!pool || !std::is_trivially_destructible<KeyValue>::value) {
+					if(root) free_tree_nodes_r(root);
+					if(nil) free_node(nil);
+				}
+				root = 0;
+				nil = 0;
+				pool_free_slabs(true);
+			}
+			
+			/** \brief create a new node with the same key / value, partial sum and flags as x (links are not set) */
+			Node* copy_node(const Node* x) {
+				Node* n = new_node(x->kv);
+				n->red = x->red;
+				n->dirty = x->dirty;
+				set_node_sum(n, Node::sum_ptr(x->partialsum));
+				if CONSTEXPR (cache_weight) set_node_weight(n, Node::sum_ptr(x->partialsum) + get_nv_per_node());
+				return n;
+			}
+			/** \brief translate a link to one of the sentinels of a to the corresponding sentinel here */
+			Node* copy_link(const Node* x, const NodeAllocatorPtr& a) const {
+				if(x == a.nil) return nil;
+				if(x == a.root) return root;
+				return Invalid;
+			}
+			/** \brief copy the subtree starting at x (in a) to n (with the given parent);
+			 * n is set before recursing, so that a partial copy can be freed if an exception happens */
+			void copy_tree_r(Node*& n, const Node* x, Node* parent, const NodeAllocatorPtr& a) {
+				if(x == Invalid || x == a.nil) { n = copy_link(x, a); return; }
+				n = copy_node(x);
+				n->parent = parent;
+				copy_tree_r(n->left, x->left, n, a);
+				copy_tree_r(n->right, x->right, n, a);
 			}
 			
+			/** \brief allocate partial sum array in a new node (only if it is not stored in the node) */
+			void init_sum(Node* n, NVType*& x) {
+				if CONSTEXPR (pool) x = (NVType*)(((char*)n) + pool_sum_offset);
+				else x = new NVType[nv_per_node*sum_mult];
+			}
+			/** \brief allocate partial sum array in a new node (only if it is not stored in the node) */
+			template<class T> void init_sum(Node*, T&) { }
+			
 			/** \brief safely initialize new node, throw an exception if memory allocation failed */
-			template <bool simple_ = simple>
-			void init_node(typename std::enable_if<simple_, Node*>::type n) {
-				if(n) {
-					n->parent = Invalid;
-					n->left = Invalid;
-					n->right = Invalid;
-				}
+			void init_node(Node* n) {
 				if(!n) throw std::runtime_error("NodeAllocatorPtr::init_node(): out of memory!\n");
+				n->parent = Invalid;
+				n->left = Invalid;
+				n->right = Invalid;
+				n->dirty = false;
+				init_sum(n, n->partialsum);
 			}
-			/** \brief safely initialize new node, throw an exception if memory allocation failed */
-			template <bool simple_ = simple>
-			void init_node(typename std::enable_if<!simple_, Node*>::type n) {
-				if(n) {
-					n->parent = Invalid;
-					n->left = Invalid;
-					n->right = Invalid;
-					n->partialsum = new NVType[nv_per_node];
+			
+			/* pool allocation: memory is allocated in slabs that are divided into
+			 * slots of equal size; each slot holds one node, followed by its partial
+			 * sum array if that is not part of the node; unused slots are linked
+			 * into a free list (using the slot memory to store the link) */
+			/// \brief header at the start of each slab (slots start at pool_slab_header)
+			struct PoolSlab {
+				PoolSlab* next;
+			};
+			static_assert(!pool || (alignof(Node) <= alignof(std::max_align_t) && alignof(NVType) <= alignof(std::max_align_t)),
+				"NodeAllocatorPtr: over-aligned types are not supported with pool allocation!\n");
+			static constexpr size_t pool_align = alignof(Node) > alignof(void*) ? alignof(Node) : alignof(void*);
+			static constexpr size_t pool_slab_header = ((sizeof(PoolSlab) + alignof(std::max_align_t) - 1) /
+				alignof(std::max_align_t)) * alignof(std::max_align_t);
+			static constexpr size_t pool_sum_offset = ((sizeof(Node) + alignof(NVType) - 1) / alignof(NVType)) * alignof(NVType);
+			/// \brief number of slots in the first slab (which also holds the sentinels)
+			static constexpr size_t pool_first_slab = 64;
+			/// \brief maximum number of slots in a slab allocated by default (reserve() can allocate larger slabs)
+			static constexpr size_t pool_max_slab = 65536;
+			
+			PoolSlab* pool_first = 0; ///< \brief first slab, holds root and nil, not freed by clear_tree()
+			PoolSlab* pool_slabs = 0; ///< \brief further slabs (linked list, last allocated first)
+			char* pool_next = 0; ///< \brief next unused slot in the current slab
+			char* pool_end = 0; ///< \brief end of the current slab
+			void* pool_free_head = 0; ///< \brief head of the free list of slots
+			size_t pool_nfree = 0; ///< \brief number of slots in the free list
+			size_t pool_slot_size = 0; ///< \brief size of one slot in bytes
+			size_t pool_next_slab = 0; ///< \brief number of slots in the next slab to allocate
+			
+			/// \brief allocate memory for one node and construct it
+			template<class... T> Node* alloc_node(T&&... args) {
+				if CONSTEXPR (pool) {
+					void* p = pool_get();
+					try { return new(p) Node(std::forward<T>(args)...); }
+					catch(...) { pool_put(p); throw; }
 				}
-				if( !n || ! (n->partialsum) ) throw std::runtime_error("NodeAllocatorPtr::init_node(): out of memory!\n");
+				else return new Node(std::forward<T>(args)...);
 			}
 			
-			/// \brief get the value of the partial sum of weights stored in this node -- simple case when the weight function returns only one value 
-			template<bool simple_ = simple>
-			void get_node_sum(NodeHandle n, typename std::enable_if<simple_,NVType*>::type s) const {
-				*s = n->partialsum;
+			/// \brief set up slot size and allocate the first slab
+			void pool_init() {
+				if CONSTEXPR (pool) {
+					size_t size = pool_sum_offset;
+					if(std::is_pointer<PartialSumType>::value) size += sizeof(NVType)*nv_per_node*sum_mult;
+					pool_slot_size = ((size + pool_align - 1) / pool_align) * pool_align;
+					pool_first = pool_new_slab(pool_first_slab);
+					pool_next_slab = 2*pool_first_slab;
+				}
 			}
-			/// \brief get the value of the partial sum of weights stored in this node -- case when the weight function returns a vector
-			template<bool simple_ = simple>
-			void get_node_sum(NodeHandle n, typename std::enable_if<!simple_,NVType*>::type s) const {
-				for(unsigned int i = 0; i < nv_per_node; i++) s[i] = n->partialsum[i];
+			
+			/// \brief allocate a new slab with the given number of slots and make it the current one
+			PoolSlab* pool_new_slab(size_t nslots) {
+				char* mem = (char*)::operator new(pool_slab_header + nslots*pool_slot_size);
+				PoolSlab* slab = (PoolSlab*)mem;
+				slab->next = 0;
+				pool_next = mem + pool_slab_header;
+				pool_end = pool_next + nslots*pool_slot_size;
+				return slab;
 			}
-			/// \brief set the value of the partial sum stored in this node -- simple case when the weight function returns only one value 
-			template<bool simple_ = simple>
-			void set_node_sum(NodeHandle n1, typename std::enable_if<simple_,const NVType*>::type s) { 
-				Node* n = const_cast<Node*>(n1);
-				n->partialsum = *s;
+			
+			/// \brief get memory for one node: from the free list, the current slab or a new slab
+			void* pool_get() {
+				if(pool_free_head) {
+					void* p = pool_free_head;
+					pool_free_head = *(void**)p;
+					pool_nfree--;
+					return p;
+				}
+				if(pool_next == pool_end) {
+					/* slab size grows geometrically, up to pool_max_slab */
+					PoolSlab* slab = pool_new_slab(pool_next_slab);
+					slab->next = pool_slabs;
+					pool_slabs = slab;
+					if(pool_next_slab < pool_max_slab) pool_next_slab *= 2;
+				}
+				void* p = pool_next;
+				pool_next += pool_slot_size;
+				return p;
 			}
-			/// \brief set the value of the partial sum stored in this node -- case when the weight function returns a vector
-			template<bool simple_ = simple>
-			void set_node_sum(NodeHandle n1, typename std::enable_if<!simple_,const NVType*>::type s) { 
-				Node* n = const_cast<Node*>(n1);
-				for(unsigned int i = 0; i < nv_per_node; i++) n->partialsum[i] = s[i];
+			
+			/// \brief put back memory used by a node in the free list
+			void pool_put(void* p) {
+				*(void**)p = pool_free_head;
+				pool_free_head = p;
+				pool_nfree++;
+			}
+			
+			/** \brief free all slabs except the first one (that contains root and nil), or
+			 * also the first one if all is true; nodes should be already destroyed
+			 * (or have trivial destructors) */
+			void pool_free_slabs(bool all) {
+				if CONSTEXPR (pool) {
+					while(pool_slabs) {
+						PoolSlab* next = pool_slabs->next;
+						::operator delete(pool_slabs);
+						pool_slabs = next;
+					}
+					pool_free_head = 0;
+					pool_nfree = 0;
+					pool_next_slab = 2*pool_first_slab;
+					if(all) {
+						if(pool_first) ::operator delete(pool_first);
+						pool_first = 0;
+						pool_next = 0;
+						pool_end = 0;
+					}
+					else if(pool_first) {
+						/* keep root and nil at the start of the first slab */
+						pool_next = ((char*)pool_first) + pool_slab_header + 2*pool_slot_size;
+						pool_end = ((char*)pool_first) + pool_slab_header + pool_first_slab*pool_slot_size;
+					}
+				}
+			}
+			
+			/// \brief get the value of the partial sum of weights stored in this node
+			void get_node_sum(NodeHandle n, NVType* s) const {
+				const NVType* x = Node::sum_ptr(n->partialsum);
+				for(unsigned int i = 0; i < get_nv_per_node(); i++) s[i] = x[i];
+			}
+			/// \brief set the value of the partial sum stored in this node
+			void set_node_sum(NodeHandle n1, const NVType* s) {
+				NVType* x = Node::sum_ptr(const_cast<Node*>(n1)->partialsum);
+				for(unsigned int i = 0; i < get_nv_per_node(); i++) x[i] = s[i];
+			}
+			/// \brief get one component of the partial sum stored in this node
+			NVType get_node_sum_component(NodeHandle n, unsigned int i) const { return Node::sum_ptr(n->partialsum)[i]; }
+			/// \brief get the weight of this node (only valid if cache_weight == true)
+			void get_node_weight(NodeHandle n, NVType* s) const {
+				const NVType* x = Node::sum_ptr(n->partialsum) + get_nv_per_node();
+				for(unsigned int i = 0; i < get_nv_per_node(); i++) s[i] = x[i];
+			}
+			/// \brief store the weight of this node (only has an effect if cache_weight == true)
+			void set_node_weight(NodeHandle n1, const NVType* s) {
+				if CONSTEXPR (cache_weight) {
+					NVType* x = Node::sum_ptr(const_cast<Node*>(n1)->partialsum) + get_nv_per_node();
+					for(unsigned int i = 0; i < get_nv_per_node(); i++) x[i] = s[i];
+				}
 			}
 	};
 	
 	
+	/** \brief Node allocator that allocates nodes from large slabs, see NodeAllocatorPtr for description of parameters */
+	template<class KeyValueT, class NVTypeT, bool simple = false, unsigned int fixed_nr = 0, bool cache_weight = false>
+	using NodeAllocatorPool = NodeAllocatorPtr<KeyValueT, NVTypeT, simple, fixed_nr, true, cache_weight>;
+	
+	
 	/** \brief Alternate node allocator with the aim to use less memory. 
 	 * 
 	 * Special node allocator that stores values in separate array + stores red/black flag in parent pointer.
@@ -341,17 +622,27 @@ namespace orbtree {
 	 * 
 	 * Note: this uses the custom vector implementation either \ref realloc_vector::vector
 	 * if key and value are trivially copyable or \ref stacked_vector::vector if not. The
-	 * latter version will be significantly slower.
+	 * latter version uses arrays with a power of two size, so that indexing only needs
+	 * a shift and a mask.
 	 * 
 	 * @tparam KeyValueT Type of stored data, should be either KeyOnly or KeyValue
 	 * @tparam NVTypeT Type of extra data stored along in nodes (i.e. the return value of the function whose sum can be calculated).
+	 * @tparam IndexType Unsigned integer type used to refer to nodes.
+	 * @tparam fixed_nr If nonzero, the weight function returns this many values (known at compile time).
+	 * @tparam AllocPolicy Allocation policy used by \ref realloc_vector::vector for storing nodes and
+	 * partial sums. Use \ref realloc_vector::mmap_alloc for very large trees to use memory mappings
+	 * backed by huge pages on Linux.
+	 * @tparam cache_weight If true, the weight of each node is stored after its partial sum in the
+	 * same array, so that the weight function only needs to be called when a node is inserted or its
+	 * value changes (see \ref NodeAllocatorPtr).
 
 	 * Note: the actual requirement for \ref realloc_vector::vector
 	 * would be "trivially moveable" (meaning any object that can be moved to a new
 	 * memory location without problems, but can still have nontrivial destructor), but
 	 * as far as I know, this concept does not exist in C++.
 	 */
-	template<class KeyValueT, class NVTypeT, class IndexType>
+	template<class KeyValueT, class NVTypeT, class IndexType, unsigned int fixed_nr = 0,
+		class AllocPolicy = realloc_vector::malloc_alloc, bool cache_weight = false>
 	class NodeAllocatorCompact {
 		protected:
 			//~ static_assert(std::is_trivially_copyable<KeyValueT>::value,
@@ -361,7 +652,7 @@ namespace orbtree {
 			typedef NVTypeT NVType;
 		
 		private:
-			static constexpr IndexType redbit = 1U << (std::numeric_limits<IndexType>::digits - 1);
+			static constexpr IndexType redbit = ((IndexType)1) << (std::numeric_limits<IndexType>::digits - 1);
 			static constexpr IndexType max_nodes = redbit - 1;
 			static constexpr IndexType deleted_indicator = (max_nodes | redbit); /* 0xFFFFFFFFh */
 			
@@ -373,9 +664,9 @@ namespace orbtree {
 					KeyValue kv;
 					/// \brief Parent node reference, actually an index in a vector; also stores red-black flag.
 					IndexType parent;
-					IndexType left; ///< \brief Left child.
+					IndexType left; ///< \brief Left child; also stores a flag if the partial sum is outdated.
 					IndexType right; ///< \brief Right child.
-					/* red-black flag is stored inside parent */
+					/* red-black flag is stored inside parent, the "dirty" flag (used in lazy mode) inside left */
 					
 				public:
 					Node(const KeyValue& kv_) : kv(kv_), parent(NodeAllocatorCompact::Invalid),
@@ -395,15 +686,19 @@ namespace orbtree {
 					void set_black() { parent &= (~NodeAllocatorCompact::redbit); }
 					
 					NodeHandle get_parent() const { return parent & (~NodeAllocatorCompact::redbit); }
-					NodeHandle get_left() const { return left; }
+					NodeHandle get_left() const { return left & (~NodeAllocatorCompact::redbit); }
 					NodeHandle get_right() const { return right; }
 					void set_parent(NodeHandle p) {
 						if(p > NodeAllocatorCompact::max_nodes) throw std::runtime_error("NodeAllocatorCompact::Node::set_parent(): parent ID too large!\n");
 						parent = p | (parent & NodeAllocatorCompact::redbit);
 					}
-					void set_left(NodeHandle x) { left = x; }
+					void set_left(NodeHandle x) { left = x | (left & NodeAllocatorCompact::redbit); }
 					void set_right(NodeHandle x) { right = x; }
 					
+					bool is_dirty() const { return left & NodeAllocatorCompact::redbit; }
+					void set_dirty() { left |= NodeAllocatorCompact::redbit; }
+					void set_clean() { left &= (~NodeAllocatorCompact::redbit); }
+					
 					/// \brief Set a flag indicating this node has been deleted (but memory has not been freed yet).
 					void set_deleted() { parent = NodeAllocatorCompact::deleted_indicator; }
 					/// \brief Check if this node is deleted.
@@ -418,21 +713,23 @@ namespace orbtree {
 						swap(right,n.right);
 					}
 					
-					friend class NodeAllocatorCompact<KeyValueT,NVTypeT,IndexType>;
+					friend class NodeAllocatorCompact<KeyValueT,NVTypeT,IndexType,fixed_nr,AllocPolicy,cache_weight>;
 			};
 			
 		private:
 
+			/* note: stacked_vector uses arrays with a power of two size, so indexing does not need a division */
 #ifdef USE_STACKED_VECTOR
-			typedef stacked_vector::vector<Node> node_vector_type;
+			typedef stacked_vector::vector<Node, stacked_vector::std_vector_wrapper, true> node_vector_type;
 #else			
 			typedef typename std::conditional< std::is_trivially_copyable<KeyValueT>::value,
-				realloc_vector::vector<Node>, stacked_vector::vector<Node> >::type node_vector_type;
+				realloc_vector::vector<Node, AllocPolicy>, stacked_vector::vector<Node, stacked_vector::std_vector_wrapper, true> >::type node_vector_type;
 #endif
+			typedef realloc_vector::vector<NVType, AllocPolicy> nv_vector_type;
 			
-			realloc_vector::vector<NVType> nvarray; ///< \brief Vector storing the partial sum of function values in nodes.
+			nv_vector_type nvarray; ///< \brief Vector storing the partial sum of function values in nodes.
 			node_vector_type nodes; ///< \brief Vector storing the node objects.
-			const unsigned int nv_per_node; ///< \brief Number of weight values per node (number of components returned by the weight function).
+			unsigned int nv_per_node; ///< \brief Number of weight values per node (number of components returned by the weight function).
 			size_t n_del; ///< \brief Number of deleted nodes (memory not freed yet, these are stored in-place, forming a linked list).
 			NodeHandle deleted_nodes_head; ///< \brief Head of linked list for deleted nodes.
 
@@ -442,16 +739,37 @@ namespace orbtree {
 			NodeHandle root; /** \brief Root sentinel. */
 			NodeHandle nil; /** \brief Nil sentinel */
 			
-			NodeAllocatorCompact():nv_per_node(1),n_del(0),deleted_nodes_head(Invalid),root(Invalid),nil(Invalid) { 
+			NodeAllocatorCompact():nv_per_node(fixed_nr ? fixed_nr : 1),n_del(0),deleted_nodes_head(Invalid),root(Invalid),nil(Invalid) { 
 				root = new_node();
 				nil = new_node();
 			}
 			explicit NodeAllocatorCompact(unsigned int nv_per_node_):nv_per_node(nv_per_node_),n_del(0),
 					deleted_nodes_head(Invalid),root(Invalid),nil(Invalid) {
+				if CONSTEXPR (fixed_nr != 0) if(nv_per_node != fixed_nr)
+					throw std::runtime_error("NodeAllocatorCompact: weight function returns different number of components than expected!\n");
 				root = new_node();
 				nil = new_node();
 			}
 			//~ ~NodeAllocatorCompact() { }
+			/* note: the default copy constructor copies the node and partial sum
+			 * arrays directly (using memcpy if nodes are trivially copyable) */
+			NodeAllocatorCompact(const NodeAllocatorCompact&) = default;
+			/** \brief take over the arrays (and the sentinels) of a without allocating;
+			 * a is left without sentinels, so it can only be destroyed or swapped with */
+			NodeAllocatorCompact(NodeAllocatorCompact&& a) noexcept : nv_per_node(a.nv_per_node),n_del(0),
+					deleted_nodes_head(Invalid),root(Invalid),nil(Invalid) { swap(a); }
+			
+			/** \brief swap contents with another allocator (only the arrays and sentinel indices are exchanged) */
+			void swap(NodeAllocatorCompact& a) {
+				using std::swap;
+				nvarray.swap(a.nvarray);
+				nodes.swap(a.nodes);
+				swap(nv_per_node, a.nv_per_node);
+				swap(n_del, a.n_del);
+				swap(deleted_nodes_head, a.deleted_nodes_head);
+				swap(root, a.root);
+				swap(nil, a.nil);
+			}
 			/* main interface */
 			/** \brief get reference to a modifiable node */
 			Node& get_node(NodeHandle x) { return nodes[x]; }
@@ -476,9 +794,9 @@ namespace orbtree {
 			
 			/** \brief Move the partial sum of a node to a new location */
 			void move_nv(IndexType x, IndexType y) {
-				size_t xbase = ((size_t)x)*nv_per_node;
-				size_t ybase = ((size_t)y)*nv_per_node;
-				for(unsigned int i=0;i<nv_per_node;i++) nvarray[xbase + i] = nvarray[ybase + i];
+				size_t xbase = ((size_t)x)*nv_stride();
+				size_t ybase = ((size_t)y)*nv_stride();
+				for(unsigned int i=0;i<nv_stride();i++) nvarray[xbase + i] = nvarray[ybase + i];
 			}
 			
 			/** \brief Move node from position y to x, updating parent and child relationships.
@@ -512,10 +830,34 @@ namespace orbtree {
 				}
 			}
 			
+			/// \brief helper for relayout(): height of the subtree rooted at x
+			size_t relayout_height_r(NodeHandle x) const {
+				if(x == nil) return 0;
+				size_t hl = relayout_height_r(nodes[x].get_left());
+				size_t hr = relayout_height_r(nodes[x].get_right());
+				return 1 + (hl > hr ? hl : hr);
+			}
+			/// \brief helper for relayout(): add nodes in the subtree of x that are less than h levels deep to order, in van Emde Boas order
+			void relayout_veb_r(NodeHandle x, size_t h, realloc_vector::vector<IndexType>& order) const {
+				if(x == nil || h == 0) return;
+				if(h == 1) { order.push_back(x); return; }
+				size_t ht = h / 2; /* height of the top part */
+				relayout_veb_r(x, ht, order);
+				/* add the subtrees below the top part, from left to right */
+				relayout_veb_bottom_r(x, ht, h - ht, order);
+			}
+			/// \brief helper for relayout(): add subtrees that start d levels below x, each with height h
+			void relayout_veb_bottom_r(NodeHandle x, size_t d, size_t h, realloc_vector::vector<IndexType>& order) const {
+				if(x == nil) return;
+				if(d == 0) { relayout_veb_r(x, h, order); return; }
+				relayout_veb_bottom_r(nodes[x].get_left(), d - 1, h, order);
+				relayout_veb_bottom_r(nodes[x].get_right(), d - 1, h, order);
+			}
+			
 			/** \brief shrink memory used to current size */
 			void shrink_memory(IndexType new_capacity = 0) {
 				nodes.shrink_to_fit(new_capacity);
-				nvarray.shrink_to_fit(((size_t)new_capacity)*nv_per_node);
+				nvarray.shrink_to_fit(((size_t)new_capacity)*nv_stride());
 			}
 			
 		protected:
@@ -528,7 +870,7 @@ namespace orbtree {
 					/* create new node */
 					if(n == max_nodes) throw std::runtime_error("NodeAllocatorFlat::new_node(): reached maximum number of nodes!\n");
 					nodes.emplace_back();
-					nvarray.resize(((size_t)(n+1))*nv_per_node,NVType());
+					nvarray.resize(((size_t)(n+1))*nv_stride(),NVType());
 				}
 				return n;
 			}
@@ -539,7 +881,7 @@ namespace orbtree {
 				else {
 					if(n == max_nodes) throw std::runtime_error("NodeAllocatorFlat::new_node(): reached maximum number of nodes!\n");
 					nodes.emplace_back(kv);
-					nvarray.resize(((size_t)(n+1))*nv_per_node,NVType());
+					nvarray.resize(((size_t)(n+1))*nv_stride(),NVType());
 				}
 				return n;
 			}
@@ -550,7 +892,7 @@ namespace orbtree {
 				else {
 					if(n == max_nodes) throw std::runtime_error("NodeAllocatorFlat::new_node(): reached maximum number of nodes!\n");
 					nodes.emplace_back(std::forward<KeyValue>(kv));
-					nvarray.resize(((size_t)(n+1))*nv_per_node,NVType());
+					nvarray.resize(((size_t)(n+1))*nv_stride(),NVType());
 				}
 				return n;
 			}
@@ -561,7 +903,7 @@ namespace orbtree {
 				else {
 					if(n == max_nodes) throw std::runtime_error("NodeAllocatorFlat::new_node(): reached maximum number of nodes!\n");
 					nodes.emplace_back(std::forward<T>(kv)...);
-					nvarray.resize(((size_t)(n+1))*nv_per_node,NVType());
+					nvarray.resize(((size_t)(n+1))*nv_stride(),NVType());
 				}
 				return n;
 			}
@@ -579,7 +921,7 @@ namespace orbtree {
 			/** \brief clear tree, to be reused */
 			void clear_tree() {
 				nodes.resize(2);
-				nvarray.resize(2);
+				nvarray.resize(2*nv_stride());
 				root = 0;
 				nil = 1;
 				deleted_nodes_head = Invalid;
@@ -590,33 +932,70 @@ namespace orbtree {
 			}
 			
 			
-			/** \brief each node has nv_per_node values calculated and stored in it */
-			unsigned int get_nv_per_node() const { return nv_per_node; }
+			/** \brief each node has nv_per_node values calculated and stored in it
+			 * (this is a compile-time constant if fixed_nr is given) */
+			unsigned int get_nv_per_node() const { return fixed_nr ? fixed_nr : nv_per_node; }
+			/** \brief number of values stored in nvarray for each node: the partial sum,
+			 * followed by the node's own weight if cache_weight == true */
+			unsigned int nv_stride() const { return get_nv_per_node()*(cache_weight ? 2 : 1); }
+			/// \brief true if the weight of each node is stored (see \ref get_node_weight())
+			static constexpr bool stores_weight = cache_weight;
 			
 			/// \brief get the partial sum stored in node n
 			void get_node_sum(NodeHandle n, NVType* s) const {
-				size_t base = ((size_t)n)*nv_per_node;
-				for(unsigned int i=0;i<nv_per_node;i++) s[i] = nvarray[base+i];
+				size_t base = ((size_t)n)*nv_stride();
+				for(unsigned int i=0;i<get_nv_per_node();i++) s[i] = nvarray[base+i];
 			}
 			/// \brief set the partial sum stored in node n
 			void set_node_sum(NodeHandle n, const NVType* s) {
-				size_t base = ((size_t)n)*nv_per_node;
-				for(unsigned int i=0;i<nv_per_node;i++) nvarray[base+i] = s[i];
+				size_t base = ((size_t)n)*nv_stride();
+				for(unsigned int i=0;i<get_nv_per_node();i++) nvarray[base+i] = s[i];
+			}
+			/// \brief get one component of the partial sum stored in node n
+			NVType get_node_sum_component(NodeHandle n, unsigned int i) const { return nvarray[((size_t)n)*nv_stride() + i]; }
+			/// \brief get the weight of node n (only valid if cache_weight == true)
+			void get_node_weight(NodeHandle n, NVType* s) const {
+				size_t base = ((size_t)n)*nv_stride() + get_nv_per_node();
+				for(unsigned int i=0;i<get_nv_per_node();i++) s[i] = nvarray[base+i];
+			}
+			/// \brief store the weight of node n (only has an effect if cache_weight == true)
+			void set_node_weight(NodeHandle n, const NVType* s) {
+				if CONSTEXPR (cache_weight) {
+					size_t base = ((size_t)n)*nv_stride() + get_nv_per_node();
+					for(unsigned int i=0;i<get_nv_per_node();i++) nvarray[base+i] = s[i];
+				}
 			}
 		
 		public:
 			
 			/** \brief get the current capacity of the underlying storage */
 			size_t capacity() const { return nodes.capacity(); }
+			/** \brief get the number of nodes that can be created without growing storage
+			 * (including the place of deleted nodes) */
+			size_t free_capacity() const { return nodes.capacity() - nodes.size() + n_del; }
 			/** \brief get the number of deleted nodes */
 			size_t deleted_nodes() const { return n_del; }
+			/** \brief get the memory allocated for storing nodes and partial sums (in bytes) */
+			void get_storage_bytes(size_t& node_bytes, size_t& nv_bytes) const {
+				node_bytes = nodes.capacity() * sizeof(Node);
+				nv_bytes = nvarray.capacity() * sizeof(NVType);
+			}
 			
-			/// \brief Free up memory taken up by deleted nodes by rearranging storage.
-			void shrink_to_fit() {
-				while(deleted_nodes_head != Invalid) {
+			/** \brief Free up some of the memory taken up by deleted nodes by rearranging storage.
+			 * 
+			 * Performs at most budget steps, each of them removing one node from the
+			 * end of storage: if it is a deleted node, it is simply removed, otherwise
+			 * it is moved into the place of a deleted node. If the node given by track
+			 * is moved, track is updated to its new position. Other handles to moved
+			 * nodes become invalid. If the storage becomes much smaller than the
+			 * allocated capacity, memory is given back.
+			 * 
+			 * Returns the number of deleted nodes still taking up space. */
+			size_t compact_step(size_t budget, NodeHandle* track = 0) {
+				for(;budget && deleted_nodes_head != Invalid;budget--) {
 					/* remove nodes at the end */
 					NodeHandle size = nodes.size();
-					if(size == 0) throw std::runtime_error("NodeAllocatorCompact::shrink_size(): ran out of nodes!\n");
+					if(size == 0) throw std::runtime_error("NodeAllocatorCompact::compact_step(): ran out of nodes!\n");
 					size--;
 					if(nodes[size].is_deleted()) {
 						/* if last node was deleted, update the list of deleted nodes */
@@ -627,32 +1006,241 @@ namespace orbtree {
 						if(deleted_nodes_head == size) {
 							deleted_nodes_head = left; // in this case, right == Invalid
 							if(deleted_nodes_head == Invalid && n_del > 1)
-								throw std::runtime_error("NodeAllocatorCompact::shrink_size(): inconsistent deleted nodes!\n");
+								throw std::runtime_error("NodeAllocatorCompact::compact_step(): inconsistent deleted nodes!\n");
 						}
 					}
 					else {
 						/* otherwise move last node into the place of a deleted node */
 						NodeHandle n = deleted_nodes_head;
 						if(n == size)
-							throw std::runtime_error("NodeAllocatorCompact::shrink_size(): inconsistent deleted nodes!\n");
+							throw std::runtime_error("NodeAllocatorCompact::compact_step(): inconsistent deleted nodes!\n");
 						deleted_nodes_head = nodes[deleted_nodes_head].get_left();
-						nodes[deleted_nodes_head].set_right(Invalid);
+						if(deleted_nodes_head != Invalid) nodes[deleted_nodes_head].set_right(Invalid);
 						move_node(n,size);
+						if(track && *track == size) *track = n;
 					}
 					nodes.pop_back();
-					nvarray.resize(((size_t)size)*nv_per_node);
-					if(!n_del) throw std::runtime_error("NodeAllocatorCompact::shrink_size(): inconsistent deleted nodes!\n");
+					nvarray.resize(((size_t)size)*nv_stride());
+					if(!n_del) throw std::runtime_error("NodeAllocatorCompact::compact_step(): inconsistent deleted nodes!\n");
 					n_del--;
 				}
+				/* give back memory if less than half of it is used */
+				size_t size = nodes.size();
+				if(nodes.capacity() > 2*size + 16) shrink_memory((IndexType)(size + size/2));
+				return n_del;
+			}
+			
+			/// \brief Free up memory taken up by deleted nodes by rearranging storage.
+			void shrink_to_fit() {
+				compact_step(n_del);
 				shrink_memory();
 			}
 			
-			/// \brief Reserve storage for at least the requested number of elements.
-			/// It can throw an exception on failure to allocate memory.
-			void reserve(size_t size) {
-				nvarray.reserve(size);
+			/** \brief Renumber nodes so that their storage follows the van Emde Boas layout of the tree.
+			 * 
+			 * The tree is recursively split by height into a top half and the subtrees
+			 * below it, each of which is stored contiguously. This way, the nodes (and
+			 * their partial sums) visited on any root-to-leaf path are stored close to
+			 * each other for any cache line or page size, making searches faster.
+			 * Deleted nodes are removed as well. Inserting new nodes after this is
+			 * possible, but they are stored at the end of the storage (or at the
+			 * place of deleted nodes), so the benefits are gradually lost.
+			 * 
+			 * This takes O(N log log N) time and temporarily needs memory for a
+			 * second copy of all nodes. All handles to existing nodes become invalid. */
+			void relayout() {
+				NodeHandle r = nodes[root].get_right();
+				size_t n_live = nodes.size() - n_del;
+				/* new order of nodes: sentinels first, then the actual tree */
+				realloc_vector::vector<IndexType> order;
+				order.reserve(n_live);
+				order.push_back(root);
+				order.push_back(nil);
+				if(r != nil && r != Invalid) relayout_veb_r(r, relayout_height_r(r), order);
+				if(order.size() != n_live) throw std::runtime_error("NodeAllocatorCompact::relayout(): inconsistent number of nodes!\n");
+				
+				/* inverse mapping from old to new positions */
+				realloc_vector::vector<IndexType> new_idx(nodes.size(), (IndexType)Invalid);
+				for(size_t i=0;i<order.size();i++) new_idx[order[i]] = i;
+				
+				node_vector_type nodes2;
+				nv_vector_type nvarray2;
+				nodes2.reserve(n_live);
+				nvarray2.reserve(n_live*nv_stride());
+				for(size_t i=0;i<order.size();i++) {
+					IndexType x = order[i];
+					nodes2.push_back(std::move(nodes[x]));
+					Node& n = nodes2[i];
+					/* note: parent of nil can refer to any node (or even a deleted node) */
+					NodeHandle p = n.get_parent();
+					n.set_parent(p == Invalid ? Invalid : new_idx[p]);
+					if(n.get_left() != Invalid) n.set_left(new_idx[n.get_left()]);
+					if(n.right != Invalid) n.right = new_idx[n.right];
+					size_t base = ((size_t)x)*nv_stride();
+					for(unsigned int j=0;j<nv_stride();j++) nvarray2.push_back(nvarray[base + j]);
+				}
+				
+				nodes.swap(nodes2);
+				nvarray.swap(nvarray2);
+				root = new_idx[root];
+				nil = new_idx[nil];
+				n_del = 0;
+				deleted_nodes_head = Invalid;
+			}
+			
+			/// \brief Reserve storage for at least the requested number of new nodes (deleted
+			/// nodes are reused first). It can throw an exception on failure to allocate memory.
+			void reserve(size_t n) {
+				if(free_capacity() >= n) return;
+				size_t size = nodes.size() - n_del + n;
+				nvarray.reserve(size*nv_stride());
 				nodes.reserve(size);
 			}
+			
+		protected:
+			/** \brief Header of tree images written by \ref save_image().
+			 * 
+			 * It is followed by the node array and the partial sum array, both
+			 * starting at an offset that is a multiple of image_align, so that
+			 * they can be mapped into memory directly. */
+			struct ImageHeader {
+				char magic[8]; ///< \brief always "ORBTREEC"
+				uint32_t byte_order; ///< \brief image_byte_order as written by the machine creating the image
+				uint32_t index_size; ///< \brief sizeof(IndexType)
+				uint32_t node_size; ///< \brief sizeof(Node)
+				uint32_t nv_size; ///< \brief sizeof(NVType)
+				uint32_t nv_per_node; ///< \brief number of partial sum components per node
+				uint32_t nv_stride; ///< \brief number of values stored per node in the partial sum array (zero means nv_per_node)
+				uint64_t n_nodes; ///< \brief number of nodes stored (including sentinels and deleted nodes)
+				uint64_t nodes_offset; ///< \brief position of nodes in the file
+				uint64_t nv_offset; ///< \brief position of partial sums in the file
+				uint64_t n_del; ///< \brief number of deleted nodes
+				uint64_t deleted_nodes_head; ///< \brief first deleted node
+				uint64_t root; ///< \brief root sentinel
+				uint64_t nil; ///< \brief nil sentinel
+				uint64_t size; ///< \brief number of elements in the tree (stored for the tree class)
+			};
+			static constexpr uint32_t image_byte_order = 0x01020304U;
+			/// \brief alignment of arrays in images, a multiple of the page size on all common systems
+			static constexpr uint64_t image_align = 65536;
+			static uint64_t image_align_up(uint64_t x) { return ((x + image_align - 1) / image_align) * image_align; }
+			
+			/// \brief calculate a*b + c in res, returns false if the result does not fit in a size_t
+			static bool image_size(uint64_t a, uint64_t b, uint64_t c, uint64_t& res) {
+				const uint64_t max = std::numeric_limits<size_t>::max();
+				if(c > max || (b && a > (max - c) / b)) return false;
+				res = a*b + c;
+				return true;
+			}
+			
+			/// \brief write len bytes from p to f, padded with zeros to padded_len bytes
+			static bool image_write(FILE* f, const void* p, size_t len, size_t padded_len) {
+				if(len && fwrite(p, 1, len, f) != len) return false;
+				char zeros[4096] = {0};
+				for(;len < padded_len;) {
+					size_t l = padded_len - len;
+					if(l > sizeof(zeros)) l = sizeof(zeros);
+					if(fwrite(zeros, 1, l, f) != l) return false;
+					len += l;
+				}
+				return true;
+			}
+			
+			/** \brief Write the node and partial sum arrays to the given file, along
+			 * with a header that also stores size (number of elements in the tree).
+			 * 
+			 * The arrays are written as they are stored in memory, so the image can
+			 * only be used on the same platform with the same type of tree.
+			 * Partial sums should be up-to-date (i.e. no dirty nodes). */
+			void save_image(const char* fn, size_t size) const {
+				static_assert(std::is_same<node_vector_type, realloc_vector::vector<Node, AllocPolicy> >::value,
+					"NodeAllocatorCompact: saving a tree requires trivially copyable keys and values!\n");
+				ImageHeader h;
+				memset(&h, 0, sizeof(h));
+				memcpy(h.magic, "ORBTREEC", 8);
+				h.byte_order = image_byte_order;
+				h.index_size = sizeof(IndexType);
+				h.node_size = sizeof(Node);
+				h.nv_size = sizeof(NVType);
+				h.nv_per_node = get_nv_per_node();
+				h.nv_stride = nv_stride();
+				h.n_nodes = nodes.size();
+				h.nodes_offset = image_align;
+				h.nv_offset = image_align_up(h.nodes_offset + h.n_nodes*sizeof(Node));
+				h.n_del = n_del;
+				h.deleted_nodes_head = deleted_nodes_head;
+				h.root = root;
+				h.nil = nil;
+				h.size = size;
+				
+				FILE* f = fopen(fn, "wb");
+				if(!f) throw std::runtime_error("NodeAllocatorCompact::save_image(): cannot open output file!\n");
+				bool ok = image_write(f, &h, sizeof(h), h.nodes_offset) &&
+					image_write(f, nodes.data(), h.n_nodes*sizeof(Node), h.nv_offset - h.nodes_offset) &&
+					image_write(f, nvarray.data(), nvarray.size()*sizeof(NVType), nvarray.size()*sizeof(NVType));
+				if(fclose(f)) ok = false;
+				if(!ok) throw std::runtime_error("NodeAllocatorCompact::save_image(): error writing output file!\n");
+			}
+			
+#ifdef REALLOC_VECTOR_MMAP
+			/** \brief Replace the current contents with an image written by \ref save_image()
+			 * by mapping the file into memory (see \ref realloc_vector::vector::map_file()).
+			 * 
+			 * Returns the size stored in the header. Throws an exception if the image
+			 * cannot be opened, is not compatible with this allocator or its header
+			 * is not consistent (with itself and with the size of the file); in this
+			 * case, the current contents are not changed. */
+			size_t open_image(const char* fn) {
+				static_assert(std::is_same<node_vector_type, realloc_vector::vector<Node, AllocPolicy> >::value,
+					"NodeAllocatorCompact: opening a saved tree requires trivially copyable keys and values!\n");
+				int fd = open(fn, O_RDONLY);
+				if(fd < 0) throw std::runtime_error("NodeAllocatorCompact::open_image(): cannot open input file!\n");
+				ImageHeader h;
+				struct stat st;
+				const char* err = 0;
+				if(pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || fstat(fd, &st))
+					err = "NodeAllocatorCompact::open_image(): error reading input file!\n";
+				else if(memcmp(h.magic, "ORBTREEC", 8) || h.byte_order != image_byte_order)
+					err = "NodeAllocatorCompact::open_image(): input file is not a saved tree!\n";
+				else if(h.index_size != sizeof(IndexType) || h.node_size != sizeof(Node) || h.nv_size != sizeof(NVType) ||
+						h.nv_per_node != get_nv_per_node() ||
+						(h.nv_stride ? h.nv_stride : h.nv_per_node) != nv_stride()) /* nv_stride is zero in older images */
+					err = "NodeAllocatorCompact::open_image(): saved tree has a different type!\n";
+				else {
+					/* check all fields against each other and the file size before mapping */
+					uint64_t nodes_end, nv_end;
+					if(h.n_nodes < 2 || h.n_nodes > max_nodes || h.root >= h.n_nodes || h.nil >= h.n_nodes || h.root == h.nil ||
+							h.nodes_offset < sizeof(h) || h.nodes_offset % image_align || h.nv_offset % image_align ||
+							!image_size(h.n_nodes, sizeof(Node), h.nodes_offset, nodes_end) || h.nv_offset < nodes_end ||
+							!image_size(h.n_nodes, ((uint64_t)nv_stride())*sizeof(NVType), h.nv_offset, nv_end) ||
+							(uint64_t)st.st_size < nv_end)
+						err = "NodeAllocatorCompact::open_image(): inconsistent saved tree!\n";
+					/* deleted nodes form a list starting at deleted_nodes_head, the remaining
+					 * ones (except the sentinels) are the elements of the tree */
+					else if(h.n_del > h.n_nodes - 2 || h.size != h.n_nodes - 2 - h.n_del ||
+							(h.n_del == 0) != (h.deleted_nodes_head == (uint64_t)Invalid) ||
+							(h.n_del && (h.deleted_nodes_head >= h.n_nodes || h.deleted_nodes_head == h.root || h.deleted_nodes_head == h.nil)))
+						err = "NodeAllocatorCompact::open_image(): inconsistent deleted nodes in saved tree!\n";
+				}
+				if(!err) {
+					node_vector_type nodes2;
+					nv_vector_type nvarray2;
+					if(nodes2.map_file(fd, h.nodes_offset, h.n_nodes) &&
+							nvarray2.map_file(fd, h.nv_offset, h.n_nodes*nv_stride())) {
+						nodes.swap(nodes2);
+						nvarray.swap(nvarray2);
+						n_del = h.n_del;
+						deleted_nodes_head = h.deleted_nodes_head;
+						root = h.root;
+						nil = h.nil;
+					}
+					else err = "NodeAllocatorCompact::open_image(): cannot map input file!\n";
+				}
+				close(fd);
+				if(err) throw std::runtime_error(err);
+				return h.size;
+			}
+#endif
 	};
 }
 
@@ -34,18 +34,122 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <vector>
+#include <algorithm>
 #include "read_table.h"
 #include "orbtree.h"
+#ifdef USE_WIDE
+#include "orbtree_wide.h"
+#endif
+#include "orbtree_fenwick.h"
+#include "orbtree_concurrent.h"
+#include <thread>
+#include <atomic>
+
+/* weight function for testing maps with two component weights: value multiplied by the parameter */
+struct value_mult {
+	typedef std::pair<unsigned int, double> argument_type;
+	typedef double ParType;
+	typedef double result_type;
+	double operator()(const std::pair<unsigned int, double>& p, double a) const { return a*p.second; }
+};
+
+/* compare a run-length encoded multiset with the tree storing each copy of keys separately */
+template<class RLE, class Tree>
+void check_rle(const RLE& rle, const Tree& rbtree) {
+	rle.check_tree(0.0);
+	if(rle.size() != rbtree.size()) throw std::runtime_error("inconsistent size of run-length encoded multiset!\n");
+	size_t n = 0;
+	for(auto it = rle.cbegin();it != rle.cend();++it,++n) {
+		if(it->second != rbtree.count(it->first) || rle.count(it->first) != it->second)
+			throw std::runtime_error("inconsistent count in run-length encoded multiset!\n");
+		if(rle.get_sum(it->first) != rbtree.get_sum(it->first) || rle.get_sum(it->first + 1) != rbtree.get_sum(it->first + 1))
+			throw std::runtime_error("inconsistent partial sums in run-length encoded multiset!\n");
+	}
+	if(n != rle.distinct_size()) throw std::runtime_error("inconsistent number of distinct keys in run-length encoded multiset!\n");
+	for(uint32_t r = 0;r < rle.size();r++) {
+		uint32_t s;
+		auto it = rle.find_by_weight(0, r, &s);
+		if(it == rle.cend() || it->first != *rbtree.find_by_weight(0, r) || s != rbtree.get_sum(it->first))
+			throw std::runtime_error("inconsistent search by weight in run-length encoded multiset!\n");
+	}
+	if(rle.find_by_weight(0, rle.size()) != rle.cend()) throw std::runtime_error("search by weight past the end in run-length encoded multiset!\n");
+}
+
+/* appending a key before the last one or a range that is not sorted fails and
+ * leaves the tree unchanged */
+template<class Tree>
+void check_append_errors(Tree& t) {
+	std::vector<unsigned int> keys(t.cbegin(), t.cend());
+	if(keys.empty() || keys.back() == 0) return;
+	unsigned int last = keys.back();
+	auto check_unchanged = [&t, &keys] () {
+		t.check_tree(0.0);
+		if(t.size() != keys.size() || !std::equal(keys.begin(), keys.end(), t.cbegin()))
+			throw std::runtime_error("tree changed by failed append!\n");
+	};
+	bool thrown = false;
+	try { t.push_back(last - 1); }
+	catch(std::runtime_error&) { thrown = true; }
+	if(!thrown) throw std::runtime_error("missing error when appending a key before the last one!\n");
+	check_unchanged();
+	std::vector<std::vector<unsigned int> > bad{{last + 1, last + 3, last + 2}, {last - 1, last + 1}, {last + 1, last + 2, last + 2, last}};
+	for(const auto& b : bad) {
+		thrown = false;
+		try { t.append_sorted(b.begin(), b.end()); }
+		catch(std::runtime_error&) { thrown = true; }
+		if(!thrown) throw std::runtime_error("missing error when appending a range that is not sorted!\n");
+		check_unchanged();
+	}
+}
+
+/* insert a batch of keys (each twice, in copies 1 and 2) in parallel into a tree without
+ * duplicates that already contains every third key (in copy 0); depending on the offset,
+ * the keys that split the batch among threads are already in the tree or not */
+template<class Tree, class Make>
+Tree check_insert_batch_unique(unsigned int offset, Make make) {
+	const unsigned int m = 24000;
+	Tree t;
+	std::vector<bool> present(m + offset, false);
+	for(unsigned int k = 0;k < m + offset;k += 3) { t.insert(make(k, 0)); present[k] = true; }
+	std::vector<decltype(make(0, 0))> batch;
+	size_t expected = 0;
+	for(unsigned int k = offset;k < m + offset;k++) {
+		batch.push_back(make(k, 1));
+		batch.push_back(make(k, 2));
+		if(!present[k]) { present[k] = true; expected++; }
+	}
+	size_t n0 = t.size();
+	if(t.insert_batch(batch.begin(), batch.end(), 4) != expected) throw std::runtime_error("inconsistent result of parallel insert without duplicates!\n");
+	t.check_tree(0.0);
+	if(t.size() != n0 + expected) throw std::runtime_error("inconsistent tree size after parallel insert without duplicates!\n");
+	uint32_t i = 0;
+	for(unsigned int k = 0;k < m + offset;k++) if(present[k]) {
+		if(t.find(k) == t.end() || t.get_sum(k) != i) throw std::runtime_error("key rank not consistent after parallel insert without duplicates!\n");
+		i++;
+	}
+	return t;
+}
 
 int main(int argc, char **argv)
 {
 
 #ifdef USE_COMPACT	
 	orbtree::rankmultisetC<unsigned int> rbtree;
+#elif defined(USE_POOL)
+	orbtree::rankmultisetP<unsigned int> rbtree;
+#elif defined(USE_WIDE)
+	/* B+ tree with small nodes, so that splits and merges happen often */
+	orbtree::orbtree_wide<orbtree::KeyOnly<unsigned int>, uint32_t, std::less<unsigned int>,
+		orbtree::NVFunc_Adapter_Simple<orbtree::RankFunc<unsigned int, uint32_t> >, true, true, 4> rbtree;
 #else
 	orbtree::rankmultiset<unsigned int> rbtree;
 #endif
 	
+	/* the same keys, stored with their counts */
+	orbtree::rankmultisetR<unsigned int> rle;
+	orbtree::rankmultisetCR<unsigned int> rleC;
+	
 	bool check_only_end = false;
 	if(argc > 1 && argv[1][0] == '-' && argv[1][1] == 'c') check_only_end = true;
 	
@@ -64,10 +168,13 @@ int main(int argc, char **argv)
 			auto it = rbtree.lower_bound(y);
 			if(it == rbtree.end() || *it != y) throw std::runtime_error("key not found!\n");
 			rbtree.erase(it);
+			if(rle.erase(y, 1) != 1 || rleC.erase(y, 1) != 1) throw std::runtime_error("key not found in run-length encoded multiset!\n");
 		}
 		else {
 			/* add one more key */
 			rbtree.insert(y);
+			rle.insert(y);
+			rleC.insert(y);
 		}
 		
 		if(!check_only_end) {
@@ -81,8 +188,15 @@ int main(int argc, char **argv)
 				if(r != i) throw std::runtime_error("key rank not consistent!\n");
 				auto it2 = orbtree::lower_bound_r(rbtree, r);
 				if(it2 != it) throw std::runtime_error("rank search result not consistent!\n");
+				auto smp = rbtree.sample(r);
+				if(smp.first != it || smp.second != r) throw std::runtime_error("weighted search result not consistent!\n");
+				auto lb = rbtree.lower_bound_sum(*it);
+				if(lb.first != rbtree.lower_bound(*it) || lb.second != rbtree.get_sum(*it) ||
+					lb.second != rbtree.get_sum_node(lb.first)) throw std::runtime_error("key search with sum not consistent!\n");
 			}
 			if(i != rbtree.size()) throw std::runtime_error("inconsistent tree size!\n");
+			check_rle(rle, rbtree);
+			check_rle(rleC, rbtree);
 		}
 	}
 	
@@ -97,9 +211,448 @@ int main(int argc, char **argv)
 			if(r != i) throw std::runtime_error("key rank not consistent!\n");
 			auto it2 = orbtree::lower_bound_r(rbtree, r);
 			if(it2 != it) throw std::runtime_error("rank search result not consistent!\n");
+			if(rbtree.sample(r).first != it) throw std::runtime_error("weighted search result not consistent!\n");
 		}
 		if(i != rbtree.size()) throw std::runtime_error("inconsistent tree size!\n");
 	}
+
+	{
+		/* build a copy from the sorted contents and check it */
+		decltype(rbtree) rbtree2;
+		rbtree2.assign_sorted(rbtree.cbegin(),rbtree.cend());
+		rbtree2.check_tree(0.0);
+		if(rbtree2.size() != rbtree.size()) throw std::runtime_error("inconsistent tree size after bulk build!\n");
+		uint32_t i = 0;
+		auto it = rbtree.cbegin();
+		for(auto it2 = rbtree2.cbegin();it2 != rbtree2.cend();++it,++it2,++i) {
+			if(*it != *it2) throw std::runtime_error("inconsistent keys after bulk build!\n");
+			if(rbtree2.get_sum_node(it2) != i) throw std::runtime_error("key rank not consistent after bulk build!\n");
+		}
+	}
+
+#ifndef USE_WIDE
+	{
+		/* append the first half of the keys one by one and the rest in one batch */
+		decltype(rbtree) rbtree2;
+		std::vector<unsigned int> keys(rbtree.cbegin(),rbtree.cend());
+		size_t half = keys.size() / 2;
+		for(size_t j = 0;j < half;j++) rbtree2.push_back(keys[j]);
+		rbtree2.check_tree(0.0);
+		if(rbtree2.append_sorted(keys.begin() + half,keys.end()) != keys.size() - half)
+			throw std::runtime_error("inconsistent result of appending a sorted range!\n");
+		rbtree2.check_tree(0.0);
+		if(rbtree2.size() != keys.size()) throw std::runtime_error("inconsistent tree size after appending!\n");
+		uint32_t i = 0;
+		for(auto it = rbtree2.cbegin();it != rbtree2.cend();++it,++i)
+			if(*it != keys[i] || rbtree2.get_sum_node(it) != i) throw std::runtime_error("tree not consistent after appending!\n");
+		check_append_errors(rbtree2);
+		
+		/* without duplicates, repeated keys are not appended */
+		orbtree::rankset<unsigned int> rs;
+		std::vector<unsigned int> dkeys(keys);
+		dkeys.erase(std::unique(dkeys.begin(), dkeys.end()), dkeys.end());
+		if(rs.append_sorted(keys.begin(), keys.end()) != dkeys.size() || rs.size() != dkeys.size())
+			throw std::runtime_error("inconsistent result of appending a range with duplicates!\n");
+		rs.check_tree(0.0);
+		if(!std::equal(dkeys.begin(), dkeys.end(), rs.cbegin())) throw std::runtime_error("tree not consistent after appending!\n");
+		if(dkeys.size()) {
+			unsigned int last = dkeys.back();
+			auto r = rs.push_back(last);
+			if(r.second || r.first != --rs.end() || rs.size() != dkeys.size()) throw std::runtime_error("repeated key appended!\n");
+			std::vector<unsigned int> more{last, last, last + 1, last + 1};
+			if(rs.append_sorted(more.begin(), more.end()) != 1 || rs.size() != dkeys.size() + 1)
+				throw std::runtime_error("repeated key appended!\n");
+			rs.check_tree(0.0);
+		}
+		check_append_errors(rs);
+	}
+	
+	{
+		/* insert all keys 8 more times into a copy of the tree in parallel */
+		std::vector<unsigned int> keys;
+		for(unsigned int k : rbtree) for(unsigned int j = 0;j < 8;j++) keys.push_back(k);
+		decltype(rbtree) rbtree2(rbtree);
+		if(rbtree2.insert_batch(keys.begin(),keys.end(),4) != keys.size()) throw std::runtime_error("inconsistent result of parallel insert!\n");
+		rbtree2.check_tree(0.0);
+		if(rbtree2.size() != 9*rbtree.size()) throw std::runtime_error("inconsistent tree size after parallel insert!\n");
+		uint32_t i = 0;
+		auto it = rbtree.cbegin();
+		for(auto it2 = rbtree2.cbegin();it2 != rbtree2.cend();++it2,++i) {
+			if(i && i % 9 == 0) ++it;
+			if(*it != *it2) throw std::runtime_error("inconsistent keys after parallel insert!\n");
+			if(rbtree2.get_sum_node(it2) != i) throw std::runtime_error("key rank not consistent after parallel insert!\n");
+		}
+	}
+	
+	for(unsigned int offset = 0;offset < 2;offset++) {
+		/* the same for trees without duplicates: keys already present and repeated keys
+		 * in the batch are not inserted, a map keeps the existing or the first new value */
+		auto key = [] (unsigned int k, unsigned int) { return k; };
+		auto kv = [] (unsigned int k, unsigned int c) { return std::make_pair(k, c); };
+		check_insert_batch_unique<orbtree::rankset<unsigned int> >(offset, key);
+		check_insert_batch_unique<orbtree::ranksetC<unsigned int> >(offset, key);
+		auto t = check_insert_batch_unique<orbtree::rankmapC<unsigned int, unsigned int> >(offset, kv);
+		for(auto it = t.cbegin();it != t.cend();++it) if(it->second != (it->first % 3 ? 1U : 0U))
+			throw std::runtime_error("value changed by parallel insert without duplicates!\n");
+	}
+#endif
+
+	{
+		/* erase the middle third of a copy in one step, and then every second key */
+		decltype(rbtree) rbtree2(rbtree);
+		size_t n = rbtree.size();
+		auto first = orbtree::lower_bound_r(rbtree2, n / 3);
+		auto last = orbtree::lower_bound_r(rbtree2, 2 * (n / 3));
+		rbtree2.erase(first,last);
+		rbtree2.check_tree(0.0);
+		if(rbtree2.size() != n - n / 3) throw std::runtime_error("inconsistent tree size after erasing a range!\n");
+		std::vector<unsigned int> keys;
+		uint32_t i = 0;
+		for(auto it = rbtree.cbegin();it != rbtree.cend();++it,++i) if(i < n / 3 || i >= 2 * (n / 3)) keys.push_back(*it);
+		i = 0;
+		for(auto it = rbtree2.cbegin();it != rbtree2.cend();++it,++i) if(*it != keys[i] || rbtree2.get_sum_node(it) != i)
+			throw std::runtime_error("tree not consistent after erasing a range!\n");
+		size_t n_odd = std::count_if(keys.begin(),keys.end(),[] (unsigned int k) { return k % 2; });
+		if(rbtree2.erase_if([] (unsigned int k) { return k % 2; }) != n_odd) throw std::runtime_error("inconsistent result of erase_if!\n");
+		rbtree2.check_tree(0.0);
+		i = 0;
+		for(auto it = rbtree2.cbegin();it != rbtree2.cend();++it,++i) if(*it % 2 || rbtree2.get_sum_node(it) != i)
+			throw std::runtime_error("tree not consistent after erase_if!\n");
+		if(i != keys.size() - n_odd) throw std::runtime_error("inconsistent tree size after erase_if!\n");
+	}
+
+	{
+		/* erase a range from the beginning and one until the end of a copy */
+		decltype(rbtree) rbtree2(rbtree);
+		size_t n = rbtree.size();
+		rbtree2.erase(rbtree2.cbegin(),orbtree::lower_bound_r(rbtree2, n / 4));
+		rbtree2.check_tree(0.0);
+		rbtree2.erase(orbtree::lower_bound_r(rbtree2, n / 2),rbtree2.cend());
+		rbtree2.check_tree(0.0);
+		if(rbtree2.size() != n / 2) throw std::runtime_error("inconsistent tree size after erasing a prefix and suffix!\n");
+		uint32_t i = 0;
+		auto it = orbtree::lower_bound_r(rbtree, n / 4);
+		for(auto it2 = rbtree2.cbegin();it2 != rbtree2.cend();++it,++it2,++i) if(*it != *it2 || rbtree2.get_sum_node(it2) != i)
+			throw std::runtime_error("tree not consistent after erasing a prefix and suffix!\n");
+	}
+
+	{
+		/* reserve storage for all elements up front, then shrink after erasing half of them */
+		decltype(rbtree) rbtree2;
+		rbtree2.reserve(rbtree.size());
+#if defined(USE_COMPACT) || defined(USE_POOL)
+		if(rbtree2.capacity() < rbtree.size()) throw std::runtime_error("reserve() did not increase capacity!\n");
+#endif
+		for(auto it = rbtree.cbegin();it != rbtree.cend();++it) rbtree2.insert(*it);
+		for(size_t j = rbtree.size()/2;j;j--) rbtree2.erase(rbtree2.begin());
+		rbtree2.shrink_to_fit();
+		rbtree2.check_tree(0.0);
+		if(rbtree2.size() != rbtree.size() - rbtree.size()/2 || rbtree2.capacity() < rbtree2.size())
+			throw std::runtime_error("inconsistent tree size after shrink_to_fit()!\n");
+	}
+
+	{
+		/* copy the tree structurally, then move and swap it back */
+		decltype(rbtree) rbtree2(rbtree);
+		rbtree2.check_tree(0.0);
+		decltype(rbtree) rbtree3(std::move(rbtree2));
+		if(rbtree3.size() != rbtree.size()) throw std::runtime_error("inconsistent tree size after move!\n");
+		swap(rbtree2,rbtree3);
+		rbtree2.check_tree(0.0);
+#ifndef USE_WIDE
+		/* moving does not allocate, so std::vector moves trees when reallocating */
+		static_assert(std::is_nothrow_move_constructible<decltype(rbtree)>::value &&
+			std::is_nothrow_move_assignable<decltype(rbtree)>::value, "tree should be nothrow movable!\n");
+		rbtree3 = rbtree2; /* assigning to a moved-from tree makes it usable again */
+		std::vector<decltype(rbtree)> trees;
+		trees.push_back(std::move(rbtree3));
+		for(unsigned int j = 0;j < 20;j++) trees.emplace_back();
+		trees.front().check_tree(0.0);
+		rbtree3 = std::move(trees.front());
+		if(rbtree3.size() != rbtree.size()) throw std::runtime_error("inconsistent tree size after moving in a vector!\n");
+		rbtree3.check_tree(0.0);
+#endif
+		uint32_t i = 0;
+		auto it = rbtree.cbegin();
+		for(auto it2 = rbtree2.cbegin();it2 != rbtree2.cend();++it,++it2,++i) {
+			if(*it != *it2) throw std::runtime_error("inconsistent keys after copy!\n");
+			if(rbtree2.get_sum_node(it2) != i) throw std::runtime_error("key rank not consistent after copy!\n");
+		}
+		if(i != rbtree.size()) throw std::runtime_error("inconsistent tree size after copy!\n");
+	}
+
+#if defined(USE_COMPACT) && !defined(USE_STACKED_VECTOR)
+	{
+		/* save the tree and map it back from the file (only works with realloc_vector) */
+		const char* fn = "orbtree_test.tmp";
+		rbtree.save(fn);
+		decltype(rbtree) rbtree2;
+		rbtree2.open_mapped(fn);
+		rbtree2.check_tree(0.0);
+		if(rbtree2.size() != rbtree.size()) throw std::runtime_error("inconsistent tree size after opening saved tree!\n");
+		auto it = rbtree.cbegin();
+		for(auto it2 = rbtree2.cbegin();it2 != rbtree2.cend();++it,++it2)
+			if(*it != *it2 || rbtree2.get_sum_node(it2) != rbtree.get_sum_node(it))
+				throw std::runtime_error("saved tree not consistent!\n");
+		
+		/* images with inconsistent headers are rejected before mapping them, the tree is not changed;
+		 * fields are modified at their offset in the header:
+		 * 32: number of nodes, 40 / 48: offset of nodes / partial sums,
+		 * 56: number of deleted nodes, 64: first deleted node, 88: size */
+		std::string image;
+		{
+			FILE* f = fopen(fn, "rb");
+			if(!f) throw std::runtime_error("cannot open saved tree!\n");
+			char buf[65536];
+			size_t len;
+			while((len = fread(buf, 1, sizeof(buf), f)) > 0) image.append(buf, len);
+			fclose(f);
+		}
+		remove(fn); /* mapping stays valid */
+		auto open_modified = [&] (size_t offset, uint64_t x) {
+			std::string image2(image);
+			memcpy(&image2[offset], &x, sizeof(x));
+			FILE* f = fopen(fn, "wb");
+			if(!f) throw std::runtime_error("cannot create temporary file!\n");
+			fwrite(image2.data(), 1, image2.size(), f);
+			fclose(f);
+			bool thrown = false;
+			try { rbtree2.open_mapped(fn); }
+			catch(std::runtime_error&) { thrown = true; }
+			remove(fn);
+			if(!thrown) throw std::runtime_error("inconsistent saved tree opened!\n");
+			rbtree2.check_tree(0.0);
+			if(rbtree2.size() != rbtree.size()) throw std::runtime_error("tree changed by opening inconsistent saved tree!\n");
+		};
+		uint64_t n_nodes, n_del;
+		memcpy(&n_nodes, &image[32], sizeof(n_nodes));
+		memcpy(&n_del, &image[56], sizeof(n_del));
+		open_modified(32, n_nodes + 1); /* larger than the file */
+		open_modified(32, ((uint64_t)1) << 62);
+		open_modified(32, ~(uint64_t)0);
+		open_modified(40, 0); /* overlaps the header */
+		open_modified(48, 0);
+		open_modified(48, ((uint64_t)1) << 62);
+		open_modified(56, n_nodes);
+		open_modified(56, n_del + 1);
+		open_modified(64, n_del ? n_nodes : 0);
+		open_modified(88, rbtree.size() + 1);
+		
+		/* the mapped tree can be still modified */
+		rbtree2.insert(1U);
+		rbtree2.check_tree(0.0);
+	}
+#endif
+
+	{
+		/* check batched queries for all keys present + some not present */
+		std::vector<unsigned int> keys;
+		for(unsigned int k : rbtree) { keys.push_back(k); keys.push_back(k + 1); }
+		std::sort(keys.begin(),keys.end());
+		std::vector<uint32_t> sums(keys.size());
+		rbtree.get_sums(keys.begin(),keys.end(),sums.data());
+		for(size_t j = 0;j < keys.size();j++) if(sums[j] != rbtree.get_sum(keys[j]))
+			throw std::runtime_error("batched rank query not consistent!\n");
+
+		/* check range sums by key, by iterators and by ranks */
+		for(size_t j = 0;j < keys.size();j += 7) for(size_t d = 0;d < 200 && j + d < keys.size();d += 13) {
+			uint32_t lo = sums[j], hi = sums[j+d];
+			if(rbtree.get_range_sum(keys[j],keys[j+d]) != hi - lo || rbtree.get_range_sum(keys[j+d],keys[j]) != 0)
+				throw std::runtime_error("range sum not consistent!\n");
+			auto it1 = rbtree.lower_bound(keys[j]);
+			auto it2 = rbtree.lower_bound(keys[j+d]);
+			if(rbtree.get_range_sum_node(it1,it2) != hi - lo) throw std::runtime_error("range sum by iterators not consistent!\n");
+			uint32_t r;
+			rbtree.get_range_sum_by_weight(0,lo,hi,&r);
+			if(r != hi - lo) throw std::runtime_error("range sum by ranks not consistent!\n");
+		}
+	}
+
+#ifndef USE_WIDE
+	{
+		/* give back storage of deleted nodes (if any) in small steps */
+		while(rbtree.compact_step(16)) if(!check_only_end) rbtree.check_tree(0.0);
+		if(rbtree.deleted_nodes() || rbtree.fragmentation() != 0.0) throw std::runtime_error("deleted nodes remain after compaction!\n");
+		rbtree.check_tree(0.0);
+		uint32_t i = 0;
+		for(auto it = rbtree.cbegin();it != rbtree.cend();++it,++i)
+			if(rbtree.get_sum_node(it) != i) throw std::runtime_error("key rank not consistent after compaction!\n");
+		/* store nodes in search order and check again */
+		std::vector<unsigned int> keys(rbtree.cbegin(),rbtree.cend());
+		rbtree.relayout();
+		rbtree.check_tree(0.0);
+		i = 0;
+		for(auto it = rbtree.cbegin();it != rbtree.cend();++it,++i)
+			if(*it != keys[i] || rbtree.get_sum_node(it) != i) throw std::runtime_error("tree not consistent after relayout!\n");
+	}
+#endif
+	
+	{
+		check_rle(rle, rbtree);
+		check_rle(rleC, rbtree);
+		
+		/* insert and erase multiple copies at once */
+		decltype(rbtree) rbtree2(rbtree);
+		decltype(rle) rle2(rle);
+		for(unsigned int k : {1U, 5U, 1000U}) {
+			rle2.insert(k, 10);
+			for(unsigned int j = 0;j < 10;j++) rbtree2.insert(k);
+			check_rle(rle2, rbtree2);
+		}
+		for(unsigned int k : {1U, 5U, 1000U, 1001U}) {
+			size_t c = rbtree2.count(k);
+			size_t e = std::min(c, (size_t)7);
+			if(rle2.erase(k, 7) != e) throw std::runtime_error("inconsistent result of erasing copies in run-length encoded multiset!\n");
+			for(size_t j = 0;j < e;j++) rbtree2.erase(rbtree2.find(k));
+			check_rle(rle2, rbtree2);
+		}
+		if(rle2.erase(1000U) != 3) throw std::runtime_error("inconsistent result of erasing a key in run-length encoded multiset!\n");
+		for(size_t j = 0;j < 3;j++) rbtree2.erase(rbtree2.find(1000U));
+		check_rle(rle2, rbtree2);
+		
+		/* overflow of weights or counts throws an exception and leaves the multiset unchanged */
+		orbtree::rankmultisetR<unsigned int, uint16_t> rle3;
+		rle3.insert(10, 40000);
+		bool thrown = false;
+		try { rle3.insert(20, 70000); } catch(std::runtime_error&) { thrown = true; } /* weight of one node */
+		if(!thrown) throw std::runtime_error("missing overflow error in run-length encoded multiset!\n");
+		thrown = false;
+		try { rle3.insert(20, 30000); } catch(std::runtime_error&) { thrown = true; } /* sum of weights */
+		if(!thrown) throw std::runtime_error("missing overflow error in run-length encoded multiset!\n");
+		rle3.check_tree(0.0);
+		if(rle3.size() != 40000 || rle3.distinct_size() != 1 || rle3.count(10) != 40000 || rle3.count(20) != 0 || rle3.get_norm() != 40000)
+			throw std::runtime_error("run-length encoded multiset changed by failed insert!\n");
+		orbtree::rankmultisetCR<unsigned int, uint32_t, uint8_t> rle4;
+		rle4.insert(10, 200);
+		thrown = false;
+		try { rle4.insert(10, 100); } catch(std::runtime_error&) { thrown = true; } /* count of one key */
+		if(!thrown) throw std::runtime_error("missing count overflow error in run-length encoded multiset!\n");
+		rle4.check_tree(0.0);
+		if(rle4.size() != 200 || rle4.count(10) != 200 || rle4.get_norm() != 200)
+			throw std::runtime_error("run-length encoded multiset changed by failed insert!\n");
+	}
+
+	if(rbtree.empty() || *(--rbtree.cend()) < (1U << 24)) {
+		/* sets and maps stored in a Fenwick tree, compared to trees with the distinct keys
+		 * (only if keys are from a small range, since memory use depends on the largest key) */
+		size_t n = rbtree.empty() ? 1 : *(--rbtree.cend()) + 1;
+		orbtree::rankset<unsigned int> ref;
+		orbtree::ranksetD<unsigned int> fs(n);
+		for(unsigned int k : rbtree) if(fs.insert(k).second != ref.insert(k).second)
+			throw std::runtime_error("inconsistent insert result in Fenwick tree!\n");
+		fs.check_tree(0.0);
+		/* erase every third key */
+		uint32_t i = 0;
+		for(auto it = ref.cbegin();it != ref.cend();++i) {
+			if(i % 3) { ++it; continue; }
+			if(fs.erase(*it) != 1) throw std::runtime_error("inconsistent erase result in Fenwick tree!\n");
+			it = ref.erase(it);
+		}
+		fs.check_tree(0.0);
+		
+		auto check_fs = [&fs,&ref] () {
+			if(fs.size() != ref.size()) throw std::runtime_error("inconsistent size of Fenwick tree!\n");
+			auto it2 = ref.cbegin();
+			for(auto it = fs.cbegin();it != fs.cend();++it,++it2) if(it2 == ref.cend() || *it != *it2)
+				throw std::runtime_error("inconsistent keys in Fenwick tree!\n");
+			/* iterate backward */
+			it2 = ref.cend();
+			for(auto it = fs.cend();it != fs.cbegin();) {
+				--it; --it2;
+				if(*it != *it2) throw std::runtime_error("inconsistent keys in Fenwick tree when iterating backward!\n");
+			}
+			for(unsigned int k : ref) {
+				if(fs.get_sum(k) != ref.get_sum(k) || fs.get_sum(k + 1) != ref.get_sum(k + 1))
+					throw std::runtime_error("inconsistent partial sums in Fenwick tree!\n");
+			}
+			for(uint32_t r = 0;r <= ref.size();r++) {
+				uint32_t s1 = 0, s2 = 0;
+				auto it1 = fs.find_by_weight(0, r, &s1);
+				auto it2 = ref.find_by_weight(0, r, &s2);
+				if((it1 == fs.cend()) != (it2 == ref.cend()) || (it1 != fs.cend() && (*it1 != *it2 || s1 != s2)))
+					throw std::runtime_error("inconsistent search by weight in Fenwick tree!\n");
+				auto it3 = fs.lower_bound_w([r] (const uint32_t* x) { return *x >= r; });
+				auto it4 = ref.lower_bound_w([r] (const uint32_t* x) { return *x >= r; });
+				if((it3 == fs.cend()) != (it4 == ref.cend()) || (it3 != fs.cend() && *it3 != *it4))
+					throw std::runtime_error("inconsistent lower_bound_w() result in Fenwick tree!\n");
+			}
+		};
+		check_fs();
+		
+		/* shrink the range (removing larger keys), then grow it and add keys to the new part */
+		fs.resize(n / 2 + 1);
+		fs.check_tree(0.0);
+		ref.erase(ref.lower_bound(n / 2 + 1),ref.end());
+		check_fs();
+		fs.resize(2 * n + 3);
+		fs.check_tree(0.0);
+		for(unsigned int k = n;k < 2 * n + 3;k += 3) { fs.insert(k); ref.insert(k); }
+		fs.check_tree(0.0);
+		check_fs();
+		
+		/* build from sorted keys */
+		orbtree::ranksetD<unsigned int> fs2(2 * n + 3);
+		fs2.assign_sorted(ref.cbegin(),ref.cend());
+		fs2.check_tree(0.0);
+		swap(fs,fs2);
+		check_fs();
+		
+		/* map with two component weights, values changed with set_value() */
+		std::vector<double> pars{1.0, 2.5};
+		orbtree::orbmapD<unsigned int, double, orbtree::NVFunc_Adapter_Vec<value_mult> > fm(n, pars);
+		orbtree::orbmap<unsigned int, double, orbtree::NVFunc_Adapter_Vec<value_mult> > refm(pars);
+		for(unsigned int k : rbtree) {
+			double v = 1.0 + (k % 7);
+			if(fm.set_value(k, v) != refm.set_value(k, v)) throw std::runtime_error("inconsistent result of set_value() in Fenwick tree!\n");
+			fm.check_tree(0.0);
+		}
+		for(unsigned int k : rbtree) if(k % 2) { fm.set_value(k, 0.5 * k); refm.set_value(k, 0.5 * k); }
+		fm.check_tree(0.0);
+		for(unsigned int k : rbtree) {
+			double s1[2], s2[2];
+			fm.get_sum(k, s1);
+			refm.get_sum(k, s2);
+			if(fabs(s1[0] - s2[0]) > 1e-6 || fabs(s1[1] - s2[1]) > 1e-6 || fm.at(k) != refm.at(k))
+				throw std::runtime_error("inconsistent partial sums in Fenwick tree map!\n");
+		}
+	}
+	
+	{
+		/* one writer publishing batches of insertions while readers query the snapshots */
+#ifdef USE_WIDE
+		typedef orbtree::rankmultiset<unsigned int> ctree_type;
+#else
+		typedef decltype(rbtree) ctree_type;
+#endif
+		const size_t batch = 64;
+		const size_t nbatch = (rbtree.size() + batch - 1) / batch;
+		orbtree::concurrent_tree<ctree_type> ct;
+		std::atomic<bool> error(false);
+		std::vector<std::thread> readers;
+		for(unsigned int i = 0;i < 3;i++) readers.emplace_back([&ct, &error, nbatch] () {
+			uint64_t last_ver = 0;
+			size_t last_size = 0;
+			while(true) {
+				uint64_t v = ct.version();
+				auto s = ct.snapshot();
+				if(v < last_ver || s->size() < last_size || s->get_norm() != s->size()) { error = true; break; }
+				last_ver = v;
+				last_size = s->size();
+				if(v > nbatch) break;
+			}
+		});
+		auto it = rbtree.cbegin();
+		for(size_t i = 0;i < nbatch;i++) {
+			for(size_t j = 0;j < batch && it != rbtree.cend();j++,++it) ct.writer().insert(*it);
+			ct.publish();
+		}
+		for(auto& t : readers) t.join();
+		if(error) throw std::runtime_error("inconsistent snapshot of concurrent tree!\n");
+		auto s = ct.snapshot();
+		if(ct.version() != nbatch + 1 || s->size() != rbtree.size()) throw std::runtime_error("inconsistent final version of concurrent tree!\n");
+		s->check_tree(0.0);
+		if(!std::equal(s->cbegin(), s->cend(), rbtree.cbegin())) throw std::runtime_error("inconsistent final version of concurrent tree!\n");
+	}
 	
 	if(rt.get_last_error() != T_EOF) rt.write_error(stderr);
 	
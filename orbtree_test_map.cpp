@@ -34,22 +34,66 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <vector>
+#include <algorithm>
 #include "read_table.h"
 #include "orbtree.h"
+#include "orbtree_load.h"
+
+/* weight function for testing maps with two component weights: value multiplied by the parameter */
+struct value_mult {
+	typedef std::pair<double, double> argument_type;
+	typedef double ParType;
+	typedef double result_type;
+	double operator()(const std::pair<double, double>& p, double a) const { return a*p.second; }
+};
+
+/* compare the partial sums of two trees (with the same keys), with a tolerance
+ * relative to the magnitude of the sums */
+template<class Tree1, class Tree2>
+void check_sums(const Tree1& t1, const Tree2& t2, const char* msg) {
+	if(t1.size() != t2.size()) throw std::runtime_error(msg);
+	unsigned int nr = t1.get_nvfunc().get_nr();
+	std::vector<double> s1(nr), s2(nr);
+	auto it2 = t2.cbegin();
+	for(auto it1 = t1.cbegin();;++it1,++it2) {
+		if(it1 == t1.cend()) { t1.get_norm(s1.data()); t2.get_norm(s2.data()); }
+		else {
+			t1.get_sum_node(it1, s1.data());
+			t2.get_sum_node(it2, s2.data());
+		}
+		for(unsigned int i = 0;i < nr;i++) if(fabs(s1[i] - s2[i]) > 1e-9 * (1.0 + fabs(s2[i]))) throw std::runtime_error(msg);
+		if(it1 == t1.cend()) break;
+	}
+}
 
 int main(int argc, char **argv)
 {
 
 #ifdef USE_COMPACT	
 	orbtree::rankmultimapC<double, double, uint32_t> rbtree;
+#elif defined(USE_POOL)
+	orbtree::rankmultimapP<double, double, uint32_t> rbtree;
+#elif defined(USE_CACHE_WEIGHT)
+	/* weight of each node is stored (along with the partial sum) */
+	orbtree::orbtree< orbtree::NodeAllocatorPtr< orbtree::KeyValue<double, double>, uint32_t, true, 0, false, true >, std::less<double>,
+		orbtree::NVFunc_Adapter_Simple< orbtree::RankFunc<orbtree::trivial_pair<double, double>, uint32_t> >, true, true > rbtree;
 #else
 	orbtree::rankmultimap<double, double, uint32_t> rbtree;
 #endif
 	
 	bool check_only_end = false;
-	if(argc > 1 && argv[1][0] == '-' && argv[1][1] == 'c') check_only_end = true;
+	bool lazy = false;
+	bool use_mmap = false;
+	for(int i = 1;i < argc;i++) if(argv[i][0] == '-') {
+		if(argv[i][1] == 'c') check_only_end = true;
+		if(argv[i][1] == 'l') lazy = true; /* update partial sums only when needed */
+		if(argv[i][1] == 'm') use_mmap = true; /* map the input into memory if it is a file */
+	}
+	rbtree.set_lazy_sums(lazy);
 	
 	read_table2 rt(stdin);
+	if(use_mmap) rt.use_mmap();
 	
 	while(rt.read_line()) {
 		double x;
@@ -71,7 +115,8 @@ int main(int argc, char **argv)
 		}
 		
 		if(!check_only_end) {
-			/* check tree */
+			/* check tree -- in lazy mode, first without partial sums, as those are not updated yet */
+			if(lazy) rbtree.check_tree();
 			rbtree.check_tree(0.0);
 			
 			/* check all ranks (by iterating over all nodes) */
@@ -100,6 +145,313 @@ int main(int argc, char **argv)
 		}
 		if(i != rbtree.size()) throw std::runtime_error("inconsistent tree size!\n");
 	}
+
+	{
+		/* change all values at once */
+		std::vector<std::pair<decltype(rbtree)::iterator, double> > updates;
+		for(auto it = rbtree.begin();it != rbtree.end();++it) updates.push_back(std::make_pair(it, 2.0*it->first));
+		rbtree.update_values(updates.begin(),updates.end(),2);
+		rbtree.check_tree(0.0);
+		for(auto it = rbtree.cbegin();it != rbtree.cend();++it)
+			if(it->second != 2.0*it->first) throw std::runtime_error("value not updated!\n");
+	}
+
+	/* recalculate all partial sums at once, using multiple threads */
+	rbtree.recompute_weights(4);
+	rbtree.check_tree(0.0);
+
+	{
+		/* structure of the tree reported by get_stats() */
+		auto s = rbtree.get_stats();
+		if(s.size != rbtree.size()) throw std::runtime_error("inconsistent tree size in statistics!\n");
+		if(s.height > 2*s.black_height + 1 || (s.size && s.avg_depth > s.height)) throw std::runtime_error("inconsistent tree height!\n");
+		
+		/* memory use of a compact tree: erased nodes are kept until compacting the storage */
+		const unsigned int k = 1000;
+		orbtree::rankmultimapC<double, double, uint32_t> tc;
+		tc.reset_stats();
+		for(unsigned int i = 0;i < k;i++) tc.insert(std::make_pair(0.5 * i, 1.0));
+		for(unsigned int i = 0;i < k;i += 2) tc.erase(0.5 * i);
+		tc.check_tree(0.0);
+		auto sc = tc.get_stats();
+		if(sc.size != k / 2 || sc.deleted_nodes != k / 2 || sc.node_capacity < k ||
+			sc.node_bytes < sc.node_capacity * sizeof(uint32_t) || sc.nv_bytes < (k + 2) * sizeof(uint32_t))
+			throw std::runtime_error("inconsistent memory use in statistics!\n");
+		tc.shrink_to_fit();
+		tc.check_tree(0.0);
+		auto sc2 = tc.get_stats();
+		if(sc2.deleted_nodes != 0 || sc2.node_bytes >= sc.node_bytes || sc2.node_capacity < k / 2)
+			throw std::runtime_error("inconsistent memory use in statistics after compacting!\n");
+		
+#ifdef ORBTREE_STATS
+		/* operation counters (if compiled with -DORBTREE_STATS): each insert searches for the
+		 * place of the new element once, inserting sorted keys needs rotations */
+		if(!sc.counters_enabled || sc.insert_search_calls != k || sc.insert_search_nodes < k - 1 || sc.rotations == 0)
+			throw std::runtime_error("inconsistent operation counters!\n");
+		decltype(rbtree) t2;
+		for(unsigned int i = 0;i < k;i++) t2.insert(std::make_pair(0.5 * i, 1.0));
+		auto s2 = t2.get_stats();
+		if(s2.insert_search_calls != k || s2.rotations == 0) throw std::runtime_error("inconsistent operation counters!\n");
+		t2.reset_stats();
+		s2 = t2.get_stats();
+		if(s2.insert_search_calls || s2.insert_search_nodes || s2.rotations || s2.get_sum_calls || s2.nvfunc_calls)
+			throw std::runtime_error("operation counters not reset!\n");
+		for(unsigned int i = 0;i < k;i += 10) if(t2.get_sum(0.5 * i) != i) throw std::runtime_error("key rank not consistent!\n");
+		s2 = t2.get_stats();
+		if(s2.get_sum_calls != k / 10 || s2.get_sum_nodes < k / 10 || s2.insert_search_calls || s2.rotations)
+			throw std::runtime_error("inconsistent operation counters!\n");
+#else
+		if(sc.counters_enabled || sc.insert_search_calls || sc.rotations) throw std::runtime_error("operation counters should not be updated!\n");
+#endif
+	}
+
+	{
+		/* load a file with many repeated keys using 1 and 4 threads (with small chunks,
+		 * so that the input is split), the original line numbers are stored as values */
+		const char* fn = "orbtree_test_map.tmp";
+		const size_t n = 20000;
+		const size_t min_chunk = 4096;
+		FILE* f = fopen(fn, "w");
+		if(!f) throw std::runtime_error("cannot create temporary file!\n");
+		for(size_t i = 0;i < n;i++) fprintf(f, "%u\t%zu\n", (unsigned int)((i * 7919) % 1000), i);
+		fclose(f);
+		
+		decltype(rbtree) t1, t4;
+		orbtree::load_file(t1, fn, 1, '\t', 0, min_chunk);
+		orbtree::load_file(t4, fn, 4, '\t', 0, min_chunk);
+		t1.check_tree(0.0);
+		t4.check_tree(0.0);
+		if(t1.size() != n || t4.size() != n) throw std::runtime_error("inconsistent tree size after loading file!\n");
+		for(auto it1 = t1.cbegin(), it4 = t4.cbegin();it1 != t1.cend();++it1,++it4)
+			if(it1->first != it4->first || it1->second != it4->second)
+				throw std::runtime_error("inconsistent result of loading file with multiple threads!\n");
+		/* equal keys keep the order of the file */
+		for(auto it = t4.cbegin(), prev = it++;it != t4.cend();prev = it++)
+			if(prev->first == it->first && prev->second >= it->second)
+				throw std::runtime_error("order of equal keys not kept when loading file!\n");
+		
+		/* without duplicates, the first line with each key is kept */
+		orbtree::rankmap<double, double, uint32_t> m1, m4;
+		orbtree::load_file(m1, fn, 1, '\t', 0, min_chunk);
+		orbtree::load_file(m4, fn, 4, '\t', 0, min_chunk);
+		m1.check_tree(0.0);
+		m4.check_tree(0.0);
+		if(m1.size() != 1000 || m4.size() != 1000) throw std::runtime_error("inconsistent map size after loading file!\n");
+		for(auto it1 = m1.cbegin(), it4 = m4.cbegin();it1 != m1.cend();++it1,++it4)
+			if(it1->first != it4->first || it1->second != it4->second || it4->second != t4.lower_bound(it4->first)->second)
+				throw std::runtime_error("inconsistent map after loading file with multiple threads!\n");
+		
+		/* an invalid line in the third chunk gives an error with its line number, the tree is not changed */
+		const size_t bad = (3 * n) / 4;
+		f = fopen(fn, "w");
+		if(!f) throw std::runtime_error("cannot create temporary file!\n");
+		for(size_t i = 0;i < n;i++) {
+			if(i == bad) fprintf(f, "x%zu\t%zu\n", i, i);
+			else fprintf(f, "%u\t%zu\n", (unsigned int)((i * 7919) % 1000), i);
+		}
+		fclose(f);
+		bool thrown = false;
+		try { orbtree::load_file(t4, fn, 4, '\t', 0, min_chunk); }
+		catch(std::runtime_error& e) {
+			thrown = true;
+			if(!strstr(e.what(), (std::string("line ") + std::to_string(bad + 1) + ",").c_str()))
+				throw std::runtime_error("wrong line number in error when loading file!\n");
+		}
+		remove(fn);
+		if(!thrown) throw std::runtime_error("missing error when loading invalid file!\n");
+		t4.check_tree(0.0);
+		if(t4.size() != n) throw std::runtime_error("tree changed by failed load!\n");
+		for(auto it1 = t1.cbegin(), it4 = t4.cbegin();it1 != t1.cend();++it1,++it4)
+			if(it1->first != it4->first || it1->second != it4->second) throw std::runtime_error("tree changed by failed load!\n");
+	}
+	
+	{
+		/* change the exponents of the weight function in place, using multiple threads;
+		 * the partial sums are the same as in a tree built with the new exponents */
+		typedef orbtree::NVPower2<double> nvfunc;
+		std::vector<double> pars{0.0, 1.0};
+		orbtree::orbset<double, nvfunc> ps(pars);
+		orbtree::orbsetC<double, nvfunc> psC(pars);
+		for(auto it = rbtree.cbegin();it != rbtree.cend();++it) { ps.insert(it->first + 1.0); psC.insert(it->first + 1.0); }
+		for(const auto& new_pars : std::vector<std::vector<double> >{{0.5, 2.0}, {-1.0, 1.5}, {1.0, 0.0}}) {
+			ps.set_nvfunc(new_pars, 4);
+			psC.set_nvfunc(nvfunc(new_pars), 3);
+			ps.check_tree(1e-6);
+			psC.check_tree(1e-6);
+			orbtree::orbset<double, nvfunc> ref(new_pars);
+			for(double x : ps) ref.insert(x);
+			check_sums(ps, ref, "inconsistent partial sums after changing the weight function!\n");
+			check_sums(psC, ref, "inconsistent partial sums after changing the weight function in compact tree!\n");
+		}
+		/* the number of components cannot be changed */
+		bool thrown = false;
+		try { ps.set_nvfunc(std::vector<double>{1.0}, 4); }
+		catch(std::runtime_error&) { thrown = true; }
+		if(!thrown || ps.get_nvfunc().get_nr() != 2) throw std::runtime_error("number of weight components changed!\n");
+	}
+	
+	{
+		/* trees storing the weight of each node, with weights depending on the values:
+		 * stored weights have to follow changes of the values (weights are multiples
+		 * of 0.25, so partial sums are exact) */
+		typedef orbtree::NVFunc_Adapter_Vec<value_mult> nvfunc;
+		std::vector<double> pars{1.0, 2.5};
+		orbtree::orbmultimapW<double, double, nvfunc> mw(pars);
+		orbtree::orbmapCW<double, double, nvfunc> mcw(pars);
+		orbtree::orbmultimap<double, double, nvfunc> refw(pars);
+		orbtree::orbmap<double, double, nvfunc> refcw(pars);
+		auto check_w = [&] () {
+			mw.check_tree(0.0);
+			mcw.check_tree(0.0);
+			check_sums(mw, refw, "inconsistent partial sums in tree storing weights!\n");
+			check_sums(mcw, refcw, "inconsistent partial sums in compact tree storing weights!\n");
+		};
+		for(auto it = rbtree.cbegin();it != rbtree.cend();++it) {
+			double v = 1.0 + ((unsigned int)it->first) % 5;
+			mw.insert(std::make_pair(it->first, v));
+			refw.insert(std::make_pair(it->first, v));
+			mcw.insert(std::make_pair(it->first, v));
+			refcw.insert(std::make_pair(it->first, v));
+		}
+		check_w();
+		
+		/* change single values */
+		{
+			auto it1 = mw.begin();
+			auto it2 = refw.begin();
+			for(unsigned int i = 0;it1 != mw.end();++it1,++it2,i++) if(i % 3 == 0) {
+				it1.set_value(0.5 * i);
+				it2.set_value(0.5 * i);
+			}
+		}
+		for(auto it = refcw.cbegin();it != refcw.cend();++it) if(((unsigned int)it->first) % 2) {
+			mcw.set_value(it->first, it->first + 0.5);
+			refcw.set_value(it->first, it->first + 0.5);
+		}
+		check_w();
+		
+		/* change all values at once, using multiple threads */
+		{
+			std::vector<std::pair<decltype(mw)::iterator, double> > u1;
+			std::vector<std::pair<decltype(refw)::iterator, double> > u2;
+			auto it2 = refw.begin();
+			for(auto it1 = mw.begin();it1 != mw.end();++it1,++it2) {
+				u1.push_back(std::make_pair(it1, 3.0 * it1->first));
+				u2.push_back(std::make_pair(it2, 3.0 * it1->first));
+			}
+			mw.update_values(u1.begin(), u1.end(), 4);
+			refw.update_values(u2.begin(), u2.end());
+			std::vector<std::pair<double, double> > u3;
+			for(auto it = refcw.cbegin();it != refcw.cend();++it) u3.push_back(std::make_pair(it->first, it->first + 2.0));
+			mcw.update_values(u3.begin(), u3.end(), 4);
+			refcw.update_values(u3.begin(), u3.end());
+		}
+		check_w();
+		
+		/* changes in lazy mode, partial sums are updated at once */
+		mcw.set_lazy_sums(true);
+		for(auto it = refcw.cbegin();it != refcw.cend();++it) if(((unsigned int)it->first) % 3 == 1) {
+			mcw.set_value(it->first, 1.5);
+			refcw.set_value(it->first, 1.5);
+		}
+		mcw.check_tree();
+		mcw.set_lazy_sums(false);
+		check_w();
+		
+		/* reorganize nodes, then remove some */
+		mcw.relayout();
+		check_w();
+		for(unsigned int k = 0;k < 300;k += 4) { mcw.erase((double)k); refcw.erase((double)k); }
+		mcw.relayout();
+		check_w();
+	}
+	
+	{
+		/* lines with DOS line endings and missing fields give the same result when
+		 * reading the file line by line, by mapping it into memory or from a buffer;
+		 * the file ends at a page boundary, after a line with a missing field */
+		const char* fn = "orbtree_test_map.tmp";
+		std::string data = "1\r\n2 3\r\n4 \r\n5\t6 7\r\n8\n\r\n9 x\r\n1,2\r\n3,\r\n,4\r\n";
+		while((data.size() + 3) % 4096) data += (data.size() + 4) % 4096 ? "0\n" : "\n";
+		data += "7\r\n";
+		FILE* f = fopen(fn, "w");
+		if(!f) throw std::runtime_error("cannot create temporary file!\n");
+		fwrite(data.data(), 1, data.size(), f);
+		fclose(f);
+		/* read up to three numbers from each line, record the results and errors */
+		auto read_all = [] (read_table2& r, char delim) {
+			std::vector<int64_t> res;
+			r.set_delim(delim);
+			while(r.read_line()) for(int i = 0;i < 3;i++) {
+				int64_t x = -1;
+				bool ok = r.read(x);
+				if(r.get_pos() > r.line_len) throw std::runtime_error("position past the end of line!\n");
+				res.push_back(r.get_line());
+				res.push_back(ok ? x : -1);
+				res.push_back(r.get_last_error());
+			}
+			return res;
+		};
+		for(char delim : {(char)0, ','}) {
+			read_table2 r1(fn), r2(fn), r3(fn);
+			if(!r2.use_mmap()) throw std::runtime_error("cannot map temporary file!\n");
+			r3.use_buffer(data.data(), data.size());
+			auto res1 = read_all(r1, delim);
+			auto res2 = read_all(r2, delim);
+			auto res3 = read_all(r3, delim);
+			if(res1 != res2 || res1 != res3) throw std::runtime_error("inconsistent result of reading file in memory!\n");
+			/* first line: the number is read, then the end of line is found */
+			if(res1.size() < 6 || res1[1] != 1 || res1[2] != T_OK || res1[4] != -1 || res1[5] != T_EOL)
+				throw std::runtime_error("inconsistent result of reading line with DOS line ending!\n");
+			if(res1[res1.size() - 8] != 7 || res1[res1.size() - 5] != -1 || res1[res1.size() - 4] != T_EOL)
+				throw std::runtime_error("inconsistent result of reading the last line!\n");
+		}
+		remove(fn);
+	}
+	
+	{
+		/* searching for multiple values at once with two component weights gives the
+		 * same result as searching for each value separately (weights are multiples
+		 * of 0.5, so partial sums are exact) */
+		std::vector<double> pars{1.0, 2.5};
+		orbtree::orbmultimap<double, double, orbtree::NVFunc_Adapter_Vec<value_mult> > mm(pars);
+		for(auto it = rbtree.cbegin();it != rbtree.cend();++it)
+			mm.insert(std::make_pair(it->first, 1.0 + ((unsigned int)it->first) % 5));
+		mm.check_tree(0.0);
+		const auto& cmm = mm;
+		for(unsigned int c = 0;c < 2;c++) {
+			double norm[2];
+			mm.get_norm(norm);
+			/* values at the start of each element and inside it, the total weight and beyond */
+			std::vector<double> values;
+			for(auto it = mm.cbegin();it != mm.cend();++it) {
+				double s[2];
+				mm.get_sum_node(it, s);
+				values.push_back(s[c]);
+				values.push_back(s[c] + 0.25);
+			}
+			values.push_back(norm[c]);
+			values.push_back(norm[c]);
+			values.push_back(norm[c] + 1.0);
+			std::sort(values.begin(), values.end());
+			
+			std::vector<decltype(mm)::iterator> its;
+			std::vector<decltype(mm)::const_iterator> cits;
+			std::vector<double> res(2 * values.size()), cres(2 * values.size());
+			mm.find_by_weights(c, values.begin(), values.end(), std::back_inserter(its), res.data());
+			cmm.find_by_weights(c, values.begin(), values.end(), std::back_inserter(cits), cres.data());
+			if(its.size() != values.size() || cits.size() != values.size())
+				throw std::runtime_error("inconsistent number of results when searching multiple weights!\n");
+			for(size_t i = 0;i < values.size();i++) {
+				double s[2] = {-1.0, -1.0};
+				auto it = mm.find_by_weight(c, values[i], s);
+				if(it != its[i] || it != cits[i] || s[0] != res[2*i] || s[1] != res[2*i+1] || s[0] != cres[2*i] || s[1] != cres[2*i+1])
+					throw std::runtime_error("inconsistent result when searching multiple weights!\n");
+				if(values[i] >= norm[c] ? (it != mm.end() || s[0] != norm[0] || s[1] != norm[1]) : it == mm.end())
+					throw std::runtime_error("inconsistent result when searching weights!\n");
+			}
+		}
+	}
 	
 	if(rt.get_last_error() != T_EOF) rt.write_error(stderr);
 	
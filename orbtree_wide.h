@@ -0,0 +1,1655 @@
+/*  -*- C++ -*-
+ * orbtree_wide.h -- generalized order statistic tree with wide nodes
+ * 	(B+ tree storing partial sums for the children of each node)
+ *
+ * Copyright 2020 Daniel Kondor <kondor.dani@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the  nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+
+#ifndef ORBTREE_WIDE_H
+#define ORBTREE_WIDE_H
+
+#include "orbtree.h"
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <stdint.h>
+
+/* constexpr if support only for c++17 or newer */
+#if __cplusplus >= 201703L
+#define CONSTEXPR constexpr
+#else
+#define CONSTEXPR
+#endif
+
+/* size of temporary arrays storing weights (same as in orbtree_base.h) */
+#define ORBTREE_NV_SIZE (fixed_nr ? fixed_nr : f.get_nr())
+
+
+namespace orbtree {
+
+	/** \brief Generalized order statistic tree with wide nodes (B+ tree).
+	 *
+	 * Alternative to \ref orbtree::orbtree "orbtree" with mostly the same interface.
+	 * Elements are stored in leaves holding up to B elements each, which are linked
+	 * in a list in order. Inner nodes store up to B children, the keys separating
+	 * them and the sum of weights in the subtree of each child. Sums are stored
+	 * contiguously for all children of a node (separately for each component of
+	 * the weights), so that they are added in loops that can be vectorized by the
+	 * compiler. A tree of N elements has about log(N) / log(B/2) levels, compared
+	 * to up to 2 log_2(N) for the red-black tree, so searches and queries of partial
+	 * sums visit several times fewer nodes (and cache lines). The weight of each
+	 * element is stored along with it, so the weight function is only called when
+	 * inserting an element or changing its value.
+	 *
+	 * Nodes are stored in flat arrays and refer to each other by indexes, similarly
+	 * to NodeAllocatorCompact. Elements are moved between positions and nodes when
+	 * other elements are inserted or erased, so any modification invalidates all
+	 * iterators (the iterator returned by insert() or erase() stays valid). Keys and
+	 * values need to be default constructible and move assignable. Lazy updates,
+	 * parallel operations and compaction of the red-black tree are not supported.
+	 *
+	 * It is recommended to use the templates \ref orbsetB, \ref orbmultisetB,
+	 * \ref orbmapB, \ref orbmultimapB and the rank variants ranksetB, rankmultisetB,
+	 * rankmapB and rankmultimapB instead of directly using this class template.
+	 *
+	 * @tparam KeyValueT Type of stored data, should be either KeyOnly or KeyValue
+	 * @tparam NVTypeT Type of weights (i.e. the return value of NVFunc)
+	 * @tparam Compare comparison functor
+	 * @tparam NVFunc function that calculates the weights associated with
+	 * 		elements based on key and value (see NVFunc_Adapter_Simple)
+	 * @tparam multi determines if this is a multiset / multimap (keys
+	 * 		can be present multiple times) or not
+	 * @tparam simple determines if the weight function returns one value
+	 * 		(if true) or multiple values (if false), same as for orbtree
+	 * @tparam B maximum number of elements in a leaf and maximum number
+	 * 		of children of inner nodes (even, at least 4)
+	 * @tparam IndexType unsigned integer type used to refer to nodes
+	 */
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple = false,
+		unsigned int B = 32, class IndexType = uint32_t>
+	class orbtree_wide {
+		static_assert(B >= 4 && B % 2 == 0, "orbtree_wide: B should be even and at least 4!\n");
+		static_assert(std::is_integral<IndexType>::value && std::is_unsigned<IndexType>::value,
+			"orbtree_wide: IndexType should be an unsigned integral type!\n");
+		protected:
+			typedef KeyValueT KeyValue;
+			typedef typename KeyValueT::KeyType KeyType;
+		public:
+/* typedefs */
+			/// \brief Values stored in this tree. Either the key (for sets)
+			///	or an orbtree::trivial_pair of key and value
+			typedef typename KeyValueT::ValueType value_type;
+			/// Key type of elements that determines ordering.
+			typedef KeyType key_type;
+			/// Type of values associated by elements (calculated by NVFunc)
+			typedef NVTypeT NVType;
+			typedef NVFunc NVFunc_t;
+			typedef size_t size_type;
+			typedef size_t difference_type;
+			/// maximum number of elements in a leaf and children of an inner node
+			static constexpr unsigned int node_width = B;
+
+		protected:
+			/// \brief index used for missing nodes (and in the past-the-end iterator)
+			static constexpr IndexType Invalid = (IndexType)-1;
+			/// \brief minimum number of elements / children in nodes other than the root
+			static constexpr unsigned int min_fill = B / 2;
+			/// \brief number of components returned by NVFunc if known at compile time (zero otherwise)
+			static constexpr unsigned int fixed_nr = NVFunc_fixed_nr<NVFunc>::value;
+
+			/// \brief leaf node: stores elements in order
+			struct Leaf {
+				IndexType parent; ///< \brief parent node (Invalid for the root)
+				IndexType prev; ///< \brief previous leaf in order (Invalid for the first)
+				IndexType next; ///< \brief next leaf in order (Invalid for the last)
+				unsigned int n; ///< \brief number of elements stored
+				KeyValue kv[B]; ///< \brief stored elements, only the first n are valid
+			};
+			/// \brief inner node: stores children and separator keys
+			struct Inner {
+				IndexType parent; ///< \brief parent node (Invalid for the root)
+				unsigned int n; ///< \brief number of children
+				/** \brief keys separating children: all keys in the subtree
+				 * of child i are not greater than keys[i], and all keys in
+				 * the subtree of child i+1 are not less than it */
+				KeyType keys[B-1];
+				IndexType child[B]; ///< \brief children (leaves or inner nodes, depending on the level)
+			};
+			/// \brief position of an element: leaf and index in it (leaf is Invalid for the past-the-end position)
+			struct Pos {
+				IndexType l;
+				unsigned int i;
+			};
+
+			std::vector<Leaf> leaves; ///< \brief storage for leaves
+			std::vector<Inner> inner; ///< \brief storage for inner nodes
+			/** \brief weights of elements in leaves: weight component k of element
+			 * i in leaf l is stored at (l * get_nr() + k) * B + i */
+			std::vector<NVType> lw;
+			/** \brief sums of weights in the subtrees of children of inner nodes,
+			 * stored in the same layout as lw */
+			std::vector<NVType> iw;
+			std::vector<IndexType> free_leaves; ///< \brief leaves that are not used currently
+			std::vector<IndexType> free_inner; ///< \brief inner nodes that are not used currently
+			IndexType root; ///< \brief root node (Invalid if the tree is empty)
+			unsigned int height; ///< \brief number of levels of inner nodes (zero: root is a leaf)
+			IndexType first_leaf; ///< \brief first leaf in order
+			IndexType last_leaf; ///< \brief last leaf in order
+			size_t size1; ///< \brief number of elements stored
+			NVFunc f;
+			Compare c;
+
+			/// \brief number of components returned by NVFunc (compile-time constant if fixed_nr is nonzero)
+			unsigned int get_nr() const { return fixed_nr ? fixed_nr : f.get_nr(); }
+			/// \brief x = x + y, checks for overflow and throws exception in the case of integral types
+			void NVAdd(NVType* x, const NVType* y) const { NVOps<NVType>::add(x,y,get_nr()); }
+			/// \brief x = x - y, checks for overflow and throws exception in the case of integral types
+			void NVSubtract(NVType* x, const NVType* y) const { NVOps<NVType>::subtract(x,y,get_nr()); }
+
+			/// \brief weights of elements in leaf l (first component, further components follow with stride B)
+			NVType* leaf_w(IndexType l) { return lw.data() + (size_t)l * get_nr() * B; }
+			/// \copydoc leaf_w()
+			const NVType* leaf_w(IndexType l) const { return lw.data() + (size_t)l * get_nr() * B; }
+			/// \brief partial sums of children of inner node n (first component, further components follow with stride B)
+			NVType* inner_w(IndexType n) { return iw.data() + (size_t)n * get_nr() * B; }
+			/// \copydoc inner_w()
+			const NVType* inner_w(IndexType n) const { return iw.data() + (size_t)n * get_nr() * B; }
+
+			/** \brief sum of the first j values in one component of a block of weights
+			 *
+			 * Uses separate accumulators, so that the loop can be vectorized for
+			 * floating point types as well (without reordering additions). */
+			static NVType block_sum1(const NVType* w, unsigned int j) {
+				NVType s0 = NVType(), s1 = NVType(), s2 = NVType(), s3 = NVType();
+				unsigned int i = 0;
+				for(;i + 4 <= j;i += 4) {
+					s0 += w[i];
+					s1 += w[i+1];
+					s2 += w[i+2];
+					s3 += w[i+3];
+				}
+				for(;i < j;i++) s0 += w[i];
+				return (s0 + s1) + (s2 + s3);
+			}
+			/// \brief sum of the first j values in all components of a block of weights
+			void block_sum(const NVType* w, unsigned int j, NVType* res) const {
+				for(unsigned int k = 0;k < get_nr();k++, w += B) res[k] = block_sum1(w,j);
+			}
+			/// \brief copy all components of the value at index j of a block of weights to res
+			void block_get(const NVType* w, unsigned int j, NVType* res) const {
+				for(unsigned int k = 0;k < get_nr();k++) res[k] = w[k*B + j];
+			}
+			/// \brief set all components of the value at index j of a block of weights
+			void block_set(NVType* w, unsigned int j, const NVType* x) const {
+				for(unsigned int k = 0;k < get_nr();k++) w[k*B + j] = x[k];
+			}
+			/** \brief move n values starting at index j1 in block w1 to index j2 in
+			 * block w2 (in all components); w1 and w2 can be the same block */
+			void block_move(const NVType* w1, unsigned int j1, NVType* w2, unsigned int j2, unsigned int n) const {
+				for(unsigned int k = 0;k < get_nr();k++, w1 += B, w2 += B) {
+					if(w1 == w2 && j2 > j1) std::copy_backward(w1 + j1, w1 + j1 + n, w2 + j2 + n);
+					else std::copy(w1 + j1, w1 + j1 + n, w2 + j2);
+				}
+			}
+
+			/// \brief number of elements (for leaves, lv == 0) or children (for inner nodes) of node n
+			unsigned int node_size(IndexType n, unsigned int lv) const { return lv ? inner[n].n : leaves[n].n; }
+			/// \brief set the parent of node n, which is a leaf if lv == 0
+			void set_parent(IndexType n, unsigned int lv, IndexType p) {
+				if(lv) inner[n].parent = p;
+				else leaves[n].parent = p;
+			}
+			/// \brief index of x among the children of p
+			unsigned int child_index(IndexType p, IndexType x) const {
+				const Inner& q = inner[p];
+				unsigned int j = 0;
+				while(j + 1 < q.n && q.child[j] != x) j++;
+				return j;
+			}
+			/// \brief smallest key in the subtree of n (at level lv)
+			const KeyType& min_key(IndexType n, unsigned int lv) const {
+				for(;lv;lv--) n = inner[n].child[0];
+				return leaves[n].kv[0].key();
+			}
+			/// \brief position j in leaf l, or the first element of the next leaf if j is at the end
+			Pos fix_pos(IndexType l, unsigned int j) const {
+				if(j < leaves[l].n) return Pos{l,j};
+				return Pos{leaves[l].next,0};
+			}
+			/// \brief past-the-end position
+			static Pos end_pos() { return Pos{Invalid,0}; }
+
+			/** \brief number of separator keys in inner node n that compare less than k
+			 * (i.e. the child where the first element not less than k can be found)
+			 *
+			 * For arithmetic keys, all keys are compared and the results counted
+			 * without branches, so that the compiler can use vector instructions. */
+			template<class K> unsigned int inner_lower(IndexType n, const K& k) const {
+				const Inner& x = inner[n];
+				if CONSTEXPR (std::is_arithmetic<KeyType>::value) {
+					unsigned int j = 0;
+					for(unsigned int i = 0;i + 1 < x.n;i++) j += c(x.keys[i],k) ? 1 : 0;
+					return j;
+				}
+				else return std::partition_point(x.keys, x.keys + x.n - 1,
+					[this,&k] (const KeyType& s) { return c(s,k); }) - x.keys;
+			}
+			/** \brief number of separator keys in inner node n that are not greater than k
+			 * (i.e. the child where the first element greater than k can be found) */
+			template<class K> unsigned int inner_upper(IndexType n, const K& k) const {
+				const Inner& x = inner[n];
+				if CONSTEXPR (std::is_arithmetic<KeyType>::value) {
+					unsigned int j = 0;
+					for(unsigned int i = 0;i + 1 < x.n;i++) j += c(k,x.keys[i]) ? 0 : 1;
+					return j;
+				}
+				else return std::partition_point(x.keys, x.keys + x.n - 1,
+					[this,&k] (const KeyType& s) { return !c(k,s); }) - x.keys;
+			}
+			/// \brief number of elements in leaf l that compare less than k
+			template<class K> unsigned int leaf_lower(IndexType l, const K& k) const {
+				const Leaf& x = leaves[l];
+				if CONSTEXPR (std::is_arithmetic<KeyType>::value) {
+					unsigned int j = 0;
+					for(unsigned int i = 0;i < x.n;i++) j += c(x.kv[i].key(),k) ? 1 : 0;
+					return j;
+				}
+				else return std::partition_point(x.kv, x.kv + x.n,
+					[this,&k] (const KeyValue& s) { return c(s.key(),k); }) - x.kv;
+			}
+			/// \brief number of elements in leaf l that are not greater than k
+			template<class K> unsigned int leaf_upper(IndexType l, const K& k) const {
+				const Leaf& x = leaves[l];
+				if CONSTEXPR (std::is_arithmetic<KeyType>::value) {
+					unsigned int j = 0;
+					for(unsigned int i = 0;i < x.n;i++) j += c(k,x.kv[i].key()) ? 0 : 1;
+					return j;
+				}
+				else return std::partition_point(x.kv, x.kv + x.n,
+					[this,&k] (const KeyValue& s) { return !c(k,s.key()); }) - x.kv;
+			}
+
+			/// \brief allocate a new (empty) leaf
+			IndexType new_leaf();
+			/// \brief allocate a new inner node (without children)
+			IndexType new_inner();
+			/// \brief reduce the number of elements in leaf l to n, resetting the elements after them
+			void leaf_truncate(IndexType l, unsigned int n) {
+				Leaf& x = leaves[l];
+				for(unsigned int i = n;i < x.n;i++) x.kv[i] = KeyValue();
+				x.n = n;
+			}
+			/// \brief set the partial sum stored for child j of p (at level lv) from the weights stored in the child
+			void update_entry(IndexType p, unsigned int j, unsigned int lv) {
+				IndexType x = inner[p].child[j];
+				const NVType* src = lv ? inner_w(x) : leaf_w(x);
+				unsigned int n = node_size(x,lv);
+				NVType* dst = inner_w(p) + j;
+				for(unsigned int k = 0;k < get_nr();k++, src += B, dst += B) *dst = block_sum1(src,n);
+			}
+			/// \brief recalculate the partial sums on the path from leaf l to the root
+			void update_path(IndexType l) {
+				IndexType x = l;
+				unsigned int lv = 0;
+				for(IndexType p = leaves[l].parent;p != Invalid;x = p, p = inner[p].parent, lv++)
+					update_entry(p,child_index(p,x),lv);
+			}
+			/** \brief split the child j of p (which is full and is at level lv) into two nodes;
+			 * the new node will be child j+1 of p (which should not be full) */
+			void split_child(IndexType p, unsigned int j, unsigned int lv);
+			/// \brief add a new root above the current one and split the current root (which is full)
+			void split_root();
+			/// \brief remove child j and the separator before it from inner node p
+			void remove_child(IndexType p, unsigned int j);
+			/// \brief restore the minimum size of leaf l after erasing from it; next is adjusted if elements are moved
+			void rebalance_leaf(IndexType l, Pos& next);
+			/// \brief restore the minimum size of inner node n at level lv after removing a child
+			void rebalance_inner(IndexType n, unsigned int lv);
+
+			/// \brief insert a new element (or find an existing one with the same key in a non-multi tree)
+			std::pair<Pos,bool> insert_kv(KeyValue&& kv);
+			/// \brief erase the element at p, returns the position of the next element
+			Pos erase_pos(Pos p);
+			/// \brief change the value of the element at p and update partial sums
+			template<class V> void update_value(Pos p, V&& v) {
+				NVType w[ORBTREE_NV_SIZE];
+				KeyValue& kv = leaves[p.l].kv[p.i];
+				kv.value() = std::forward<V>(v);
+				f(kv.keyvalue(),w);
+				block_set(leaf_w(p.l),p.i,w);
+				update_path(p.l);
+			}
+
+			/// \brief position of the first element not less than k; the sum of weights before it is stored in res (if not null)
+			template<class K> Pos lower_bound_pos(const K& k, NVType* res) const;
+			/// \brief position of the first element greater than k
+			template<class K> Pos upper_bound_pos(const K& k) const;
+			/// \brief position of an element with key equivalent to k, or the past-the-end position
+			template<class K> Pos find_pos(const K& k) const {
+				Pos p = lower_bound_pos(k,0);
+				if(p.l != Invalid && c(k,leaves[p.l].kv[p.i].key())) return end_pos();
+				return p;
+			}
+			/// \brief first element where the predicate on the sum of weights before it returns true
+			template<class pred> Pos lower_bound_w_pos(const pred& p) const;
+			/// \brief see \ref orbtree::find_by_weight()
+			Pos find_by_weight_pos(unsigned int component, const NVType& value, NVType* res) const;
+			/// \brief sum of weights before the element at p
+			void get_sum_fv_pos(Pos p, NVType* res) const;
+			/// \brief sum of all weights
+			void get_norm_fv(NVType* res) const {
+				if(root == Invalid) for(unsigned int k = 0;k < get_nr();k++) res[k] = NVType();
+				else block_sum(height ? inner_w(root) : leaf_w(root), node_size(root,height), res);
+			}
+
+			/// \brief recursive helper for \ref check_tree()
+			void check_tree_r(double epsilon, IndexType x, unsigned int lv, IndexType parent, const KeyType* lo,
+				const KeyType* hi, size_t& n, IndexType& prev_leaf, NVType* sum) const;
+			/// \brief helper for check_tree(): throw an exception with the given message if x and y differ
+			void check_nv_equal(double epsilon, const NVType* x, const NVType* y, const char* msg) const {
+				/* if NVType is integral, we want exact match -- otherwise, we use epsilon for comparison */
+				if(std::is_integral<NVType>::value) { for(unsigned int i=0;i<get_nr();i++) if(x[i] != y[i]) throw std::runtime_error(msg); }
+				else for(unsigned int i=0;i<get_nr();i++) if(fabs(x[i]-y[i]) > epsilon) throw std::runtime_error(msg);
+			}
+
+		public:
+			explicit orbtree_wide(const NVFunc& f_ = NVFunc(), const Compare& c_ = Compare()) : root(Invalid), height(0),
+					first_leaf(Invalid), last_leaf(Invalid), size1(0), f(f_), c(c_) {
+				if CONSTEXPR (simple) if(f.get_nr() != 1) {
+					throw std::runtime_error("For simple tree, weight function can only return one component!\n");
+				}
+			}
+			explicit orbtree_wide(NVFunc&& f_, const Compare& c_ = Compare()) : root(Invalid), height(0),
+					first_leaf(Invalid), last_leaf(Invalid), size1(0), f(std::move(f_)), c(c_) {
+				if CONSTEXPR (simple) if(f.get_nr() != 1) {
+					throw std::runtime_error("For simple tree, weight function can only return one component!\n");
+				}
+			}
+			template<class T>
+			explicit orbtree_wide(const T& t, const Compare& c_ = Compare()) : root(Invalid), height(0),
+					first_leaf(Invalid), last_leaf(Invalid), size1(0), f(t), c(c_) {
+				if CONSTEXPR (simple) if(f.get_nr() != 1) {
+					throw std::runtime_error("For simple tree, weight function can only return one component!\n");
+				}
+			}
+			/// \brief Copy constructor: copies the nodes directly, without comparisons or evaluating the weight function.
+			orbtree_wide(const orbtree_wide& t) = default;
+			/// \brief Move constructor: takes over the nodes of t in constant time, t is left as a valid empty tree.
+			orbtree_wide(orbtree_wide&& t) : root(Invalid), height(0), first_leaf(Invalid), last_leaf(Invalid),
+					size1(0), f(t.f), c(t.c) {
+				swap(t);
+			}
+			/// \brief Copy assignment, see the copy constructor.
+			orbtree_wide& operator = (const orbtree_wide& t) {
+				if(this != &t) {
+					orbtree_wide tmp(t);
+					swap(tmp);
+				}
+				return *this;
+			}
+			/// \brief Move assignment: takes over the nodes of t in constant time, t is left as a valid empty tree.
+			orbtree_wide& operator = (orbtree_wide&& t) {
+				if(this != &t) {
+					clear();
+					swap(t);
+				}
+				return *this;
+			}
+			/// \brief Exchange the contents of this tree with t in constant time (invalidates iterators).
+			void swap(orbtree_wide& t) {
+				using std::swap;
+				leaves.swap(t.leaves);
+				inner.swap(t.inner);
+				lw.swap(t.lw);
+				iw.swap(t.iw);
+				free_leaves.swap(t.free_leaves);
+				free_inner.swap(t.free_inner);
+				swap(root, t.root);
+				swap(height, t.height);
+				swap(first_leaf, t.first_leaf);
+				swap(last_leaf, t.last_leaf);
+				swap(size1, t.size1);
+				swap(f, t.f);
+				swap(c, t.c);
+			}
+
+
+			/// Iterators
+			template<bool is_const>
+			struct iterator_base {
+				protected:
+					typedef typename std::conditional<is_const, const orbtree_wide, orbtree_wide>::type orbtree_t;
+				public:
+					/* typedefs */
+					typedef std::bidirectional_iterator_tag iterator_category;
+					typedef std::ptrdiff_t difference_type;
+					/** \brief Type of value pointed to by iterator; cannot be changed directly
+					 * (use the set_value() member function for maps) */
+					typedef const typename KeyValueT::ValueType value_type;
+					typedef value_type* pointer;
+					typedef value_type& reference;
+
+					friend struct iterator_base<!is_const>;
+					friend class orbtree_wide;
+				protected:
+					orbtree_t* t;
+					Pos p;
+					iterator_base() = delete;
+					iterator_base(orbtree_t* t_, Pos p_):t(t_),p(p_) { }
+				public:
+					/* any iterator can be copied from non-const iterator;
+					 * this is not explicit so comparison operators can auto-convert */
+					iterator_base(const iterator_base<false>& it):t(it.t),p(it.p) { }
+					void operator = (const iterator_base<false>& it) { t = it.t; p = it.p; }
+					/* only const iterator can be copied from const iterator */
+					template<bool is_const_ = is_const>
+					iterator_base(const iterator_base<true>& it, typename std::enable_if<is_const_>::type* = 0 ):t(it.t),p(it.p) { }
+					template<bool is_const_ = is_const>
+					void operator = (typename std::enable_if<is_const_, const iterator_base<true> >::type& it) {
+						t = it.t;
+						p = it.p;
+					}
+
+					/// read-only access to values; dereferencing the past-the-end iterator throws an exception
+					reference operator * () const {
+						if(p.l == Invalid) throw std::runtime_error("Attempt to dereference invalid orbtree_wide::iterator!\n");
+						return t->leaves[p.l].kv[p.i].keyvalue();
+					}
+					/// \copydoc operator*()
+					pointer operator -> () const {
+						if(p.l == Invalid) throw std::runtime_error("Attempt to dereference invalid orbtree_wide::iterator!\n");
+						return &(t->leaves[p.l].kv[p.i].keyvalue());
+					}
+					/// change value stored in map or multimap (invalidates other iterators)
+					template<bool is_const_ = is_const, class KeyValue_ = KeyValue>
+					typename std::enable_if<!is_const_>::type set_value(typename KeyValue_::MappedType&& v) {
+						t->update_value(p,std::move(v));
+					}
+					/// change value stored in map or multimap (invalidates other iterators)
+					template<bool is_const_ = is_const, class KeyValue_ = KeyValue>
+					typename std::enable_if<!is_const_>::type set_value(typename KeyValue_::MappedType const& v) {
+						t->update_value(p,v);
+					}
+					/// convenience function to return the key (for both set and map)
+					const key_type& key() const { return t->leaves[p.l].kv[p.i].key(); }
+
+					/// compare iterators (comparing iterators from different trees is undefined behavior)
+					template<bool is_const2> bool operator == (const iterator_base<is_const2>& i) const {
+						return p.l == i.p.l && p.i == i.p.i;
+					}
+					/// compare iterators (comparing iterators from different trees is undefined behavior)
+					template<bool is_const2> bool operator != (const iterator_base<is_const2>& i) const {
+						return !(*this == i);
+					}
+
+					/// increment: move to the next element
+					iterator_base& operator ++() {
+						if(++p.i >= t->leaves[p.l].n) p = Pos{t->leaves[p.l].next,0};
+						return *this;
+					}
+					/// increment: move to the next element
+					iterator_base operator ++(int) { iterator_base<is_const> i(*this); ++(*this); return i; }
+					/// decrement: move to the previous element
+					iterator_base& operator --() {
+						IndexType l = p.l;
+						if(l != Invalid && p.i) p.i--;
+						else {
+							l = (l == Invalid) ? t->last_leaf : t->leaves[l].prev;
+							p = Pos{l, l == Invalid ? 0 : t->leaves[l].n - 1};
+						}
+						return *this;
+					}
+					/// decrement: move to the previous element
+					iterator_base operator --(int) { iterator_base<is_const> i(*this); --(*this); return i; }
+			};
+
+			/// iterator that does not allow modification
+			typedef iterator_base<true> const_iterator;
+			/// iteraror that allows the modification of the stored value (for maps)
+			typedef typename std::conditional<KeyValue::keyonly, iterator_base<true>, iterator_base<false> >::type iterator;
+
+			iterator begin() { return iterator(this,Pos{first_leaf,0}); } /// get an iterator to the beginning (element with the lowest key value)
+			const_iterator begin() const { return const_iterator(this,Pos{first_leaf,0}); } /// get an iterator to the beginning (element with the lowest key value)
+			const_iterator cbegin() const { return const_iterator(this,Pos{first_leaf,0}); } /// get an iterator to the beginning (element with the lowest key value)
+
+			iterator end() { return iterator(this,end_pos()); } /// get the past-the-end iterator
+			const_iterator end() const { return const_iterator(this,end_pos()); } /// get the past-the-end iterator
+			const_iterator cend() const { return const_iterator(this,end_pos()); } /// get the past-the-end iterator
+
+			bool empty() const { return size1 == 0; } /// check if the tree is empty
+			size_t size() const { return size1; } /// return the number of elemets
+			/// return the maximum possible number of elements
+			constexpr size_t max_size() const {
+				return (size_t)Invalid < std::numeric_limits<size_t>::max() / B ? (size_t)Invalid * B : std::numeric_limits<size_t>::max();
+			}
+			/// \brief number of components returned by NVFunc
+			unsigned int get_nr_components() const { return get_nr(); }
+
+			/// delete all elements and free all memory used by the tree
+			void clear() {
+				std::vector<Leaf>().swap(leaves);
+				std::vector<Inner>().swap(inner);
+				std::vector<NVType>().swap(lw);
+				std::vector<NVType>().swap(iw);
+				std::vector<IndexType>().swap(free_leaves);
+				std::vector<IndexType>().swap(free_inner);
+				root = first_leaf = last_leaf = Invalid;
+				height = 0;
+				size1 = 0;
+			}
+			/** \brief Reserve storage for at least n elements in total (assuming
+			 * that all nodes are at least half full). */
+			void reserve(size_t n) {
+				size_t nl = (n + min_fill - 1) / min_fill;
+				leaves.reserve(nl);
+				lw.reserve(nl * get_nr() * B);
+				size_t ni = nl / (min_fill - 1) + 1;
+				inner.reserve(ni);
+				iw.reserve(ni * get_nr() * B);
+			}
+			/** \brief Get the number of elements that fit in the leaves allocated
+			 * currently (this is an upper bound, as leaves are typically not full). */
+			size_t capacity() const { return leaves.capacity() * B; }
+			/** \brief Give back unused memory.
+			 *
+			 * The tree is rebuilt with full nodes from its current contents, then all
+			 * arrays are shrunk to the size actually used. This invalidates all iterators. */
+			void shrink_to_fit() {
+				std::vector<typename std::remove_const<value_type>::type> tmp;
+				tmp.reserve(size1);
+				for(IndexType l = first_leaf;l != Invalid;l = leaves[l].next)
+					for(unsigned int i = 0;i < leaves[l].n;i++) tmp.push_back(leaves[l].kv[i].keyvalue());
+				orbtree_wide t(f,c);
+				t.assign_sorted(tmp.begin(),tmp.end());
+				t.leaves.shrink_to_fit();
+				t.inner.shrink_to_fit();
+				t.lw.shrink_to_fit();
+				t.iw.shrink_to_fit();
+				swap(t);
+			}
+
+/* 2. add / remove */
+			/// return type of insert functions
+			typedef typename std::conditional<multi, iterator, std::pair<iterator, bool> >::type insert_type;
+
+		protected:
+			template<bool multi_ = multi>
+			typename std::enable_if<multi_,insert_type>::type insert_result(const std::pair<Pos,bool>& x) {
+				return iterator(this,x.first);
+			}
+			template<bool multi_ = multi>
+			typename std::enable_if<!multi_,insert_type>::type insert_result(const std::pair<Pos,bool>& x) {
+				return std::pair<iterator,bool>(iterator(this,x.first),x.second);
+			}
+			/// \brief helper for \ref update_values(): get the element to modify from an iterator
+			Pos update_values_pos(const iterator& it) const {
+				if(it.p.l == Invalid) throw std::out_of_range("orbtree_wide::update_values(): invalid iterator!\n");
+				return it.p;
+			}
+			/// \brief helper for \ref update_values(): find the element to modify by key
+			template<class K> Pos update_values_pos(const K& k) const {
+				Pos p = find_pos(k);
+				if(p.l == Invalid) throw std::out_of_range("orbtree_wide::update_values(): key not present in map!\n");
+				return p;
+			}
+
+		public:
+			/** \brief Insert new element
+			 *
+			 * For non-multi map/set, the return type is std::pair<iterator,bool>,
+			 * where the second element indicates if insert was successful.
+			 * If an element with the same key already existed, the insert fails and
+			 * false is returned.
+			 *
+			 * For multi map/set, inserting always succeeds and the return type is an
+			 * iterator to the new element. In this case, a new element is always inserted
+			 * after any existing elements with the same key */
+			insert_type insert(const value_type& v) { return insert_result(insert_kv(KeyValue(v))); }
+			/// \copydoc insert(const value_type& v)
+			insert_type insert(value_type&& v) { return insert_result(insert_kv(KeyValue(std::move(v)))); }
+			/** \brief Insert new element; the hint is ignored (provided for compatibility
+			 * with orbtree::orbtree, searching is fast anyway). Returns an iterator to the
+			 * new element, or an existing element with the same key for non-multi trees. */
+			iterator insert(const_iterator hint, const value_type& v) { return iterator(this,insert_kv(KeyValue(v)).first); }
+			/// \copydoc iterator insert(const_iterator hint, const value_type& v)
+			iterator insert(const_iterator hint, value_type&& v) { return iterator(this,insert_kv(KeyValue(std::move(v))).first); }
+			/// insert all elements in the range [first,last)
+			template<class InputIt> void insert(InputIt first, InputIt last) {
+				for(;first!=last;++first) insert_kv(KeyValue(*first));
+			}
+			/// construct new element in-place
+			template<class... Args> insert_type emplace(Args&&... args) {
+				return insert_result(insert_kv(KeyValue(value_type(std::forward<Args>(args)...))));
+			}
+
+			/** \brief Replace the contents of the tree with the elements in the
+			 * range [first,last), which must be sorted according to the comparison
+			 * functor.
+			 *
+			 * Leaves are filled completely in order and inner levels are built above
+			 * them, so this takes O(N) time (with N evaluations of NVFunc). For a
+			 * non-multi tree, only the first of any elements with equal keys is kept.
+			 * Throws an exception if the input is not sorted; in this case, the tree
+			 * is left empty. */
+			template<class InputIt> void assign_sorted(InputIt first, InputIt last);
+
+			/// erase element pointed to by the given iterator; returns the element after it (in order)
+			iterator erase(const_iterator pos) { return iterator(this,erase_pos(pos.p)); }
+			/// erase elements in the range [first,last); returns the element after them
+			iterator erase(const_iterator first, const_iterator last) {
+				size_t n = 0;
+				for(const_iterator it = first;it != last;++it) n++;
+				Pos p = first.p;
+				for(;n;n--) p = erase_pos(p);
+				return iterator(this,p);
+			}
+			/// erase all elements for which p returns true (called in order); returns the number of elements erased
+			template<class Pred> size_t erase_if(Pred p) {
+				size_t r = 0;
+				for(Pos x = Pos{first_leaf,0};x.l != Invalid;) {
+					if(p(leaves[x.l].kv[x.i].keyvalue())) {
+						x = erase_pos(x);
+						r++;
+					}
+					else x = fix_pos(x.l,x.i+1);
+				}
+				return r;
+			}
+			/// erase all elements with the given key; returns the number of elements erased
+			size_t erase(const key_type& k) {
+				size_t r = 0;
+				for(Pos x = lower_bound_pos(k,0);x.l != Invalid && !c(k,leaves[x.l].kv[x.i].key());x = erase_pos(x)) r++;
+				return r;
+			}
+
+			/// count the number of elements whose key compares equal to k
+			template<class K> size_t count(const K& k) const {
+				size_t r = 0;
+				for(const_iterator it(this,lower_bound_pos(k,0));it != cend() && !c(k,it.key());++it) r++;
+				return r;
+			}
+			/// count number of elements with key
+			size_t count(const key_type& k) const { return count<key_type>(k); }
+
+/* 3. search based on key */
+			/** \brief Find an element with the given key and return an iterator to it.
+			 *
+			 * Returns the past-the-end iterator if no such element is found.
+			 * For multimap / multiset, the first element with such key is returned. */
+			template<class K> iterator find(const K& k) { return iterator(this,find_pos(k)); }
+			/// \copydoc find()
+			template<class K> const_iterator find(const K& k) const { return const_iterator(this,find_pos(k)); }
+			/// return an iterator to the first element with key not less than k
+			template<class K> iterator lower_bound(const K& k) { return iterator(this,lower_bound_pos(k,0)); }
+			/// return an iterator to the first element with key not less than k
+			template<class K> const_iterator lower_bound(const K& k) const { return const_iterator(this,lower_bound_pos(k,0)); }
+			/// return an iterator to the first element with key greater than k
+			template<class K> iterator upper_bound(const K& k) { return iterator(this,upper_bound_pos(k)); }
+			/// return an iterator to the first element with key greater than k
+			template<class K> const_iterator upper_bound(const K& k) const { return const_iterator(this,upper_bound_pos(k)); }
+			/// return a pair of iterators corresponding to the range of all elements with keys that compare equal to k
+			template<class K> std::pair<iterator,iterator> equal_range(const K& k) {
+				return std::pair<iterator,iterator>(lower_bound(k),upper_bound(k));
+			}
+			/// return a pair of iterators corresponding to the range of all elements with keys that compare equal to k
+			template<class K> std::pair<const_iterator,const_iterator> equal_range(const K& k) const {
+				return std::pair<const_iterator,const_iterator>(lower_bound(k),upper_bound(k));
+			}
+			/// returns if an element with key equivalent to k exists in this tree
+			template<class K> bool contains(const K& k) const { return find_pos(k).l != Invalid; }
+
+			/// returns the first element where the supplied predicate based on the cumulative weight function values returns true
+			template<class pred> iterator lower_bound_w(const pred& p) { return iterator(this,lower_bound_w_pos(p)); }
+			/// returns the first element where the supplied predicate based on the cumulative weight function values returns true
+			template<class pred> const_iterator lower_bound_w(const pred& p) const { return const_iterator(this,lower_bound_w_pos(p)); }
+			/// returns the first element with generalized rank not less than r (only for cases with scalar weight function)
+			template<bool simple_ = simple> iterator lower_bound_rank(const NVType& r) {
+				return lower_bound_w([&r] (const NVType* x) { return *x >= r; });
+			}
+			/// returns the first element with generalized rank not less than r (only for cases with scalar weight function)
+			template<bool simple_ = simple> const_iterator lower_bound_rank(const NVType& r) const {
+				return lower_bound_w([&r] (const NVType* x) { return *x >= r; });
+			}
+
+			/** \brief Find the element whose weight covers value in the given component,
+			 * see \ref orbtree::find_by_weight() */
+			iterator find_by_weight(unsigned int component, const NVType& value, NVType* res = 0) {
+				return iterator(this,find_by_weight_pos(component,value,res));
+			}
+			/// \copydoc find_by_weight()
+			const_iterator find_by_weight(unsigned int component, const NVType& value, NVType* res = 0) const {
+				return const_iterator(this,find_by_weight_pos(component,value,res));
+			}
+			/** \brief Find the elements for multiple values at once, see \ref orbtree::find_by_weights().
+			 * Values in [first,last) must be sorted (an exception is thrown otherwise). */
+			template<class ValIt, class OutIt>
+			OutIt find_by_weights(unsigned int component, ValIt first, ValIt last, OutIt out, NVType* res = 0) const {
+				if(!std::is_sorted(first,last)) throw std::runtime_error("orbtree_wide::find_by_weights(): values are not sorted!\n");
+				for(;first != last;++first, ++out) {
+					*out = find_by_weight(component,*first,res);
+					if(res) res += get_nr();
+				}
+				return out;
+			}
+			/** \brief Weighted sampling for simple containers: find the element whose weight
+			 * covers u (see \ref find_by_weight()) and return it along with the partial sum
+			 * of the weights before it. */
+			template<bool simple_ = simple>
+			std::pair<iterator,NVType> sample(typename std::enable_if<simple_,const NVType&>::type u) {
+				NVType res;
+				Pos p = find_by_weight_pos(0,u,&res);
+				return std::pair<iterator,NVType>(iterator(this,p),res);
+			}
+			/// \copydoc sample()
+			template<bool simple_ = simple>
+			std::pair<const_iterator,NVType> sample(typename std::enable_if<simple_,const NVType&>::type u) const {
+				NVType res;
+				Pos p = find_by_weight_pos(0,u,&res);
+				return std::pair<const_iterator,NVType>(const_iterator(this,p),res);
+			}
+
+			/** \brief Change the values of multiple elements (only for maps and multimaps).
+			 *
+			 * Elements in [first,last) should be pairs, where first is either an
+			 * iterator to or the key of the element to modify, and second is its new
+			 * value. Throws an exception if a key is not found or an iterator is invalid;
+			 * in this case, values before it are changed. */
+			template<class InputIt>
+			void update_values(InputIt first, InputIt last) {
+				for(;first != last;++first) update_value(update_values_pos(first->first),first->second);
+			}
+
+/* 4. partial sums of weights */
+			/** \brief Calculate partial sum of the weights of elements
+			 * that come before the one pointed to by it.
+			 *
+			 * Result is returned in res, which must point to an array
+			 * large enough (with as many elements as the components
+			 * calculated by NVFunc) */
+			void get_sum_node(const_iterator it, NVType* res) const { get_sum_fv_pos(it.p,res); }
+			/// \brief Calculate partial sum of the weights of elements before it, for simple containers.
+			template<bool simple_ = simple>
+			NVType get_sum_node(typename std::enable_if<simple_,const_iterator>::type it) const {
+				NVType res;
+				get_sum_fv_pos(it.p,&res);
+				return res;
+			}
+			/** \brief Calculate partial sum of weights for keys that come before k.
+			 *
+			 * Result is returned in res, which must point to an array
+			 * large enough. Works for any type K that is comparable to the keys. */
+			template<class K, bool simple_ = simple>
+			void get_sum(const K& k, typename std::enable_if<!simple_,NVType*>::type res) const { lower_bound_pos(k,res); }
+			/// \brief Calculate partial sum of weights for keys that come before k, for simple containers.
+			template<class K, bool simple_ = simple>
+			typename std::enable_if<simple_,NVType>::type get_sum(const K& k) const {
+				NVType res;
+				lower_bound_pos(k,&res);
+				return res;
+			}
+			/** \brief Calculate partial sum of weights for multiple keys.
+			 *
+			 * Keys in the range [first,last) must be sorted (an exception
+			 * is thrown otherwise). Results are stored in res, which must
+			 * point to an array of size n_keys * NVFunc::get_nr(). */
+			template<class KeyIt> void get_sums(KeyIt first, KeyIt last, NVType* res) const {
+				typedef typename std::iterator_traits<KeyIt>::value_type K;
+				if(!std::is_sorted(first,last,[this](const K& x, const K& y) { return c(x,y); }))
+					throw std::runtime_error("orbtree_wide::get_sums(): keys are not sorted!\n");
+				for(;first != last;++first, res += get_nr()) lower_bound_pos(*first,res);
+			}
+			/** \brief Find the first element with key not less than k and
+			 * calculate the partial sum of weights for all elements before it
+			 * in one traversal of the tree. */
+			template<class K, bool simple_ = simple>
+			iterator lower_bound_sum(const K& k, typename std::enable_if<!simple_,NVType*>::type res) {
+				return iterator(this,lower_bound_pos(k,res));
+			}
+			/// \copydoc lower_bound_sum(const K&, NVType*)
+			template<class K, bool simple_ = simple>
+			const_iterator lower_bound_sum(const K& k, typename std::enable_if<!simple_,NVType*>::type res) const {
+				return const_iterator(this,lower_bound_pos(k,res));
+			}
+			/// \brief Find the first element with key not less than k and the partial sum before it, for simple containers.
+			template<class K, bool simple_ = simple>
+			typename std::enable_if<simple_, std::pair<iterator,NVType> >::type lower_bound_sum(const K& k) {
+				NVType res;
+				Pos p = lower_bound_pos(k,&res);
+				return std::pair<iterator,NVType>(iterator(this,p),res);
+			}
+			/// \copydoc lower_bound_sum(const K&)
+			template<class K, bool simple_ = simple>
+			typename std::enable_if<simple_, std::pair<const_iterator,NVType> >::type lower_bound_sum(const K& k) const {
+				NVType res;
+				Pos p = lower_bound_pos(k,&res);
+				return std::pair<const_iterator,NVType>(const_iterator(this,p),res);
+			}
+			/// Calculate normalization, i.e. sum of all weights.
+			template<bool simple_ = simple>
+			void get_norm(typename std::enable_if<!simple_,NVType*>::type res) const { get_norm_fv(res); }
+			/// Calculate normalization, i.e. sum of all weights.
+			template<bool simple_ = simple> NVType get_norm(typename std::enable_if<simple_,void*>::type k = 0) const {
+				NVType res;
+				get_norm_fv(&res);
+				return res;
+			}
+			/** \brief Calculate the sum of weights for keys in the range [lo,hi)
+			 * (zero if hi is not after lo). Calculated as get_sum(hi) - get_sum(lo). */
+			template<class K1, class K2, bool simple_ = simple>
+			void get_range_sum(const K1& lo, const K2& hi, typename std::enable_if<!simple_,NVType*>::type res) const {
+				get_range_sum_pos(lower_bound_pos(lo,0), lower_bound_pos(hi,0), res);
+			}
+			/// \brief Calculate the sum of weights for keys in the range [lo,hi), for simple containers.
+			template<class K1, class K2, bool simple_ = simple>
+			typename std::enable_if<simple_,NVType>::type get_range_sum(const K1& lo, const K2& hi) const {
+				NVType res;
+				get_range_sum_pos(lower_bound_pos(lo,0), lower_bound_pos(hi,0), &res);
+				return res;
+			}
+			/// \brief Calculate the sum of weights for elements in the range [it1,it2).
+			void get_range_sum_node(const_iterator it1, const_iterator it2, NVType* res) const {
+				get_range_sum_pos(it1.p,it2.p,res);
+			}
+			/// \brief Calculate the sum of weights for elements in the range [it1,it2), for simple containers.
+			template<bool simple_ = simple>
+			NVType get_range_sum_node(typename std::enable_if<simple_,const_iterator>::type it1, const_iterator it2) const {
+				NVType res;
+				get_range_sum_pos(it1.p,it2.p,&res);
+				return res;
+			}
+			/** \brief Calculate the sum of weights for elements from find_by_weight(component,lo)
+			 * (inclusive) to find_by_weight(component,hi) (exclusive). */
+			void get_range_sum_by_weight(unsigned int component, const NVType& lo, const NVType& hi, NVType* res) const {
+				get_range_sum_pos(find_by_weight_pos(component,lo,0), find_by_weight_pos(component,hi,0), res);
+			}
+
+			/** \brief check that the tree is valid
+			 *
+			 * Checks the structure of the tree (number of elements in nodes, links,
+			 * ordering of keys), throws exception on error. Also checks that stored
+			 * weights and partial sums are consistent if epsilon >= 0 (epsilon is
+			 * the tolerance for rounding errors if NVType is not integral) */
+			void check_tree(double epsilon = -1.0) const;
+
+		protected:
+			/// \brief check if the element at p1 comes before the one at p2 (either can be the past-the-end position)
+			bool pos_before(Pos p1, Pos p2) const {
+				if(p1.l == Invalid) return false;
+				if(p2.l == Invalid) return true;
+				if(p1.l == p2.l) return p1.i < p2.i;
+				/* all leaves are on the same level: go up until the common ancestor */
+				IndexType x1 = p1.l, x2 = p2.l;
+				IndexType q1 = leaves[x1].parent, q2 = leaves[x2].parent;
+				while(q1 != q2) {
+					x1 = q1;
+					x2 = q2;
+					q1 = inner[q1].parent;
+					q2 = inner[q2].parent;
+				}
+				return child_index(q1,x1) < child_index(q1,x2);
+			}
+			/// \brief sum of weights of elements from p1 (inclusive) to p2 (exclusive); zero if p2 is not after p1
+			void get_range_sum_pos(Pos p1, Pos p2, NVType* res) const {
+				if(!pos_before(p1,p2)) {
+					for(unsigned int k = 0;k < get_nr();k++) res[k] = NVType();
+					return;
+				}
+				NVType tmp[ORBTREE_NV_SIZE];
+				get_sum_fv_pos(p1,tmp);
+				get_sum_fv_pos(p2,res);
+				NVSubtract(res,tmp);
+			}
+	};
+
+	/// Exchange the contents of two trees in constant time
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	void swap(orbtree_wide<KeyValueT, NVTypeT, Compare, NVFunc, multi, simple, B, IndexType>& t1,
+			orbtree_wide<KeyValueT, NVTypeT, Compare, NVFunc, multi, simple, B, IndexType>& t2) {
+		t1.swap(t2);
+	}
+
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	IndexType orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::new_leaf() {
+		IndexType l;
+		if(free_leaves.size()) {
+			l = free_leaves.back();
+			free_leaves.pop_back();
+		}
+		else {
+			if(leaves.size() >= (size_t)Invalid) throw std::runtime_error("orbtree_wide::new_leaf(): too many nodes!\n");
+			l = (IndexType)leaves.size();
+			leaves.emplace_back();
+			try { lw.resize(lw.size() + (size_t)get_nr() * B); }
+			catch(...) {
+				leaves.pop_back();
+				throw;
+			}
+		}
+		Leaf& x = leaves[l];
+		x.parent = x.prev = x.next = Invalid;
+		x.n = 0;
+		return l;
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	IndexType orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::new_inner() {
+		IndexType n;
+		if(free_inner.size()) {
+			n = free_inner.back();
+			free_inner.pop_back();
+		}
+		else {
+			if(inner.size() >= (size_t)Invalid) throw std::runtime_error("orbtree_wide::new_inner(): too many nodes!\n");
+			n = (IndexType)inner.size();
+			inner.emplace_back();
+			try { iw.resize(iw.size() + (size_t)get_nr() * B); }
+			catch(...) {
+				inner.pop_back();
+				throw;
+			}
+		}
+		Inner& x = inner[n];
+		x.parent = Invalid;
+		x.n = 0;
+		return n;
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	void orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::split_child(IndexType p, unsigned int j, unsigned int lv) {
+		IndexType x = inner[p].child[j];
+		IndexType y;
+		if(lv == 0) {
+			y = new_leaf(); /* note: can reallocate leaves */
+			Leaf& a = leaves[x];
+			Leaf& b = leaves[y];
+			std::move(a.kv + min_fill, a.kv + a.n, b.kv);
+			block_move(leaf_w(x), min_fill, leaf_w(y), 0, a.n - min_fill);
+			b.n = a.n - min_fill;
+			leaf_truncate(x, min_fill);
+			b.parent = p;
+			b.prev = x;
+			b.next = a.next;
+			if(a.next != Invalid) leaves[a.next].prev = y;
+			else last_leaf = y;
+			a.next = y;
+		}
+		else {
+			y = new_inner();
+			Inner& a = inner[x];
+			Inner& b = inner[y];
+			std::move(a.keys + min_fill, a.keys + a.n - 1, b.keys);
+			std::copy(a.child + min_fill, a.child + a.n, b.child);
+			block_move(inner_w(x), min_fill, inner_w(y), 0, a.n - min_fill);
+			b.n = a.n - min_fill;
+			a.n = min_fill;
+			b.parent = p;
+			for(unsigned int i = 0;i < b.n;i++) set_parent(b.child[i], lv - 1, y);
+		}
+		/* add y as child j+1 of p; the separator is the smallest key in y
+		 * (for an inner node, the separator before its first child) */
+		Inner& q = inner[p];
+		std::move_backward(q.keys + j, q.keys + q.n - 1, q.keys + q.n);
+		if(lv == 0) q.keys[j] = leaves[y].kv[0].key();
+		else q.keys[j] = std::move(inner[x].keys[min_fill - 1]);
+		std::copy_backward(q.child + j + 1, q.child + q.n, q.child + q.n + 1);
+		q.child[j+1] = y;
+		NVType* w = inner_w(p);
+		block_move(w, j + 1, w, j + 2, q.n - j - 1);
+		q.n++;
+		update_entry(p, j, lv);
+		update_entry(p, j + 1, lv);
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	void orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::split_root() {
+		IndexType r = new_inner();
+		Inner& x = inner[r];
+		x.n = 1;
+		x.child[0] = root;
+		set_parent(root, height, r);
+		update_entry(r, 0, height);
+		root = r;
+		height++;
+		split_child(r, 0, height - 1);
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	void orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::remove_child(IndexType p, unsigned int j) {
+		Inner& q = inner[p];
+		std::move(q.keys + j, q.keys + q.n - 1, q.keys + j - 1);
+		std::copy(q.child + j + 1, q.child + q.n, q.child + j);
+		NVType* w = inner_w(p);
+		block_move(w, j + 1, w, j, q.n - j - 1);
+		q.n--;
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	void orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::rebalance_leaf(IndexType l, Pos& next) {
+		Leaf& a = leaves[l];
+		IndexType p = a.parent;
+		if(p == Invalid) {
+			/* root can have any number of elements, it is only removed if it is empty */
+			if(a.n == 0) {
+				free_leaves.push_back(l);
+				root = first_leaf = last_leaf = Invalid;
+				height = 0;
+			}
+			return;
+		}
+		if(a.n >= min_fill) return;
+		unsigned int j = child_index(p, l);
+		Inner& q = inner[p];
+		if(j > 0 && leaves[q.child[j-1]].n > min_fill) {
+			/* move the last element of the left sibling to the front of l */
+			IndexType s = q.child[j-1];
+			Leaf& b = leaves[s];
+			std::move_backward(a.kv, a.kv + a.n, a.kv + a.n + 1);
+			a.kv[0] = std::move(b.kv[b.n - 1]);
+			NVType* w = leaf_w(l);
+			block_move(w, 0, w, 1, a.n);
+			block_move(leaf_w(s), b.n - 1, w, 0, 1);
+			a.n++;
+			leaf_truncate(s, b.n - 1);
+			q.keys[j-1] = a.kv[0].key();
+			update_entry(p, j - 1, 0);
+			update_entry(p, j, 0);
+			if(next.l == l) next.i++;
+			return;
+		}
+		if(j + 1 < q.n && leaves[q.child[j+1]].n > min_fill) {
+			/* move the first element of the right sibling to the end of l */
+			IndexType s = q.child[j+1];
+			Leaf& b = leaves[s];
+			if(next.l == s) {
+				if(next.i == 0) next = Pos{l,a.n};
+				else next.i--;
+			}
+			a.kv[a.n] = std::move(b.kv[0]);
+			NVType* w = leaf_w(s);
+			block_move(w, 0, leaf_w(l), a.n, 1);
+			std::move(b.kv + 1, b.kv + b.n, b.kv);
+			block_move(w, 1, w, 0, b.n - 1);
+			a.n++;
+			leaf_truncate(s, b.n - 1);
+			q.keys[j] = b.kv[0].key();
+			update_entry(p, j, 0);
+			update_entry(p, j + 1, 0);
+			return;
+		}
+		/* merge with a sibling: child j+1 of p is merged into child j */
+		if(j > 0) j--;
+		IndexType x = q.child[j];
+		IndexType y = q.child[j+1];
+		Leaf& a2 = leaves[x];
+		Leaf& b2 = leaves[y];
+		if(next.l == y) next = Pos{x, a2.n + next.i};
+		std::move(b2.kv, b2.kv + b2.n, a2.kv + a2.n);
+		block_move(leaf_w(y), 0, leaf_w(x), a2.n, b2.n);
+		a2.n += b2.n;
+		leaf_truncate(y, 0);
+		a2.next = b2.next;
+		if(b2.next != Invalid) leaves[b2.next].prev = x;
+		else last_leaf = x;
+		free_leaves.push_back(y);
+		remove_child(p, j + 1);
+		update_entry(p, j, 0);
+		rebalance_inner(p, 1);
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	void orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::rebalance_inner(IndexType n, unsigned int lv) {
+		while(true) {
+			Inner& a = inner[n];
+			IndexType p = a.parent;
+			if(p == Invalid) {
+				/* root should have at least two children, otherwise its child becomes the new root */
+				if(a.n == 1) {
+					root = a.child[0];
+					set_parent(root, lv - 1, Invalid);
+					free_inner.push_back(n);
+					height--;
+				}
+				return;
+			}
+			if(a.n >= min_fill) return;
+			/* a node below the root lost at most one child since it was last
+			 * balanced, so it still has at least min_fill - 1 >= 1 children */
+			if(a.n == 0) throw std::runtime_error("orbtree_wide::rebalance_inner(): empty inner node!\n");
+			unsigned int j = child_index(p, n);
+			Inner& q = inner[p];
+			if(j > 0 && inner[q.child[j-1]].n > min_fill) {
+				/* move the last child of the left sibling to n, rotating the separators */
+				IndexType s = q.child[j-1];
+				Inner& b = inner[s];
+				std::move_backward(a.keys, a.keys + a.n - 1, a.keys + a.n);
+				a.keys[0] = std::move(q.keys[j-1]);
+				q.keys[j-1] = std::move(b.keys[b.n - 2]);
+				std::copy_backward(a.child, a.child + a.n, a.child + a.n + 1);
+				a.child[0] = b.child[b.n - 1];
+				set_parent(a.child[0], lv - 1, n);
+				NVType* w = inner_w(n);
+				block_move(w, 0, w, 1, a.n);
+				block_move(inner_w(s), b.n - 1, w, 0, 1);
+				a.n++;
+				b.n--;
+				update_entry(p, j - 1, lv);
+				update_entry(p, j, lv);
+				return;
+			}
+			if(j + 1 < q.n && inner[q.child[j+1]].n > min_fill) {
+				/* move the first child of the right sibling to n */
+				IndexType s = q.child[j+1];
+				Inner& b = inner[s];
+				a.keys[a.n - 1] = std::move(q.keys[j]);
+				q.keys[j] = std::move(b.keys[0]);
+				std::move(b.keys + 1, b.keys + b.n - 1, b.keys);
+				a.child[a.n] = b.child[0];
+				set_parent(a.child[a.n], lv - 1, n);
+				std::copy(b.child + 1, b.child + b.n, b.child);
+				NVType* w = inner_w(s);
+				block_move(w, 0, inner_w(n), a.n, 1);
+				block_move(w, 1, w, 0, b.n - 1);
+				a.n++;
+				b.n--;
+				update_entry(p, j, lv);
+				update_entry(p, j + 1, lv);
+				return;
+			}
+			/* merge child j+1 of p into child j (the separator between them is moved down) */
+			if(j > 0) j--;
+			IndexType x = q.child[j];
+			IndexType y = q.child[j+1];
+			Inner& a2 = inner[x];
+			Inner& b2 = inner[y];
+			a2.keys[a2.n - 1] = std::move(q.keys[j]);
+			std::move(b2.keys, b2.keys + b2.n - 1, a2.keys + a2.n);
+			std::copy(b2.child, b2.child + b2.n, a2.child + a2.n);
+			for(unsigned int i = 0;i < b2.n;i++) set_parent(b2.child[i], lv - 1, x);
+			block_move(inner_w(y), 0, inner_w(x), a2.n, b2.n);
+			a2.n += b2.n;
+			b2.n = 0;
+			free_inner.push_back(y);
+			remove_child(p, j + 1);
+			update_entry(p, j, lv);
+			n = p;
+			lv++;
+		}
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	auto orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::insert_kv(KeyValue&& kv) -> std::pair<Pos,bool> {
+		NVType w[ORBTREE_NV_SIZE];
+		if(root == Invalid) {
+			IndexType l = new_leaf();
+			root = first_leaf = last_leaf = l;
+			height = 0;
+		}
+		else if(node_size(root,height) == B) split_root();
+		
+		/* go down from the root, splitting full nodes on the way, so the parent of
+		 * any node that is split always has space for the new child */
+		IndexType n = root;
+		for(unsigned int h = height;h;h--) {
+			unsigned int j = inner_upper(n, kv.key());
+			if(node_size(inner[n].child[j], h - 1) == B) {
+				split_child(n, j, h - 1);
+				if(!c(kv.key(), inner[n].keys[j])) j++;
+			}
+			n = inner[n].child[j];
+		}
+		unsigned int i = leaf_upper(n, kv.key());
+		if CONSTEXPR (!multi) {
+			/* an element with the same key would be right before the new one */
+			if(i) {
+				if(!c(leaves[n].kv[i-1].key(), kv.key())) return std::pair<Pos,bool>(Pos{n,i-1},false);
+			}
+			else if(leaves[n].prev != Invalid) {
+				const Leaf& x = leaves[leaves[n].prev];
+				if(!c(x.kv[x.n-1].key(), kv.key())) return std::pair<Pos,bool>(Pos{leaves[n].prev,x.n-1},false);
+			}
+		}
+		
+		f(kv.keyvalue(), w);
+		{
+			/* check that the total does not overflow before changing anything */
+			NVType norm[ORBTREE_NV_SIZE];
+			get_norm_fv(norm);
+			NVAdd(norm, w);
+		}
+		Leaf& a = leaves[n];
+		std::move_backward(a.kv + i, a.kv + a.n, a.kv + a.n + 1);
+		a.kv[i] = std::move(kv);
+		NVType* lwp = leaf_w(n);
+		block_move(lwp, i, lwp, i + 1, a.n - i);
+		block_set(lwp, i, w);
+		a.n++;
+		size1++;
+		update_path(n);
+		return std::pair<Pos,bool>(Pos{n,i},true);
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	auto orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::erase_pos(Pos p) -> Pos {
+		if(p.l == Invalid) throw std::runtime_error("orbtree_wide::erase(): invalid iterator!\n");
+		Leaf& a = leaves[p.l];
+		std::move(a.kv + p.i + 1, a.kv + a.n, a.kv + p.i);
+		NVType* w = leaf_w(p.l);
+		block_move(w, p.i + 1, w, p.i, a.n - p.i - 1);
+		leaf_truncate(p.l, a.n - 1);
+		size1--;
+		update_path(p.l);
+		Pos next = fix_pos(p.l, p.i);
+		rebalance_leaf(p.l, next);
+		return next;
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType> template<class K>
+	auto orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::lower_bound_pos(const K& k, NVType* res) const -> Pos {
+		if(res) for(unsigned int i = 0;i < get_nr();i++) res[i] = NVType();
+		if(root == Invalid) return end_pos();
+		NVType tmp[ORBTREE_NV_SIZE];
+		IndexType n = root;
+		for(unsigned int h = height;h;h--) {
+			unsigned int j = inner_lower(n, k);
+			if(res && j) {
+				block_sum(inner_w(n), j, tmp);
+				NVAdd(res, tmp);
+			}
+			n = inner[n].child[j];
+		}
+		unsigned int j = leaf_lower(n, k);
+		if(res && j) {
+			block_sum(leaf_w(n), j, tmp);
+			NVAdd(res, tmp);
+		}
+		return fix_pos(n, j);
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType> template<class K>
+	auto orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::upper_bound_pos(const K& k) const -> Pos {
+		if(root == Invalid) return end_pos();
+		IndexType n = root;
+		for(unsigned int h = height;h;h--) n = inner[n].child[inner_upper(n, k)];
+		return fix_pos(n, leaf_upper(n, k));
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType> template<class pred>
+	auto orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::lower_bound_w_pos(const pred& p) const -> Pos {
+		if(root == Invalid) return end_pos();
+		NVType acc[ORBTREE_NV_SIZE]; /* sum of weights before the current child */
+		NVType cur[ORBTREE_NV_SIZE];
+		for(unsigned int i = 0;i < get_nr();i++) acc[i] = NVType();
+		IndexType n = root;
+		for(unsigned int h = height;h;h--) {
+			/* find the first child where the predicate is true for the sum after it */
+			const Inner& x = inner[n];
+			unsigned int j = 0;
+			for(;j + 1 < x.n;j++) {
+				block_get(inner_w(n), j, cur);
+				NVAdd(cur, acc);
+				if(p(cur)) break;
+				for(unsigned int i = 0;i < get_nr();i++) acc[i] = cur[i];
+			}
+			n = x.child[j];
+		}
+		const Leaf& x = leaves[n];
+		unsigned int j = 0;
+		for(;j < x.n;j++) {
+			if(p(acc)) break;
+			block_get(leaf_w(n), j, cur);
+			NVAdd(acc, cur);
+		}
+		return fix_pos(n, j);
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	auto orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::find_by_weight_pos(unsigned int component,
+			const NVType& value, NVType* res) const -> Pos {
+		if(component >= get_nr()) throw std::runtime_error("orbtree_wide::find_by_weight(): invalid component!\n");
+		if(res) for(unsigned int i = 0;i < get_nr();i++) res[i] = NVType();
+		if(root == Invalid) return end_pos();
+		NVType acc = NVType(); /* sum of the searched component before the current node */
+		NVType tmp[ORBTREE_NV_SIZE];
+		IndexType n = root;
+		for(unsigned int h = height;h;h--) {
+			const Inner& x = inner[n];
+			const NVType* w = inner_w(n) + component * B;
+			unsigned int j = 0;
+			for(;j + 1 < x.n;j++) {
+				if(value < acc + w[j]) break;
+				acc += w[j];
+			}
+			if(res && j) {
+				block_sum(inner_w(n), j, tmp);
+				NVAdd(res, tmp);
+			}
+			n = x.child[j];
+		}
+		const Leaf& x = leaves[n];
+		const NVType* w = leaf_w(n) + component * B;
+		unsigned int j = 0;
+		for(;j < x.n;j++) {
+			if(value < acc + w[j]) break;
+			acc += w[j];
+		}
+		if(res && j) {
+			block_sum(leaf_w(n), j, tmp);
+			NVAdd(res, tmp);
+		}
+		return fix_pos(n, j);
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	void orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::get_sum_fv_pos(Pos p, NVType* res) const {
+		if(p.l == Invalid) {
+			get_norm_fv(res);
+			return;
+		}
+		NVType tmp[ORBTREE_NV_SIZE];
+		block_sum(leaf_w(p.l), p.i, res);
+		IndexType x = p.l;
+		for(IndexType q = leaves[x].parent;q != Invalid;x = q, q = inner[q].parent) {
+			unsigned int j = child_index(q, x);
+			if(j) {
+				block_sum(inner_w(q), j, tmp);
+				NVAdd(res, tmp);
+			}
+		}
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType> template<class InputIt>
+	void orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::assign_sorted(InputIt first, InputIt last) {
+		clear();
+		NVType w[ORBTREE_NV_SIZE];
+		try {
+			/* 1. fill leaves in order */
+			IndexType l = Invalid;
+			for(;first != last;++first) {
+				KeyValue kv(*first);
+				if(l != Invalid) {
+					const KeyType& prev = leaves[l].kv[leaves[l].n - 1].key();
+					if(c(kv.key(), prev)) throw std::runtime_error("orbtree_wide::assign_sorted(): input is not sorted!\n");
+					if(!multi && !c(prev, kv.key())) continue;
+				}
+				if(l == Invalid || leaves[l].n == B) {
+					IndexType l2 = new_leaf();
+					if(l == Invalid) first_leaf = l2;
+					else {
+						leaves[l].next = l2;
+						leaves[l2].prev = l;
+					}
+					l = l2;
+					last_leaf = l;
+				}
+				Leaf& a = leaves[l];
+				f(kv.keyvalue(), w);
+				a.kv[a.n] = std::move(kv);
+				block_set(leaf_w(l), a.n, w);
+				a.n++;
+				size1++;
+			}
+			if(l == Invalid) return;
+			
+			/* 2. the last leaf might have too few elements, move some from the one before it (which is full) */
+			Leaf& a = leaves[l];
+			if(a.n < min_fill && a.prev != Invalid) {
+				IndexType s = a.prev;
+				Leaf& b = leaves[s];
+				unsigned int m = min_fill - a.n;
+				std::move_backward(a.kv, a.kv + a.n, a.kv + a.n + m);
+				std::move(b.kv + b.n - m, b.kv + b.n, a.kv);
+				NVType* wl = leaf_w(l);
+				block_move(wl, 0, wl, m, a.n);
+				block_move(leaf_w(s), b.n - m, wl, 0, m);
+				a.n += m;
+				leaf_truncate(s, b.n - m);
+			}
+			
+			/* 3. build levels of inner nodes above the nodes of the previous level;
+			 * nodes are filled except for the last two, which share the remaining
+			 * children so that both have at least min_fill */
+			std::vector<IndexType> level;
+			for(IndexType x = first_leaf;x != Invalid;x = leaves[x].next) level.push_back(x);
+			unsigned int lv = 0;
+			while(level.size() > 1) {
+				std::vector<IndexType> up;
+				size_t m = level.size();
+				for(size_t pos = 0;pos < m;) {
+					size_t cnt = m - pos;
+					if(cnt > B) cnt = (cnt < B + min_fill) ? cnt - min_fill : B;
+					IndexType n = new_inner();
+					up.push_back(n);
+					Inner& x = inner[n];
+					x.n = (unsigned int)cnt;
+					for(unsigned int i = 0;i < cnt;i++) {
+						x.child[i] = level[pos + i];
+						set_parent(x.child[i], lv, n);
+						if(i) x.keys[i-1] = min_key(x.child[i], lv);
+						update_entry(n, i, lv);
+					}
+					pos += cnt;
+				}
+				level.swap(up);
+				lv++;
+			}
+			root = level[0];
+			height = lv;
+		}
+		catch(...) {
+			clear();
+			throw;
+		}
+	}
+	
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	void orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::check_tree(double epsilon) const {
+		if(root == Invalid) {
+			if(size1 || height || first_leaf != Invalid || last_leaf != Invalid)
+				throw std::runtime_error("orbtree_wide::check_tree(): inconsistent empty tree!\n");
+			return;
+		}
+		size_t n = 0;
+		IndexType prev_leaf = Invalid;
+		NVType sum[ORBTREE_NV_SIZE];
+		check_tree_r(epsilon, root, height, Invalid, 0, 0, n, prev_leaf, sum);
+		if(n != size1) throw std::runtime_error("orbtree_wide::check_tree(): inconsistent tree size!\n");
+		if(prev_leaf != last_leaf) throw std::runtime_error("orbtree_wide::check_tree(): inconsistent list of leaves!\n");
+	}
+	
+	/* recursive helper function to check tree, this function checks:
+	 *  -- number of elements / children of x, link to its parent
+	 *  -- for leaves: that they are linked in order, elements are ordered (and unique if !multi),
+	 *     stored weights are consistent with the weight function (if epsilon >= 0.0)
+	 *  -- for inner nodes: separator keys are ordered and their children are consistent with them,
+	 *     partial sums stored for each child are consistent (if epsilon >= 0.0)
+	 *  -- all keys are between lo and hi (if given), i.e. the separators in ancestors
+	 * the sum of weights in the subtree of x is stored in sum (if epsilon >= 0.0)
+	 */
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool multi, bool simple, unsigned int B, class IndexType>
+	void orbtree_wide<KeyValueT,NVTypeT,Compare,NVFunc,multi,simple,B,IndexType>::check_tree_r(double epsilon, IndexType x,
+			unsigned int lv, IndexType parent, const KeyType* lo, const KeyType* hi, size_t& n, IndexType& prev_leaf, NVType* sum) const {
+		NVType tmp[ORBTREE_NV_SIZE];
+		NVType tmp2[ORBTREE_NV_SIZE];
+		if(lv == 0) {
+			const Leaf& a = leaves[x];
+			if(a.parent != parent) throw std::runtime_error("orbtree_wide::check_tree(): inconsistent node!\n");
+			if(a.n == 0 || a.n > B || (parent != Invalid && a.n < min_fill))
+				throw std::runtime_error("orbtree_wide::check_tree(): invalid number of elements in node!\n");
+			if(a.prev != prev_leaf || (prev_leaf == Invalid ? first_leaf != x : leaves[prev_leaf].next != x))
+				throw std::runtime_error("orbtree_wide::check_tree(): inconsistent list of leaves!\n");
+			for(unsigned int i = 0;i < a.n;i++) {
+				const KeyType& k = a.kv[i].key();
+				if((lo && c(k,*lo)) || (hi && c(*hi,k))) throw std::runtime_error("orbtree_wide::check_tree(): inconsistent ordering!\n");
+				const KeyType* prev = 0;
+				if(i) prev = &(a.kv[i-1].key());
+				else if(prev_leaf != Invalid) prev = &(leaves[prev_leaf].kv[leaves[prev_leaf].n - 1].key());
+				if(prev) {
+					if(c(k,*prev)) throw std::runtime_error("orbtree_wide::check_tree(): inconsistent ordering!\n");
+					if(!multi && !c(*prev,k)) throw std::runtime_error("orbtree_wide::check_tree(): non-unique key found!\n");
+				}
+				if(epsilon >= 0.0) {
+					f(a.kv[i].keyvalue(), tmp);
+					block_get(leaf_w(x), i, tmp2);
+					check_nv_equal(epsilon, tmp2, tmp, "orbtree_wide::check_tree(): stored weight is inconsistent!\n");
+				}
+			}
+			if(epsilon >= 0.0) block_sum(leaf_w(x), a.n, sum);
+			n += a.n;
+			prev_leaf = x;
+			return;
+		}
+		
+		const Inner& a = inner[x];
+		if(a.parent != parent) throw std::runtime_error("orbtree_wide::check_tree(): inconsistent node!\n");
+		if(a.n < 2 || a.n > B || (parent != Invalid && a.n < min_fill))
+			throw std::runtime_error("orbtree_wide::check_tree(): invalid number of children in node!\n");
+		for(unsigned int i = 0;i + 1 < a.n;i++) {
+			if((lo && c(a.keys[i],*lo)) || (hi && c(*hi,a.keys[i])) || (i && c(a.keys[i],a.keys[i-1])))
+				throw std::runtime_error("orbtree_wide::check_tree(): inconsistent ordering!\n");
+		}
+		if(epsilon >= 0.0) for(unsigned int i = 0;i < get_nr();i++) sum[i] = NVType();
+		for(unsigned int j = 0;j < a.n;j++) {
+			check_tree_r(epsilon, a.child[j], lv - 1, x, j ? a.keys + j - 1 : lo, j + 1 < a.n ? a.keys + j : hi, n, prev_leaf, tmp);
+			if(epsilon >= 0.0) {
+				block_get(inner_w(x), j, tmp2);
+				check_nv_equal(epsilon, tmp2, tmp, "orbtree_wide::check_tree(): partial sums are inconsistent!\n");
+				NVAdd(sum, tmp);
+			}
+		}
+	}
+	
+	
+	/** \brief Map based on orbtree_wide, adds the functions specific to maps
+	 * (the same as \ref orbtree::orbtreemap "orbtreemap"). */
+	template<class KeyValueT, class NVTypeT, class Compare, class NVFunc, bool simple = false,
+		unsigned int B = 32, class IndexType = uint32_t>
+	class orbtreemap_wide : public orbtree_wide<KeyValueT, NVTypeT, Compare, NVFunc, false, simple, B, IndexType> {
+		protected:
+			typedef orbtree_wide<KeyValueT, NVTypeT, Compare, NVFunc, false, simple, B, IndexType> base;
+		public:
+			typedef typename base::value_type value_type;
+			typedef typename base::key_type key_type;
+			typedef typename base::iterator iterator;
+			typedef typename base::const_iterator const_iterator;
+			/// type of values stored in this map
+			typedef typename KeyValueT::MappedType mapped_type;
+			
+			explicit orbtreemap_wide(const NVFunc& f_ = NVFunc(), const Compare& c_ = Compare()) : base(f_,c_) { }
+			explicit orbtreemap_wide(NVFunc&& f_, const Compare& c_ = Compare()) : base(std::move(f_),c_) { }
+			template <class T>
+			explicit orbtreemap_wide(const T& t, const Compare& c_ = Compare()) : base(t,c_) { }
+			
+			/// Access mapped value for a key that compares equal to k, throws an exception if not such key is found
+			template<class K> const mapped_type& at(const K& k) const {
+				const_iterator it = base::find(k);
+				if(it == base::cend()) throw std::out_of_range("orbtreemap_wide::at(): key not present in map!\n");
+				return it->second;
+			}
+			/// Access mapped value for a given key, inserts a new element with the default value if not found.
+			const mapped_type& operator[](const key_type& k) {
+				iterator it = base::find(k);
+				if(it == base::end()) it = base::insert(value_type(k,mapped_type())).first;
+				return it->second;
+			}
+			/** \brief set value associated with the given key or insert new element
+			 * 
+			 * Returns true if a new element was inserted, false if the
+			 * value of an existing element was updated. */
+			bool set_value(const key_type& k, const mapped_type& v) {
+				std::pair<iterator,bool> tmp = base::insert(value_type(k,v));
+				if(tmp.second == false) tmp.first.set_value(v);
+				return tmp.second;
+			}
+	};
+	
+	
+	/** \class orbtree::orbsetB
+	 * \brief Same as \ref orbtree::orbset "orbset", but stored in an orbtree_wide
+	 * (B+ tree with 32 elements / children in each node).
+	 */
+	template<class Key, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbsetB = orbtree_wide< KeyOnly<Key>, typename NVFunc::result_type, Compare, NVFunc, false, false, 32, IndexType >;
+	
+	/** \class orbtree::orbmultisetB
+	 * \brief Same as \ref orbtree::orbmultiset "orbmultiset", but stored in an orbtree_wide.
+	 */
+	template<class Key, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbmultisetB = orbtree_wide< KeyOnly<Key>, typename NVFunc::result_type, Compare, NVFunc, true, false, 32, IndexType >;
+	
+	/** \class orbtree::orbmapB
+	 * \brief Same as \ref orbtree::orbmap "orbmap", but stored in an orbtree_wide.
+	 */
+	template<class Key, class Value, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbmapB = orbtreemap_wide< KeyValue<Key,Value>, typename NVFunc::result_type, Compare, NVFunc, false, 32, IndexType >;
+	
+	/** \class orbtree::orbmultimapB
+	 * \brief Same as \ref orbtree::orbmultimap "orbmultimap", but stored in an orbtree_wide.
+	 */
+	template<class Key, class Value, class NVFunc, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using orbmultimapB = orbtree_wide< KeyValue<Key,Value>, typename NVFunc::result_type, Compare, NVFunc, true, false, 32, IndexType >;
+	
+	/** \class orbtree::ranksetB
+	 * \brief Same as \ref orbtree::rankset "rankset", but stored in an orbtree_wide.
+	 */
+	template<class Key, class NVType = uint32_t, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using ranksetB = orbtree_wide< KeyOnly<Key>, NVType, Compare,
+			NVFunc_Adapter_Simple<RankFunc<Key, NVType> >, false, true, 32, IndexType >;
+	
+	/** \class orbtree::rankmultisetB
+	 * \brief Same as \ref orbtree::rankmultiset "rankmultiset", but stored in an orbtree_wide.
+	 */
+	template<class Key, class NVType = uint32_t, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using rankmultisetB = orbtree_wide< KeyOnly<Key>, NVType, Compare,
+			NVFunc_Adapter_Simple<RankFunc<Key, NVType> >, true, true, 32, IndexType >;
+	
+	/** \class orbtree::rankmapB
+	 * \brief Same as \ref orbtree::rankmap "rankmap", but stored in an orbtree_wide.
+	 */
+	template<class Key, class Value, class NVType = uint32_t, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using rankmapB = orbtreemap_wide< KeyValue<Key,Value>, NVType, Compare,
+			NVFunc_Adapter_Simple< RankFunc<trivial_pair<Key,Value>, NVType > >, true, 32, IndexType >;
+	
+	/** \class orbtree::rankmultimapB
+	 * \brief Same as \ref orbtree::rankmultimap "rankmultimap", but stored in an orbtree_wide.
+	 */
+	template<class Key, class Value, class NVType = uint32_t, class IndexType = uint32_t, class Compare = std::less<Key> >
+	using rankmultimapB = orbtree_wide< KeyValue<Key,Value>, NVType, Compare,
+			NVFunc_Adapter_Simple< RankFunc<trivial_pair<Key,Value>, NVType > >, true, true, 32, IndexType >;
+}
+
+#undef ORBTREE_NV_SIZE
+#undef CONSTEXPR
+
+#endif
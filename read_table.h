@@ -10,6 +10,10 @@
  * version with both C and C++ interface; it requires the POSIX C getline()
  * function which is not available on all systems (most notably on Windows)
  * 
+ * on POSIX systems, regular files can be mapped into memory instead of reading
+ * them line by line (see read_table_mmap() and read_table2::use_mmap()), in this
+ * case lines are parsed directly from the mapping, without copying
+ * 
  * note that the C++ interface requires C++11
  * 
  * Copyright 2018 Daniel Kondor <kondor.dani@gmail.com>
@@ -92,6 +96,16 @@ f.close(); // close file separately -- r should not be used after this point
 #include <limits.h>
 #include <ctype.h>
 #include <errno.h>
+#include <string.h>
+#include <float.h>
+
+/* memory mapping input files is only supported on POSIX systems */
+#if defined(__unix__) || defined(__APPLE__)
+#define READ_TABLE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
 #ifdef __cplusplus
 #include <cmath>
@@ -160,11 +174,17 @@ typedef struct read_table_s {
 	char delim; /* delimiter to use; 0 means any blank (space or tab) note: cannot be newline */
 	char comment; /* character to indicate comments; 0 means none */
 	uint8_t flags; /* further flags: whether reading a NaN or INF for double values is considered and error */
+	char* map; /* start of the memory mapped input file (if READ_TABLE_MAPPED is set in flags) */
+	size_t map_size; /* size of the mapping */
+	size_t map_pos; /* start of the next line in the mapping */
+	char* tail; /* copy of the last line if it does not end with a newline (only used with a mapping) */
 } read_table;
 
 /* flags used above */
 #define READ_TABLE_ALLOW_NAN_INF 1
 #define READ_TABLE_CLOSE_FILE 2
+#define READ_TABLE_MAPPED 4
+#define READ_TABLE_BORROWED 8
 
 /* allocate new read_table struct, fill in the necessary fields */
 static void read_table_init(read_table* r, FILE* f_) {
@@ -181,6 +201,29 @@ static void read_table_init(read_table* r, FILE* f_) {
 	r->fn = 0;
 	r->base = 10;
 	r->flags = READ_TABLE_ALLOW_NAN_INF;
+	r->map = 0;
+	r->map_size = 0;
+	r->map_pos = 0;
+	r->tail = 0;
+}
+
+/* free the line buffer or the memory mapping used by r (but not r itself) */
+static void read_table_release(read_table* r) {
+	if(r->flags & READ_TABLE_MAPPED) {
+#ifdef READ_TABLE_MMAP
+		if(r->map && !(r->flags & READ_TABLE_BORROWED)) munmap(r->map,r->map_size);
+#endif
+		if(r->tail) free(r->tail);
+		r->flags &= ~(READ_TABLE_MAPPED | READ_TABLE_BORROWED);
+	}
+	else if(r->buf) free(r->buf);
+	r->buf = 0;
+	r->buf_size = 0;
+	r->line_len = 0;
+	r->map = 0;
+	r->map_size = 0;
+	r->map_pos = 0;
+	r->tail = 0;
 }
 
 /* create new read_table object, reading from the given file
@@ -215,12 +258,99 @@ static read_table* read_table_new_fn(const char* fn_) {
  * note that this does not close the file, that is the caller's responsibility! */
 static void read_table_free(read_table* r) {
 	if(r) {
-		if(r->buf) free(r->buf);
+		read_table_release(r);
 		if(r->flags & READ_TABLE_CLOSE_FILE) if(r->f) fclose(r->f);
 		free(r);
 	}
 }
 
+#ifdef READ_TABLE_MMAP
+/* read the input by mapping the file into memory instead of reading it line by line
+ * (this is only possible for regular files); lines are not copied into a separate
+ * buffer, and strings returned by read_table_string() stay valid until r is freed
+ * (not only until reading the next line); note that lines are not NULL-terminated
+ * in this case, except for the last line if it does not end with a newline
+ * this has to be called before reading the first line, reading starts from the
+ * current position in r->f
+ * returns 0 on success, 1 if the file cannot be mapped; in this case, reading
+ * continues using getline() */
+static int read_table_mmap(read_table* r) {
+	if(!r || !r->f || r->line || (r->flags & READ_TABLE_MAPPED)) return 1;
+	if(r->last_error != T_OK) return 1;
+	int fd = fileno(r->f);
+	struct stat st;
+	if(fd < 0 || fstat(fd,&st) || !S_ISREG(st.st_mode)) return 1;
+	off_t offset = ftello(r->f);
+	if(offset < 0 || offset > st.st_size) return 1;
+	char* p = 0;
+	if(st.st_size > 0) {
+		void* p1 = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		if(p1 == MAP_FAILED) return 1;
+		p = (char*)p1;
+#ifdef MADV_SEQUENTIAL
+		madvise(p1,st.st_size,MADV_SEQUENTIAL);
+#endif
+	}
+	if(r->buf) free(r->buf);
+	r->buf = 0;
+	r->buf_size = 0;
+	r->map = p;
+	r->map_size = st.st_size;
+	r->map_pos = offset;
+	r->flags |= READ_TABLE_MAPPED;
+	return 0;
+}
+
+#else
+/* memory mapping is not supported, files are always read line by line */
+static int read_table_mmap(read_table* r) { return 1; }
+#endif
+
+/* read lines from the memory region [buf_,buf_+len) instead of a file; the data
+ * is not copied (it has to stay valid while reading) and is not freed by
+ * read_table_free(); lines are handled the same way as with read_table_mmap()
+ * this has to be called before reading the first line
+ * returns 0 on success, 1 on error */
+static int read_table_use_buffer(read_table* r, const char* buf_, size_t len) {
+	if(!r || r->line || (r->flags & READ_TABLE_MAPPED)) return 1;
+	if(r->buf) free(r->buf);
+	r->buf = 0;
+	r->buf_size = 0;
+	r->map = (char*)buf_;
+	r->map_size = len;
+	r->map_pos = 0;
+	r->flags |= (READ_TABLE_MAPPED | READ_TABLE_BORROWED);
+	r->last_error = T_OK;
+	return 0;
+}
+
+/* find the next line in the mapping, store its start in r->buf
+ * returns the length of the line (including the newline), or -1 on end of file
+ * or if there is no memory to copy the last line */
+static ssize_t read_table_line_mmap(read_table* r) {
+	if(r->map_pos >= r->map_size) return -1;
+	char* start = r->map + r->map_pos;
+	size_t rem = r->map_size - r->map_pos;
+	/* note: memchr() is typically vectorized, making this faster than a simple loop */
+	const char* nl = (const char*)memchr(start,'\n',rem);
+	if(nl) {
+		size_t len = nl - start + 1;
+		r->buf = start;
+		r->map_pos += len;
+		return len;
+	}
+	/* the last line does not end with a newline: it is copied and terminated,
+	 * so that number conversions cannot read past the end of the mapping */
+	char* tmp = (char*)malloc(rem + 1);
+	if(!tmp) return -1;
+	memcpy(tmp,start,rem);
+	tmp[rem] = 0;
+	r->tail = tmp;
+	r->buf = tmp;
+	r->map_pos = r->map_size;
+	return rem;
+}
+
 /* read a new line (discarding any remaining data in the current line)
  * returns 0 if a line was read, 1 on failure
  * note that failure can mean end of file, which should be checked separately
@@ -231,9 +361,11 @@ static int read_table_line_skip(read_table* r, int skip) {
 	if(!r) return 1;
 	if(r->last_error == T_EOF || r->last_error == T_COPIED ||
 		r->last_error == T_ERROR_FOPEN) return 1;
-	if(!(r->f)) { r->last_error = T_READ_ERROR; return 1; }
+	if(!(r->f) && !(r->flags & READ_TABLE_MAPPED)) { r->last_error = T_READ_ERROR; return 1; }
 	while(1) {
-		ssize_t len = getline(&(r->buf),&(r->buf_size),r->f);
+		ssize_t len;
+		if(r->flags & READ_TABLE_MAPPED) len = read_table_line_mmap(r);
+		else len = getline(&(r->buf),&(r->buf_size),r->f);
 		if(len < 0) {
 			r->last_error = T_EOF;
 			r->line_len = 0; /* ensure the buffer will never be accessed */
@@ -248,7 +380,7 @@ static int read_table_line_skip(read_table* r, int skip) {
 			for(; r->pos < r->line_len; r->pos++)
 				if( ! (r->buf[r->pos] == ' ' || r->buf[r->pos] == '\t' 
 					|| r->buf[r->pos] == '\r' || r->buf[r->pos] == '\n') ) break;
-			if(r->comment) if(r->buf[r->pos] == r->comment) continue; /* check for comment character first */
+			if(r->comment) if(r->pos < r->line_len && r->buf[r->pos] == r->comment) continue; /* check for comment character first */
 			if(r->pos < r->line_len) break; /* there is some data in the line */
 		}
 		else break; /* if empty lines should not be skipped */
@@ -262,16 +394,29 @@ static inline int read_table_line(read_table* r) {
 	return read_table_line_skip(r,1);
 }
 
+/* check if the character at the current position ends the data in the line:
+ * a newline or any whitespace that is not a blank or the delimiter (e.g. '\r' in
+ * files with DOS line endings), or the comment character; note that in memory
+ * mapped mode, lines are not terminated, so number conversions are only tried
+ * if this is false (libc functions would skip the newline and continue reading
+ * the next line) */
+static inline int read_table_at_eol(const read_table* r) {
+	if(r->pos == r->line_len) return 1;
+	char c = r->buf[r->pos];
+	if(r->comment && c == r->comment) return 1;
+	return (c != ' ' && c != r->delim && isspace((unsigned char)c));
+}
+
 /* checks to be performed before trying to convert a field */
 static int read_table_pre_check(read_table* r) {
 	if(!r) return 1;
 	if(r->last_error == T_EOF || r->last_error == T_EOL ||
 		r->last_error == T_READ_ERROR || r->last_error == T_ERROR_FOPEN) return 1;
-	/* 1. skip any blanks */
+	/* 1. skip any blanks (except if it is the delimiter, e.g. a tab) */
 	for(;r->pos<r->line_len;r->pos++)
-		if( ! (r->buf[r->pos] == ' ' || r->buf[r->pos] == '\t') ) break;
+		if( ! (r->buf[r->pos] == ' ' || r->buf[r->pos] == '\t') || r->buf[r->pos] == r->delim ) break;
 	/* 2. check for end of line or comment */
-	if(r->pos == r->line_len || r->buf[r->pos] == '\n' || (r->comment && r->buf[r->pos] == r->comment) ) {
+	if(read_table_at_eol(r)) {
 		r->last_error = T_EOL;
 		return 1;
 	}
@@ -298,12 +443,11 @@ static int read_table_post_check(read_table* r, char* c2) {
 	/* 1. skip the converted number and any blanks */
 	int have_blank = 0;
 	for(r->pos = c2 - r->buf;r->pos<r->line_len;r->pos++)
-		if( ! (r->buf[r->pos] == ' ' || r->buf[r->pos] == '\t') ) break;
+		if( ! (r->buf[r->pos] == ' ' || r->buf[r->pos] == '\t') || r->buf[r->pos] == r->delim ) break;
 		else have_blank = 1;
 	r->last_error = T_OK;
 	/* 2. check for end of line -- this is not a problem here */
-	if(r->pos == r->line_len || r->buf[r->pos] == '\n' ||
-		(r->comment && r->buf[r->pos] == r->comment) ) return 0;
+	if(read_table_at_eol(r)) return 0;
 	if(r->delim == 0 && have_blank == 0) {
 		/* if there is no explicit delimiter, then there need to be at least
 		 * one blank after the converted number if it is not the end of line */
@@ -395,6 +539,107 @@ static int read_table_string(read_table* r, const char** str, size_t* len) {
 	return 0;
 }
 
+/* fast conversion of decimal integers: gives the same result as strtoll(), but
+ * does not need to handle locales, different bases, overflow, etc.; these cases
+ * (i.e. anything other than an optional sign followed by at most 18 digits) are
+ * passed to strtoll()
+ * note: the input has to be terminated by a newline or a null character */
+static long long read_table_strtoll(const char* s, char** end, int base) {
+	if(base == 10) {
+		const char* p = s;
+		int neg = 0;
+		if(*p == '-' || *p == '+') { neg = (*p == '-'); p++; }
+		if(*p >= '0' && *p <= '9') {
+			const char* p1 = p;
+			long long x = 0;
+			for(;*p >= '0' && *p <= '9' && p - p1 < 18;p++) x = 10*x + (*p - '0');
+			if(!(*p >= '0' && *p <= '9')) {
+				*end = (char*)p;
+				return neg ? -x : x;
+			}
+		}
+	}
+	return strtoll(s,end,base);
+}
+/* unsigned version of the previous, same as strtoull() */
+static unsigned long long read_table_strtoull(const char* s, char** end, int base) {
+	if(base == 10) {
+		const char* p = s;
+		if(*p == '+') p++;
+		if(*p >= '0' && *p <= '9') {
+			const char* p1 = p;
+			unsigned long long x = 0;
+			for(;*p >= '0' && *p <= '9' && p - p1 < 19;p++) x = 10*x + (*p - '0');
+			if(!(*p >= '0' && *p <= '9')) {
+				*end = (char*)p;
+				return x;
+			}
+		}
+	}
+	return strtoull(s,end,base);
+}
+/* fast conversion of simple decimal numbers to double, the same as strtod()
+ * only numbers with at most 19 significant digits that can be converted exactly
+ * (mantissa at most 2^53 and decimal exponent at most 22 in absolute value) are
+ * handled here, all other cases (including hexadecimal, infinity, NaN) are passed
+ * to strtod(); this is only done if double arithmetic is not done in extended
+ * precision (that could result in double rounding)
+ * note: the input has to be terminated by a newline or a null character */
+static double read_table_strtod(const char* s, char** end) {
+#if FLT_EVAL_METHOD == 0
+	static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+	const char* p = s;
+	int neg = 0;
+	if(*p == '-' || *p == '+') { neg = (*p == '-'); p++; }
+	uint64_t m = 0;
+	int nd = 0; /* number of significant digits in m */
+	int e = 0; /* decimal exponent */
+	int any = 0; /* set if there were any digits */
+	for(;*p >= '0' && *p <= '9';p++) {
+		if(nd == 19) return strtod(s,end);
+		m = 10*m + (*p - '0');
+		if(m) nd++;
+		any = 1;
+	}
+	if(*p == '.') for(p++;*p >= '0' && *p <= '9';p++) {
+		if(nd == 19) return strtod(s,end);
+		m = 10*m + (*p - '0');
+		if(m) nd++;
+		e--;
+		any = 1;
+	}
+	if(!any) return strtod(s,end);
+	if(*p == 'e' || *p == 'E') {
+		const char* q = p + 1;
+		int eneg = 0;
+		if(*q == '-' || *q == '+') { eneg = (*q == '-'); q++; }
+		if(!(*q >= '0' && *q <= '9')) return strtod(s,end);
+		int e2 = 0;
+		for(;*q >= '0' && *q <= '9';q++) {
+			if(e2 > 1000) return strtod(s,end);
+			e2 = 10*e2 + (*q - '0');
+		}
+		e += eneg ? -e2 : e2;
+		p = q;
+	}
+	/* anything unusual after the number is handled by strtod() */
+	if(isalnum((unsigned char)*p) || *p == '.') return strtod(s,end);
+	double res;
+	if(m == 0) res = 0.0;
+	else {
+		if(m > ((uint64_t)1 << 53) || e < -22 || e > 22) return strtod(s,end);
+		res = (double)m;
+		if(e < 0) res /= pow10[-e];
+		else res *= pow10[e];
+	}
+	*end = (char*)p;
+	return neg ? -res : res;
+#else
+	return strtod(s,end);
+#endif
+}
+
 /* try to convert the next value to integer
  * check explicitely that it is within the limits provided
  * (note: the limits are inclusive, so either min or max is OK)
@@ -403,11 +648,11 @@ static int read_table_int32_limits(read_table* r, int32_t* i, int32_t min, int32
 	if(read_table_pre_check(r)) return 1;
 	errno = 0;
 	char* c2;
-	long res = strtol(r->buf + r->pos, &c2, r->base);
-	/* check that result fits in 32-bit integer -- long might be 64-bit */
-	if(res > (long)max || res < (long)min) {
-		if(res > (long)max) *i = max;
-		if(res < (long)min) *i = min;
+	long long res = read_table_strtoll(r->buf + r->pos, &c2, r->base);
+	/* check that result fits in 32-bit integer */
+	if(res > (long long)max || res < (long long)min) {
+		if(res > (long long)max) *i = max;
+		if(res < (long long)min) *i = min;
 		r->last_error = T_OVERFLOW;
 		return 1;
 	}
@@ -431,7 +676,7 @@ static int read_table_int64_limits(read_table* r, int64_t* i, int64_t min, int64
 	long res;
 	long long res2;
 	if(LONG_MAX >= INT64_MAX && LONG_MIN <= INT64_MIN) {
-		res = strtol(r->buf + r->pos, &c2, r->base);
+		res = read_table_strtoll(r->buf + r->pos, &c2, r->base);
 		/* note: this check might be unnecessary */
 		if(res > (long)max || res < (long)min) {
 			r->last_error = T_OVERFLOW;
@@ -442,7 +687,7 @@ static int read_table_int64_limits(read_table* r, int64_t* i, int64_t min, int64
 		*i = res; /* store potential result */
 	}
 	else {
-		res2 = strtoll(r->buf + r->pos, &c2, r->base);
+		res2 = read_table_strtoll(r->buf + r->pos, &c2, r->base);
 		if(res2 > (long long)max || res2 < (long long)min) {
 			r->last_error = T_OVERFLOW;
 			if(res2 > (long long)max) *i = max;
@@ -472,12 +717,12 @@ static int read_table_uint32_limits(read_table* r, uint32_t* i, uint32_t min, ui
 		*i = 0;
 		return 1;
 	}
-	unsigned long res = strtoul(r->buf + r->pos, &c2, r->base);
-	/* check that result fits in 32-bit integer -- long might be 64-bit */
-	if(res > (unsigned long)max || res < (unsigned long)min) {
+	unsigned long long res = read_table_strtoull(r->buf + r->pos, &c2, r->base);
+	/* check that result fits in 32-bit integer */
+	if(res > (unsigned long long)max || res < (unsigned long long)min) {
 		r->last_error = T_OVERFLOW;
-		if(res > (unsigned long)max) *i = max;
-		if(res < (unsigned long)min) *i = min;
+		if(res > (unsigned long long)max) *i = max;
+		if(res < (unsigned long long)min) *i = min;
 		return 1;
 	}
 	*i = res; /* store potential result */
@@ -506,7 +751,7 @@ static int read_table_uint64_limits(read_table* r, uint64_t* i, uint64_t min, ui
 	unsigned long res;
 	unsigned long long res2;
 	if(ULONG_MAX >= UINT64_MAX) {
-		res = strtoul(r->buf + r->pos, &c2, r->base);
+		res = read_table_strtoull(r->buf + r->pos, &c2, r->base);
 		/* note: this check might be unnecessary */
 		if(res > (unsigned long)max || res < (unsigned long)min) {
 			r->last_error = T_OVERFLOW;
@@ -517,7 +762,7 @@ static int read_table_uint64_limits(read_table* r, uint64_t* i, uint64_t min, ui
 		*i = res; /* store potential result */
 	}
 	else {
-		res2 = strtoull(r->buf + r->pos, &c2, r->base);
+		res2 = read_table_strtoull(r->buf + r->pos, &c2, r->base);
 		if(res2 > (unsigned long long)max || res2 < (unsigned long long)min) {
 			r->last_error = T_OVERFLOW;
 			if(res2 > (unsigned long long)max) *i = max;
@@ -566,7 +811,7 @@ static int read_table_double(read_table* r, double* d) {
 	if(read_table_pre_check(r)) return 1;
 	errno = 0;
 	char* c2;
-	*d = strtod(r->buf + r->pos, &c2);
+	*d = read_table_strtod(r->buf + r->pos, &c2);
 	/* advance position after the number, check if there is proper field separator */
 	if(read_table_post_check(r,c2)) return 1;
 	if( (r->flags & READ_TABLE_ALLOW_NAN_INF) == 0) {
@@ -581,7 +826,7 @@ static int read_table_double_limits(read_table* r, double* d, double min, double
 	if(read_table_pre_check(r)) return 1;
 	errno = 0;
 	char* c2;
-	*d = strtod(r->buf + r->pos, &c2);
+	*d = read_table_strtod(r->buf + r->pos, &c2);
 	if(read_table_post_check(r,c2)) return 1;
 	if(isnan(*d)) {
 		r->last_error = T_NAN;
@@ -864,6 +1109,11 @@ struct read_table2 : public read_table {
 			 * with two different instances of this class */
 			rt_.buf = 0;
 			rt_.buf_size = 0;
+			rt_.map = 0;
+			rt_.map_size = 0;
+			rt_.map_pos = 0;
+			rt_.tail = 0;
+			rt_.flags &= ~(READ_TABLE_MAPPED | READ_TABLE_BORROWED);
 			rt_.pos = 0;
 			rt_.line_len = 0;
 			rt_.col = 0;
@@ -871,12 +1121,18 @@ struct read_table2 : public read_table {
 		}
 		/* destructor frees temporary buffer */
 		~read_table2() {
-			if(buf) free(buf);
-			buf = 0;
-			buf_size = 0;
+			read_table_release(this);
 			if(flags & READ_TABLE_CLOSE_FILE) if(f) fclose(f);
 			f = 0;
 		}
+		/* map the input file into memory instead of reading it line by line
+		 * (see read_table_mmap() above); has to be called before reading the
+		 * first line; returns false if this is not possible (e.g. the input
+		 * is a pipe), in this case the input is read normally */
+		bool use_mmap() { return (read_table_mmap(this) == 0); }
+		/* read lines from the given memory region instead of the file
+		 * (see read_table_use_buffer() above) */
+		bool use_buffer(const char* buf_, size_t len) { return (read_table_use_buffer(this,buf_,len) == 0); }
 		/* read next line into the internal buffer */
 		bool read_line(bool skip = true) {
 			return (read_table_line_skip(this,skip) == 0);
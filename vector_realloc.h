@@ -67,6 +67,16 @@
  * explicitly), i.e. any type that allocates dynamic memory as well, as long
  * as it does not store a pointer to itself (and no pointers to it are stored
  * elsewhere as well).
+ * 
+ * Memory is obtained through the allocation policy given as the second template
+ * parameter. The default, \ref realloc_vector::malloc_alloc uses realloc() directly.
+ * Alternatively, \ref realloc_vector::mmap_alloc uses anonymous memory mappings
+ * for large arrays on Linux, grown with mremap() (without copying) and backed by
+ * transparent huge pages if possible.
+ * 
+ * @tparam T Type stored in this vector.
+ * @tparam alloc_policy Class with static member functions used to allocate memory
+ * (see \ref realloc_vector::malloc_alloc for the required interface).
  */
 
 #ifndef VECTOR_REALLOC_H
@@ -79,6 +89,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* memory mapping files is only supported on POSIX systems */
+#if defined(__unix__) || defined(__APPLE__)
+#define REALLOC_VECTOR_MMAP
+#include <sys/types.h>
+#include <sys/mman.h>
+/* growing memory mappings in place is only supported on Linux */
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+#define REALLOC_VECTOR_MREMAP
+#endif
+#endif
+
 
 /* constexpr if support only for c++17 or newer */
 #if __cplusplus >= 201703L
@@ -109,9 +130,87 @@ namespace realloc_vector {
 				std::is_same< typename std::iterator_traits<It>::iterator_category, typename std::input_iterator_tag >::value;
 		};
 		
+		
+		
+		/** \brief Default allocation policy, using malloc(), realloc() and free().
+		 * 
+		 * Any allocation policy needs to provide the same two static functions. */
+		struct malloc_alloc {
+			/** \brief Change the size of the memory area starting at p from old_size to
+			 * new_size bytes (p can be nullptr if old_size is zero, new_size is always
+			 * nonzero). Contents are preserved up to the smaller of the two sizes.
+			 * Returns the new location, or nullptr on failure (p is not changed then). */
+			static void* resize(void* p, size_t old_size, size_t new_size) {
+				(void)old_size;
+				return realloc(p, new_size);
+			}
+			/// \brief Free the memory area starting at p, allocated with size bytes.
+			static void release(void* p, size_t size) {
+				(void)size;
+				free(p);
+			}
+		};
+		
+		/** \brief Allocation policy aimed at large arrays (several GB), using anonymous
+		 * memory mappings on Linux.
+		 * 
+		 * Areas smaller than map_min bytes are allocated with malloc() as by
+		 * \ref malloc_alloc. Larger areas are mapped with mmap() and grown with
+		 * mremap(), so growing never copies elements. Mappings are requested to be
+		 * backed by transparent huge pages (with madvise(MADV_HUGEPAGE)), which
+		 * reduces TLB misses for random access. The size of mappings is a multiple
+		 * of map_min, so only every map_min bytes of growth needs a system call.
+		 * 
+		 * On other systems, this is the same as \ref malloc_alloc. */
+		struct mmap_alloc {
+			/// \brief use memory mappings for areas of at least this many bytes (size of a huge page on x86-64)
+			static constexpr size_t map_min = 2097152;
+#ifdef REALLOC_VECTOR_MREMAP
+			/// \brief actual size of the mapping used for an area of the given size
+			static size_t map_size(size_t size) { return ((size + map_min - 1) / map_min) * map_min; }
+			/// \brief create a new mapping of the given size (already rounded)
+			static void* map(size_t size) {
+				void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if(p == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+				madvise(p, size, MADV_HUGEPAGE); /* only a hint, failure is not a problem */
+#endif
+				return p;
+			}
+			/// \brief Change the size of a memory area, see \ref malloc_alloc::resize()
+			static void* resize(void* p, size_t old_size, size_t new_size) {
+				if(old_size < map_min && new_size < map_min) return realloc(p, new_size);
+				if(old_size >= map_min && new_size >= map_min) {
+					size_t s1 = map_size(old_size);
+					size_t s2 = map_size(new_size);
+					if(s1 == s2) return p;
+					/* note: the new pages keep the huge page setting of the mapping */
+					void* tmp = mremap(p, s1, s2, MREMAP_MAYMOVE);
+					return (tmp == MAP_FAILED) ? nullptr : tmp;
+				}
+				/* switch between malloc() and mmap(), need to copy */
+				void* tmp = (new_size < map_min) ? malloc(new_size) : map(map_size(new_size));
+				if(!tmp) return nullptr;
+				if(p) memcpy(tmp, p, old_size < new_size ? old_size : new_size);
+				release(p, old_size);
+				return tmp;
+			}
+			/// \brief Free a memory area, see \ref malloc_alloc::release()
+			static void release(void* p, size_t size) {
+				if(size < map_min) free(p);
+				else munmap(p, map_size(size));
+			}
+#else
+			/// \brief Change the size of a memory area, see \ref malloc_alloc::resize()
+			static void* resize(void* p, size_t old_size, size_t new_size) { return malloc_alloc::resize(p, old_size, new_size); }
+			/// \brief Free a memory area, see \ref malloc_alloc::release()
+			static void release(void* p, size_t size) { malloc_alloc::release(p, size); }
+#endif
+		};
+		
 
 
-template <class T>
+template <class T, class alloc_policy = malloc_alloc>
 class vector {
 	protected:
 		/* This requirement is too strict; what we actually want is trivially moveable,
@@ -125,17 +224,44 @@ class vector {
 		size_t p_size; /**< \brief number of elements in vector */
 		size_t p_capacity; /**< \brief current capacity of vector */
 		size_t max_grow; /**< \brief grow memory by maximum this many elements at a time */
+		/// \brief if nonzero, elements are stored in a memory mapped file of this many bytes (instead of memory from alloc_policy)
+		size_t p_mapped;
 		/// \brief maximum safe capacity to avoid overflow
 		static constexpr size_t p_max_capacity = std::numeric_limits<size_t>::max() / sizeof(T);
 		
 		/// \brief Reallocate memory to the given new size
 		bool change_size(size_t new_size) {
-			T* tmp = (T*)realloc(start,new_size*sizeof(T));
+			if(!new_size) {
+				free_memory();
+				p_capacity = 0;
+				return true;
+			}
+			if(p_mapped) {
+				/* elements are copied out of the mapped area on the first change in capacity */
+				T* tmp = (T*)alloc_policy::resize(nullptr, 0, new_size*sizeof(T));
+				if(!tmp) return false;
+				memcpy(tmp, start, sizeof(T)*(p_size < new_size ? p_size : new_size));
+				free_memory();
+				start = tmp;
+				p_capacity = new_size;
+				return true;
+			}
+			T* tmp = (T*)alloc_policy::resize(start, p_capacity*sizeof(T), new_size*sizeof(T));
 			if(!tmp) return false;
 			start = tmp;
 			p_capacity = new_size;
 			return true;
 		}
+		/// \brief Free (or unmap) the memory used for storage, elements should be already destroyed
+		void free_memory() {
+#ifdef REALLOC_VECTOR_MMAP
+			if(p_mapped) munmap(start, p_mapped);
+			else
+#endif
+			if(start) alloc_policy::release(start, p_capacity*sizeof(T));
+			start = nullptr;
+			p_mapped = 0;
+		}
 		/// \brief Attempt to grow vector either to the given minimum size or
 		/// by doubling the current size unless growth would be
 		/// larger than max_grow, in which case size is increased by max_grow.
@@ -166,7 +292,7 @@ class vector {
 		/* Constructors */
 		
 		/** \brief default constructor, creates empty vector, maximum growth is 128k elements */
-		vector() noexcept : start(nullptr),p_size(0),p_capacity(0),max_grow(131072) { }
+		vector() noexcept : start(nullptr),p_size(0),p_capacity(0),max_grow(131072),p_mapped(0) { }
 		/** \brief constructor to create vector of given size and potentially set maximum growth size */
 		explicit vector(size_t count, const T& value = T(), size_t max_grow_ = 131072);
 		/** \brief contructor from iterators and optionally setting maximum growth size */
@@ -185,7 +311,7 @@ class vector {
 		~vector() {
 			/* call destructors of existing elements -- these are not allowed to throw an exception! */
 			if(p_size) resize(0);
-			if(start) free(start);
+			free_memory();
 		}
 		
 		
@@ -243,6 +369,20 @@ class vector {
 		/// \brief Free up unused memory.
 		void shrink_to_fit(size_t new_capacity = 0);
 		
+#ifdef REALLOC_VECTOR_MMAP
+		/** \brief Replace the contents of the vector with count elements stored
+		 * in the file fd, starting at offset (which must be a multiple of the page size).
+		 * 
+		 * The file is mapped into memory privately, so elements can be read
+		 * without copying them first. Modifications are not written back to the
+		 * file (pages are copied on write); any change in capacity copies all
+		 * elements to newly allocated memory. The file descriptor can be closed
+		 * after this call. Returns false if the mapping failed. */
+		bool map_file(int fd, off_t offset, size_t count);
+#endif
+		/// \brief Returns true if elements are stored in a memory mapped file (see \ref map_file()).
+		bool is_mapped() const { return p_mapped != 0; }
+		
 		/* insert /create elements at the end of the vector
 		 * versions that throw an exception if out of memory */
 		/// \brief Insert element at the end of the vector. Can throw an exception if memory allocation fails.
@@ -357,9 +497,9 @@ class vector {
 
 
 /* Constructors */
-template<class T>
-vector<T>::vector(size_t count, const T& value, size_t max_grow_) :
-		start(nullptr),p_size(0),p_capacity(0),max_grow(max_grow_) {
+template<class T, class A>
+vector<T,A>::vector(size_t count, const T& value, size_t max_grow_) :
+		start(nullptr),p_size(0),p_capacity(0),max_grow(max_grow_),p_mapped(0) {
 	reserve(count);
 	if CONSTEXPR(std::is_nothrow_constructible<T>::value) {
 		p_size = count;
@@ -368,35 +508,36 @@ vector<T>::vector(size_t count, const T& value, size_t max_grow_) :
 	else for(;p_size < count; ++p_size) new(start + p_size) T(value);
 }
 
-template<class T> template<class It, typename std::enable_if< at_least_input_iterator<It>::value, int>::type >
-vector<T>::vector(It first, It last, size_t max_grow_) :
-		start(nullptr),p_size(0),p_capacity(0),max_grow(max_grow_) {
+template<class T, class A> template<class It, typename std::enable_if< at_least_input_iterator<It>::value, int>::type >
+vector<T,A>::vector(It first, It last, size_t max_grow_) :
+		start(nullptr),p_size(0),p_capacity(0),max_grow(max_grow_),p_mapped(0) {
 	for(; first != last; ++first) push_back(*first);
 }
 
-template<class T>
-vector<T>::vector(const vector<T>& v) : start(nullptr), p_size(0), p_capacity(0), max_grow(v.max_grow) {
+template<class T, class A>
+vector<T,A>::vector(const vector<T,A>& v) : start(nullptr), p_size(0), p_capacity(0), max_grow(v.max_grow), p_mapped(0) {
 	reserve(v.size());
 	memcpy(start, v.start, sizeof(T)*(v.size()));
 	p_size = v.size();
 }
 
-template<class T>
-void vector<T>::swap(vector<T>& v) {
+template<class T, class A>
+void vector<T,A>::swap(vector<T,A>& v) {
 	using std::swap;
 	swap(start, v.start);
 	swap(p_size, v.p_size);
 	swap(p_capacity, v.p_capacity);
 	swap(max_grow, v.max_grow);
+	swap(p_mapped, v.p_mapped);
 }
 
-template<class T>
-vector<T>::vector(vector<T>&& v) : start(nullptr), p_size(0), p_capacity(0), max_grow(v.max_grow) {
+template<class T, class A>
+vector<T,A>::vector(vector<T,A>&& v) : start(nullptr), p_size(0), p_capacity(0), max_grow(v.max_grow), p_mapped(0) {
 	swap(v);
 }
 
-template<class T>
-vector<T>& vector<T>::operator = (const vector<T>& v) {
+template<class T, class A>
+vector<T,A>& vector<T,A>::operator = (const vector<T,A>& v) {
 	resize(0);
 	reserve(v.size());
 	memcpy(start, v.start, sizeof(T)*(v.size()));
@@ -404,60 +545,78 @@ vector<T>& vector<T>::operator = (const vector<T>& v) {
 	return *this;
 }
 
-template<class T>
-vector<T>& vector<T>::operator = (vector<T>&& v) {
+template<class T, class A>
+vector<T,A>& vector<T,A>::operator = (vector<T,A>&& v) {
 	resize(0);
-	if(start) free(start);
-	start = nullptr;
+	free_memory();
+	p_capacity = 0;
 	swap(v);
+	return *this;
 }
 
-template<class T>
-bool vector<T>::reserve_nothrow(size_t n) {
+template<class T, class A>
+bool vector<T,A>::reserve_nothrow(size_t n) {
 	if(n > p_max_capacity) return false;
 	if(n <= p_capacity) return true;
 	return change_size(n);
 }
 
-template<class T>
-void vector<T>::shrink_to_fit(size_t new_capacity) {
+template<class T, class A>
+void vector<T,A>::shrink_to_fit(size_t new_capacity) {
 	if(new_capacity < p_size) new_capacity = p_size;
 	if(new_capacity > p_capacity) return;
 	if(!change_size(new_capacity)) throw std::bad_alloc(); /* this should not happen, shrinking memory should always succeed */
 }
 
+#ifdef REALLOC_VECTOR_MMAP
+template<class T, class A>
+bool vector<T,A>::map_file(int fd, off_t offset, size_t count) {
+	if(count > p_max_capacity) return false;
+	resize(0);
+	if(!count) return true;
+	void* tmp = mmap(nullptr, count*sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+	if(tmp == MAP_FAILED) return false;
+	free_memory();
+	start = (T*)tmp;
+	p_mapped = count*sizeof(T);
+	p_size = count;
+	p_capacity = count;
+	return true;
+}
+#endif
+
 
 
 /* insert /create elements at the end of the vector */
-template<class T>
-void vector<T>::push_back(const T& x) {
+template<class T, class A>
+void vector<T,A>::push_back(const T& x) {
 	if(!push_back_nothrow(x)) throw std::bad_alloc();
 }
-template<class T>
-void vector<T>::push_back(T&& x) {
+template<class T, class A>
+void vector<T,A>::push_back(T&& x) {
 	if(!push_back_nothrow(std::forward<T>(x))) throw std::bad_alloc();
 }
-template<class T> template<class... Args>
-T& vector<T>::emplace_back(Args&&... args) {
+template<class T, class A> template<class... Args>
+T& vector<T,A>::emplace_back(Args&&... args) {
 	if(!emplace_back_nothrow(std::forward<Args>(args)...)) throw std::bad_alloc();
 	return back();
 }
-template<class T>
-bool vector<T>::push_back_nothrow(const T& x) {
+template<class T, class A>
+bool vector<T,A>::push_back_nothrow(const T& x) {
 	if(p_size == p_capacity) if(!grow_vector()) return false;
 	new(start + p_size) T(x); /* copy constructor -- might still throw an exception */
 	p_size++;
 	return true;
 }
-template<class T>
-bool vector<T>::push_back_nothrow(T&& x) {
+template<class T, class A>
+bool vector<T,A>::push_back_nothrow(T&& x) {
 	if(p_size == p_capacity) if(!grow_vector()) return false;
 	new(start + p_size) T(std::forward<T>(x)); /* move constructor -- might throw an exception */
 	p_size++;
 	return true;
 }
-template<class T> template<class... Args>
-bool vector<T>::emplace_back_nothrow(Args&&... args) {
+template<class T, class A> template<class... Args>
+bool vector<T,A>::emplace_back_nothrow(Args&&... args) {
 	if(p_size == p_capacity) if(!grow_vector()) return false;
 	new(start + p_size) T(std::forward<Args>(args)...); /* constructor -- might throw an exception */
 	p_size++;
@@ -466,8 +625,8 @@ bool vector<T>::emplace_back_nothrow(Args&&... args) {
 
 
 
-template<class T>
-bool vector<T>::resize_nothrow(size_t count) {
+template<class T, class A>
+bool vector<T,A>::resize_nothrow(size_t count) {
 	if(count == p_size) return true;
 	if(!count) { clear(); return true; }
 	if(count < p_size) {
@@ -483,8 +642,8 @@ bool vector<T>::resize_nothrow(size_t count) {
 	else for(; p_size < count; p_size++) new(start + p_size) T();
 	return true;
 }
-template<class T>
-bool vector<T>::resize_nothrow(size_t count, const T& x) {
+template<class T, class A>
+bool vector<T,A>::resize_nothrow(size_t count, const T& x) {
 	if(count == p_size) return true;
 	if(!count) { clear(); return true; }
 	if(count < p_size) {
@@ -502,8 +661,8 @@ bool vector<T>::resize_nothrow(size_t count, const T& x) {
 }
 
 
-template<class T>
-typename vector<T>::iterator vector<T>::erase(vector<T>::const_iterator pos) {
+template<class T, class A>
+typename vector<T,A>::iterator vector<T,A>::erase(vector<T,A>::const_iterator pos) {
 	size_t p2 = pos - start;
 	if(p2 >= p_size) throw std::out_of_range("vector::erase(): iterator out of bounds!\n");
 	
@@ -513,8 +672,8 @@ typename vector<T>::iterator vector<T>::erase(vector<T>::const_iterator pos) {
 	p_size--;
 	return iterator(start + p2);
 }
-template<class T>
-typename vector<T>::iterator vector<T>::erase(vector<T>::const_iterator first, vector<T>::const_iterator last) {
+template<class T, class A>
+typename vector<T,A>::iterator vector<T,A>::erase(vector<T,A>::const_iterator first, vector<T,A>::const_iterator last) {
 	ssize_t dist = last - first;
 	if(!dist) return iterator(first);
 	
@@ -532,8 +691,8 @@ typename vector<T>::iterator vector<T>::erase(vector<T>::const_iterator first, v
 
 
 /* move elements to new position from given position */
-template<class T>
-bool vector<T>::insert_helper(size_t pos, size_t new_pos) {
+template<class T, class A>
+bool vector<T,A>::insert_helper(size_t pos, size_t new_pos) {
 	if(new_pos > pos) {
 		size_t diff = new_pos - pos;
 		if(p_size > p_max_capacity - diff || !reserve_nothrow(p_size + diff)) return false;
@@ -545,8 +704,8 @@ bool vector<T>::insert_helper(size_t pos, size_t new_pos) {
 
 
 
-template<class T>
-bool vector<T>::insert_nothrow(vector<T>::const_iterator pos, vector<T>::iterator& res, const T& x) {
+template<class T, class A>
+bool vector<T,A>::insert_nothrow(vector<T,A>::const_iterator pos, vector<T,A>::iterator& res, const T& x) {
 	if(pos == cend()) return push_back_nothrow(x);
 	size_t p2 = pos - start;
 	if(!insert_helper(p2,p2+1)) return false;
@@ -562,29 +721,29 @@ bool vector<T>::insert_nothrow(vector<T>::const_iterator pos, vector<T>::iterato
 		}
 	}
 	p_size++;
-	res = vector<T>::iterator(start + p2);
+	res = vector<T,A>::iterator(start + p2);
 	return true;
 }
 
-template<class T>
-bool vector<T>::insert_nothrow(vector<T>::const_iterator pos, vector<T>::iterator& res, T&& x) {
+template<class T, class A>
+bool vector<T,A>::insert_nothrow(vector<T,A>::const_iterator pos, vector<T,A>::iterator& res, T&& x) {
 	if(pos == cend()) return push_back_nothrow(std::forward<T>(x));
 	size_t p2 = pos - start;
 	if(!insert_helper(p2,p2+1)) return false;
 	/* note: move constructor of T should never throw an exception */
 	new(start + p2) T(std::forward<T>(x));
 	p_size++;
-	res = vector<T>::iterator(start + p2);
+	res = vector<T,A>::iterator(start + p2);
 	return true;
 }
 
 
-template<class T>
-bool vector<T>::insert_nothrow(vector<T>::const_iterator pos, vector<T>::iterator& res, size_t count, const T& x) {
+template<class T, class A>
+bool vector<T,A>::insert_nothrow(vector<T,A>::const_iterator pos, vector<T,A>::iterator& res, size_t count, const T& x) {
 	size_t p2 = pos - start;
 	if(pos == cend()) {
 		if(!resize_nothrow(p_size + count, x)) return false;
-		res = vector<T>::iterator(start + p2);
+		res = vector<T,A>::iterator(start + p2);
 		return true;
 	}
 	
@@ -610,14 +769,14 @@ bool vector<T>::insert_nothrow(vector<T>::const_iterator pos, vector<T>::iterato
 		}
 	}
 	p_size += count;
-	res = vector<T>::iterator(start + p2);
+	res = vector<T,A>::iterator(start + p2);
 	return true;
 }
 
 
-template<class T> template<class InputIt,
+template<class T, class A> template<class InputIt,
 	typename std::enable_if<at_least_input_iterator<InputIt>::value, int>::type >
-bool vector<T>::insert_nothrow(vector<T>::const_iterator pos, vector<T>::iterator& res, InputIt first, InputIt last) {
+bool vector<T,A>::insert_nothrow(vector<T,A>::const_iterator pos, vector<T,A>::iterator& res, InputIt first, InputIt last) {
 	size_t p2 = pos - start;
 	if(first != last) {
 		if CONSTEXPR(at_least_forward_iterator<InputIt>::value) {
@@ -627,7 +786,7 @@ bool vector<T>::insert_nothrow(vector<T>::const_iterator pos, vector<T>::iterato
 			if(pos == cend()) {
 				if(!reserve_nothrow(p_size + dist)) return false;
 				for(; first != last; ++first) push_back(*first);
-				res = vector<T>::iterator(start + p2);
+				res = vector<T,A>::iterator(start + p2);
 				return true;
 			}
 			
@@ -657,10 +816,10 @@ bool vector<T>::insert_nothrow(vector<T>::const_iterator pos, vector<T>::iterato
 		}
 		else {
 			for(size_t p3 = p2;first != last; ++first, p3++)
-				if(!insert_nothrow(vector<T>::iterator(start + p3),res,*first)) return false;
+				if(!insert_nothrow(vector<T,A>::iterator(start + p3),res,*first)) return false;
 		}
 	}
-	res = vector<T>::iterator(start + p2);
+	res = vector<T,A>::iterator(start + p2);
 	return true;
 }
 
@@ -42,6 +42,9 @@
  * @tparam T Type stored in this vector.
  * @tparam vector_type Container type to use for storing pointers to
  * the individual arrays
+ * @tparam pow2 If true, the size of individual arrays (the max_grow
+ * constructor parameter) is rounded up to a power of two, so that indexing
+ * only needs a shift and a mask instead of a division.
  * 
  * Main motivation for this class are the following perceived issues with std::vector:
  * 
@@ -68,7 +71,10 @@
  * division and an extra memory lookup operation, thus it can be significantly
  * slower than using a regular vector.
  * 
- * This can be mitigated by optimizing divide operations with the use of the
+ * This can be mitigated by using arrays with a size that is a power of two (setting
+ * the pow2 template parameter to true), so that the division is replaced by a
+ * shift. This is what NodeAllocatorCompact does in \ref orbtree_node.h. For other
+ * array sizes, divide operations can be optimized with the use of the
  * [libdivide library](https://github.com/ridiculousfish/libdivide). To do this,
  * download libdivide.h and place it in the same directory and define
  * USE_LIBDIVIDE (e.g. by the by adding -DUSE_LIBDIVIDE command line argument
@@ -167,7 +173,7 @@ namespace stacked_vector {
 template <class T>
 using std_vector_wrapper = std::vector<T>;
 
-template <class T, template<class> class vector_type = std_vector_wrapper>
+template <class T, template<class> class vector_type = std_vector_wrapper, bool pow2 = false>
 class vector {
 	protected:
 		vector_type<T*> stack;
@@ -180,6 +186,21 @@ class vector {
 #else
 		size_t max_grow; /**< \brief grow memory by maximum this many elements at a time, i.e. maximum value for p_stack_size. Does not change, but not const to allow for swapping / copying / moving vectors with different value. */
 #endif
+		unsigned int grow_shift; /**< \brief log2(max_grow) if pow2 == true (not used otherwise) */
+		
+		/// \brief Actual value of max_grow to use: requested value rounded up to a power of two if pow2 == true
+		static size_t grow_size(size_t max_grow_) {
+			if(!pow2) return max_grow_;
+			size_t x = 1;
+			while(x < max_grow_ && x <= std::numeric_limits<size_t>::max() / 2) x *= 2;
+			return x;
+		}
+		/// \brief Calculate grow_shift for the given (already rounded) max_grow
+		static unsigned int grow_log2(size_t max_grow_) {
+			unsigned int r = 0;
+			for(;max_grow_ > 1;max_grow_ /= 2) r++;
+			return r;
+		}
 		/// \brief maximum safe capacity to avoid overflow
 		static constexpr size_t p_max_capacity = std::numeric_limits<size_t>::max() / sizeof(T);
 				
@@ -276,6 +297,7 @@ class vector {
 		
 		/// Helper to get internal indices (which stack + position in stack) based on item index.
 		std::pair<size_t,size_t> get_indices(size_t i) const {
+			if CONSTEXPR (pow2) return std::pair<size_t,size_t>(i >> grow_shift, i & ((((size_t)1) << grow_shift) - 1));
 #ifdef USE_LIBDIVIDE
 			size_t i1 = i / max_grow;
 			size_t i2 = (i - i1*max_grow);
@@ -312,7 +334,7 @@ class vector {
 		/* Constructors */
 		
 		/** \brief default constructor, creates empty vector, maximum growth is 128k elements */
-		vector() noexcept : p_size(0),p_capacity(0),p_stack_size(0),max_grow(131072) { }
+		vector() noexcept : p_size(0),p_capacity(0),p_stack_size(0),max_grow(131072),grow_shift(17) { }
 		/** \brief constructor to create vector of given size and potentially set maximum growth size */
 		explicit vector(size_t count, const T& value = T(), size_t max_grow_ = 131072);
 		/** \brief contructor from iterators and optionally setting maximum growth size */
@@ -448,7 +470,7 @@ class vector {
     */
     
 				friend class iterator_base<!is_const>;
-				friend class vector<T,vector_type>;
+				friend class vector<T,vector_type,pow2>;
 			
 			protected:
 				typedef typename std::conditional<is_const, const vector, vector>::type vector_type1;
@@ -603,16 +625,16 @@ class vector {
 };
 
 
-template <class T, template<class> class vector_type>
-auto operator + (ssize_t i, const typename vector<T,vector_type>::iterator& it) -> typename vector<T,vector_type>::iterator {
-	typename vector<T,vector_type>::iterator it2(it);
+template <class T, template<class> class vector_type, bool pow2>
+auto operator + (ssize_t i, const typename vector<T,vector_type,pow2>::iterator& it) -> typename vector<T,vector_type,pow2>::iterator {
+	typename vector<T,vector_type,pow2>::iterator it2(it);
 	it2 += i;
 	return it2;
 }
 
-template <class T, template<class> class vector_type>
-auto operator + (ssize_t i, const typename vector<T,vector_type>::const_iterator& it) -> typename vector<T,vector_type>::const_iterator {
-	typename vector<T,vector_type>::const_iterator it2(it);
+template <class T, template<class> class vector_type, bool pow2>
+auto operator + (ssize_t i, const typename vector<T,vector_type,pow2>::const_iterator& it) -> typename vector<T,vector_type,pow2>::const_iterator {
+	typename vector<T,vector_type,pow2>::const_iterator it2(it);
 	it2 += i;
 	return it2;
 }
@@ -620,43 +642,44 @@ auto operator + (ssize_t i, const typename vector<T,vector_type>::const_iterator
 
 
 /* Constructors */
-template <class T, template<class> class vt>
-vector<T,vt>::vector(size_t count, const T& value, size_t max_grow_) :
-		p_size(0),p_capacity(0),p_stack_size(0),max_grow(max_grow_) {
+template <class T, template<class> class vt, bool pow2>
+vector<T,vt,pow2>::vector(size_t count, const T& value, size_t max_grow_) :
+		p_size(0),p_capacity(0),p_stack_size(0),max_grow(grow_size(max_grow_)),grow_shift(grow_log2(grow_size(max_grow_))) {
 	reserve(count);
 	for(;p_size < count; ++p_size) new(get_addr(p_size)) T(value);
 }
 
-template <class T, template<class> class vt> template<class It,
+template <class T, template<class> class vt, bool pow2> template<class It,
 	typename std::enable_if< at_least_input_iterator<It>::value, int>::type >
-vector<T,vt>::vector(It first, It last, size_t max_grow_) :
-		 p_size(0),p_capacity(0),p_stack_size(0),max_grow(max_grow_) {
+vector<T,vt,pow2>::vector(It first, It last, size_t max_grow_) :
+		 p_size(0),p_capacity(0),p_stack_size(0),max_grow(grow_size(max_grow_)),grow_shift(grow_log2(grow_size(max_grow_))) {
 	for(; first != last; ++first) push_back(*first);
 }
 
-template <class T, template<class> class vt>
-vector<T,vt>::vector(const vector<T,vt>& v) : p_size(0),p_capacity(0),p_stack_size(0),max_grow(v.max_grow) {
+template <class T, template<class> class vt, bool pow2>
+vector<T,vt,pow2>::vector(const vector<T,vt,pow2>& v) : p_size(0),p_capacity(0),p_stack_size(0),max_grow(v.max_grow),grow_shift(v.grow_shift) {
 	reserve(v.size());
 	for(;p_size < v.size(); ++p_size) new(get_addr(p_size)) T(v[p_size]);
 }
 
-template <class T, template<class> class vt>
-void vector<T,vt>::swap(vector<T,vt>& v) {
+template <class T, template<class> class vt, bool pow2>
+void vector<T,vt,pow2>::swap(vector<T,vt,pow2>& v) {
 	using std::swap;
 	swap(stack, v.stack);
 	swap(p_size, v.p_size);
 	swap(p_capacity, v.p_capacity);
 	swap(p_stack_size, v.p_stack_size);
 	swap(max_grow, v.max_grow);
+	swap(grow_shift, v.grow_shift);
 }
 
-template <class T, template<class> class vt>
-vector<T,vt>::vector(vector<T,vt>&& v) : p_size(0),p_capacity(0),p_stack_size(0),max_grow(v.max_grow) {
+template <class T, template<class> class vt, bool pow2>
+vector<T,vt,pow2>::vector(vector<T,vt,pow2>&& v) : p_size(0),p_capacity(0),p_stack_size(0),max_grow(v.max_grow),grow_shift(v.grow_shift) {
 	swap(v);
 }
 
-template <class T, template<class> class vt>
-vector<T,vt>& vector<T,vt>::operator = (const vector<T,vt>& v) {
+template <class T, template<class> class vt, bool pow2>
+vector<T,vt,pow2>& vector<T,vt,pow2>::operator = (const vector<T,vt,pow2>& v) {
 	resize(0);
 	shrink_to_fit(v.size());
 	reserve(v.size());
@@ -664,23 +687,24 @@ vector<T,vt>& vector<T,vt>::operator = (const vector<T,vt>& v) {
 	return *this;
 }
 
-template <class T, template<class> class vt>
-vector<T,vt>& vector<T,vt>::operator = (vector<T,vt>&& v) {
+template <class T, template<class> class vt, bool pow2>
+vector<T,vt,pow2>& vector<T,vt,pow2>::operator = (vector<T,vt,pow2>&& v) {
 	resize(0);
 	for(auto x : stack) free(x);
 	stack.resize(0);
 	swap(v);
+	return *this;
 }
 
-template <class T, template<class> class vt>
-bool vector<T,vt>::reserve_nothrow(size_t n) {
+template <class T, template<class> class vt, bool pow2>
+bool vector<T,vt,pow2>::reserve_nothrow(size_t n) {
 	if(n > p_max_capacity) return false;
 	if(n <= p_capacity) return true;
 	return grow_vector(n);
 }
 
-template <class T, template<class> class vt>
-void vector<T,vt>::shrink_to_fit(size_t new_capacity) {
+template <class T, template<class> class vt, bool pow2>
+void vector<T,vt,pow2>::shrink_to_fit(size_t new_capacity) {
 	if(new_capacity < p_size) new_capacity = p_size;
 	if(new_capacity > p_capacity) return;
 	if(new_capacity > max_grow) {
@@ -707,35 +731,35 @@ void vector<T,vt>::shrink_to_fit(size_t new_capacity) {
 
 
 /* insert /create elements at the end of the vector */
-template <class T, template<class> class vt>
-void vector<T,vt>::push_back(const T& x) {
+template <class T, template<class> class vt, bool pow2>
+void vector<T,vt,pow2>::push_back(const T& x) {
 	if(!push_back_nothrow(x)) throw std::bad_alloc();
 }
-template <class T, template<class> class vt>
-void vector<T,vt>::push_back(T&& x) {
+template <class T, template<class> class vt, bool pow2>
+void vector<T,vt,pow2>::push_back(T&& x) {
 	if(!push_back_nothrow(std::forward<T>(x))) throw std::bad_alloc();
 }
-template<class T, template<class> class vt> template<class... Args>
-T& vector<T,vt>::emplace_back(Args&&... args) {
+template<class T, template<class> class vt, bool pow2> template<class... Args>
+T& vector<T,vt,pow2>::emplace_back(Args&&... args) {
 	if(!emplace_back_nothrow(std::forward<Args>(args)...)) throw std::bad_alloc();
 	return back();
 }
-template <class T, template<class> class vt>
-bool vector<T,vt>::push_back_nothrow(const T& x) {
+template <class T, template<class> class vt, bool pow2>
+bool vector<T,vt,pow2>::push_back_nothrow(const T& x) {
 	if(p_size == p_capacity) if(!grow_vector()) return false;
 	new(get_addr(p_size)) T(x); /* copy constructor -- might still throw an exception */
 	p_size++;
 	return true;
 }
-template <class T, template<class> class vt>
-bool vector<T,vt>::push_back_nothrow(T&& x) {
+template <class T, template<class> class vt, bool pow2>
+bool vector<T,vt,pow2>::push_back_nothrow(T&& x) {
 	if(p_size == p_capacity) if(!grow_vector()) return false;
 	new(get_addr(p_size)) T(std::forward<T>(x)); /* move constructor -- might throw an exception */
 	p_size++;
 	return true;
 }
-template<class T, template<class> class vt> template<class... Args>
-bool vector<T,vt>::emplace_back_nothrow(Args&&... args) {
+template<class T, template<class> class vt, bool pow2> template<class... Args>
+bool vector<T,vt,pow2>::emplace_back_nothrow(Args&&... args) {
 	if(p_size == p_capacity) if(!grow_vector()) return false;
 	new(get_addr(p_size)) T(std::forward<Args>(args)...); /* constructor -- might throw an exception */
 	p_size++;
@@ -744,8 +768,8 @@ bool vector<T,vt>::emplace_back_nothrow(Args&&... args) {
 
 
 
-template <class T, template<class> class vt>
-bool vector<T,vt>::resize_nothrow(size_t count) {
+template <class T, template<class> class vt, bool pow2>
+bool vector<T,vt,pow2>::resize_nothrow(size_t count) {
 	if(count == p_size) return true;
 	if(!count) { clear(); return true; }
 	if(count < p_size) {
@@ -757,8 +781,8 @@ bool vector<T,vt>::resize_nothrow(size_t count) {
 	for(; p_size < count; p_size++) new(get_addr(p_size)) T();
 	return true;
 }
-template <class T, template<class> class vt>
-bool vector<T,vt>::resize_nothrow(size_t count, const T& x) {
+template <class T, template<class> class vt, bool pow2>
+bool vector<T,vt,pow2>::resize_nothrow(size_t count, const T& x) {
 	if(count == p_size) return true;
 	if(!count) { clear(); return true; }
 	if(count < p_size) {
@@ -772,16 +796,16 @@ bool vector<T,vt>::resize_nothrow(size_t count, const T& x) {
 }
 
 
-template <class T, template<class> class vt>
-typename vector<T,vt>::iterator vector<T,vt>::erase(vector<T,vt>::const_iterator pos) {
+template <class T, template<class> class vt, bool pow2>
+typename vector<T,vt,pow2>::iterator vector<T,vt,pow2>::erase(vector<T,vt,pow2>::const_iterator pos) {
 	if(pos.pos >= p_size) throw std::out_of_range("vector::erase(): iterator out of bounds!\n");
 	for(size_t p2 = pos.pos; p2 + 1 < p_size; p2++) get_ref(p2) = std::move(get_ref(p2+1));
 	p_size--;
 	get_ref(p_size).~T();
 	return make_iterator(pos.pos);
 }
-template <class T, template<class> class vt>
-typename vector<T,vt>::iterator vector<T,vt>::erase(vector<T,vt>::const_iterator first, vector<T,vt>::const_iterator last) {
+template <class T, template<class> class vt, bool pow2>
+typename vector<T,vt,pow2>::iterator vector<T,vt,pow2>::erase(vector<T,vt,pow2>::const_iterator first, vector<T,vt,pow2>::const_iterator last) {
 	if(first.pos >= p_size) throw std::out_of_range("vector::erase(): iterator out of bounds!\n");
 	ssize_t dist = last - first;
 	if(!dist) return make_iterator(first);
@@ -797,8 +821,8 @@ typename vector<T,vt>::iterator vector<T,vt>::erase(vector<T,vt>::const_iterator
 
 /* move elements to new position from given position
  * requires that new_pos >= pos and p_size > pos */
-template <class T, template<class> class vt>
-bool vector<T,vt>::insert_helper(size_t pos, size_t new_pos) {
+template <class T, template<class> class vt, bool pow2>
+bool vector<T,vt,pow2>::insert_helper(size_t pos, size_t new_pos) {
 	size_t diff = new_pos - pos;
 	if(p_size > p_max_capacity - diff || !reserve_nothrow(p_size + diff)) return false;
 	size_t remaining = p_size - pos;
@@ -814,8 +838,8 @@ bool vector<T,vt>::insert_helper(size_t pos, size_t new_pos) {
 
 
 
-template <class T, template<class> class vt>
-bool vector<T,vt>::insert_nothrow(vector<T,vt>::const_iterator pos, vector<T,vt>::iterator& res, const T& x) {
+template <class T, template<class> class vt, bool pow2>
+bool vector<T,vt,pow2>::insert_nothrow(vector<T,vt,pow2>::const_iterator pos, vector<T,vt,pow2>::iterator& res, const T& x) {
 	res = make_iterator(pos);
 	if(pos == cend()) return push_back_nothrow(x);
 	if(!insert_helper(pos.pos,pos.pos+1)) return false;
@@ -823,8 +847,8 @@ bool vector<T,vt>::insert_nothrow(vector<T,vt>::const_iterator pos, vector<T,vt>
 	return true;
 }
 
-template <class T, template<class> class vt>
-bool vector<T,vt>::insert_nothrow(vector<T,vt>::const_iterator pos, vector<T,vt>::iterator& res, T&& x) {
+template <class T, template<class> class vt, bool pow2>
+bool vector<T,vt,pow2>::insert_nothrow(vector<T,vt,pow2>::const_iterator pos, vector<T,vt,pow2>::iterator& res, T&& x) {
 	res = make_iterator(pos);
 	if(pos == cend()) return push_back_nothrow(std::forward<T>(x));
 	if(!insert_helper(pos.pos,pos.pos+1)) return false;
@@ -833,8 +857,8 @@ bool vector<T,vt>::insert_nothrow(vector<T,vt>::const_iterator pos, vector<T,vt>
 }
 
 
-template <class T, template<class> class vt>
-bool vector<T,vt>::insert_nothrow(vector<T,vt>::const_iterator pos, vector<T,vt>::iterator& res, size_t count, const T& x) {
+template <class T, template<class> class vt, bool pow2>
+bool vector<T,vt,pow2>::insert_nothrow(vector<T,vt,pow2>::const_iterator pos, vector<T,vt,pow2>::iterator& res, size_t count, const T& x) {
 	res = make_iterator(pos);
 	if(pos == cend()) return resize_nothrow(p_size + count, x);
 	if(!insert_helper(pos.pos,pos.pos+count)) return false;
@@ -843,9 +867,9 @@ bool vector<T,vt>::insert_nothrow(vector<T,vt>::const_iterator pos, vector<T,vt>
 }
 
 
-template <class T, template<class> class vt> template<class InputIt,
+template <class T, template<class> class vt, bool pow2> template<class InputIt,
 	typename std::enable_if<at_least_input_iterator<InputIt>::value, int>::type >
-bool vector<T,vt>::insert_nothrow(vector<T,vt>::const_iterator pos, vector<T,vt>::iterator& res, InputIt first, InputIt last) {
+bool vector<T,vt,pow2>::insert_nothrow(vector<T,vt,pow2>::const_iterator pos, vector<T,vt,pow2>::iterator& res, InputIt first, InputIt last) {
 	res = make_iterator(pos);
 	if(first != last) {
 		if CONSTEXPR(at_least_forward_iterator<InputIt>::value) {
@@ -862,9 +886,9 @@ bool vector<T,vt>::insert_nothrow(vector<T,vt>::const_iterator pos, vector<T,vt>
 			for(size_t i = pos.pos; first != last; ++first, i++) get_ref(i) = *first;
 		}
 		else {
-			vector<T,vt>::iterator tmp;
+			vector<T,vt,pow2>::iterator tmp;
 			for(size_t i = pos.pos; first != last; ++first, i++)
-				if(!insert_nothrow(vector<T,vt>::iterator(*this,i),tmp,*first)) return false;
+				if(!insert_nothrow(vector<T,vt,pow2>::iterator(*this,i),tmp,*first)) return false;
 		}
 	}
 	return true;
@@ -207,6 +207,49 @@ int main(int argc, char **argv)
 	
 	cmp_vec(v12,v22);
 	
+#ifndef USE_STACKED
+	{
+		/* vector using memory mappings for large sizes: grow past the size where
+		 * memory is mapped (copying from malloc()), then with mremap(), then shrink
+		 * back below it (copying to malloc() again) */
+		typedef realloc_vector::mmap_alloc alloc;
+		const size_t n1 = alloc::map_min / sizeof(int) / 2;
+		const size_t n2 = 5 * alloc::map_min / sizeof(int) + 1;
+		std::vector<int> r;
+		realloc_vector::vector<int, alloc> vm;
+		for(size_t i = 0;i < n2;i++) {
+			int x = rd(rg);
+			r.push_back(x);
+			vm.push_back(x);
+			if(i == n1) cmp_vec(r,vm);
+		}
+		cmp_vec(r,vm);
+		
+		r.resize(n1);
+		vm.resize(n1);
+		vm.shrink_to_fit();
+		if(vm.capacity() * sizeof(int) >= alloc::map_min) throw std::runtime_error("capacity not reduced!\n");
+		cmp_vec(r,vm);
+		
+		/* grow in one step, then shrink while staying above the limit */
+		vm.reserve(n2);
+		cmp_vec(r,vm);
+		for(size_t i = n1;i < n2;i++) { int x = rd(rg); r.push_back(x); vm.push_back(x); }
+		r.resize(n2 / 2);
+		vm.resize(n2 / 2);
+		vm.shrink_to_fit();
+		cmp_vec(r,vm);
+		
+		/* copies use the same policy */
+		realloc_vector::vector<int, alloc> vm2(vm);
+		vm2.resize(n1 / 2);
+		vm2.shrink_to_fit();
+		cmp_vec(vm,r);
+		r.resize(n1 / 2);
+		cmp_vec(vm2,r);
+	}
+#endif
+	
 	return 0;
 }
 